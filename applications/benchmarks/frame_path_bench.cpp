@@ -0,0 +1,455 @@
+// Benchmarks of the hot paths of a frame, from the registers to the
+// clients, on synthetic 640x480 frames and optionally on a recording made
+// with frame_recorder:
+//  - hal_*: register access through Camera and ImageProcessing (in-memory
+//    registers by default, UVISPACE_BACKEND=mmio for the real ones).
+//  - replay_read_*: frame read from a recording (FrameSource::read_frame).
+//  - camera_server_*: capture_frame request answered by camera_server
+//    through a TCP connection over the loopback interface.
+//  - convert_*: format conversions of frame_convert.hpp.
+//  - detect_*: triangle detection of a binary frame.
+//  - motion_mask_*: tiles changed between two consecutive frames.
+//
+// Each case is repeated BENCH_REPETITIONS times after a warm up and the
+// median is reported as JSON on stdout, with the time per frame, the
+// throughput of the frame data and the memory allocations per frame, so
+// the results of two commits can be compared.
+//
+// Usage: frame_path_bench [--recording file.rec] [--frames N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "avalon_camera.hpp"
+#include "avalon_image_processing.hpp"
+#include "frame_convert.hpp"
+#include "frame_recorder.hpp"
+#include "frame_source.hpp"
+#include "hw_backend.hpp"
+#include "motion_mask.hpp"
+#include "triangle_detector.hpp"
+#include "camera_server.hpp"
+
+#define BENCH_WIDTH  640
+#define BENCH_HEIGHT 480
+// Frames measured per repetition (--frames) and repetitions
+#define BENCH_FRAMES_DEFAULT 200
+#define BENCH_REPETITIONS 5
+#define BENCH_WARMUP 10
+// Register accesses are much faster than a frame: more iterations
+#define BENCH_HAL_FACTOR 50
+// Different synthetic frames and UGVs in each one
+#define SYNTHETIC_FRAMES 16
+#define SYNTHETIC_UGVS 8
+
+// Memory allocations of the whole process
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+void operator delete(void* p) noexcept {
+  free(p);
+}
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+struct BenchResult {
+  std::string name;
+  uint64_t frames;
+  double ns_per_frame;
+  // Negative if the case does not move frame data
+  double mb_per_s;
+  double allocs_per_frame;
+};
+
+static std::vector<BenchResult> results;
+
+// Run f(i) for frames i, BENCH_REPETITIONS times, and keep the median
+template <typename F>
+static void measure(const std::string& name, size_t bytes_per_frame, uint64_t frames, F f) {
+  for (uint64_t i = 0; i < BENCH_WARMUP; i++) {
+    f(i);
+  }
+  std::vector<double> ns;
+  ns.reserve(BENCH_REPETITIONS);
+  uint64_t allocations_start = allocations.load();
+  for (int r = 0; r < BENCH_REPETITIONS; r++) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < frames; i++) {
+      f(i);
+    }
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+    ns.push_back((double) elapsed.count() / frames);
+  }
+  std::sort(ns.begin(), ns.end());
+  BenchResult result;
+  result.name = name;
+  result.frames = frames * BENCH_REPETITIONS;
+  result.ns_per_frame = ns[ns.size() / 2];
+  result.mb_per_s = (bytes_per_frame > 0) ? bytes_per_frame / result.ns_per_frame * 1e3 : -1;
+  result.allocs_per_frame = (double) (allocations.load() - allocations_start) / result.frames;
+  results.push_back(result);
+  fprintf(stderr, "%-36s %12.1f ns/frame\n", name.c_str(), result.ns_per_frame);
+}
+
+// Synthetic frames: checkerboard floor and red triangles (UGVs)
+static bool inside_triangle(const double* x, const double* y, double px, double py) {
+  bool negative = false, positive = false;
+  for (int k = 0; k < 3; k++) {
+    double cross = (x[(k + 1) % 3] - x[k]) * (py - y[k]) - (y[(k + 1) % 3] - y[k]) * (px - x[k]);
+    negative = negative || (cross < 0);
+    positive = positive || (cross > 0);
+  }
+  return !(negative && positive);
+}
+
+static void make_synthetic(uint32_t format, int index, std::vector<uint8_t>* frame) {
+  unsigned int pixel_size = frame_format_pixel_size(format);
+  frame->resize((size_t) BENCH_WIDTH * BENCH_HEIGHT * pixel_size);
+  for (int y = 0; y < BENCH_HEIGHT; y++) {
+    for (int x = 0; x < BENCH_WIDTH; x++) {
+      uint8_t level = (((x >> 5) + (y >> 5)) & 1) ? 80 : 60;
+      uint8_t* p = &(*frame)[((size_t) y * BENCH_WIDTH + x) * pixel_size];
+      if (format == FRAME_FORMAT_RGBG) {
+        p[0] = p[1] = p[2] = p[3] = level;
+      } else {
+        p[0] = (format == FRAME_FORMAT_GRAY) ? level : 0;
+      }
+    }
+  }
+  srand(1);
+  for (int u = 0; u < SYNTHETIC_UGVS; u++) {
+    double cx = 40 + rand() % (BENCH_WIDTH - 80) + 2 * index;
+    double cy = 40 + rand() % (BENCH_HEIGHT - 80) + index;
+    double heading = (rand() % 628) / 100.0 + 0.1 * index;
+    double x[3], y[3];
+    const double local_x[3] = {1.0, -0.6, -0.6}, local_y[3] = {0.0, 0.5, -0.5};
+    for (int k = 0; k < 3; k++) {
+      x[k] = cx + 24 * (local_x[k] * cos(heading) - local_y[k] * sin(heading));
+      y[k] = cy + 24 * (local_x[k] * sin(heading) + local_y[k] * cos(heading));
+    }
+    for (int py = (int) cy - 30; py <= (int) cy + 30; py++) {
+      for (int px = (int) cx - 30; px <= (int) cx + 30; px++) {
+        if (!inside_triangle(x, y, px + 0.5, py + 0.5)) {
+          continue;
+        }
+        uint8_t* p = &(*frame)[((size_t) py * BENCH_WIDTH + px) * pixel_size];
+        if (format == FRAME_FORMAT_RGBG) {
+          p[0] = 200;
+          p[1] = 30;
+          p[2] = 30;
+          p[3] = 87;
+        } else {
+          p[0] = (format == FRAME_FORMAT_GRAY) ? 87 : 255;
+        }
+      }
+    }
+  }
+}
+
+// Recording of the synthetic frames of a format. Returns false on error.
+static bool record_synthetic(uint32_t format, const std::string& path,
+                             std::vector<std::vector<uint8_t> >* frames) {
+  FrameRecorder recorder;
+  frames->resize(SYNTHETIC_FRAMES);
+  for (int i = 0; i < SYNTHETIC_FRAMES; i++) {
+    make_synthetic(format, i, &(*frames)[i]);
+  }
+  if (recorder.open(path.c_str(), (*frames)[0].size(), SYNTHETIC_FRAMES) != 0) {
+    return false;
+  }
+  for (int i = 0; i < SYNTHETIC_FRAMES; i++) {
+    FrameMetadata meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.frame_counter = i + 1;
+    meta.format = format;
+    meta.width = BENCH_WIDTH;
+    meta.height = BENCH_HEIGHT;
+    meta.size = (*frames)[i].size();
+    if (recorder.append(&(*frames)[i][0], &meta) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Frames of a recording (at most max_frames) and their format
+static bool load_recording(const std::string& path, size_t max_frames, uint32_t* format,
+                           std::vector<std::vector<uint8_t> >* frames) {
+  FrameReplay replay;
+  if (replay.open(path.c_str()) != 0) {
+    return false;
+  }
+  replay.set_loop(0);
+  FrameMetadata meta;
+  const uint8_t* frame;
+  frames->clear();
+  while ((frames->size() < max_frames) && ((frame = replay.get_frame(&meta)) != NULL)) {
+    frames->push_back(std::vector<uint8_t>(frame, frame + meta.size));
+    *format = meta.format;
+  }
+  return !frames->empty();
+}
+
+static const char* format_name(uint32_t format) {
+  return (format == FRAME_FORMAT_RGBG) ? "rgbg" : (format == FRAME_FORMAT_GRAY) ? "gray" : "bin";
+}
+
+static void bench_hal(uint64_t frames) {
+  RegisterBackend* backend = open_register_backend("sim");
+  if (backend == NULL) {
+    fprintf(stderr, "ERROR: register backend could not be open\n");
+    return;
+  }
+  Camera camera(backend->component_address(AVALON_CAMERA_0_BASE));
+  ImageProcessing processing(backend->component_address(AVALON_IMAGE_PROCESSING_0_BASE));
+  volatile uint32_t sink = 0;
+  // A camera profile switch
+  measure("hal_camera_configure", 0, frames, [&](uint64_t) {
+    camera.config_set_default();
+    camera.config_update();
+  });
+  measure("hal_camera_read_config", 0, frames, [&](uint64_t) {
+    sink = sink + camera.config_get_width() + camera.config_get_height() +
+           camera.config_get_start_row() + camera.config_get_start_column() +
+           camera.config_get_row_size() + camera.config_get_column_size() +
+           camera.config_get_row_mode() + camera.config_get_column_mode() +
+           camera.config_get_exposure() + camera.config_get_h_blanking() +
+           camera.config_get_v_blanking() + camera.config_get_red_gain() +
+           camera.config_get_blue_gain() + camera.config_get_green1_gain() +
+           camera.config_get_green2_gain();
+  });
+  // A threshold profile switch
+  measure("hal_thresholds_write", 0, frames, [&](uint64_t i) {
+    processing.set_hue_th_L(230 + (i & 1));
+    processing.set_hue_th_H(20);
+    processing.set_brightness_th_L(45);
+    processing.set_brightness_th_H(255);
+    processing.set_saturation_th_L(20);
+    processing.set_saturation_th_H(255);
+  });
+  close_register_backend(backend);
+}
+
+static void bench_replay_read(const std::string& name, const std::string& path, uint64_t frames) {
+  ReplayFrameSource source;
+  if (source.open(path.c_str(), REPLAY_MAX_SPEED) != 0) {
+    fprintf(stderr, "ERROR: %s could not be open\n", path.c_str());
+    return;
+  }
+  std::vector<uint8_t> buffer(source.get_frame_size());
+  measure(name, buffer.size(), frames, [&](uint64_t) {
+    source.read_frame(&buffer[0], buffer.size(), NULL);
+  });
+}
+
+static bool recv_all(int fd, void* data, size_t len) {
+  uint8_t* p = (uint8_t*) data;
+  while (len > 0) {
+    ssize_t n = recv(fd, p, len, 0);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Connected pair of TCP sockets over the loopback interface
+static bool tcp_pair(int* client, int* server) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t address_len = sizeof(address);
+  *client = *server = -1;
+  if ((bind(listener, (struct sockaddr*) &address, sizeof(address)) == 0) &&
+      (listen(listener, 1) == 0) &&
+      (getsockname(listener, (struct sockaddr*) &address, &address_len) == 0)) {
+    *client = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(*client, (struct sockaddr*) &address, sizeof(address)) == 0) {
+      *server = accept(listener, NULL, NULL);
+    }
+  }
+  close(listener);
+  if (*server < 0) {
+    close(*client);
+    return false;
+  }
+  return true;
+}
+
+static void bench_camera_server(const std::string& name, const std::string& path,
+                                uint32_t format, uint64_t frames) {
+  ReplayFrameSource source;
+  if (source.open(path.c_str(), REPLAY_MAX_SPEED) != 0) {
+    return;
+  }
+  std::vector<uint8_t> buffer(source.get_frame_size());
+  source.close();
+  int client, server_socket;
+  if (!tcp_pair(&client, &server_socket)) {
+    fprintf(stderr, "ERROR: TCP connection could not be open\n");
+    return;
+  }
+  // Port 0: the listening socket of the server is not used
+  camera_server::camera_server server(0, format, path, REPLAY_MAX_SPEED);
+  std::thread thread([&]() { server.handle(server_socket); });
+  const char request[] = "capture_frame\n";
+  measure(name, buffer.size(), frames, [&](uint64_t) {
+    send(client, request, strlen(request), MSG_NOSIGNAL);
+    recv_all(client, &buffer[0], buffer.size());
+  });
+  char reply[4];
+  send(client, "quit\n", 5, MSG_NOSIGNAL);
+  recv_all(client, reply, sizeof(reply));
+  thread.join();
+  close(client);
+}
+
+static void bench_convert(const std::string& suffix, const std::vector<std::vector<uint8_t> >& rgbg,
+                          uint64_t frames) {
+  size_t pixels = rgbg[0].size() / 4;
+  std::vector<uint8_t> rgb(pixels * 3), gray(pixels);
+  measure("convert_rgbg_to_rgb_" + suffix, rgbg[0].size(), frames, [&](uint64_t i) {
+    frame_rgbg_to_rgb(&rgbg[i % rgbg.size()][0], pixels, &rgb[0]);
+  });
+  measure("convert_rgbg_to_gray_" + suffix, rgbg[0].size(), frames, [&](uint64_t i) {
+    frame_rgbg_to_gray(&rgbg[i % rgbg.size()][0], pixels, &gray[0]);
+  });
+}
+
+static void bench_detect(const std::string& suffix, const std::vector<std::vector<uint8_t> >& bin,
+                         uint32_t width, uint64_t frames) {
+  TriangleDetector detector;
+  std::vector<Triangle> triangles;
+  triangles.reserve(64);
+  uint32_t height = bin[0].size() / width;
+  measure("detect_triangles_" + suffix, bin[0].size(), frames, [&](uint64_t i) {
+    detector.detect(&bin[i % bin.size()][0], width, height, width, &triangles);
+  });
+}
+
+static void bench_motion_mask(const std::string& suffix,
+                              const std::vector<std::vector<uint8_t> >& frames_8bit,
+                              uint32_t width, uint64_t frames) {
+  MotionMask motion;
+  uint32_t height = frames_8bit[0].size() / width;
+  measure("motion_mask_" + suffix, frames_8bit[0].size(), frames, [&](uint64_t i) {
+    motion.update(&frames_8bit[i % frames_8bit.size()][0], width, height, width);
+  });
+}
+
+static void print_json(const std::string& recording) {
+  const char* backend = getenv("UVISPACE_BACKEND");
+  printf("{\n  \"benchmark\": \"frame_path_bench\",\n");
+  printf("  \"width\": %d,\n  \"height\": %d,\n", BENCH_WIDTH, BENCH_HEIGHT);
+  printf("  \"backend\": \"%s\",\n", (backend != NULL) ? backend : "sim");
+  if (recording.empty()) {
+    printf("  \"recording\": null,\n");
+  } else {
+    printf("  \"recording\": \"%s\",\n", recording.c_str());
+  }
+  printf("  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult& r = results[i];
+    printf("    {\"name\": \"%s\", \"frames\": %llu, \"ns_per_frame\": %.1f, ", r.name.c_str(),
+           (unsigned long long) r.frames, r.ns_per_frame);
+    if (r.mb_per_s < 0) {
+      printf("\"mb_per_s\": null, ");
+    } else {
+      printf("\"mb_per_s\": %.1f, ", r.mb_per_s);
+    }
+    printf("\"allocs_per_frame\": %.2f}%s\n", r.allocs_per_frame,
+           (i + 1 < results.size()) ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+  std::string recording;
+  uint64_t frames = BENCH_FRAMES_DEFAULT;
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "--recording") == 0) && (i + 1 < argc)) {
+      recording = argv[++i];
+    } else if ((strcmp(argv[i], "--frames") == 0) && (i + 1 < argc)) {
+      frames = std::max(atoi(argv[++i]), 1);
+    } else {
+      fprintf(stderr, "Usage: %s [--recording file.rec] [--frames N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  bench_hal(frames * BENCH_HAL_FACTOR);
+
+  // Synthetic frames, recorded to be served as camera_server does
+  const uint32_t formats[3] = {FRAME_FORMAT_RGBG, FRAME_FORMAT_GRAY, FRAME_FORMAT_BIN};
+  std::vector<std::vector<uint8_t> > synthetic[3];
+  for (int f = 0; f < 3; f++) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/frame_path_bench_%d_%s.rec", (int) getpid(),
+             format_name(formats[f]));
+    if (!record_synthetic(formats[f], path, &synthetic[f])) {
+      fprintf(stderr, "ERROR: %s could not be written\n", path);
+      return 1;
+    }
+    std::string suffix = std::string(format_name(formats[f])) + "_synthetic";
+    bench_replay_read("replay_read_" + suffix, path, frames);
+    bench_camera_server("camera_server_" + suffix, path, formats[f], frames);
+    unlink(path);
+  }
+  bench_convert("synthetic", synthetic[0], frames);
+  bench_detect("synthetic", synthetic[2], BENCH_WIDTH, frames);
+  bench_motion_mask("gray_synthetic", synthetic[1], BENCH_WIDTH, frames);
+  bench_motion_mask("bin_synthetic", synthetic[2], BENCH_WIDTH, frames);
+
+  if (!recording.empty()) {
+    uint32_t format = FRAME_FORMAT_BIN;
+    std::vector<std::vector<uint8_t> > recorded;
+    if (!load_recording(recording, SYNTHETIC_FRAMES * 4, &format, &recorded)) {
+      fprintf(stderr, "ERROR: %s could not be read\n", recording.c_str());
+      return 1;
+    }
+    std::string suffix = std::string(format_name(format)) + "_recorded";
+    bench_replay_read("replay_read_" + suffix, recording, frames);
+    bench_camera_server("camera_server_" + suffix, recording, format, frames);
+    if (format == FRAME_FORMAT_RGBG) {
+      bench_convert("recorded", recorded, frames);
+    } else if (format == FRAME_FORMAT_BIN) {
+      ReplayFrameSource source;
+      source.open(recording.c_str());
+      bench_detect("recorded", recorded, source.get_width(), frames);
+      bench_motion_mask("bin_recorded", recorded, source.get_width(), frames);
+    }
+  }
+  print_json(recording);
+  return 0;
+}
@@ -0,0 +1,180 @@
+// Cost of serving frames with each I/O backend of abstract_server:
+//  - blocking: recv of the request, read of the device into a string and
+//    send of the string.
+//  - io_uring: the frame read into a registered buffer and sent from it,
+//    together with the receive of the next request, in one submission
+//    (built with make USE_IO_URING=1, otherwise it is not reported).
+//
+// A server process answers capture_frame with frames read from /dev/zero,
+// which like the camera driver returns a whole frame per read, to a client
+// (inc/camera_client.hpp) asking for FRAMES frames through a TCP connection
+// over the loopback interface, one at a time or with several requests in
+// flight. Reported per frame: system calls of the server (counted where
+// they are made), CPU time of the server process (user and system,
+// including the io_uring workers) and frames per second.
+//
+// Usage: server_io_bench [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "abstract_server.hpp"
+#include "camera_client.hpp"
+
+#define FRAMES 2000
+#define DEVICE "/dev/zero"
+#define FRAME_WIDTH 640
+// Requests in flight of the pipelined client
+#define PIPELINE_DEPTH 4
+
+// Serves frames of 'size' Bytes read from DEVICE
+class zero_frame_server : public abstract_server::abstract_server {
+  public:
+    zero_frame_server(size_t size) : abstract_server(0), size(size) {
+      this->fd = open(DEVICE, O_RDONLY);
+    }
+    ~zero_frame_server() { close(this->fd); }
+
+  protected:
+    std::string process_request(std::string request) override {
+      if (request == "capture_frame") {
+        std::string frame(this->size, '\0');
+        this->count_syscalls(1);
+        if (read(this->fd, &frame[0], this->size) != (ssize_t) this->size) {
+          throw server_error::server_handling_error("Error reading frame");
+        }
+        return frame;
+      }
+      if (request == "frame_info") {
+        // Gray frames of FRAME_WIDTH pixels
+        return std::to_string(FRAME_WIDTH) + " " + std::to_string(this->size / FRAME_WIDTH) +
+               " 1 " + std::to_string(this->size) + "\n";
+      }
+      return abstract_server::process_request(request);
+    }
+    bool file_response(const std::string& request, int* fd, size_t* size) override {
+      if (request != "capture_frame") {
+        return false;
+      }
+      *fd = this->fd;
+      *size = this->size;
+      return true;
+    }
+
+  private:
+    int fd;
+    size_t size;
+};
+
+static bool count_frame(const CameraClientFrame& frame, void* user) {
+  (*(int*) user)++;
+  return true;
+}
+
+static void run_case(const char* name, bool io_uring, size_t size, int frames, int depth) {
+  // Connection over the loopback interface
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t address_len = sizeof(address);
+  CameraClient client;
+  if ((bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0) ||
+      (listen(listener, 1) != 0) ||
+      (getsockname(listener, (struct sockaddr*) &address, &address_len) != 0)) {
+    printf("ERROR: the TCP connection could not be open\n");
+    return;
+  }
+
+  // The server in its own process, to get its CPU time alone
+  int results[2];
+  if (pipe(results) != 0) {
+    return;
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    int server_socket = accept(listener, NULL, NULL);
+    close(listener);
+    uint64_t syscalls = UINT64_MAX;
+    zero_frame_server server(size);
+    if (server.set_io_uring(io_uring) == io_uring) {
+      uint64_t start = server.get_syscalls();
+      server.handle(server_socket);
+      syscalls = server.get_syscalls() - start;
+    } else {
+      close(server_socket);
+    }
+    if (write(results[1], &syscalls, sizeof(syscalls)) != sizeof(syscalls)) {
+      _exit(1);
+    }
+    _exit(0);
+  }
+  close(listener);
+  close(results[1]);
+
+  int served = 0;
+  double seconds = 0;
+  if (client.open("127.0.0.1", ntohs(address.sin_port)) == 0) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    client.stream(depth, frames, count_frame, &served);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::string bye;
+    if (client.command("quit", &bye) == 0) {
+      // Closed by the server
+    }
+  }
+  client.close();
+
+  uint64_t syscalls = UINT64_MAX;
+  if (read(results[0], &syscalls, sizeof(syscalls)) != sizeof(syscalls)) {
+    syscalls = UINT64_MAX;
+  }
+  close(results[0]);
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  if (syscalls == UINT64_MAX) {
+    printf("%-8s  %5d  %10zu  not available\n", name, depth, size);
+    return;
+  }
+  if (served < frames) {
+    printf("%-8s  %5d  %10zu  failed after %d frames\n", name, depth, size, served);
+    return;
+  }
+  double cpu_us = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 +
+      usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  printf("%-8s  %5d  %10zu  %6d  %14.2f  %12.1f  %8.0f\n", name, depth, size, frames,
+         (double) syscalls / frames, cpu_us / frames, frames / seconds);
+}
+
+int main(int argc, char** argv) {
+  int frames = (argc > 1) ? atoi(argv[1]) : FRAMES;
+  // Binary or gray and RGBG VGA frames
+  size_t sizes[2] = {640 * 480, 640 * 480 * 4};
+  printf("backend   depth  frame_bytes  frames  syscalls/frame  cpu_us/frame  frames/s\n");
+  // One request at a time and pipelined
+  int depths[2] = {1, PIPELINE_DEPTH};
+  for (int i = 0; i < 2; i++) {
+    for (int d = 0; d < 2; d++) {
+      run_case("blocking", false, sizes[i], frames, depths[d]);
+#ifdef USE_IO_URING
+      run_case("io_uring", true, sizes[i], frames, depths[d]);
+#endif
+    }
+  }
+  return 0;
+}
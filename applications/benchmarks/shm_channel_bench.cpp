@@ -0,0 +1,193 @@
+// Latency from detection_server to a local client: the shared memory
+// channel of shm_channel.hpp against a TCP connection over the loopback
+// interface, the transport below the ZMQ sockets.
+//
+// A writer thread publishes a message like the ones of detection_server
+// (binary triangles followed by the poses) every PERIOD_US, stamped with
+// the time it is published. The readers take the time they get it:
+//  - shm: polling the channel (no system calls), one reader per core left
+//    by the writer up to MAX_READERS.
+//  - tcp: blocked in recv on a TCP_NODELAY socket.
+// Reported as percentiles of the latency in microseconds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shm_channel.hpp"
+#include "triangle_message.hpp"
+#include "triangle_pose.hpp"
+
+#define CHANNEL_NAME "/uvispace_shm_channel_bench"
+#define MESSAGES 5000
+#define PERIOD_US 200
+#define TRIANGLES 5
+#define MAX_READERS 4
+
+// Message of detection_server stamped with the current time
+static void make_message(uint32_t counter, std::string* message) {
+  std::vector<Triangle> triangles(TRIANGLES);
+  std::vector<TrianglePose> poses(TRIANGLES);
+  for (int i = 0; i < TRIANGLES; i++) {
+    for (int v = 0; v < 3; v++) {
+      triangles[i].vertices[v].r = 100 + 10 * i + v;
+      triangles[i].vertices[v].c = 200 + 10 * i - v;
+    }
+    memset(&poses[i], 0, sizeof(TrianglePose));
+  }
+  TriangleMessageHeader header;
+  header.label = -1;
+  header.frame_counter = counter;
+  header.timestamp_ns = shm_channel_now_ns();
+  triangle_message_encode(header, triangles, message);
+  message->append((const char*) poses.data(), poses.size() * sizeof(TrianglePose));
+}
+
+static void print_latencies(const char* name, int readers, std::vector<double>* latencies) {
+  if (latencies->empty()) {
+    printf("%-4s  %7d  no messages received\n", name, readers);
+    return;
+  }
+  std::sort(latencies->begin(), latencies->end());
+  size_t n = latencies->size();
+  printf("%-4s  %7d  %8zu  %7.1f  %7.1f  %7.1f  %7.1f\n", name, readers, n,
+         (*latencies)[n / 2], (*latencies)[n * 90 / 100], (*latencies)[n * 99 / 100],
+         (*latencies)[n - 1]);
+}
+
+static void shm_bench(int readers) {
+  ShmChannelWriter writer;
+  if (writer.open(CHANNEL_NAME, 4096) != 0) {
+    printf("ERROR: the shared memory channel could not be created\n");
+    return;
+  }
+  std::atomic<bool> done(false);
+  std::vector<std::vector<double> > latencies(readers);
+  std::vector<std::thread> threads;
+  for (int r = 0; r < readers; r++) {
+    threads.push_back(std::thread([&, r]() {
+      ShmChannelReader reader;
+      if (reader.open(CHANNEL_NAME) != 0) {
+        return;
+      }
+      char buffer[4096];
+      uint32_t sequence = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        int size = reader.read_new(buffer, sizeof(buffer), sequence, &sequence, NULL);
+        if (size > 0) {
+          uint64_t now = shm_channel_now_ns();
+          TriangleMessageHeader header;
+          if (triangle_message_decode(buffer, size, &header, NULL) >= 0) {
+            latencies[r].push_back((now - header.timestamp_ns) / 1000.0);
+          }
+        }
+      }
+    }));
+  }
+  // Readers mapped before the first message
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  std::string message;
+  for (uint32_t i = 0; i < MESSAGES; i++) {
+    make_message(i, &message);
+    writer.write(message.data(), message.size());
+    std::this_thread::sleep_for(std::chrono::microseconds(PERIOD_US));
+  }
+  done = true;
+  std::vector<double> all;
+  for (int r = 0; r < readers; r++) {
+    threads[r].join();
+    all.insert(all.end(), latencies[r].begin(), latencies[r].end());
+  }
+  print_latencies("shm", readers, &all);
+}
+
+static bool recv_all(int fd, void* data, size_t len) {
+  uint8_t* p = (uint8_t*) data;
+  while (len > 0) {
+    ssize_t n = recv(fd, p, len, 0);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static void tcp_bench(void) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  socklen_t address_len = sizeof(address);
+  if ((bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0) ||
+      (listen(listener, 1) != 0) ||
+      (getsockname(listener, (struct sockaddr*) &address, &address_len) != 0)) {
+    printf("ERROR: the TCP socket could not be open\n");
+    close(listener);
+    return;
+  }
+  std::vector<double> latencies;
+  std::thread reader([&]() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+      close(fd);
+      return;
+    }
+    char buffer[4096];
+    uint32_t len;
+    // Length-prefixed messages, as the ZMTP frames
+    while (recv_all(fd, &len, sizeof(len)) && (len <= sizeof(buffer)) &&
+           recv_all(fd, buffer, len)) {
+      uint64_t now = shm_channel_now_ns();
+      TriangleMessageHeader header;
+      if (triangle_message_decode(buffer, len, &header, NULL) >= 0) {
+        latencies.push_back((now - header.timestamp_ns) / 1000.0);
+      }
+    }
+    close(fd);
+  });
+  int fd = accept(listener, NULL, NULL);
+  close(listener);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  std::string message;
+  for (uint32_t i = 0; (i < MESSAGES) && (fd >= 0); i++) {
+    make_message(i, &message);
+    uint32_t len = message.size();
+    message.insert(0, (const char*) &len, sizeof(len));
+    if (send(fd, message.data(), message.size(), 0) != (ssize_t) message.size()) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(PERIOD_US));
+  }
+  close(fd);
+  reader.join();
+  print_latencies("tcp", 1, &latencies);
+}
+
+int main(int argc, char** argv) {
+  printf("path  readers  messages  p50_us   p90_us   p99_us   max_us\n");
+  // Polling readers sharing a core with the writer would delay it
+  long readers = std::min(sysconf(_SC_NPROCESSORS_ONLN) - 1, (long) MAX_READERS);
+  shm_bench(1);
+  if (readers > 1) {
+    shm_bench(readers);
+  }
+  tcp_bench();
+  return 0;
+}
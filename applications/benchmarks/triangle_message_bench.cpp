@@ -0,0 +1,123 @@
+// Cost of the triangle messages of detection_server: JSON (as send_json of
+// triangle-detector-server.py) against the binary format of
+// triangle_message.hpp, for 1 to 20 triangles per frame.
+//
+// The JSON decoder is a minimal one for this message (strtod on each
+// number), so its time is a lower bound of a general JSON parser.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "triangle_message.hpp"
+
+#define MAX_TRIANGLES 20
+// Minimum time measured for each case
+#define MEASURE_NS 50000000
+
+// Vertices like the ones of the detector: whole pixels in one coordinate
+// and a fraction in the other
+static void make_triangles(size_t count, std::vector<Triangle>* triangles) {
+  triangles->resize(count);
+  for (size_t i = 0; i < count; i++) {
+    for (int v = 0; v < 3; v++) {
+      double r = rand() % 468, c = rand() % 640;
+      if (v & 1) {
+        r += 0.0035294117647;
+      } else {
+        c += 0.9964705882353;
+      }
+      (*triangles)[i].vertices[v].r = r;
+      (*triangles)[i].vertices[v].c = c;
+    }
+  }
+}
+
+// Parse a JSON message of triangles. Returns the number read or -1.
+static int json_decode(const std::string& json, std::vector<Triangle>* triangles) {
+  const char* p = json.c_str();
+  double values[6];
+  int n = 0;
+  triangles->clear();
+  while (*p != '\0') {
+    if ((*p == '-') || ((*p >= '0') && (*p <= '9'))) {
+      char* end;
+      values[n++] = strtod(p, &end);
+      p = end;
+      if (n == 6) {
+        Triangle t;
+        for (int v = 0; v < 3; v++) {
+          t.vertices[v].r = values[2 * v];
+          t.vertices[v].c = values[2 * v + 1];
+        }
+        triangles->push_back(t);
+        n = 0;
+      }
+    } else {
+      p++;
+    }
+  }
+  return (n == 0) ? (int) triangles->size() : -1;
+}
+
+// Average ns per call of f
+template <typename F>
+static double measure(F f) {
+  uint64_t calls = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::nanoseconds elapsed(0);
+  while (elapsed.count() < MEASURE_NS) {
+    for (int i = 0; i < 100; i++) {
+      f();
+    }
+    calls += 100;
+    elapsed = std::chrono::steady_clock::now() - start;
+  }
+  return (double) elapsed.count() / calls;
+}
+
+int main(int argc, char** argv) {
+  std::vector<Triangle> triangles, decoded;
+  std::string json, binary;
+  TriangleMessageHeader header;
+  header.label = -1;
+  header.frame_counter = 1;
+  header.timestamp_ns = 0;
+  // Keeps the compiler from removing the work
+  volatile size_t sink = 0;
+
+  printf("triangles  json_bytes  binary_bytes  json_encode_ns  binary_encode_ns"
+         "  json_decode_ns  binary_decode_ns\n");
+  for (size_t count = 1; count <= MAX_TRIANGLES; count++) {
+    make_triangles(count, &triangles);
+    triangles_json(triangles, &json);
+    triangle_message_encode(header, triangles, &binary);
+    if ((json_decode(json, &decoded) != (int) count) ||
+        (triangle_message_decode(binary.data(), binary.size(), &header, &decoded) !=
+         (int) count)) {
+      printf("ERROR: message could not be decoded\n");
+      return 1;
+    }
+    double json_encode = measure([&]() {
+      triangles_json(triangles, &json);
+      sink += json.size();
+    });
+    double binary_encode = measure([&]() {
+      triangle_message_encode(header, triangles, &binary);
+      sink += binary.size();
+    });
+    double json_decode_ns = measure([&]() {
+      sink += json_decode(json, &decoded);
+    });
+    double binary_decode = measure([&]() {
+      sink += triangle_message_decode(binary.data(), binary.size(), &header, &decoded);
+    });
+    printf("%9zu  %10zu  %12zu  %14.0f  %16.0f  %14.0f  %16.0f\n", count, json.size(),
+           binary.size(), json_encode, binary_encode, json_decode_ns, binary_decode);
+  }
+  return 0;
+}
@@ -1,6 +1,16 @@
 #include "abstract_server.hpp"
 
-abstract_server::abstract_server::abstract_server(int port) : port(port) {
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+// Operations of the io_uring backend (user_data)
+#define IO_OP_RECV 0
+#define IO_OP_READ 1
+#define IO_OP_SEND 2
+
+abstract_server::abstract_server::abstract_server(int port)
+        : port(port), client(-1), client_connected(false), syscalls(0), io_uring_enabled(false) {
     // Setup socket address structure
     struct sockaddr_in server_addr;
     std::memset(&server_addr, 0, sizeof(server_addr));
@@ -29,9 +39,38 @@ abstract_server::abstract_server::abstract_server(int port) : port(port) {
     if (listen(this->sock, SOMAXCONN) < 0) {
         throw server_error::server_init_error("Socket listening failed");
     }
+    this->set_io_uring(true);
+}
+
+bool abstract_server::abstract_server::set_io_uring(bool enable) {
+#ifdef USE_IO_URING
+    if (enable && !this->ring.is_open()) {
+        for (int i = 0; i < 3; i++) {
+            this->pending[i] = false;
+        }
+        this->file_buffer_registered = false;
+        this->file_fd = -1;
+        if (this->ring.open(IO_RING_ENTRIES) != 0) {
+            std::cerr << "io_uring not available, using blocking system calls\n";
+        }
+    }
+    this->io_uring_enabled = enable && this->ring.is_open();
+#endif
+    return this->io_uring_enabled;
+}
+
+uint64_t abstract_server::abstract_server::get_syscalls() {
+#ifdef USE_IO_URING
+    return this->syscalls + this->ring.get_syscalls();
+#else
+    return this->syscalls;
+#endif
 }
 
 void abstract_server::abstract_server::run() {
+#ifdef USE_COROUTINES
+    this->run_async();
+#endif
     int client;
     struct sockaddr_in client_addr;
     socklen_t clientlen = sizeof(client_addr);
@@ -39,7 +78,6 @@ void abstract_server::abstract_server::run() {
     while (true) {
         client = accept(this->sock, (struct sockaddr *) &client_addr, &clientlen);
         if (client > 0) {
-            this->client_connected = true;
             handle(client);
         }
     }
@@ -48,35 +86,76 @@ void abstract_server::abstract_server::run() {
 }
 
 void abstract_server::abstract_server::handle(int client) {
+#ifdef USE_IO_URING
+    if (this->io_uring_enabled && this->handle_io_uring(client)) {
+        return;
+    }
+#endif
+    this->handle_blocking(client);
+}
+
+void abstract_server::abstract_server::handle_blocking(int client) {
+    this->requests.clear();
+    this->client = client;
+    this->client_connected = true;
+    this->client_opened(client);
     try {
         while (this->client_connected) {
             std::string request = this->get_request(client);
             std::string response = this->process_request(request);
             this->send_response(client, response);
+            this->response_sent(request, response.length());
         }
     } catch (server_error::server_handling_error& e) {
         this->disconnect_client();
     }
+    this->client_closed(client);
     close(client);
     return;
 }
 
 std::string abstract_server::abstract_server::get_request(int client) {
-    char* rx = new char[32];
-    ssize_t nread = recv(client, rx, 32, 0);
-    if (nread < 0) {
-        throw server_error::server_handling_error("Error reading request");
+    std::string request;
+    char rx[REQUEST_SIZE];
+    while (!this->requests.next(&request)) {
+        ssize_t nread = recv(client, rx, REQUEST_SIZE, 0);
+        this->syscalls++;
+        if (nread <= 0) {
+            throw server_error::server_handling_error("Error reading request");
+        }
+        // Be sure to use append in case we have binary data
+        this->requests.append(rx, nread);
     }
+    return request;
+}
 
-    // Be sure to use append in case we have binary data
-    std::string request = "";
-    request.append(rx, nread);
-
+bool abstract_server::request_reader::next(std::string* request) {
+    size_t end = this->received.find('\n');
+    if (end != std::string::npos) {
+        this->framed = true;
+        request->assign(this->received, 0, end);
+        this->received.erase(0, end + 1);
+    } else if (!this->framed && !this->received.empty()) {
+        request->swap(this->received);
+        this->received.clear();
+    } else {
+        return false;
+    }
     // Remove line breaks
-    request.erase(std::remove(request.begin(), request.end(), '\n'), request.end());
-    request.erase(std::remove(request.begin(), request.end(), '\r'), request.end());
-    delete[] rx;
-    return request;
+    request->erase(std::remove(request->begin(), request->end(), '\r'), request->end());
+    return true;
+}
+
+bool abstract_server::request_reader::ready() const {
+    if (this->received.find('\n') != std::string::npos) {
+        return true;
+    }
+    return !this->framed && !this->received.empty();
+}
+
+void abstract_server::request_reader::clear() {
+    this->received.clear();
+    this->framed = false;
 }
 
 std::string abstract_server::abstract_server::process_request(std::string request) {
@@ -93,8 +172,253 @@ std::string abstract_server::abstract_server::disconnect_client() {
 
 void abstract_server::abstract_server::send_response(int client, std::string response) {
     ssize_t nwritten = send(client, response.c_str(), response.length(), MSG_NOSIGNAL);
+    this->syscalls++;
     if (nwritten < 0) {
         throw server_error::server_handling_error("Error sending request");
     }
     return;
 }
+
+int abstract_server::abstract_server::pending_clients() {
+    // The accept queue of a listening socket is reported as unacked
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(this->sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        return 0;
+    }
+    return info.tcpi_unacked;
+}
+
+#ifdef USE_IO_URING
+bool abstract_server::abstract_server::handle_io_uring(int client) {
+    if (this->ring.register_files(&client, 1) != 0) {
+        return false;
+    }
+    this->file_fd = -1;
+    this->requests.clear();
+    this->client = client;
+    this->client_connected = true;
+    this->client_opened(client);
+    try {
+        // The next requests are always received while answering this one
+        this->ring.recv(0, this->request_buffer, REQUEST_SIZE, IO_OP_RECV);
+        this->pending[IO_OP_RECV] = true;
+        while (this->client_connected) {
+            std::string request;
+            while (!this->requests.next(&request)) {
+                // Received while answering, or still in flight
+                this->wait_operations(1 << IO_OP_RECV);
+                if (this->results[IO_OP_RECV] <= 0) {
+                    throw server_error::server_handling_error("Error reading request");
+                }
+                this->requests.append(this->request_buffer, this->results[IO_OP_RECV]);
+                if (!this->requests.ready()) {
+                    // Part of a request: receive the rest
+                    this->ring.recv(0, this->request_buffer, REQUEST_SIZE, IO_OP_RECV);
+                    this->pending[IO_OP_RECV] = true;
+                }
+            }
+            // The next request is received with the response unless it was
+            // already (pipelined requests), so nothing is in flight when a
+            // file is registered
+            bool receive = !this->requests.ready();
+
+            // Nothing in flight: the file and its buffer can be registered
+            int fd;
+            size_t size;
+            if (this->file_response(request, &fd, &size)) {
+                this->prepare_file(client, fd, size);
+                // Read, send and receive the next request with one system call
+                if (this->file_buffer_registered) {
+                    this->ring.read_fixed(1, this->file_buffer.data(), size, 0, 0, IO_OP_READ, true);
+                } else {
+                    this->ring.read(1, this->file_buffer.data(), size, 0, IO_OP_READ, true);
+                }
+                this->ring.send(0, this->file_buffer.data(), size, IO_OP_SEND);
+                if (receive) {
+                    this->ring.recv(0, this->request_buffer, REQUEST_SIZE, IO_OP_RECV);
+                }
+                this->pending[IO_OP_READ] = this->pending[IO_OP_SEND] = true;
+                this->pending[IO_OP_RECV] = receive;
+                this->wait_operations((1 << IO_OP_READ) | (1 << IO_OP_SEND));
+                int nread = this->results[IO_OP_READ];
+                int sent = this->results[IO_OP_SEND];
+                if ((nread > 0) && (nread < (int) size)) {
+                    // A short read cancels the send: read the rest and send it all
+                    nread = this->finish_read(size, nread);
+                    sent = 0;
+                }
+                this->file_response_read(request, nread);
+                if (nread < (int) size) {
+                    throw server_error::server_handling_error("Error reading file");
+                }
+                this->finish_send(this->file_buffer.data(), size, sent);
+            } else {
+                std::string response = this->process_request(request);
+                size = response.length();
+                this->ring.send(0, response.data(), size, IO_OP_SEND);
+                if (receive) {
+                    this->ring.recv(0, this->request_buffer, REQUEST_SIZE, IO_OP_RECV);
+                }
+                this->pending[IO_OP_SEND] = true;
+                this->pending[IO_OP_RECV] = receive;
+                this->wait_operations(1 << IO_OP_SEND);
+                this->finish_send(response.data(), size, this->results[IO_OP_SEND]);
+            }
+            this->response_sent(request, size);
+        }
+    } catch (server_error::server_handling_error& e) {
+        this->disconnect_client();
+    }
+    // Complete the operations in flight (the receive of the next request)
+    shutdown(client, SHUT_RDWR);
+    try {
+        this->wait_operations((1 << IO_OP_RECV) | (1 << IO_OP_READ) | (1 << IO_OP_SEND));
+    } catch (server_error::server_handling_error& e) {
+    }
+    this->ring.unregister_files();
+    this->file_fd = -1;
+    this->client_closed(client);
+    close(client);
+    return true;
+}
+
+void abstract_server::abstract_server::wait_operations(unsigned int mask) {
+    while (true) {
+        IoRingCompletion completion;
+        while (this->ring.pop(&completion)) {
+            this->pending[completion.user_data] = false;
+            this->results[completion.user_data] = completion.result;
+        }
+        // Submit what is queued and wait for all the operations at once
+        unsigned int waiting = 0;
+        for (int i = 0; i < 3; i++) {
+            waiting += ((mask >> i) & 1) && this->pending[i];
+        }
+        if (waiting == 0) {
+            return;
+        }
+        if (this->ring.submit(waiting) < 0) {
+            throw server_error::server_handling_error("io_uring failure");
+        }
+    }
+}
+
+void abstract_server::abstract_server::prepare_file(int client, int fd, size_t size) {
+    if (this->file_buffer.size() < size) {
+        if (this->file_buffer_registered) {
+            this->ring.unregister_buffers();
+        }
+        this->file_buffer.resize(size);
+        // Can fail with the memlock limit of older kernels: then the buffer
+        // is used without registering it
+        struct iovec buffer = {this->file_buffer.data(), this->file_buffer.size()};
+        this->file_buffer_registered = (this->ring.register_buffers(&buffer, 1) == 0);
+    }
+    if (fd != this->file_fd) {
+        int files[2] = {client, fd};
+        this->ring.unregister_files();
+        if (this->ring.register_files(files, 2) != 0) {
+            throw server_error::server_handling_error("Error registering file");
+        }
+        this->file_fd = fd;
+    }
+}
+
+int abstract_server::abstract_server::finish_read(size_t size, int nread) {
+    size_t total = nread;
+    while (total < size) {
+        char* data = this->file_buffer.data() + total;
+        if (this->file_buffer_registered) {
+            this->ring.read_fixed(1, data, size - total, total, 0, IO_OP_READ);
+        } else {
+            this->ring.read(1, data, size - total, total, IO_OP_READ);
+        }
+        this->pending[IO_OP_READ] = true;
+        this->wait_operations(1 << IO_OP_READ);
+        if (this->results[IO_OP_READ] <= 0) {
+            return (this->results[IO_OP_READ] < 0) ? this->results[IO_OP_READ] : total;
+        }
+        total += this->results[IO_OP_READ];
+    }
+    return total;
+}
+
+void abstract_server::abstract_server::finish_send(const char* data, size_t size, int sent) {
+    size_t total = 0;
+    while (true) {
+        if (sent < 0) {
+            throw server_error::server_handling_error("Error sending request");
+        }
+        total += sent;
+        if (total >= size) {
+            return;
+        }
+        // Short send: the rest after the receive already in flight
+        this->ring.send(0, data + total, size - total, IO_OP_SEND);
+        this->pending[IO_OP_SEND] = true;
+        this->wait_operations(1 << IO_OP_SEND);
+        sent = this->results[IO_OP_SEND];
+    }
+}
+#endif
+
+#ifdef USE_COROUTINES
+void abstract_server::abstract_server::run_async() {
+    fcntl(this->sock, F_SETFL, fcntl(this->sock, F_GETFL) | O_NONBLOCK);
+    this->accept_clients().detach();
+    this->loop.run();
+}
+
+async_io::task abstract_server::abstract_server::accept_clients() {
+    while (true) {
+        int client = accept4(this->sock, NULL, NULL, SOCK_NONBLOCK);
+        if (client >= 0) {
+            this->serve_client(client).detach();
+        } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            co_await this->loop.readable(this->sock);
+        } else if ((errno == EMFILE) || (errno == ENFILE)) {
+            // Out of descriptors until some client leaves
+            co_await this->loop.sleep_for(10000000);
+        }
+    }
+}
+
+async_io::task abstract_server::abstract_server::serve_client(int client) {
+    async_io::connection conn(this->loop, client);
+    this->client = client;
+    this->client_opened(client);
+    request_reader requests;
+    try {
+        while (!conn.is_closing()) {
+            std::string request;
+            std::string received;
+            while (!requests.next(&request)) {
+                co_await conn.receive(&received, REQUEST_SIZE);
+                if (received.empty()) {
+                    throw server_error::server_handling_error("Client closed");
+                }
+                requests.append(received.data(), received.size());
+            }
+            this->client = client;
+            co_await this->handle_request(conn, request);
+        }
+    } catch (server_error::server_handling_error& e) {
+    }
+    this->loop.forget(client);
+    this->client_closed(client);
+    close(client);
+}
+
+async_io::task abstract_server::abstract_server::handle_request(async_io::connection& conn,
+                                                               std::string request) {
+    this->client_connected = true;
+    std::string response = this->process_request(request);
+    if (!this->client_connected) {
+        conn.close_after_response();
+    }
+    co_await conn.write(response.data(), response.length());
+    this->client = conn.get_fd();
+    this->response_sent(request, response.length());
+}
+#endif
@@ -1,25 +1,138 @@
 #include <iostream>
 #include <cstring>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <algorithm>
+#include <vector>
+
+#ifdef USE_IO_URING
+#include "io_ring.hpp"
+#endif
+#ifdef USE_COROUTINES
+#include "async_io.hpp"
+#endif
+
+// Bytes of requests read at once (several if the client pipelines them)
+#define REQUEST_SIZE 256
+// Operations in flight of the io_uring backend: a file read, a send and a
+// receive
+#define IO_RING_ENTRIES 4
 
 namespace abstract_server {
 
+    // Splits the Bytes received from a client into requests ended by a line
+    // break, so a client can send several before reading the responses. If
+    // the client never ended a request with a line break, what was received
+    // at once is a request, as the clients of the first versions expect.
+    class request_reader {
+    public:
+        request_reader() : framed(false) {}
+        void append(const char* data, size_t len) { this->received.append(data, len); }
+        // Take the next request received. Returns false if there is none.
+        bool next(std::string* request);
+        // A request can be taken without receiving more
+        bool ready() const;
+        void clear();
+    private:
+        std::string received;
+        bool framed;
+    };
+
     class abstract_server {
     public:
         abstract_server(int port);
+        // Serve the clients one at a time or, if built with USE_COROUTINES,
+        // all at once with run_async()
         void run();
+        // Serve a connected client until it quits. Closes the socket.
         void handle(int client);
         std::string get_request(int client);
         void send_response(int client, std::string response);
+        // Connections waiting to be accepted
+        int pending_clients();
+        // Serve the clients through io_uring (if built with USE_IO_URING
+        // and supported by the kernel) or with blocking system calls.
+        // Returns true if io_uring is used. It is used by default.
+        bool set_io_uring(bool enable);
+        // System calls made to serve the clients
+        uint64_t get_syscalls();
+#ifdef USE_COROUTINES
+        // Serve the clients concurrently from this thread, answering their
+        // requests with handle_request(). Never returns.
+        void run_async();
+        async_io::event_loop& get_loop() { return this->loop; }
+#endif
     protected:
         virtual std::string process_request(std::string request);
+        // Called after the response to 'request' (of 'size' Bytes) has been sent
+        virtual void response_sent(const std::string& request, size_t size) {}
+        // Called when a client is connected, before its first request, and
+        // when its connection is closed
+        virtual void client_opened(int client) {}
+        virtual void client_closed(int client) {}
+        // Client whose request is being answered
+        int get_client() { return this->client; }
+        // Answer 'request' with 'size' Bytes read from the file 'fd' (e.g.
+        // a frame of a device). The io_uring backend reads them into a
+        // registered buffer and sends them from there in one submission,
+        // without a string. Returns false to answer with process_request,
+        // as the blocking backend always does.
+        virtual bool file_response(const std::string& request, int* fd, size_t* size) {
+            return false;
+        }
+        // Called once a file response has been read and sent, with the
+        // Bytes read or a negative errno
+        virtual void file_response_read(const std::string& request, ssize_t result) {}
+        // System calls made by the subclass to answer (e.g. to read a frame)
+        void count_syscalls(uint64_t count) { this->syscalls += count; }
+#ifdef USE_COROUTINES
+        // Answer a request by writing to the connection, co_awaiting what
+        // takes time (a frame, the socket, a timer) while the other clients
+        // are served. The response can be written in several pieces from
+        // buffers that live until each write ends. By default it answers
+        // with process_request().
+        virtual async_io::task handle_request(async_io::connection& conn, std::string request);
+#endif
     private:
         std::string disconnect_client();
+        void handle_blocking(int client);
+        // Requests received from the client served by handle()
+        request_reader requests;
         int port;
         int sock;
+        int client;
         bool client_connected;
+        uint64_t syscalls;
+        bool io_uring_enabled;
+#ifdef USE_IO_URING
+        // Serve the client through the ring. Returns false, without
+        // serving it, if its socket could not be registered.
+        bool handle_io_uring(int client);
+        // Wait for the operations of 'mask' (1 << IO_OP_*) in flight
+        void wait_operations(unsigned int mask);
+        // Register the file of a file response and a buffer for it
+        void prepare_file(int client, int fd, size_t size);
+        // Complete a read of the file buffer of which 'nread' Bytes were read.
+        // Returns the Bytes read or a negative errno.
+        int finish_read(size_t size, int nread);
+        // Complete a send of which 'sent' Bytes were sent
+        void finish_send(const char* data, size_t size, int sent);
+        IoRing ring;
+        bool pending[3];
+        int results[3];
+        char request_buffer[REQUEST_SIZE];
+        // Registered as buffer 0, if the kernel allows it
+        std::vector<char> file_buffer;
+        bool file_buffer_registered;
+        // File registered as fixed file 1 (0 is the client)
+        int file_fd;
+#endif
+#ifdef USE_COROUTINES
+        async_io::task accept_clients();
+        async_io::task serve_client(int client);
+        async_io::event_loop loop;
+#endif
     };
 }
 
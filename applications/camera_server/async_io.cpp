@@ -0,0 +1,260 @@
+// Declares async_io and the errors thrown
+#include "abstract_server.hpp"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+
+// Frames read ahead of the handlers: one being read and the ones being sent
+#define FRAME_POOL_SIZE 4
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void async_io::task::detach() {
+    std::coroutine_handle<promise_type> h = this->handle;
+    this->handle = nullptr;
+    h.promise().detached = true;
+    h.resume();
+}
+
+async_io::event_loop::event_loop() : running(false) {
+    this->epoll_fd = epoll_create1(0);
+    this->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if ((this->epoll_fd < 0) || (this->wake_fd < 0)) {
+        throw server_error::server_init_error("Event loop creation failed");
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = this->wake_fd;
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->wake_fd, &event);
+}
+
+async_io::event_loop::~event_loop() {
+    close(this->wake_fd);
+    close(this->epoll_fd);
+}
+
+void async_io::event_loop::run() {
+    this->running = true;
+    struct epoll_event events[16];
+    while (this->running) {
+        // Until the next timer or forever
+        int timeout = -1;
+        if (!this->timers.empty()) {
+            uint64_t now = now_ns();
+            uint64_t deadline = this->timers.begin()->first;
+            timeout = (deadline > now) ? (int) ((deadline - now + 999999) / 1000000) : 0;
+        }
+        int n = epoll_wait(this->epoll_fd, events, 16, timeout);
+        if ((n < 0) && (errno != EINTR)) {
+            throw server_error::server_handling_error("Event loop failure");
+        }
+        std::vector<std::coroutine_handle<>> ready;
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == this->wake_fd) {
+                uint64_t count;
+                if (read(this->wake_fd, &count, sizeof(count)) < 0) {
+                    // Nothing posted since the last wake up
+                }
+                std::lock_guard<std::mutex> lock(this->posted_mutex);
+                ready.insert(ready.end(), this->posted.begin(), this->posted.end());
+                this->posted.clear();
+                continue;
+            }
+            std::map<int, fd_waiters>::iterator it = this->fds.find(fd);
+            if (it == this->fds.end()) {
+                continue;
+            }
+            // Errors and hang ups wake both so they see them in the socket
+            uint32_t happened = events[i].events;
+            if ((happened & (EPOLLIN | EPOLLERR | EPOLLHUP)) && it->second.in) {
+                ready.push_back(it->second.in);
+                it->second.in = nullptr;
+            }
+            if ((happened & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && it->second.out) {
+                ready.push_back(it->second.out);
+                it->second.out = nullptr;
+            }
+            this->arm(fd);
+        }
+        uint64_t now = now_ns();
+        while (!this->timers.empty() && (this->timers.begin()->first <= now)) {
+            ready.push_back(this->timers.begin()->second);
+            this->timers.erase(this->timers.begin());
+        }
+        for (size_t i = 0; i < ready.size(); i++) {
+            ready[i].resume();
+        }
+    }
+}
+
+void async_io::event_loop::stop() {
+    this->running = false;
+}
+
+void async_io::event_loop::post(std::coroutine_handle<> h) {
+    {
+        std::lock_guard<std::mutex> lock(this->posted_mutex);
+        this->posted.push_back(h);
+    }
+    uint64_t one = 1;
+    if (write(this->wake_fd, &one, sizeof(one)) < 0) {
+        // The counter is already non zero: the loop wakes up anyway
+    }
+}
+
+void async_io::event_loop::forget(int fd) {
+    if (this->fds.erase(fd) > 0) {
+        epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+}
+
+async_io::event_loop::fd_awaiter async_io::event_loop::readable(int fd) {
+    return fd_awaiter{this, fd, EPOLLIN};
+}
+
+async_io::event_loop::fd_awaiter async_io::event_loop::writable(int fd) {
+    return fd_awaiter{this, fd, EPOLLOUT};
+}
+
+async_io::event_loop::timer_awaiter async_io::event_loop::sleep_for(uint64_t ns) {
+    return timer_awaiter{this, now_ns() + ns};
+}
+
+void async_io::event_loop::wait_fd(int fd, uint32_t events, std::coroutine_handle<> h) {
+    bool added = (this->fds.find(fd) == this->fds.end());
+    fd_waiters& waiters = this->fds[fd];
+    if (events & EPOLLIN) {
+        waiters.in = h;
+    } else {
+        waiters.out = h;
+    }
+    if (added) {
+        struct epoll_event event;
+        event.events = 0;
+        event.data.fd = fd;
+        epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+    this->arm(fd);
+}
+
+// Watch the events of the coroutines waiting for fd, once
+void async_io::event_loop::arm(int fd) {
+    fd_waiters& waiters = this->fds[fd];
+    struct epoll_event event;
+    event.events = EPOLLONESHOT | (waiters.in ? EPOLLIN : 0) | (waiters.out ? EPOLLOUT : 0);
+    event.data.fd = fd;
+    if (waiters.in || waiters.out) {
+        epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    }
+}
+
+async_io::connection::connection(event_loop& loop, int fd) : loop(loop), fd(fd), closing(false) {}
+
+async_io::task async_io::connection::receive(std::string* request, size_t size) {
+    std::vector<char> buffer(size);
+    while (true) {
+        ssize_t nread = recv(this->fd, buffer.data(), size, MSG_DONTWAIT);
+        if (nread >= 0) {
+            request->assign(buffer.data(), nread);
+            co_return;
+        }
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+            throw server_error::server_handling_error("Error reading request");
+        }
+        co_await this->loop.readable(this->fd);
+    }
+}
+
+async_io::task async_io::connection::write(const void* data, size_t len) {
+    const char* p = (const char*) data;
+    while (len > 0) {
+        ssize_t nwritten = send(this->fd, p, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (nwritten > 0) {
+            p += nwritten;
+            len -= nwritten;
+            continue;
+        }
+        if ((nwritten < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+            throw server_error::server_handling_error("Error sending request");
+        }
+        co_await this->loop.writable(this->fd);
+    }
+}
+
+async_io::frame_feed::frame_feed(event_loop& loop, FrameSource* source)
+        : loop(loop), source(source), stopping(false) {
+    this->thread = std::thread(&frame_feed::read_frames, this);
+}
+
+async_io::frame_feed::~frame_feed() {
+    {
+        std::lock_guard<std::mutex> lock(this->waiters_mutex);
+        this->stopping = true;
+    }
+    this->waiters_added.notify_one();
+    this->thread.join();
+}
+
+void async_io::frame_feed::frame_awaiter::await_suspend(std::coroutine_handle<> h) {
+    this->handle = h;
+    {
+        std::lock_guard<std::mutex> lock(this->feed->waiters_mutex);
+        this->feed->waiters.push_back(this);
+    }
+    this->feed->waiters_added.notify_one();
+}
+
+// A frame of the pool not held by any handler
+std::shared_ptr<async_io::frame_feed::frame> async_io::frame_feed::free_frame() {
+    for (size_t i = 0; i < this->pool.size(); i++) {
+        if (this->pool[i].use_count() == 1) {
+            return this->pool[i];
+        }
+    }
+    std::shared_ptr<frame> f = std::make_shared<frame>();
+    if (this->pool.size() < FRAME_POOL_SIZE) {
+        this->pool.push_back(f);
+    }
+    return f;
+}
+
+void async_io::frame_feed::read_frames() {
+    while (true) {
+        // The handlers waiting get the next frame read
+        std::vector<frame_awaiter*> readers;
+        {
+            std::unique_lock<std::mutex> lock(this->waiters_mutex);
+            this->waiters_added.wait(lock, [this] { return this->stopping || !this->waiters.empty(); });
+            if (this->stopping) {
+                return;
+            }
+            readers.swap(this->waiters);
+        }
+        std::shared_ptr<frame> f = this->free_frame();
+        bool ok = false;
+        {
+            std::lock_guard<std::mutex> lock(this->source_mutex);
+            if (this->source != NULL) {
+                f->data.resize(this->source->get_frame_size());
+                uint64_t start = now_ns();
+                int nread = this->source->read_frame(f->data.data(), f->data.size(), &f->meta);
+                f->read_ns = now_ns() - start;
+                ok = (nread >= 0);
+                f->size = ok ? nread : 0;
+            }
+        }
+        for (size_t i = 0; i < readers.size(); i++) {
+            readers[i]->result = ok ? f : nullptr;
+            this->loop.post(readers[i]->handle);
+        }
+    }
+}
@@ -0,0 +1,194 @@
+#include <coroutine>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_source.hpp"
+
+// Coroutines to serve several clients from one thread (C++20). A handler
+// co_awaits the socket, a timer or a frame instead of blocking, and the
+// event loop runs the other clients meanwhile.
+namespace async_io {
+
+    class event_loop;
+
+    // Coroutine started when it is awaited (or detached). Exceptions are
+    // rethrown to the awaiter.
+    class task {
+    public:
+        struct promise_type {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+            bool detached = false;
+            task get_return_object() {
+                return task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            struct final_awaiter {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                    promise_type& promise = h.promise();
+                    if (promise.detached) {
+                        h.destroy();
+                        return std::noop_coroutine();
+                    }
+                    if (promise.continuation) {
+                        return promise.continuation;
+                    }
+                    return std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            final_awaiter final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { this->exception = std::current_exception(); }
+        };
+
+        task(task&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+        ~task() {
+            if (this->handle) {
+                this->handle.destroy();
+            }
+        }
+        bool await_ready() { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+            this->handle.promise().continuation = awaiter;
+            return this->handle;
+        }
+        void await_resume() {
+            if (this->handle.promise().exception) {
+                std::rethrow_exception(this->handle.promise().exception);
+            }
+        }
+        // Start it without waiting for it. It is destroyed when it ends and
+        // its exceptions are lost.
+        void detach();
+    private:
+        explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    // Resumes the coroutines when their sockets are ready, their timers
+    // expire or other threads post them
+    class event_loop {
+    public:
+        event_loop();
+        ~event_loop();
+        // Resume the coroutines until stop() is called
+        void run();
+        void stop();
+        // Resume 'h' from the loop. Can be called from any thread.
+        void post(std::coroutine_handle<> h);
+        // Stop waiting for a descriptor before closing it
+        void forget(int fd);
+
+        struct fd_awaiter {
+            event_loop* loop;
+            int fd;
+            uint32_t events;
+            bool await_ready() { return false; }
+            void await_suspend(std::coroutine_handle<> h) { this->loop->wait_fd(this->fd, this->events, h); }
+            void await_resume() {}
+        };
+        struct timer_awaiter {
+            event_loop* loop;
+            uint64_t deadline_ns;
+            bool await_ready() { return false; }
+            void await_suspend(std::coroutine_handle<> h) {
+                this->loop->timers.insert(std::make_pair(this->deadline_ns, h));
+            }
+            void await_resume() {}
+        };
+        // co_await readable(fd), writable(fd) or sleep_for(ns)
+        fd_awaiter readable(int fd);
+        fd_awaiter writable(int fd);
+        timer_awaiter sleep_for(uint64_t ns);
+    private:
+        void wait_fd(int fd, uint32_t events, std::coroutine_handle<> h);
+        void arm(int fd);
+        struct fd_waiters {
+            std::coroutine_handle<> in, out;
+        };
+        int epoll_fd;
+        // eventfd to wake up the loop when a coroutine is posted
+        int wake_fd;
+        bool running;
+        std::map<int, fd_waiters> fds;
+        std::multimap<uint64_t, std::coroutine_handle<>> timers;
+        std::mutex posted_mutex;
+        std::vector<std::coroutine_handle<>> posted;
+    };
+
+    // Non-blocking client socket
+    class connection {
+    public:
+        connection(event_loop& loop, int fd);
+        int get_fd() { return this->fd; }
+        // Receive a request of up to 'size' Bytes (empty if the client left)
+        task receive(std::string* request, size_t size);
+        // Send all the Bytes, waiting while the socket is full. The data is
+        // borrowed until the task ends.
+        task write(const void* data, size_t len);
+        // Close the connection after the current response
+        void close_after_response() { this->closing = true; }
+        bool is_closing() { return this->closing; }
+    private:
+        event_loop& loop;
+        int fd;
+        bool closing;
+    };
+
+    // Frames of a source read by a thread of their own, on demand of the
+    // handlers waiting for one. The frames are shared by all the handlers
+    // that waited for them and their buffers are reused once none of them
+    // holds them any more.
+    class frame_feed {
+    public:
+        struct frame {
+            std::vector<uint8_t> data;
+            size_t size;
+            FrameMetadata meta;
+            // Time to read it from the source
+            uint64_t read_ns;
+        };
+        // NULL if the frame could not be read
+        typedef std::shared_ptr<const frame> frame_ptr;
+
+        frame_feed(event_loop& loop, FrameSource* source);
+        ~frame_feed();
+        // Stop reading frames (e.g. to switch the source) until released
+        std::unique_lock<std::mutex> lock_source() {
+            return std::unique_lock<std::mutex>(this->source_mutex);
+        }
+        // With the source locked
+        void set_source(FrameSource* source) { this->source = source; }
+
+        struct frame_awaiter {
+            frame_feed* feed;
+            std::coroutine_handle<> handle;
+            frame_ptr result;
+            bool await_ready() { return false; }
+            void await_suspend(std::coroutine_handle<> h);
+            frame_ptr await_resume() { return this->result; }
+        };
+        // co_await next() for the next frame read
+        frame_awaiter next() { return frame_awaiter{this, nullptr, nullptr}; }
+    private:
+        void read_frames();
+        std::shared_ptr<frame> free_frame();
+        event_loop& loop;
+        FrameSource* source;
+        std::mutex source_mutex;
+        std::mutex waiters_mutex;
+        std::condition_variable waiters_added;
+        std::vector<frame_awaiter*> waiters;
+        std::vector<std::shared_ptr<frame>> pool;
+        bool stopping;
+        std::thread thread;
+    };
+}
@@ -1,41 +1,316 @@
 #include "camera_server.hpp"
 
-camera_server::camera_server::camera_server(int port, int image_type) : abstract_server(port) {
-    // Store pixel size in Bytes
-    if (image_type == 0) {
-      this->pixel_size = 4;
-    } else if ((image_type == 1) || (image_type == 2)) {
-      this->pixel_size = 1;
-    }
+#include <arpa/inet.h>
+#include <linux/sockios.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+
+#define PROFILE_COMMAND "profile "
 
-    // Open camera device
-    if (image_type == 0){
-        this->uvicamera.open("/dev/uvispace_camera_rgbg", std::ios::binary);
-    } else if (image_type == 1) {
-        this->uvicamera.open("/dev/uvispace_camera_gray", std::ios::binary);
-    } else if (image_type == 2) {
-        this->uvicamera.open("/dev/uvispace_camera_bin", std::ios::binary);
+camera_server::camera_server::camera_server(int port, int image_type,
+        const std::string& replay_path, int replay_speed)
+        : abstract_server(port), device(NULL), backend(NULL), switcher(NULL), frame_number(0),
+          client_socket(-1), frame_pending(false), frame_read_ns(0), frame_send_timed(true),
+          frame_served(false) {
+#ifdef USE_COROUTINES
+    this->feed = NULL;
+#endif
+    if (replay_path.empty()) {
+        // Open camera device
+        DeviceFrameSource* device = new DeviceFrameSource(image_type, IMAGE_WIDTH, IMAGE_HEIGHT);
+        this->uvicamera = device;
+        if (device->open() != 0) {
+            delete this->uvicamera;
+            throw server_error::server_init_error("uvispace_camera could not be open");
+        }
+        this->device = device;
+    } else {
+        // Open recording
+        ReplayFrameSource* replay = new ReplayFrameSource();
+        this->uvicamera = replay;
+        if (replay->open(replay_path.c_str(), replay_speed) != 0) {
+            delete this->uvicamera;
+            throw server_error::server_init_error("recording could not be open");
+        }
     }
+}
 
-    if (!this->uvicamera.is_open()) {
-        throw server_error::server_init_error("uvispace_camera could not be open");
+camera_server::camera_server::camera_server(int port, int image_type,
+        const std::string& profiles_path, const std::string& initial)
+        : abstract_server(port), uvicamera(NULL), device(NULL), backend(NULL), switcher(NULL),
+          frame_number(0), client_socket(-1), frame_pending(false), frame_read_ns(0),
+          frame_send_timed(true), frame_served(false) {
+#ifdef USE_COROUTINES
+    this->feed = NULL;
+#endif
+    std::vector<CameraProfile> profiles;
+    if ((load_camera_profiles(profiles_path.c_str(), &profiles) != 0) || profiles.empty()) {
+        throw server_error::server_init_error("camera profiles could not be read");
+    }
+    // The camera registers are written from userspace
+    this->backend = open_register_backend("auto");
+    if (this->backend == NULL) {
+        throw server_error::server_init_error("register backend could not be open");
     }
+    this->switcher = new CameraProfileSwitcher(this->backend, image_type);
+    if (this->switcher->open(profiles, initial.empty() ? profiles[0].name : initial) != 0) {
+        delete this->switcher;
+        close_register_backend(this->backend);
+        throw server_error::server_init_error("camera profile " + initial + " could not be applied");
+    }
+    this->uvicamera = this->switcher->get_source();
 }
 
 camera_server::camera_server::~camera_server() {
-    this->uvicamera.close();
+#ifdef USE_COROUTINES
+    // Stop reading frames before closing the source
+    delete this->feed;
+#endif
+    if (this->switcher != NULL) {
+        delete this->switcher;
+        close_register_backend(this->backend);
+    } else {
+        delete this->uvicamera;
+    }
 }
 
 std::string camera_server::camera_server::process_request(std::string request) {
+    server_metrics::add_request(this->metrics_client());
     if (request == "capture_frame") {
         return this->capture_frame();
+    } else if (request == "stats") {
+        return this->metrics_text();
+    } else if (request == "trace") {
+        return latency_trace::summary();
+    } else if (request == "trace_json") {
+        return latency_trace::chrome_json();
+    } else if (request == "profiles") {
+        return this->list_profiles();
+    } else if (request == "frame_info") {
+        return this->frame_info();
+    } else if (request.compare(0, strlen(PROFILE_COMMAND), PROFILE_COMMAND) == 0) {
+        return this->select_profile(request.substr(strlen(PROFILE_COMMAND)));
     }
     return abstract_server::process_request(request);
 }
 
+void camera_server::camera_server::response_sent(const std::string& request, size_t size) {
+    server_metrics::add_bytes(this->metrics_client(), size);
+    if (request == "capture_frame") {
+        uint64_t now = latency_trace::now_ns();
+        latency_trace::record(TRACE_SEND, this->frame_number, now);
+        server_metrics::add_frame(this->metrics_client());
+        if (this->frame_send_timed) {
+            server_metrics::observe(METRICS_SEND_LATENCY, now - this->frame_read_ns);
+        }
+        this->frame_pending = false;
+    }
+}
+
+bool camera_server::camera_server::file_response(const std::string& request, int* fd,
+                                                 size_t* size) {
+    // Frames of the driver are read and sent by the io_uring backend
+    if ((request != "capture_frame") || (this->device == NULL)) {
+        return false;
+    }
+    server_metrics::add_request(this->metrics_client());
+    *fd = this->device->get_fd();
+    *size = this->device->get_frame_size();
+    this->frame_read_ns = latency_trace::now_ns();
+    return true;
+}
+
+void camera_server::camera_server::file_response_read(const std::string& request,
+                                                      ssize_t result) {
+    if (result < 0) {
+        server_metrics::count(METRICS_READ_ERRORS);
+        return;
+    }
+    // The read latency includes the send, submitted with it
+    uint64_t now = latency_trace::now_ns();
+    server_metrics::observe(METRICS_READ_LATENCY, now - this->frame_read_ns);
+    this->frame_read_ns = now;
+    this->frame_send_timed = false;
+    this->frame_pending = true;
+    this->frame_number++;
+    latency_trace::record(TRACE_READ_COMPLETE, this->frame_number, now);
+}
+
+void camera_server::camera_server::client_opened(int client) {
+    // Counted by address: the port changes with every connection
+    struct sockaddr_in address;
+    socklen_t len = sizeof(address);
+    char name[INET_ADDRSTRLEN] = "unknown";
+    if (getpeername(client, (struct sockaddr*) &address, &len) == 0) {
+        inet_ntop(AF_INET, &address.sin_addr, name, sizeof(name));
+    }
+    this->metrics_clients[client] = server_metrics::client_slot(name);
+    this->client_socket = client;
+}
+
+void camera_server::camera_server::client_closed(int client) {
+    if (this->frame_pending) {
+        server_metrics::count(METRICS_SEND_ERRORS);
+        this->frame_pending = false;
+    }
+    this->metrics_clients.erase(client);
+    if (this->client_socket == client) {
+        this->client_socket = -1;
+    }
+}
+
+int camera_server::camera_server::metrics_client() {
+    std::map<int, int>::const_iterator it = this->metrics_clients.find(this->get_client());
+    return (it != this->metrics_clients.end()) ? it->second : METRICS_MAX_CLIENTS - 1;
+}
+
+std::string camera_server::camera_server::metrics_text() {
+    std::vector<server_metrics::gauge> gauges(2);
+    gauges[0].name = "clients_waiting";
+    gauges[0].help = "Connections waiting for the client being served.";
+    gauges[0].value = this->pending_clients();
+    // Bytes of the frames sent still in the socket (not acknowledged by the
+    // client). The socket may be closed meanwhile: then nothing is queued.
+    int queued = 0;
+    int client = this->client_socket;
+    if ((client < 0) || (ioctl(client, SIOCOUTQ, &queued) < 0)) {
+        queued = 0;
+    }
+    gauges[1].name = "send_queue_bytes";
+    gauges[1].help = "Bytes sent to the client and not acknowledged yet.";
+    gauges[1].value = queued;
+    return server_metrics::prometheus("camera_server", gauges);
+}
+
 std::string camera_server::camera_server::capture_frame() {
-    std::uint32_t image_size = IMAGE_HEIGHT * IMAGE_WIDTH * this->pixel_size;
-    std::string result(image_size, '\0');
-    this->uvicamera.read(&result[0], image_size);
+    FrameMetadata meta;
+    if (this->uvicamera == NULL) {
+        throw server_error::server_handling_error("Camera not available");
+    }
+    std::string result(this->uvicamera->get_frame_size(), '\0');
+    uint64_t start = latency_trace::now_ns();
+    if (this->uvicamera->read_frame((uint8_t*) &result[0], result.size(), &meta) < 0) {
+        server_metrics::count(METRICS_READ_ERRORS);
+        throw server_error::server_handling_error("Error reading frame");
+    }
+    this->frame_read_ns = latency_trace::now_ns();
+    server_metrics::observe(METRICS_READ_LATENCY, this->frame_read_ns - start);
+    // Frames of the source between this one and the previous one served
+    if (this->frame_served && (meta.frame_counter > this->frame_number + 1)) {
+        server_metrics::count(METRICS_FRAMES_SKIPPED, meta.frame_counter - this->frame_number - 1);
+    }
+    this->frame_served = true;
+    this->frame_pending = true;
+    this->frame_send_timed = true;
+    this->frame_number = meta.frame_counter;
+    latency_trace::record_fpga(this->frame_number, meta.fpga_start_ns, meta.fpga_ready_ns);
+    latency_trace::record(TRACE_READ_COMPLETE, this->frame_number, this->frame_read_ns);
+    return result;
+}
+
+std::string camera_server::camera_server::frame_info() {
+    if (this->uvicamera == NULL) {
+        return "camera not available\n";
+    }
+    char result[64];
+    snprintf(result, sizeof(result), "%u %u %u %zu\n", this->uvicamera->get_width(),
+             this->uvicamera->get_height(), this->uvicamera->get_format(),
+             this->uvicamera->get_frame_size());
     return result;
 }
+
+std::string camera_server::camera_server::list_profiles() {
+    if (this->switcher == NULL) {
+        return "no profiles\n";
+    }
+    std::string result;
+    char line[128];
+    const std::vector<CameraProfile>& profiles = this->switcher->get_profiles();
+    for (size_t i = 0; i < profiles.size(); i++) {
+        snprintf(line, sizeof(line), "%s %s %ux%u\n",
+                 (profiles[i].name == this->switcher->get_active().name) ? "*" : " ",
+                 profiles[i].name.c_str(), profiles[i].width, profiles[i].height);
+        result += line;
+    }
+    return result;
+}
+
+std::string camera_server::camera_server::select_profile(const std::string& name) {
+    if (this->switcher == NULL) {
+        return "no profiles\n";
+    }
+#ifdef USE_COROUTINES
+    // Not while a frame is read from the old source
+    std::unique_lock<std::mutex> feed_lock;
+    if (this->feed != NULL) {
+        feed_lock = this->feed->lock_source();
+    }
+#endif
+    int error = this->switcher->select(name);
+    // The frame source is a new one even if the switch failed
+    this->uvicamera = this->switcher->get_source();
+#ifdef USE_COROUTINES
+    if (this->feed != NULL) {
+        this->feed->set_source(this->uvicamera);
+    }
+#endif
+    this->frame_served = false;
+    if (error == ERROR_CAMERA_PROFILE_UNKNOWN) {
+        return "unknown profile\n";
+    }
+    if (this->uvicamera == NULL) {
+        return "failed, camera not available\n";
+    }
+    char result[128];
+    snprintf(result, sizeof(result), "%s %s %ux%u %.3f ms\n", (error == 0) ? "ok" : "failed",
+             this->switcher->get_active().name.c_str(), this->switcher->get_active().width,
+             this->switcher->get_active().height,
+             this->switcher->get_switch_latency_ns() / 1e6);
+    return result;
+}
+
+#ifdef USE_COROUTINES
+async_io::task camera_server::camera_server::handle_request(async_io::connection& conn,
+                                                           std::string request) {
+    if ((request != "capture_frame") || (this->uvicamera == NULL)) {
+        co_await abstract_server::handle_request(conn, request);
+        co_return;
+    }
+    // Another client may be answered while waiting
+    int client = this->metrics_client();
+    server_metrics::add_request(client);
+    if (this->feed == NULL) {
+        this->feed = new async_io::frame_feed(this->get_loop(), this->uvicamera);
+    }
+    async_io::frame_feed::frame_ptr frame = co_await this->feed->next();
+    if (!frame) {
+        server_metrics::count(METRICS_READ_ERRORS);
+        throw server_error::server_handling_error("Error reading frame");
+    }
+    server_metrics::observe(METRICS_READ_LATENCY, frame->read_ns);
+    // The clients waiting at once share a frame: it is traced and its
+    // predecessors counted as skipped once
+    uint32_t counter = frame->meta.frame_counter;
+    uint64_t start = latency_trace::now_ns();
+    if (!this->frame_served || (counter > this->frame_number)) {
+        if (this->frame_served && (counter > this->frame_number + 1)) {
+            server_metrics::count(METRICS_FRAMES_SKIPPED, counter - this->frame_number - 1);
+        }
+        this->frame_served = true;
+        this->frame_number = counter;
+        latency_trace::record_fpga(counter, frame->meta.fpga_start_ns, frame->meta.fpga_ready_ns);
+        latency_trace::record(TRACE_READ_COMPLETE, counter, start);
+    }
+    try {
+        co_await conn.write(frame->data.data(), frame->size);
+    } catch (server_error::server_handling_error& e) {
+        server_metrics::count(METRICS_SEND_ERRORS);
+        throw;
+    }
+    uint64_t now = latency_trace::now_ns();
+    latency_trace::record(TRACE_SEND, counter, now);
+    server_metrics::observe(METRICS_SEND_LATENCY, now - start);
+    server_metrics::add_frame(client);
+    server_metrics::add_bytes(client, frame->size);
+}
+#endif
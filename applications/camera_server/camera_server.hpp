@@ -1,6 +1,12 @@
 #include "abstract_server.hpp"
 
-#include <fstream>
+#include "camera_profile.hpp"
+#include "frame_source.hpp"
+#include "latency_trace.hpp"
+#include "server_metrics.hpp"
+
+#include <atomic>
+#include <map>
 
 typedef uint8_t color_component;
 
@@ -10,13 +16,63 @@ typedef uint8_t color_component;
 namespace camera_server {
     class camera_server: public abstract_server::abstract_server {
     public:
-        camera_server(int port, int image_type);
+        // Serve frames from the camera driver device of image_type
+        // (0 RGBG, 1 gray, 2 binary) or, if replay_path is not empty, from
+        // a recording made with frame_recorder.
+        camera_server(int port, int image_type, const std::string& replay_path = "",
+                      int replay_speed = REPLAY_RECORDED_SPEED);
+        // Serve frames of image_type with the camera configured with the
+        // profiles of a file, starting with 'initial' (the first one if
+        // empty)
+        camera_server(int port, int image_type, const std::string& profiles_path,
+                      const std::string& initial);
         ~camera_server();
+        // Metrics of the frames served in Prometheus text format. Can be
+        // called from any thread.
+        std::string metrics_text();
     protected:
         std::string process_request(std::string request) override;
+        void response_sent(const std::string& request, size_t size) override;
+        void client_opened(int client) override;
+        void client_closed(int client) override;
+        bool file_response(const std::string& request, int* fd, size_t* size) override;
+        void file_response_read(const std::string& request, ssize_t result) override;
+#ifdef USE_COROUTINES
+        // Frames are awaited without blocking the other clients and sent
+        // from the buffer they were read into
+        async_io::task handle_request(async_io::connection& conn, std::string request) override;
+#endif
     private:
         std::string capture_frame();
-        std::ifstream uvicamera;
-        uint8_t pixel_size;
+        // Width, height, format (as image_type) and Bytes of the frames
+        std::string frame_info();
+        std::string list_profiles();
+        std::string select_profile(const std::string& name);
+        FrameSource* uvicamera;
+        // uvicamera if it is the driver device, NULL otherwise
+        DeviceFrameSource* device;
+        // Only with profiles. The switcher owns uvicamera.
+        RegisterBackend* backend;
+        CameraProfileSwitcher* switcher;
+        // Counter of the last frame captured. Identifies it in the traces.
+        uint32_t frame_number;
+        // Metrics of the client being answered
+        int metrics_client();
+        // Slot of the metrics of each client connected
+        std::map<int, int> metrics_clients;
+        std::atomic<int> client_socket;
+        // Last frame read but not sent yet, and when it was read
+        bool frame_pending;
+        uint64_t frame_read_ns;
+        // False if the frame was read and sent in the same submission, so
+        // the send is not timed on its own
+        bool frame_send_timed;
+        // To count the frames skipped by the source between two requests
+        bool frame_served;
+#ifdef USE_COROUTINES
+        // Frames read for the clients waiting for one, created on the first
+        // capture_frame
+        async_io::frame_feed* feed;
+#endif
     };
 }
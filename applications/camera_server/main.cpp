@@ -2,34 +2,77 @@
 
 #define PORT 36000
 
+void print_usage() {
+    std::cout << "Usage:\n";
+    std::cout << "camera_server --binary\n";
+    std::cout << "camera_server --greyscale\n";
+    std::cout << "camera_server --rgbg\n";
+    std::cout << "camera_server --binary|--greyscale|--rgbg --profiles <file> [<profile>]\n";
+    std::cout << "camera_server --replay <recording> [--max-speed]\n";
+    std::cout << "Set UVISPACE_METRICS_PORT to serve the metrics over HTTP\n";
+}
+
+// Serve the camera, and the metrics if a port is given
+void run(camera_server::camera_server& cs) {
+    const char* metrics_port = getenv("UVISPACE_METRICS_PORT");
+    camera_server::metrics_endpoint* endpoint = NULL;
+    if ((metrics_port != NULL) && (atoi(metrics_port) > 0)) {
+      endpoint = new camera_server::metrics_endpoint(atoi(metrics_port),
+          [&cs]() { return cs.metrics_text(); });
+    }
+    cs.run();
+    delete endpoint;
+}
+
 int main(int argc, char** argv) {
     // Process command line arguments
-    if (argc != 2) {
-      std::cout << "Usage:\n";
-      std::cout << "camera_server --binary\n";
-      std::cout << "camera_server --greyscale\n";
-      std::cout << "camera_server --rgbg\n";
+    if ((argc < 2) || (argc > 5)) {
+      print_usage();
       return 1;
     }
 
     std::string image_type_argument(argv[1]);
-    int image_type;
-    if (image_type_argument == "--rgbg") {
+    int image_type = 0;
+    std::string replay_path;
+    std::string profiles_path;
+    std::string initial_profile;
+    int replay_speed = REPLAY_RECORDED_SPEED;
+    // Image type alone or followed by the profiles
+    bool profiles = (argc >= 4) && (std::string(argv[2]) == "--profiles");
+    bool image_type_only = (argc == 2) || profiles;
+    if (profiles) {
+      profiles_path = argv[3];
+      if (argc == 5) {
+        initial_profile = argv[4];
+      }
+    }
+    if ((image_type_argument == "--rgbg") && image_type_only) {
       image_type = 0;
-    } else if (image_type_argument == "--greyscale") {
+    } else if ((image_type_argument == "--greyscale") && image_type_only) {
       image_type = 1;
-    } else if (image_type_argument == "--binary") {
+    } else if ((image_type_argument == "--binary") && image_type_only) {
       image_type = 2;
+    } else if ((image_type_argument == "--replay") && (argc >= 3) && (argc <= 4)) {
+      replay_path = argv[2];
+      if (argc == 4) {
+        if (std::string(argv[3]) != "--max-speed") {
+          print_usage();
+          return 1;
+        }
+        replay_speed = REPLAY_MAX_SPEED;
+      }
     } else {
-      std::cout << "Usage:\n";
-      std::cout << "camera_server --binary\n";
-      std::cout << "camera_server --greyscale\n";
-      std::cout << "camera_server --rgbg\n";
+      print_usage();
       return 1;
     }
 
     // Run server
-    camera_server::camera_server cs(PORT, image_type);
-    cs.run();
+    if (!profiles_path.empty()) {
+      camera_server::camera_server cs(PORT, image_type, profiles_path, initial_profile);
+      run(cs);
+    } else {
+      camera_server::camera_server cs(PORT, image_type, replay_path, replay_speed);
+      run(cs);
+    }
     return 0;
 }
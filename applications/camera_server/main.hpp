@@ -1 +1,2 @@
 #include "camera_server.hpp"
+#include "metrics_endpoint.hpp"
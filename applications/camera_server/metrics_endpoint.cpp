@@ -0,0 +1,86 @@
+#include "metrics_endpoint.hpp"
+#include "abstract_server.hpp"
+
+#include <errno.h>
+#include <sys/socket.h>
+
+// Largest request header read
+#define HTTP_REQUEST_SIZE 4096
+
+camera_server::metrics_endpoint::metrics_endpoint(int port, std::function<std::string()> scrape)
+        : scrape(scrape) {
+    struct sockaddr_in server_addr;
+    std::memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+
+    this->sock = socket(PF_INET, SOCK_STREAM, 0);
+    if (this->sock < 0) {
+        throw server_error::server_init_error("Metrics socket creation failed");
+    }
+    int reuse = 1;
+    if ((setsockopt(this->sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) ||
+            (bind(this->sock, (const struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) ||
+            (listen(this->sock, SOMAXCONN) < 0)) {
+        close(this->sock);
+        throw server_error::server_init_error("Metrics socket configuration failed");
+    }
+    this->thread = std::thread(&metrics_endpoint::run, this);
+}
+
+camera_server::metrics_endpoint::~metrics_endpoint() {
+    // Wakes up the thread blocked in accept
+    shutdown(this->sock, SHUT_RDWR);
+    this->thread.join();
+    close(this->sock);
+}
+
+void camera_server::metrics_endpoint::run() {
+    while (true) {
+        int client = accept(this->sock, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        this->handle(client);
+        close(client);
+    }
+}
+
+void camera_server::metrics_endpoint::handle(int client) {
+    // Request line and headers, up to the empty line
+    std::string request;
+    char buffer[512];
+    while ((request.find("\r\n\r\n") == std::string::npos) && (request.size() < HTTP_REQUEST_SIZE)) {
+        ssize_t nread = recv(client, buffer, sizeof(buffer), 0);
+        if (nread <= 0) {
+            return;
+        }
+        request.append(buffer, nread);
+    }
+    std::string status = "200 OK";
+    std::string body;
+    if ((request.compare(0, 13, "GET /metrics ") == 0) ||
+            (request.compare(0, 13, "GET /metrics?") == 0)) {
+        body = this->scrape();
+    } else {
+        status = "404 Not Found";
+        body = "not found\n";
+    }
+    std::string response = "HTTP/1.0 " + status + "\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t nwritten = send(client, response.data() + sent, response.size() - sent,
+                                MSG_NOSIGNAL);
+        if (nwritten <= 0) {
+            return;
+        }
+        sent += nwritten;
+    }
+}
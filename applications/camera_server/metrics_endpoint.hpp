@@ -0,0 +1,19 @@
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace camera_server {
+    // HTTP endpoint for Prometheus. Answers GET /metrics with the text
+    // returned by 'scrape', from its own thread, one request per connection.
+    class metrics_endpoint {
+    public:
+        metrics_endpoint(int port, std::function<std::string()> scrape);
+        ~metrics_endpoint();
+    private:
+        void run();
+        void handle(int client);
+        std::function<std::string()> scrape;
+        int sock;
+        std::thread thread;
+    };
+}
@@ -19,47 +19,43 @@ void print_camera_config(Camera* cam) {
 }
 
 int main(int argc, char **argv) {
-    void *virtual_base;
-    int fd;
+    RegisterBackend *backend;
     void *camera_virtual_address;
 
-    // Open the device file for accessing the physical memory
-    if ((fd = open("/dev/mem", (O_RDWR | O_SYNC))) == -1) {
-        printf("ERROR: could not open \"/dev/mem\"...\n");
+    // Open the FPGA address map (real hardware unless UVISPACE_BACKEND
+    // selects a simulated one)
+    backend = open_register_backend();
+    if (backend == NULL) {
         return(1);
     }
-    // Map the physical memory to the virtual address space. The base address
-    // for the FPGA address map is stored in 'virtual_base'.
-    virtual_base = mmap(NULL, HW_REGS_SPAN, (PROT_READ | PROT_WRITE),
-                        MAP_SHARED, fd, HW_REGS_BASE);
-    if( virtual_base == MAP_FAILED ) {
-        printf( "ERROR: mmap() failed...\n" );
-        close( fd );
-        return( 1 );
-    }
     // Virtual address of the camera registers.
-    camera_virtual_address = (void*) ((uint8_t*)virtual_base + ((unsigned long) (AVALON_CAMERA_0_BASE) & (unsigned long) (HW_REGS_MASK)));
+    camera_virtual_address = backend->component_address(AVALON_CAMERA_0_BASE);
 
     //Initialize camera
     Camera cam(camera_virtual_address);
 
     //Write the col_size value written by the user in the avalon_camera registers
     if ( argc == 16) {
-        cam.config_set_width(atoi(argv[1]));
-        cam.config_set_height(atoi(argv[2]));
-        cam.config_set_start_row(atoi(argv[3]));
-        cam.config_set_start_column(atoi(argv[4]));
-        cam.config_set_row_size(atoi(argv[5])) ;
-        cam.config_set_column_size(atoi(argv[6]));
-        cam.config_set_row_mode(atoi(argv[7]));
-        cam.config_set_column_mode(atoi(argv[8]));
-        cam.config_set_exposure(atoi(argv[9]));
-        cam.config_set_h_blanking(atoi(argv[10]));
-        cam.config_set_v_blanking(atoi(argv[11]));
-        cam.config_set_red_gain(atoi(argv[12]));
-        cam.config_set_blue_gain(atoi(argv[13]));
-        cam.config_set_green1_gain(atoi(argv[14]));
-        cam.config_set_green2_gain(atoi(argv[15]));
+        // Values out of the range of a register are not written
+        int error = 0;
+        error |= cam.config_set_width(atoi(argv[1]));
+        error |= cam.config_set_height(atoi(argv[2]));
+        error |= cam.config_set_start_row(atoi(argv[3]));
+        error |= cam.config_set_start_column(atoi(argv[4]));
+        error |= cam.config_set_row_size(atoi(argv[5]));
+        error |= cam.config_set_column_size(atoi(argv[6]));
+        error |= cam.config_set_row_mode(atoi(argv[7]));
+        error |= cam.config_set_column_mode(atoi(argv[8]));
+        error |= cam.config_set_exposure(atoi(argv[9]));
+        error |= cam.config_set_h_blanking(atoi(argv[10]));
+        error |= cam.config_set_v_blanking(atoi(argv[11]));
+        error |= cam.config_set_red_gain(atoi(argv[12]));
+        error |= cam.config_set_blue_gain(atoi(argv[13]));
+        error |= cam.config_set_green1_gain(atoi(argv[14]));
+        error |= cam.config_set_green2_gain(atoi(argv[15]));
+        if (error != 0) {
+            printf("ERROR: some values are out of range, they were not written\n");
+        }
         cam.config_update();
         print_camera_config(&cam);
     }
@@ -79,11 +75,8 @@ int main(int argc, char **argv) {
     }
 
     // clean up the memory mapping and exit
-    if (munmap( virtual_base, HW_REGS_SPAN ) != 0) {
-        printf("ERROR: munmap() failed...\n");
-        close(fd);
+    if (close_register_backend(backend) != 0) {
         return(1);
     }
-    close(fd);
     return(0);
 }
@@ -1,16 +1,9 @@
 // Standard libraries
 #include <stdio.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <sys/mman.h>
 #include <inttypes.h>
 #include <stdlib.h> // atoi()
 
 #include "hps_0.h"
+#include "hw_backend.hpp"
 #include "avalon_camera.hpp"
 
-//Constants to do mmap and get access to FPGA peripherals
-#define HPS_FPGA_BRIDGE_BASE 0xC0000000
-#define HW_REGS_BASE ( HPS_FPGA_BRIDGE_BASE )
-#define HW_REGS_SPAN ( 0x04000000 )
-#define HW_REGS_MASK ( HW_REGS_SPAN - 1 )
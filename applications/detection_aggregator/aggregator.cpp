@@ -0,0 +1,436 @@
+#include "aggregator.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <thread>
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void detection_aggregator::clock_offset::add(uint64_t local_ns, uint64_t remote_ns) {
+    int64_t offset = (int64_t) (local_ns - remote_ns);
+    // Offsets larger than this one can not be the minimum while it is in
+    // the window
+    while (!this->minimum.empty() && (this->minimum.back().second >= offset)) {
+        this->minimum.pop_back();
+    }
+    this->minimum.push_back(std::make_pair(this->samples, offset));
+    this->samples++;
+    if (this->minimum.front().first + CLOCK_OFFSET_SAMPLES <= this->samples - 1) {
+        this->minimum.pop_front();
+    }
+}
+
+uint64_t detection_aggregator::clock_offset::to_local(uint64_t remote_ns) const {
+    return remote_ns + this->minimum.front().second;
+}
+
+void detection_aggregator::clock_offset::reset() {
+    this->minimum.clear();
+    this->samples = 0;
+}
+
+float detection_aggregator::pose_weight(const FloorPose& pose) {
+    float weight = 1.0;
+    if (pose.flags & POSE_REFINED) {
+        weight *= 2.0;
+    }
+    if (pose.flags & (POSE_BORDER | POSE_OUTSIDE_CALIBRATION)) {
+        weight *= 0.25;
+    }
+    return weight;
+}
+
+void detection_aggregator::merge_poses(const std::vector<node_pose>& poses, float radius,
+                                       std::vector<FloorPose>* merged) {
+    merged->clear();
+    // Best poses first: each one takes the closest pose of each other node
+    std::vector<std::pair<float, size_t> > order(poses.size());
+    for (size_t i = 0; i < poses.size(); i++) {
+        order[i] = std::make_pair(-pose_weight(poses[i].pose), i);
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<bool> used(poses.size(), false);
+    std::vector<size_t> cluster;
+    float radius2 = radius * radius;
+    for (size_t o = 0; o < order.size(); o++) {
+        size_t seed = order[o].second;
+        if (used[seed]) {
+            continue;
+        }
+        used[seed] = true;
+        const FloorPose& best = poses[seed].pose;
+        cluster.assign(1, seed);
+        for (size_t n = 0; n < poses.size(); n++) {
+            // Closest unused pose of a node not in the cluster yet
+            int node = poses[n].node;
+            bool in_cluster = false;
+            for (size_t c = 0; c < cluster.size(); c++) {
+                in_cluster = in_cluster || (poses[cluster[c]].node == node);
+            }
+            if (in_cluster) {
+                continue;
+            }
+            float closest2 = radius2;
+            size_t closest = poses.size();
+            for (size_t i = n; i < poses.size(); i++) {
+                const FloorPose& p = poses[i].pose;
+                if (used[i] || (poses[i].node != node) ||
+                    ((p.label != best.label) && (p.label != POSE_LABEL_NONE) &&
+                     (best.label != POSE_LABEL_NONE))) {
+                    continue;
+                }
+                float dx = p.x - best.x;
+                float dy = p.y - best.y;
+                if (dx * dx + dy * dy < closest2) {
+                    closest2 = dx * dx + dy * dy;
+                    closest = i;
+                }
+            }
+            if (closest < poses.size()) {
+                used[closest] = true;
+                cluster.push_back(closest);
+            }
+        }
+        // Weighted mean of the centroids and of the heading vectors
+        FloorPose pose = best;
+        float sum = 0, x = 0, y = 0, hx = 0, hy = 0;
+        for (size_t c = 0; c < cluster.size(); c++) {
+            const FloorPose& p = poses[cluster[c]].pose;
+            float weight = pose_weight(p);
+            sum += weight;
+            x += weight * p.x;
+            y += weight * p.y;
+            hx += weight * cosf(p.heading);
+            hy += weight * sinf(p.heading);
+            if (pose.label == POSE_LABEL_NONE) {
+                pose.label = p.label;
+            }
+        }
+        pose.x = x / sum;
+        pose.y = y / sum;
+        pose.heading = atan2f(hy, hx);
+        for (int v = 0; v < 3; v++) {
+            pose.vertex_x[v] += pose.x - best.x;
+            pose.vertex_y[v] += pose.y - best.y;
+        }
+        if (cluster.size() > 1) {
+            pose.flags |= POSE_MERGED;
+        }
+        merged->push_back(pose);
+    }
+}
+
+detection_aggregator::aggregator::aggregator(const config& conf)
+        : conf(conf), buffer(MESSAGE_SIZE_MAX), slot_open(false), slot_start_ns(0), sequence(0),
+          slots(0), slots_complete(0), slot_frames(0), poses_in(0), poses_out(0),
+          running(false) {
+    if (conf.endpoints.empty()) {
+        throw aggregator_error("No nodes");
+    }
+    this->zmq_context = zmq_ctx_new();
+    this->nodes.resize(conf.endpoints.size());
+    for (size_t i = 0; i < this->nodes.size(); i++) {
+        node& n = this->nodes[i];
+        n.endpoint = conf.endpoints[i];
+        n.has_counter = false;
+        n.last_counter = 0;
+        n.last_heard_ns = 0;
+        n.pending = false;
+        n.capture_ns = 0;
+        n.received = n.merged = n.replaced = n.late = n.lost = 0;
+        n.socket = zmq_socket(this->zmq_context, ZMQ_SUB);
+        if (n.socket == NULL) {
+            throw aggregator_error("ZMQ socket could not be created");
+        }
+        // The nodes keep only their last message for slow subscribers:
+        // so does the aggregator
+        int hwm = 1;
+        zmq_setsockopt(n.socket, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+        int linger = 0;
+        zmq_setsockopt(n.socket, ZMQ_LINGER, &linger, sizeof(linger));
+        zmq_setsockopt(n.socket, ZMQ_SUBSCRIBE, "", 0);
+        if (zmq_connect(n.socket, n.endpoint.c_str()) != 0) {
+            throw aggregator_error("ZMQ socket could not be connected to " + n.endpoint);
+        }
+    }
+    this->global_publisher.bind(this->zmq_context, conf.port);
+}
+
+detection_aggregator::aggregator::~aggregator() {
+    this->global_publisher.close();
+    for (size_t i = 0; i < this->nodes.size(); i++) {
+        if (this->nodes[i].socket != NULL) {
+            zmq_close(this->nodes[i].socket);
+        }
+    }
+    zmq_ctx_term(this->zmq_context);
+}
+
+void detection_aggregator::aggregator::run() {
+    this->running = true;
+    std::vector<zmq_pollitem_t> items(this->nodes.size());
+    for (size_t i = 0; i < this->nodes.size(); i++) {
+        items[i].socket = this->nodes[i].socket;
+        items[i].fd = 0;
+        items[i].events = ZMQ_POLLIN;
+        items[i].revents = 0;
+    }
+    uint64_t window_ns = (uint64_t) this->conf.window_us * 1000;
+    while (this->running) {
+        // Until the slot deadline, or a while to see stop()
+        long timeout_ms = 100;
+        uint64_t now = now_ns();
+        if (this->slot_open) {
+            uint64_t deadline = this->slot_start_ns + window_ns;
+            timeout_ms = (deadline > now) ? (long) ((deadline - now + 999999) / 1000000) : 0;
+        }
+        int n = zmq_poll(items.data(), items.size(), timeout_ms);
+        if ((n < 0) && (zmq_errno() != EINTR)) {
+            throw aggregator_error("ZMQ poll failure");
+        }
+        now = now_ns();
+        for (size_t i = 0; (n > 0) && (i < items.size()); i++) {
+            if (items[i].revents & ZMQ_POLLIN) {
+                this->receive(i, now);
+            }
+        }
+        if (!this->slot_open) {
+            continue;
+        }
+        // Wait for the nodes alive without a frame, until the deadline
+        bool complete = true;
+        for (size_t i = 0; i < this->nodes.size(); i++) {
+            const node& nd = this->nodes[i];
+            bool alive = nd.last_heard_ns + (uint64_t) NODE_TIMEOUT_MS * 1000000 > now;
+            complete = complete && (nd.pending || !alive);
+        }
+        if (complete || (now >= this->slot_start_ns + window_ns)) {
+            this->emit(now, complete);
+        }
+    }
+}
+
+void detection_aggregator::aggregator::stop() {
+    this->running = false;
+}
+
+// Read the messages of a node. The frame replaces the one pending.
+void detection_aggregator::aggregator::receive(size_t index, uint64_t now) {
+    node& n = this->nodes[index];
+    while (true) {
+        int len = zmq_recv(n.socket, this->buffer.data(), this->buffer.size(), ZMQ_DONTWAIT);
+        if (len < 0) {
+            return;
+        }
+        TriangleMessageHeader header;
+        std::vector<FloorPose> poses;
+        if ((len > (int) this->buffer.size()) ||
+            (floor_message_decode(this->buffer.data(), len, &header, &poses) < 0)) {
+            printf("ERROR: Wrong message from %s\n", n.endpoint.c_str());
+            continue;
+        }
+        n.received++;
+        // A node restarted (or its replay looped) if the counter went back
+        // more than a few frames: its clock may have changed too
+        if (n.has_counter) {
+            int32_t step = (int32_t) (header.frame_counter - n.last_counter);
+            if ((step <= 0) && (step > -FRAME_COUNTER_RESTART)) {
+                n.late++;
+                continue;
+            }
+            if (step <= -FRAME_COUNTER_RESTART) {
+                n.offset.reset();
+            } else {
+                n.lost += step - 1;
+            }
+        }
+        n.has_counter = true;
+        n.last_counter = header.frame_counter;
+        n.last_heard_ns = now;
+        n.offset.add(now, header.timestamp_ns);
+        if (n.pending) {
+            n.replaced++;
+        }
+        n.pending = true;
+        n.capture_ns = n.offset.to_local(header.timestamp_ns);
+        n.poses.swap(poses);
+        if (!this->slot_open) {
+            this->slot_open = true;
+            this->slot_start_ns = now;
+        }
+    }
+}
+
+void detection_aggregator::aggregator::emit(uint64_t now, bool complete) {
+    // Frames captured within the window of the newest one
+    uint64_t newest = 0;
+    for (size_t i = 0; i < this->nodes.size(); i++) {
+        if (this->nodes[i].pending && (this->nodes[i].capture_ns > newest)) {
+            newest = this->nodes[i].capture_ns;
+        }
+    }
+    uint64_t window_ns = (uint64_t) this->conf.window_us * 1000;
+    this->slot_poses.clear();
+    int64_t capture_sum = 0;
+    uint32_t frames = 0;
+    bool waiting = false;
+    for (size_t i = 0; i < this->nodes.size(); i++) {
+        node& n = this->nodes[i];
+        if (!n.pending) {
+            continue;
+        }
+        if (n.capture_ns + window_ns < newest) {
+            // For the next slot, unless a newer frame replaces it
+            waiting = true;
+            continue;
+        }
+        for (size_t p = 0; p < n.poses.size(); p++) {
+            node_pose np = {(int) i, n.poses[p]};
+            this->slot_poses.push_back(np);
+        }
+        capture_sum += (int64_t) (n.capture_ns - newest);
+        frames++;
+        n.pending = false;
+        n.merged++;
+    }
+    merge_poses(this->slot_poses, this->conf.radius, &this->merged);
+    TriangleMessageHeader header;
+    header.label = POSE_LABEL_NONE;
+    header.frame_counter = this->sequence++;
+    header.timestamp_ns = newest + capture_sum / (int64_t) frames;
+    floor_message_encode(header, this->merged, &this->message);
+    this->global_publisher.send(this->message.data(), this->message.size());
+
+    this->slots++;
+    this->slots_complete += complete;
+    this->slot_frames += frames;
+    this->poses_in += this->slot_poses.size();
+    this->poses_out += this->merged.size();
+    uint32_t latency_us = (now_ns() - this->slot_start_ns) / 1000;
+    if (this->latencies_us.size() < LATENCY_SAMPLES) {
+        this->latencies_us.push_back(latency_us);
+    } else {
+        this->latencies_us[this->slots % LATENCY_SAMPLES] = latency_us;
+    }
+    // The frames left open the next slot now
+    this->slot_open = waiting;
+    this->slot_start_ns = now;
+}
+
+std::string detection_aggregator::aggregator::summary() const {
+    std::ostringstream out;
+    out << "Slots: " << this->slots << " (" << this->slots_complete << " with all the nodes alive), "
+        << (this->slots ? (double) this->slot_frames / this->slots : 0) << " frames and "
+        << this->poses_in << " poses merged into " << this->poses_out << "\n";
+    if (!this->latencies_us.empty()) {
+        std::vector<uint32_t> sorted(this->latencies_us);
+        std::sort(sorted.begin(), sorted.end());
+        out << "Slot latency (us): p50 " << sorted[sorted.size() / 2]
+            << " p99 " << sorted[sorted.size() * 99 / 100]
+            << " max " << sorted.back() << "\n";
+    }
+    for (size_t i = 0; i < this->nodes.size(); i++) {
+        const node& n = this->nodes[i];
+        out << n.endpoint << ": " << n.received << " frames received, " << n.merged
+            << " merged, " << n.replaced << " replaced, " << n.late << " repeated, "
+            << n.lost << " lost\n";
+    }
+    return out.str();
+}
+
+// UGVs of the simulation, moving in circles
+#define SIMULATE_UGVS       6
+#define SIMULATE_FPS        30
+#define SIMULATE_FLOOR_X    4000.0
+#define SIMULATE_FLOOR_Y    3000.0
+// Overlap of the strips of two nodes and noise of the poses (floor units)
+#define SIMULATE_OVERLAP    400.0
+#define SIMULATE_NOISE      5.0
+// Capture time between two nodes
+#define SIMULATE_PHASE_US   1000
+
+static void simulate_node(int index, int nodes, int port, std::atomic<bool>* running) {
+    void* context = zmq_ctx_new();
+    detection_server::publisher node_publisher;
+    try {
+        node_publisher.bind(context, port);
+    } catch (const detection_server::detection_error& e) {
+        printf("ERROR: %s\n", e.what());
+        zmq_ctx_term(context);
+        return;
+    }
+    std::mt19937 random(index + 1);
+    std::normal_distribution<float> noise(0.0, SIMULATE_NOISE);
+    std::uniform_int_distribution<int> jitter_us(0, 3000);
+    // Own clock, and frames captured a little after those of the previous
+    // node
+    uint64_t clock_shift = (uint64_t) (index + 1) * 1000000000000ULL;
+    uint64_t period_ns = 1000000000ULL / SIMULATE_FPS;
+    uint64_t next = now_ns() + (uint64_t) index * SIMULATE_PHASE_US * 1000;
+    float strip = SIMULATE_FLOOR_X / nodes;
+    float first_x = index * strip - SIMULATE_OVERLAP / 2;
+    float last_x = (index + 1) * strip + SIMULATE_OVERLAP / 2;
+    std::vector<FloorPose> poses;
+    std::string message;
+    uint32_t counter = 0;
+    while (*running) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(next - std::min(next, now_ns())));
+        uint64_t capture = next;
+        next += period_ns;
+        double t = capture / 1e9;
+        poses.clear();
+        for (int u = 0; u < SIMULATE_UGVS; u++) {
+            // Circles of 500 units around points spread over the floor
+            float cx = SIMULATE_FLOOR_X * (u + 0.5) / SIMULATE_UGVS;
+            float cy = SIMULATE_FLOOR_Y / 2;
+            float angle = 0.3 * t + u;
+            FloorPose pose;
+            pose.x = cx + 500 * cosf(angle);
+            pose.y = cy + 500 * sinf(angle);
+            if ((pose.x < first_x) || (pose.x >= last_x)) {
+                continue;
+            }
+            pose.heading = angle + M_PI / 2;
+            for (int v = 0; v < 3; v++) {
+                float a = pose.heading + v * 2 * M_PI / 3;
+                pose.vertex_x[v] = pose.x + 60 * cosf(a);
+                pose.vertex_y[v] = pose.y + 60 * sinf(a);
+            }
+            pose.x += noise(random);
+            pose.y += noise(random);
+            bool border = (pose.x < first_x + SIMULATE_OVERLAP / 4) ||
+                          (pose.x > last_x - SIMULATE_OVERLAP / 4);
+            pose.flags = POSE_REFINED | (border ? POSE_BORDER : 0);
+            pose.label = u % 3;
+            poses.push_back(pose);
+        }
+        // Detection and network delay
+        std::this_thread::sleep_for(std::chrono::microseconds(2000 + jitter_us(random)));
+        TriangleMessageHeader header;
+        header.label = POSE_LABEL_NONE;
+        header.frame_counter = counter++;
+        header.timestamp_ns = capture + clock_shift;
+        floor_message_encode(header, poses, &message);
+        node_publisher.send(message.data(), message.size());
+    }
+    node_publisher.close();
+    zmq_ctx_term(context);
+}
+
+void detection_aggregator::simulate_nodes(int nodes, int first_port, std::atomic<bool>* running) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nodes; i++) {
+        threads.push_back(std::thread(simulate_node, i, nodes, first_port + i, running));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
@@ -0,0 +1,161 @@
+#include <inttypes.h>
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "floor_calibration.hpp"
+
+#include "publisher.hpp"
+
+// Global poses on the floor (floor messages, as port 37000 of the nodes)
+#define GLOBAL_POSES_PORT 38000
+
+// Receive time minus capture time samples kept per node to estimate its
+// clock offset (about 8 s at 30 fps)
+#define CLOCK_OFFSET_SAMPLES 256
+// A node not heard for this long is not waited for
+#define NODE_TIMEOUT_MS 1000
+// A frame counter this far behind the last one is a node restarted
+#define FRAME_COUNTER_RESTART 64
+// Slot latencies kept for the summary
+#define LATENCY_SAMPLES 4096
+// Largest message received (the header and 1600 poses)
+#define MESSAGE_SIZE_MAX 65536
+
+// Flag of a global pose seen by several nodes, added to those of the
+// best of them
+#define POSE_MERGED 0x10
+
+namespace detection_aggregator {
+    class aggregator_error : public std::runtime_error {
+    public:
+        aggregator_error(const std::string what) : std::runtime_error(what) {}
+    };
+
+    struct config {
+        // Floor pose sockets of the detection_server nodes
+        // (e.g. tcp://192.168.0.10:37000)
+        std::vector<std::string> endpoints;
+        // Longest time a slot waits for the nodes since its first frame
+        uint32_t window_us;
+        // Poses of different nodes closer than this on the floor are the
+        // same UGV (floor units)
+        float radius;
+        int port;
+    };
+
+    // Offset between the steady clock of a node and the local one: the
+    // smallest receive time minus capture time of the last
+    // CLOCK_OFFSET_SAMPLES frames. It includes the shortest delay of the
+    // node (detection and network), so the capture times of nodes with
+    // similar delays are aligned, and a frame delayed by the network does not
+    // move it.
+    class clock_offset {
+    public:
+        clock_offset() : samples(0) {}
+        void add(uint64_t local_ns, uint64_t remote_ns);
+        // Local time of a time of the node
+        uint64_t to_local(uint64_t remote_ns) const;
+        void reset();
+    private:
+        // Increasing offsets of the window (sample number, offset): the
+        // front is the minimum
+        std::deque<std::pair<uint64_t, int64_t> > minimum;
+        uint64_t samples;
+    };
+
+    // A pose of a node to merge
+    struct node_pose {
+        int node;
+        FloorPose pose;
+    };
+
+    // Weight of a pose in a merge: refined poses count more, those on the
+    // border of the image or outside the calibration less
+    float pose_weight(const FloorPose& pose);
+    // Merge the poses of the nodes: poses of different nodes closer than
+    // 'radius' with the same label (or none) are one UGV at their weighted
+    // mean, with the vertices of the best one moved there
+    void merge_poses(const std::vector<node_pose>& poses, float radius,
+                     std::vector<FloorPose>* merged);
+
+    // Subscribes to the floor poses of the nodes, aligns their frames by
+    // capture time and publishes the merged poses:
+    //  * A slot opens when a frame arrives and no slot is open.
+    //  * Each node contributes its last frame. A newer frame of a node
+    //    replaces the one pending and an older or repeated one (frame
+    //    counter) is dropped.
+    //  * The slot is merged when all the nodes alive have a frame, or
+    //    window_us after it opened, so a slow or dead node delays the
+    //    global poses by window_us at most.
+    //  * Frames captured more than window_us before the newest one of the
+    //    slot are left for the next slot, unless a newer frame of their
+    //    node replaces them first.
+    // The timestamp of the global message is the mean local capture time of
+    // the frames merged and the frame counter a sequence of the slots.
+    class aggregator {
+    public:
+        // Connect to the nodes and bind the socket. Throws aggregator_error.
+        aggregator(const config& conf);
+        ~aggregator();
+        // Run until stop() is called
+        void run();
+        void stop();
+        // Frames received, merged, dropped and latency of the slots.
+        // Consistent once run() returned.
+        std::string summary() const;
+    private:
+        struct node {
+            void* socket;
+            std::string endpoint;
+            clock_offset offset;
+            // Last frame counter received, to drop repeated frames
+            bool has_counter;
+            uint32_t last_counter;
+            uint64_t last_heard_ns;
+            // Frame waiting for the slot
+            bool pending;
+            uint64_t capture_ns;
+            std::vector<FloorPose> poses;
+            // Statistics
+            uint64_t received;
+            uint64_t merged;
+            uint64_t replaced;
+            uint64_t late;
+            uint64_t lost;
+        };
+        void receive(size_t index, uint64_t now);
+        // Merge the frames pending and publish them. 'complete' if all the
+        // nodes alive delivered.
+        void emit(uint64_t now, bool complete);
+        config conf;
+        void* zmq_context;
+        std::vector<node> nodes;
+        detection_server::publisher global_publisher;
+        std::vector<uint8_t> buffer;
+        std::string message;
+        // Open slot: time its first frame arrived
+        bool slot_open;
+        uint64_t slot_start_ns;
+        uint32_t sequence;
+        std::vector<node_pose> slot_poses;
+        std::vector<FloorPose> merged;
+        // Statistics of the slots: nodes merged and latency from the
+        // first frame to the publication (us, last LATENCY_SAMPLES slots)
+        uint64_t slots;
+        uint64_t slots_complete;
+        uint64_t slot_frames;
+        uint64_t poses_in;
+        uint64_t poses_out;
+        std::vector<uint32_t> latencies_us;
+        std::atomic<bool> running;
+    };
+
+    // Publish synthetic floor poses of UGVs moving on the floor as 'nodes'
+    // detection_server would, each one seeing a strip of the floor that
+    // overlaps its neighbours, with its own clock and noise
+    void simulate_nodes(int nodes, int first_port, std::atomic<bool>* running);
+}
@@ -0,0 +1,76 @@
+#include "main.hpp"
+
+#include <thread>
+
+static detection_aggregator::aggregator* aggregator = NULL;
+
+static void handle_signal(int signal) {
+    if (aggregator != NULL) {
+        aggregator->stop();
+    }
+}
+
+void print_usage() {
+    std::cout << "Call with the floor pose sockets of the detection_server nodes:\n";
+    std::cout << "  detection_aggregator endpoint [endpoint ...]\n";
+    std::cout << "Example with two nodes:\n";
+    std::cout << "  detection_aggregator tcp://192.168.0.10:37000 tcp://192.168.0.11:37000\n";
+    std::cout << "Call without arguments and UVISPACE_SIMULATE_NODES=3 for three simulated nodes\n";
+}
+
+int main(int argc, char** argv) {
+    detection_aggregator::config conf;
+    conf.window_us = WINDOW_US_DEFAULT;
+    conf.radius = RADIUS_DEFAULT;
+    conf.port = GLOBAL_POSES_PORT;
+
+    // Process command line arguments
+    for (int i = 1; i < argc; i++) {
+        conf.endpoints.push_back(argv[i]);
+    }
+    const char* window_us = getenv("UVISPACE_AGGREGATOR_WINDOW_US");
+    const char* radius = getenv("UVISPACE_AGGREGATOR_RADIUS");
+    if (window_us != NULL) {
+        conf.window_us = atoi(window_us);
+    }
+    if (radius != NULL) {
+        conf.radius = atof(radius);
+    }
+    // Simulated nodes on the loopback interface, to try the aggregator
+    // without cameras
+    const char* simulate = getenv("UVISPACE_SIMULATE_NODES");
+    int simulated = (simulate != NULL) ? atoi(simulate) : 0;
+    for (int i = 0; i < simulated; i++) {
+        conf.endpoints.push_back("tcp://127.0.0.1:" + std::to_string(SIMULATE_PORT_DEFAULT + i));
+    }
+    if (conf.endpoints.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    // Run the aggregator until interrupted
+    std::atomic<bool> simulating(true);
+    std::thread simulator;
+    if (simulated > 0) {
+        simulator = std::thread(detection_aggregator::simulate_nodes, simulated,
+                                SIMULATE_PORT_DEFAULT, &simulating);
+    }
+    int result = 0;
+    try {
+        detection_aggregator::aggregator ag(conf);
+        aggregator = &ag;
+        signal(SIGINT, handle_signal);
+        signal(SIGTERM, handle_signal);
+        ag.run();
+        aggregator = NULL;
+        std::cout << ag.summary();
+    } catch (const std::runtime_error& e) {
+        std::cerr << "ERROR: " << e.what() << "\n";
+        result = 1;
+    }
+    simulating = false;
+    if (simulator.joinable()) {
+        simulator.join();
+    }
+    return result;
+}
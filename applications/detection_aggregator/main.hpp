@@ -0,0 +1,13 @@
+#include <signal.h>
+#include <stdlib.h>
+
+#include <iostream>
+
+#include "aggregator.hpp"
+
+// A node missing in a slot delays the global poses this long at most
+#define WINDOW_US_DEFAULT 20000
+// Distance on the floor under which two poses are the same UGV
+#define RADIUS_DEFAULT 100.0
+// First port of the simulated nodes
+#define SIMULATE_PORT_DEFAULT 37001
@@ -0,0 +1,620 @@
+#include "detection_server.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+// Geometry attributes of the camera driver
+#define SYSFS_IMAGE_WIDTH  "/sys/uvispace_camera/attributes/image_width"
+#define SYSFS_IMAGE_HEIGHT "/sys/uvispace_camera/attributes/image_height"
+
+static void write_attribute(const char* path, uint32_t value) {
+    std::ofstream attribute(path);
+    attribute << value;
+    if (!attribute) {
+        throw detection_server::detection_error(std::string("could not write ") + path);
+    }
+}
+
+detection_server::detection_server::detection_server(const config& conf)
+        : conf(conf), backend(NULL), bin_source(NULL), rgbgray_source(NULL), scheduler(NULL),
+          pool(FRAME_POOL_SIZE), free_frames(FRAME_POOL_SIZE), detect_queue(FRAME_POOL_SIZE),
+          publish_queue(FRAME_POOL_SIZE), downsampling(1), downsampling_guard(false),
+          downsampling_first_frame(0), roi_valid(false), roi_min_row(0), roi_max_row(0),
+          motion_frames(0), motion_idle_frames(0), motion_pixels(0), motion_pixels_processed(0),
+          zmq_context(NULL), shm_truncated_frames(0), running(false), frame_number(0) {
+    if (conf.lines_skip >= conf.height) {
+        throw detection_error("lines_skip must be smaller than the height");
+    }
+    // The binary images of consecutive frames differ in their thresholds
+    if (conf.motion_gating && !conf.profiles.empty()) {
+        throw detection_error("motion gating is not available with threshold profiles");
+    }
+    this->motion.set_min_pixels(conf.motion_min_pixels);
+    if (!conf.calibration.empty() && (this->calibration.load(conf.calibration.c_str()) != 0)) {
+        throw detection_error("calibration " + conf.calibration + " could not be read");
+    }
+    bool replay = !conf.replay_bin.empty();
+    try {
+        if (replay) {
+            this->bin_source = this->open_source(FRAME_FORMAT_BIN, conf.replay_bin,
+                                                 conf.replay_max_speed);
+            // Timing is given by the binary recording
+            if (!conf.replay_rgbgray.empty()) {
+                this->rgbgray_source = this->open_source(FRAME_FORMAT_GRAY, conf.replay_rgbgray,
+                                                         true);
+            }
+        } else {
+            if (access(DEV_PATH_BIN, F_OK) == 0) {
+                // Set the resolution in the driver
+                write_attribute(SYSFS_IMAGE_WIDTH, conf.width);
+                write_attribute(SYSFS_IMAGE_HEIGHT, conf.height);
+            }
+            this->bin_source = this->open_source(FRAME_FORMAT_BIN, "", false);
+            this->rgbgray_source = this->open_source(
+                conf.send_rgb ? FRAME_FORMAT_RGBG : FRAME_FORMAT_GRAY, "", false);
+        }
+        if (!conf.profiles.empty()) {
+            // The thresholds follow the counter of the binary image writer
+            ImageWriterFrameSource* writer = dynamic_cast<ImageWriterFrameSource*>(
+                this->bin_source);
+            if (writer == NULL) {
+                throw detection_error("threshold profiles need the image writers driven from "
+                                      "userspace (not the camera driver nor recordings)");
+            }
+            this->scheduler = new ThresholdScheduler(
+                this->backend->component_address(AVALON_IMAGE_PROCESSING_0_BASE),
+                writer->get_image_writer());
+            this->scheduler->start(conf.profiles, conf.profile_frames);
+        }
+    } catch (...) {
+        this->close_sources();
+        throw;
+    }
+    // Recordings keep their own geometry
+    this->conf.width = this->bin_source->get_width();
+    this->height_send = std::min(conf.height - conf.lines_skip, this->bin_source->get_height());
+    if (this->calibration.is_loaded() &&
+            ((this->calibration.get_width() != (int) this->conf.width) ||
+             (this->calibration.get_height() < (int) this->height_send))) {
+        this->close_sources();
+        throw detection_error("the calibration is not of the geometry of the images");
+    }
+    if (conf.latency_budget_us > 0) {
+        // Only the image writers driven from userspace can be downsampled
+        bool writers = (dynamic_cast<ImageWriterFrameSource*>(this->bin_source) != NULL) &&
+                       ((this->rgbgray_source == NULL) ||
+                        (dynamic_cast<ImageWriterFrameSource*>(this->rgbgray_source) != NULL));
+        // Motion gating chooses the rows to process itself
+        this->governor.start((uint64_t) conf.latency_budget_us * 1000,
+                             writers ? conf.max_downsampling : 1, !conf.motion_gating);
+    }
+
+    // Preallocate all the frames of the pipeline
+    for (size_t i = 0; i < this->pool.size(); i++) {
+        frame& f = this->pool[i];
+        f.bin.resize((size_t) this->conf.width * this->height_send);
+        if (this->rgbgray_source != NULL) {
+            uint32_t lines = std::min(this->height_send, this->rgbgray_source->get_height());
+            f.rgbgray.resize((size_t) this->rgbgray_source->get_width() * lines *
+                             frame_format_pixel_size(this->rgbgray_source->get_format()));
+        }
+        f.read_ns = 0;
+        f.downsampling = 1;
+        f.width = this->conf.width;
+        f.lines = this->height_send;
+        f.has_rgbgray = false;
+        f.rgbgray_size = 0;
+        f.same_rgbgray = false;
+        f.profile = THRESHOLD_PROFILE_NONE;
+        f.triangles.reserve(64);
+        f.poses.reserve(64);
+        f.floor_poses.reserve(64);
+        this->free_frames.push(&f);
+    }
+
+    // Bind publisher sockets
+    this->zmq_context = zmq_ctx_new();
+    try {
+        this->triangle_publisher.bind(this->zmq_context, TRIANGLES_PORT);
+        this->bin_publisher.bind(this->zmq_context, BIN_FRAME_PORT);
+        this->rgbgray_publisher.bind(this->zmq_context, RGBGRAY_FRAME_PORT);
+        this->pose_publisher.bind(this->zmq_context, POSES_PORT);
+        if (this->calibration.is_loaded()) {
+            this->floor_pose_publisher.bind(this->zmq_context, FLOOR_POSES_PORT);
+        }
+    } catch (...) {
+        this->triangle_publisher.close();
+        this->bin_publisher.close();
+        this->rgbgray_publisher.close();
+        this->pose_publisher.close();
+        this->floor_pose_publisher.close();
+        zmq_ctx_term(this->zmq_context);
+        this->close_sources();
+        throw;
+    }
+    if (!this->conf.shm_channel.empty() &&
+            (this->shm_writer.open(this->conf.shm_channel.c_str(),
+                                   TRIANGLE_MESSAGE_HEADER_SIZE + SHM_CHANNEL_TRIANGLES *
+                                   (TRIANGLE_MESSAGE_TRIANGLE_SIZE + sizeof(TrianglePose))) != 0)) {
+        this->triangle_publisher.close();
+        this->bin_publisher.close();
+        this->rgbgray_publisher.close();
+        this->pose_publisher.close();
+        this->floor_pose_publisher.close();
+        zmq_ctx_term(this->zmq_context);
+        this->close_sources();
+        throw detection_error("shared memory channel " + this->conf.shm_channel +
+                              " could not be created");
+    }
+}
+
+detection_server::detection_server::~detection_server() {
+    this->triangle_publisher.close();
+    this->bin_publisher.close();
+    this->rgbgray_publisher.close();
+    this->pose_publisher.close();
+    this->floor_pose_publisher.close();
+    this->shm_writer.close();
+    zmq_ctx_term(this->zmq_context);
+    this->close_sources();
+}
+
+FrameSource* detection_server::detection_server::open_source(uint32_t format,
+        const std::string& replay_path, bool max_speed) {
+    if (!replay_path.empty()) {
+        ReplayFrameSource* replay = new ReplayFrameSource();
+        if (replay->open(replay_path.c_str(),
+                         max_speed ? REPLAY_MAX_SPEED : REPLAY_RECORDED_SPEED) != 0) {
+            delete replay;
+            throw detection_error("recording " + replay_path + " could not be open");
+        }
+        return replay;
+    }
+    // Frames come from the camera driver if it is loaded. Otherwise the
+    // image writer is driven from userspace (simulated without hardware).
+    if (access(DEV_PATH_BIN, F_OK) == 0) {
+        DeviceFrameSource* device = new DeviceFrameSource(format, this->conf.width,
+                                                          this->conf.height);
+        if (device->open() != 0) {
+            delete device;
+            throw detection_error("uvispace_camera could not be open");
+        }
+        return device;
+    }
+    if (this->backend == NULL) {
+        this->backend = open_register_backend("auto");
+        if (this->backend == NULL) {
+            throw detection_error("register backend could not be open");
+        }
+    }
+    ImageWriterFrameSource* writer = new ImageWriterFrameSource(format, this->conf.width,
+                                                                this->conf.height);
+    if (writer->open(this->backend) != 0) {
+        delete writer;
+        throw detection_error("image writer could not be started");
+    }
+    return writer;
+}
+
+void detection_server::detection_server::close_sources() {
+    delete this->scheduler;
+    this->scheduler = NULL;
+    delete this->bin_source;
+    delete this->rgbgray_source;
+    this->bin_source = NULL;
+    this->rgbgray_source = NULL;
+    if (this->backend != NULL) {
+        close_register_backend(this->backend);
+        this->backend = NULL;
+    }
+}
+
+void detection_server::detection_server::run() {
+    this->running = true;
+    std::thread capture(&detection_server::capture_loop, this);
+    std::thread detect(&detection_server::detect_loop, this);
+    std::thread publish(&detection_server::publish_loop, this);
+    pin_thread(capture, CAPTURE_CORE);
+    pin_thread(detect, DETECT_CORE);
+    pin_thread(publish, PUBLISH_CORE);
+    capture.join();
+    detect.join();
+    publish.join();
+}
+
+void detection_server::detection_server::stop() {
+    this->running = false;
+}
+
+void detection_server::detection_server::capture_loop() {
+    frame* f;
+    while (this->free_frames.wait_pop(&f, this->running)) {
+        const GovernorLevel& settings = this->governor.get_settings();
+        if (settings.downsampling != this->downsampling) {
+            this->set_downsampling(settings.downsampling);
+        }
+        if (!this->read_binary(f)) {
+            fprintf(stderr, "ERROR: binary frame could not be read\n");
+            this->stop();
+            break;
+        }
+        f->read_ns = latency_trace::now_ns();
+        f->number = ++this->frame_number;
+        latency_trace::record_fpga(f->number, f->meta.fpga_start_ns, f->meta.fpga_ready_ns);
+        latency_trace::record(TRACE_READ_COMPLETE, f->number);
+        // The gray or RGB image is read while the binary one is processed,
+        // one frame out of side_period
+        f->has_rgbgray = false;
+        f->same_rgbgray = false;
+        if ((this->rgbgray_source != NULL) && (f->number % settings.side_period == 0)) {
+            FrameMetadata rgbgray_meta;
+            uint32_t lines = std::min(this->height_send, this->rgbgray_source->get_height());
+            f->rgbgray_size = (size_t) (this->rgbgray_source->get_width() / f->downsampling) *
+                              (lines / f->downsampling) *
+                              frame_format_pixel_size(this->rgbgray_source->get_format());
+            f->has_rgbgray = this->rgbgray_source->read_frame(&f->rgbgray[0], f->rgbgray_size,
+                                                               &rgbgray_meta) >= 0;
+            f->same_rgbgray = f->has_rgbgray &&
+                              (rgbgray_meta.frame_counter == f->meta.frame_counter) &&
+                              (rgbgray_meta.width == f->meta.width);
+        }
+        if (!this->detect_queue.wait_push(f, this->running)) {
+            break;
+        }
+    }
+}
+
+bool detection_server::detection_server::read_binary(frame* f) {
+    f->downsampling = this->downsampling;
+    f->width = this->conf.width / f->downsampling;
+    f->lines = this->height_send / f->downsampling;
+    // Frames captured while the thresholds or the downsampling changed are
+    // read again
+    do {
+        if (this->bin_source->read_frame(&f->bin[0], (size_t) f->width * f->lines,
+                                         &f->meta) < 0) {
+            return false;
+        }
+        f->profile = THRESHOLD_PROFILE_NONE;
+        if (this->scheduler != NULL) {
+            this->scheduler->update();
+            f->profile = this->scheduler->tag(f->meta.frame_counter);
+        }
+    } while (((this->scheduler != NULL) && (f->profile < 0)) ||
+             (this->downsampling_guard &&
+              ((int32_t) (f->meta.frame_counter - 1 - this->downsampling_first_frame) < 0)));
+    return true;
+}
+
+void detection_server::detection_server::set_downsampling(uint32_t downsampling) {
+    ImageWriterFrameSource* bin_writer = dynamic_cast<ImageWriterFrameSource*>(
+        this->bin_source);
+    ImageWriterFrameSource* rgbgray_writer = dynamic_cast<ImageWriterFrameSource*>(
+        this->rgbgray_source);
+    if (bin_writer == NULL) {
+        return;
+    }
+    bin_writer->get_image_writer()->set_downsampling(downsampling);
+    if (rgbgray_writer != NULL) {
+        rgbgray_writer->get_image_writer()->set_downsampling(downsampling);
+    }
+    // As with the thresholds, the frame being captured can mix both
+    this->downsampling_first_frame = bin_writer->get_image_writer()->get_image_counter() + 1;
+    this->downsampling_guard = true;
+    this->downsampling = downsampling;
+}
+
+void detection_server::detection_server::select_roi(const frame* f, uint32_t* first,
+                                                    uint32_t* rows) {
+    uint32_t roi = this->governor.get_settings().roi_eighths;
+    *first = 0;
+    *rows = f->lines;
+    // Full frames find the UGVs that were not in the band
+    if ((roi >= GOVERNOR_ROI_FULL) || !this->roi_valid ||
+        (f->number % ROI_FULL_FRAME_PERIOD == 0)) {
+        return;
+    }
+    // Band centred on the UGVs of the previous frame, large enough for all
+    double top = (this->roi_min_row - ROI_MARGIN) / f->downsampling;
+    double bottom = (this->roi_max_row + ROI_MARGIN) / f->downsampling;
+    uint32_t band = std::max<uint32_t>(f->lines * roi / GOVERNOR_ROI_FULL, bottom - top + 1);
+    if (band >= f->lines) {
+        return;
+    }
+    double start = (top + bottom - band) / 2;
+    *first = std::min<double>(std::max(start, 0.0), f->lines - band);
+    *rows = band;
+}
+
+// Bounding box of a triangle overlaps the box [r0, r1) x [c0, c1)
+static bool triangle_overlaps(const Triangle& t, double r0, double r1, double c0, double c1) {
+    double min_r = t.vertices[0].r, max_r = min_r, min_c = t.vertices[0].c, max_c = min_c;
+    for (int v = 1; v < 3; v++) {
+        min_r = std::min(min_r, t.vertices[v].r);
+        max_r = std::max(max_r, t.vertices[v].r);
+        min_c = std::min(min_c, t.vertices[v].c);
+        max_c = std::max(max_c, t.vertices[v].c);
+    }
+    return (max_r >= r0) && (min_r < r1) && (max_c >= c0) && (min_c < c1);
+}
+
+void detection_server::detection_server::detect_motion(frame* f) {
+    int changed = this->motion.update(&f->bin[0], f->width, f->lines, f->width);
+    int tiles = this->motion.get_cols() * this->motion.get_rows();
+    this->motion_frames++;
+    this->motion_pixels += (uint64_t) f->width * f->lines;
+    // The whole image the first time, after a change of geometry and
+    // periodically, in case a change was missed
+    if ((changed == tiles) || (f->number % ROI_FULL_FRAME_PERIOD == 0)) {
+        this->detector.detect(&f->bin[0], f->width, f->lines, f->width, &f->triangles);
+        this->motion_triangles = f->triangles;
+        this->motion_pixels_processed += (uint64_t) f->width * f->lines;
+        return;
+    }
+    if (changed == 0) {
+        f->triangles = this->motion_triangles;
+        this->motion_idle_frames++;
+        return;
+    }
+    // A tile around the changed ones, so the pixels that changed are not on
+    // the border, and the triangles of the previous frame it overlaps, so
+    // they are not cut
+    int r0 = 0, r1 = f->lines, c0 = 0, c1 = f->width;
+    this->motion.changed_bounds(&r0, &r1, &c0, &c1);
+    r0 = std::max(r0 - MOTION_TILE_SIZE, 0);
+    c0 = std::max(c0 - MOTION_TILE_SIZE, 0);
+    r1 = std::min<int>(r1 + MOTION_TILE_SIZE, f->lines);
+    c1 = std::min<int>(c1 + MOTION_TILE_SIZE, f->width);
+    bool grown = true;
+    while (grown) {
+        grown = false;
+        for (size_t i = 0; i < this->motion_triangles.size(); i++) {
+            const Triangle& t = this->motion_triangles[i];
+            if (!triangle_overlaps(t, r0 - 1, r1 + 1, c0 - 1, c1 + 1)) {
+                continue;
+            }
+            for (int v = 0; v < 3; v++) {
+                int r = t.vertices[v].r, c = t.vertices[v].c;
+                int new_r0 = std::max(std::min(r0, r - 2), 0);
+                int new_c0 = std::max(std::min(c0, c - 2), 0);
+                int new_r1 = std::min<int>(std::max(r1, r + 3), f->lines);
+                int new_c1 = std::min<int>(std::max(c1, c + 3), f->width);
+                grown = grown || (new_r0 != r0) || (new_c0 != c0) || (new_r1 != r1) ||
+                        (new_c1 != c1);
+                r0 = new_r0;
+                c0 = new_c0;
+                r1 = new_r1;
+                c1 = new_c1;
+            }
+        }
+    }
+    this->detector.detect(&f->bin[(size_t) r0 * f->width + c0], c1 - c0, r1 - r0, f->width,
+                          &f->triangles);
+    this->motion_pixels_processed += (uint64_t) (r1 - r0) * (c1 - c0);
+    // Triangles on a border of the box inside the image are pieces of
+    // shapes that were not triangles
+    size_t kept = 0;
+    for (size_t i = 0; i < f->triangles.size(); i++) {
+        Triangle t = f->triangles[i];
+        bool cut = false;
+        for (int v = 0; v < 3; v++) {
+            t.vertices[v].r += r0;
+            t.vertices[v].c += c0;
+            cut = cut || ((r0 > 0) && (t.vertices[v].r < r0 + 1)) ||
+                  ((r1 < (int) f->lines) && (t.vertices[v].r > r1 - 2)) ||
+                  ((c0 > 0) && (t.vertices[v].c < c0 + 1)) ||
+                  ((c1 < (int) f->width) && (t.vertices[v].c > c1 - 2));
+        }
+        if (!cut) {
+            f->triangles[kept++] = t;
+        }
+    }
+    f->triangles.resize(kept);
+    // And those of the previous frame outside of it
+    for (size_t i = 0; i < this->motion_triangles.size(); i++) {
+        if (!triangle_overlaps(this->motion_triangles[i], r0, r1, c0, c1)) {
+            f->triangles.push_back(this->motion_triangles[i]);
+        }
+    }
+    this->motion_triangles = f->triangles;
+}
+
+std::string detection_server::detection_server::motion_summary() const {
+    char summary[160];
+    snprintf(summary, sizeof(summary),
+             "motion gating: %llu of %llu frames without motion, %.1f %% of the pixels "
+             "processed\n", (unsigned long long) this->motion_idle_frames,
+             (unsigned long long) this->motion_frames,
+             (this->motion_pixels > 0) ? 100.0 * this->motion_pixels_processed /
+                                         this->motion_pixels : 0.0);
+    return summary;
+}
+
+void detection_server::detection_server::detect_loop() {
+    frame* f;
+    while (this->detect_queue.wait_pop(&f, this->running)) {
+        if (this->conf.motion_gating) {
+            this->detect_motion(f);
+        } else {
+            uint32_t first, rows;
+            this->select_roi(f, &first, &rows);
+            this->detector.detect(&f->bin[(size_t) first * f->width], f->width, rows, f->width,
+                                  &f->triangles);
+            for (size_t i = 0; (first > 0) && (i < f->triangles.size()); i++) {
+                for (int v = 0; v < 3; v++) {
+                    f->triangles[i].vertices[v].r += first;
+                }
+            }
+        }
+        // Sub-pixel poses with the gray levels of the same frame
+        const uint8_t* gray = NULL;
+        int pixel_size = 1;
+        uint32_t lines = f->lines;
+        if (f->same_rgbgray) {
+            gray = &f->rgbgray[0];
+            pixel_size = frame_format_pixel_size(this->rgbgray_source->get_format());
+            lines = std::min<uint32_t>(lines, f->rgbgray_size / (f->width * pixel_size));
+        }
+        this->pose_estimator.estimate(f->triangles, gray, f->width, lines,
+                                      f->width * pixel_size, pixel_size, f->profile,
+                                      &f->poses);
+        // Results always in full resolution pixels
+        if (f->downsampling > 1) {
+            double scale = f->downsampling;
+            for (size_t i = 0; i < f->triangles.size(); i++) {
+                for (int v = 0; v < 3; v++) {
+                    f->triangles[i].vertices[v].r *= scale;
+                    f->triangles[i].vertices[v].c *= scale;
+                }
+                f->poses[i].row *= scale;
+                f->poses[i].col *= scale;
+                f->poses[i].area *= scale * scale;
+            }
+        }
+        // Only the points found are mapped, through the lookup grid
+        if (this->calibration.is_loaded()) {
+            this->calibration.map_poses(f->triangles, f->poses, &f->floor_poses);
+        }
+        // Rows of the band of the next frames
+        this->roi_valid = !f->triangles.empty();
+        for (size_t i = 0; i < f->triangles.size(); i++) {
+            for (int v = 0; v < 3; v++) {
+                float r = f->triangles[i].vertices[v].r;
+                this->roi_min_row = ((i == 0) && (v == 0)) ? r : std::min(this->roi_min_row, r);
+                this->roi_max_row = ((i == 0) && (v == 0)) ? r : std::max(this->roi_max_row, r);
+            }
+        }
+        latency_trace::record(TRACE_DETECT_COMPLETE, f->number);
+        if (!this->publish_queue.wait_push(f, this->running)) {
+            break;
+        }
+    }
+}
+
+void detection_server::detection_server::publish_loop() {
+    frame* f;
+    std::string message;
+    message.reserve(4096);
+    std::string shm_message;
+    shm_message.reserve(4096);
+    std::vector<Triangle> shm_triangles;
+    shm_triangles.reserve(SHM_CHANNEL_TRIANGLES);
+    std::string floor_message;
+    floor_message.reserve(4096);
+    // Latest results of each profile
+    std::vector<std::vector<Triangle> > profile_triangles(this->conf.profiles.size());
+    std::vector<bool> profile_detected(this->conf.profiles.size(), false);
+    int counter = 0;
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    while (this->publish_queue.wait_pop(&f, this->running)) {
+        if (this->conf.binary_triangles) {
+            // Frame by frame, labelled with its profile
+            TriangleMessageHeader header;
+            header.label = f->profile;
+            header.frame_counter = f->meta.frame_counter;
+            header.timestamp_ns = f->meta.timestamp_ns;
+            triangle_message_encode(header, f->triangles, &message);
+        } else if (f->profile >= 0) {
+            profile_triangles[f->profile] = f->triangles;
+            profile_detected[f->profile] = true;
+            profiles_json(this->conf.profiles, profile_triangles, profile_detected, &message);
+        } else {
+            triangles_json(f->triangles, &message);
+        }
+        this->triangle_publisher.send(message.data(), message.size());
+        latency_trace::record(TRACE_SEND, f->number);
+        this->pose_publisher.send(f->poses.data(), f->poses.size() * sizeof(TrianglePose));
+        if (this->calibration.is_loaded()) {
+            // With the frame counter and the capture time, to align the
+            // poses of several cameras
+            TriangleMessageHeader header;
+            header.label = f->profile;
+            header.frame_counter = f->meta.frame_counter;
+            header.timestamp_ns = f->meta.timestamp_ns;
+            floor_message_encode(header, f->floor_poses, &floor_message);
+            this->floor_pose_publisher.send(floor_message.data(), floor_message.size());
+        }
+        if (!this->conf.shm_channel.empty()) {
+            // Binary message followed by the poses, replaced as a whole
+            TriangleMessageHeader header;
+            header.label = f->profile;
+            header.frame_counter = f->meta.frame_counter;
+            header.timestamp_ns = f->meta.timestamp_ns;
+            // Frames with more triangles than fit are truncated: leaving the
+            // previous frame in the channel would give the readers stale poses
+            const std::vector<Triangle>* triangles = &f->triangles;
+            size_t count = f->triangles.size();
+            if (count > SHM_CHANNEL_TRIANGLES) {
+                count = SHM_CHANNEL_TRIANGLES;
+                shm_triangles.assign(f->triangles.begin(), f->triangles.begin() + count);
+                triangles = &shm_triangles;
+                if (this->shm_truncated_frames++ == 0) {
+                    fprintf(stderr, "ERROR: %zu triangles in frame %u, only %d written in the "
+                            "shared memory channel\n", f->triangles.size(),
+                            f->meta.frame_counter, SHM_CHANNEL_TRIANGLES);
+                }
+            }
+            triangle_message_encode(header, *triangles, &shm_message);
+            shm_message.append((const char*) f->poses.data(),
+                               std::min(count, f->poses.size()) * sizeof(TrianglePose));
+            if (this->shm_writer.write(shm_message.data(), shm_message.size()) != 0) {
+                fprintf(stderr, "ERROR: frame %u could not be written in the shared memory "
+                        "channel\n", f->meta.frame_counter);
+            }
+        }
+        // Publish binary image and gray image
+        this->bin_publisher.send(&f->bin[0], (size_t) f->width * f->lines);
+        if (f->has_rgbgray) {
+            this->rgbgray_publisher.send(&f->rgbgray[0], f->rgbgray_size);
+        }
+        // Adapt the work of the next frames to the latency of this one
+        if (this->governor.update(latency_trace::now_ns() - f->read_ns)) {
+            printf("governor %s\n", FrameGovernor::describe(this->governor.get_level()).c_str());
+        }
+        this->free_frames.push(f);
+
+        // Update frame rate and print
+        if (++counter == FPS_SAMPLER) {
+            std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+            printf("%.1f\n", FPS_SAMPLER / std::chrono::duration<double>(t2 - t1).count());
+            fflush(stdout);
+            t1 = t2;
+            counter = 0;
+        }
+    }
+}
+
+void detection_server::pin_thread(std::thread& thread, int core) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores <= 1) {
+        return;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(core % cores, &cpuset);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+}
+
+void detection_server::profiles_json(const std::vector<ThresholdProfile>& profiles,
+                                     const std::vector<std::vector<Triangle> >& triangles,
+                                     const std::vector<bool>& detected, std::string* json) {
+    json->assign("{");
+    for (size_t i = 0; i < profiles.size(); i++) {
+        if (!detected[i]) {
+            continue;
+        }
+        if (json->size() > 1) {
+            json->append(", ");
+        }
+        json->append("\"" + profiles[i].name + "\": ");
+        triangles_json_append(triangles[i], json);
+    }
+    json->append("}");
+}
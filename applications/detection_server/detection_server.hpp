@@ -0,0 +1,201 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "publisher.hpp"
+
+#include "hw_backend.hpp"
+#include "floor_calibration.hpp"
+#include "frame_source.hpp"
+#include "frame_governor.hpp"
+#include "latency_trace.hpp"
+#include "motion_mask.hpp"
+#include "shm_channel.hpp"
+#include "spsc_queue.hpp"
+#include "threshold_scheduler.hpp"
+#include "triangle_detector.hpp"
+#include "triangle_message.hpp"
+#include "triangle_pose.hpp"
+
+// Ports of triangle-detector-server.py
+#define TRIANGLES_PORT     32000
+#define BIN_FRAME_PORT     33000
+#define RGBGRAY_FRAME_PORT 34000
+// Poses of the UGVs (TrianglePose records)
+#define POSES_PORT         35000
+// Poses of the UGVs on the floor (FloorPose records), with a calibration
+#define FLOOR_POSES_PORT   37000
+// Triangles per frame that fit in the shared memory channel
+#define SHM_CHANNEL_TRIANGLES 256
+
+// Frames allocated for the whole pipeline
+#define FRAME_POOL_SIZE 4
+// Frames averaged for the frame rate printed
+#define FPS_SAMPLER 100
+// Cores of the Cyclone V HPS
+#define CAPTURE_CORE 0
+#define DETECT_CORE  1
+#define PUBLISH_CORE 0
+// With a reduced ROI, rows kept above and below the UGVs of the previous
+// frame (full resolution pixels) and frames between full frames, which
+// find the UGVs that entered the image
+#define ROI_MARGIN 32
+#define ROI_FULL_FRAME_PERIOD 16
+
+namespace detection_server {
+    struct config {
+        uint32_t width;
+        uint32_t height;
+        // Last lines of the image not processed nor sent
+        uint32_t lines_skip;
+        // Send the RGBG image instead of the gray one
+        bool send_rgb;
+        // Recordings processed instead of the camera (bin empty for camera)
+        std::string replay_bin;
+        std::string replay_rgbgray;
+        bool replay_max_speed;
+        // Binarization thresholds rotated between frames (one per colour)
+        // and frames kept with each one. Empty to keep the ones of the
+        // hardware.
+        std::vector<ThresholdProfile> profiles;
+        uint32_t profile_frames;
+        // Send the triangles as binary messages (triangle_message.hpp)
+        // instead of JSON
+        bool binary_triangles;
+        // POSIX shared memory channel with the latest triangles and poses
+        // for local clients (e.g. "/uvispace_triangles"). Empty for none.
+        std::string shm_channel;
+        // Latency budget from reading a frame to publishing its results
+        // (0: no governor) and largest hardware downsampling the governor
+        // can use
+        uint32_t latency_budget_us;
+        uint32_t max_downsampling;
+        // Detect only in the tiles of the binary image that changed since
+        // the previous frames, keeping the triangles found elsewhere.
+        // Changed tiles have more than motion_min_pixels pixels changed.
+        bool motion_gating;
+        uint32_t motion_min_pixels;
+        // Calibration of the camera and the floor (floor_calibration.hpp)
+        // to publish the poses on the floor. Empty for none.
+        std::string calibration;
+    };
+
+    // A frame and its results. Allocated once in the pool and passed
+    // between the stages as a pointer.
+    struct frame {
+        FrameMetadata meta;
+        // Order of capture. Identifies the frame in the traces (the frame
+        // counter of a looping replay repeats).
+        uint32_t number;
+        // When it was read, for the governor
+        uint64_t read_ns;
+        // Downsampling and geometry of the images (full resolution /
+        // downsampling)
+        uint32_t downsampling;
+        uint32_t width;
+        uint32_t lines;
+        std::vector<uint8_t> bin;
+        std::vector<uint8_t> rgbgray;
+        bool has_rgbgray;
+        size_t rgbgray_size;
+        // The gray or RGB image was captured with the binary one
+        bool same_rgbgray;
+        // Threshold profile of the binary image (THRESHOLD_PROFILE_NONE
+        // without profiles)
+        int profile;
+        std::vector<Triangle> triangles;
+        std::vector<TrianglePose> poses;
+        // Only with a calibration
+        std::vector<FloorPose> floor_poses;
+    };
+
+    // Pipeline of three stages running in their own threads, so the
+    // capture of a frame overlaps with the detection of the previous one
+    // and the publication of the one before:
+    //   capture -> detect_queue -> detect -> publish_queue -> publish
+    //      ^------------------- free_frames ------------------'
+    class detection_server {
+    public:
+        // Open the frame sources and bind the sockets. Throws detection_error.
+        detection_server(const config& conf);
+        ~detection_server();
+        // Run until stop() is called or a frame can not be read
+        void run();
+        void stop();
+        // Decisions of the governor. Consistent once run() returned.
+        const FrameGovernor& get_governor() const { return this->governor; }
+        // Frames without motion and part of the pixels processed with motion
+        // gating. Consistent once run() returned.
+        std::string motion_summary() const;
+        // Frames written truncated to SHM_CHANNEL_TRIANGLES in the shared
+        // memory channel. Consistent once run() returned.
+        uint64_t get_shm_truncated_frames() const { return this->shm_truncated_frames; }
+    private:
+        void capture_loop();
+        void detect_loop();
+        void publish_loop();
+        FrameSource* open_source(uint32_t format, const std::string& replay_path, bool max_speed);
+        void close_sources();
+        // Read the next binary frame usable for detection. Returns false
+        // on error.
+        bool read_binary(frame* f);
+        // Change the downsampling of the image writers (capture thread)
+        void set_downsampling(uint32_t downsampling);
+        // First row and rows of the binary image f to process
+        void select_roi(const frame* f, uint32_t* first, uint32_t* rows);
+        // Triangles of f, detected only around the tiles that changed
+        void detect_motion(frame* f);
+        config conf;
+        // Lines of each image processed
+        uint32_t height_send;
+        RegisterBackend* backend;
+        FrameSource* bin_source;
+        FrameSource* rgbgray_source;
+        // Only with profiles
+        ThresholdScheduler* scheduler;
+        std::vector<frame> pool;
+        SpscQueue<frame*> free_frames;
+        SpscQueue<frame*> detect_queue;
+        SpscQueue<frame*> publish_queue;
+        TriangleDetector detector;
+        TrianglePoseEstimator pose_estimator;
+        FrameGovernor governor;
+        FloorCalibration calibration;
+        // Downsampling of the image writers and first frame captured with
+        // it (CAPTURE_IMAGE_COUNTER). Only used by the capture thread.
+        uint32_t downsampling;
+        bool downsampling_guard;
+        uint32_t downsampling_first_frame;
+        // Rows with UGVs in the previous frame (full resolution). Only used
+        // by the detect thread.
+        bool roi_valid;
+        float roi_min_row, roi_max_row;
+        // Motion gating (detect thread): triangles of the previous frame,
+        // in its pixels, and the work saved
+        MotionMask motion;
+        std::vector<Triangle> motion_triangles;
+        uint64_t motion_frames;
+        uint64_t motion_idle_frames;
+        uint64_t motion_pixels;
+        uint64_t motion_pixels_processed;
+        void* zmq_context;
+        publisher triangle_publisher;
+        publisher bin_publisher;
+        publisher rgbgray_publisher;
+        publisher pose_publisher;
+        publisher floor_pose_publisher;
+        ShmChannelWriter shm_writer;
+        uint64_t shm_truncated_frames;
+        std::atomic<bool> running;
+        uint32_t frame_number;
+    };
+
+    // Pin a thread to a core (modulo the cores available)
+    void pin_thread(std::thread& thread, int core);
+    // Latest triangles of each profile as a JSON object keyed by the
+    // profile names. Profiles not detected yet are left out.
+    void profiles_json(const std::vector<ThresholdProfile>& profiles,
+                       const std::vector<std::vector<Triangle> >& triangles,
+                       const std::vector<bool>& detected, std::string* json);
+}
@@ -0,0 +1,119 @@
+#include "main.hpp"
+
+static detection_server::detection_server* server = NULL;
+
+static void handle_signal(int signal) {
+    if (server != NULL) {
+        server->stop();
+    }
+}
+
+void print_usage() {
+    std::cout << "For custom resolution call:\n";
+    std::cout << "  detection_server width height lines_skip image_type\n";
+    std::cout << "Example getting 1280x960 image from hardware and sending binary and gray skipping 24 lines:\n";
+    std::cout << "  detection_server 1280 960 24 GRAY\n";
+    std::cout << "Example getting 1280x960 image from hardware and sending binary and rgb skipping 24 lines:\n";
+    std::cout << "  detection_server 1280 960 24 RGB\n";
+    std::cout << "Call without arguments for default Uvispace: 640x480 skip last 12 lines sending gray image\n";
+}
+
+int main(int argc, char** argv) {
+    detection_server::config conf;
+    conf.width = IMG_WIDTH_DEFAULT;
+    conf.height = IMG_HEIGHT_DEFAULT;
+    conf.lines_skip = LINES_SKIP_DEFAULT;
+    conf.send_rgb = false;
+    conf.replay_max_speed = false;
+    conf.profile_frames = PROFILE_FRAMES_DEFAULT;
+    conf.binary_triangles = false;
+    conf.latency_budget_us = 0;
+    conf.max_downsampling = MAX_DOWNSAMPLING_DEFAULT;
+    conf.motion_gating = false;
+    conf.motion_min_pixels = MOTION_MIN_PIXELS;
+
+    // Process command line arguments
+    if (argc == 5) {
+        conf.width = atoi(argv[1]);
+        conf.height = atoi(argv[2]);
+        conf.lines_skip = atoi(argv[3]);
+        conf.send_rgb = (std::string(argv[4]) == "RGB");
+    } else if (argc != 1) {
+        print_usage();
+        return 1;
+    }
+    // Recordings made with frame_recorder, as in triangle-detector-server.py
+    const char* replay_bin = getenv("UVISPACE_REPLAY_BIN");
+    const char* replay_rgbgray = getenv("UVISPACE_REPLAY_GRAY");
+    const char* replay_max_speed = getenv("UVISPACE_REPLAY_MAX_SPEED");
+    if (replay_bin != NULL) {
+        conf.replay_bin = replay_bin;
+    }
+    if (replay_rgbgray != NULL) {
+        conf.replay_rgbgray = replay_rgbgray;
+    }
+    conf.replay_max_speed = (replay_max_speed != NULL) && (std::string(replay_max_speed) == "1");
+    const char* triangles_format = getenv("UVISPACE_TRIANGLES_FORMAT");
+    conf.binary_triangles = (triangles_format != NULL) &&
+                            (std::string(triangles_format) == "binary");
+    // Latest results in shared memory for local clients
+    const char* shm_channel = getenv("UVISPACE_SHM_CHANNEL");
+    if (shm_channel != NULL) {
+        conf.shm_channel = shm_channel;
+    }
+    // Work per frame adapted to keep the latency within a budget
+    const char* latency_budget = getenv("UVISPACE_LATENCY_BUDGET_US");
+    const char* max_downsampling = getenv("UVISPACE_MAX_DOWNSAMPLING");
+    if (latency_budget != NULL) {
+        conf.latency_budget_us = atoi(latency_budget);
+    }
+    if (max_downsampling != NULL) {
+        conf.max_downsampling = atoi(max_downsampling);
+    }
+    // Detection only where the binary image changed
+    const char* motion_gating = getenv("UVISPACE_MOTION_GATING");
+    const char* motion_min_pixels = getenv("UVISPACE_MOTION_MIN_PIXELS");
+    conf.motion_gating = (motion_gating != NULL) && (std::string(motion_gating) == "1");
+    if (motion_min_pixels != NULL) {
+        conf.motion_min_pixels = atoi(motion_min_pixels);
+    }
+    // Poses on the floor
+    const char* calibration = getenv("UVISPACE_CALIBRATION");
+    if (calibration != NULL) {
+        conf.calibration = calibration;
+    }
+    // Binarization thresholds rotated between frames to detect several colours
+    const char* profiles = getenv("UVISPACE_THRESHOLD_PROFILES");
+    const char* profile_frames = getenv("UVISPACE_PROFILE_FRAMES");
+    if ((profiles != NULL) && (load_threshold_profiles(profiles, &conf.profiles) != 0)) {
+        return 1;
+    }
+    if (profile_frames != NULL) {
+        conf.profile_frames = atoi(profile_frames);
+    }
+
+    // Run server until interrupted
+    try {
+        detection_server::detection_server ds(conf);
+        server = &ds;
+        signal(SIGINT, handle_signal);
+        signal(SIGTERM, handle_signal);
+        ds.run();
+        server = NULL;
+        if (ds.get_governor().is_enabled()) {
+            std::cout << ds.get_governor().summary();
+        }
+        if (conf.motion_gating) {
+            std::cout << ds.motion_summary();
+        }
+        if (ds.get_shm_truncated_frames() > 0) {
+            std::cout << "Frames truncated to " << SHM_CHANNEL_TRIANGLES
+                      << " triangles in shared memory: " << ds.get_shm_truncated_frames() << "\n";
+        }
+    } catch (const detection_server::detection_error& e) {
+        std::cerr << "ERROR: " << e.what() << "\n";
+        return 1;
+    }
+    std::cout << latency_trace::summary();
+    return 0;
+}
@@ -0,0 +1,15 @@
+#include <signal.h>
+#include <stdlib.h>
+
+#include <iostream>
+
+#include "detection_server.hpp"
+
+// Default configuration of triangle-detector-server.py
+#define IMG_WIDTH_DEFAULT 640
+#define IMG_HEIGHT_DEFAULT 480
+#define LINES_SKIP_DEFAULT 12 // lines not sent via internet
+// Frames kept with each threshold profile
+#define PROFILE_FRAMES_DEFAULT 1
+// Largest downsampling used by the governor (with a latency budget)
+#define MAX_DOWNSAMPLING_DEFAULT 2
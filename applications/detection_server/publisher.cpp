@@ -0,0 +1,38 @@
+#include "publisher.hpp"
+
+detection_server::publisher::publisher() : socket(NULL) {
+}
+
+detection_server::publisher::~publisher() {
+    this->close();
+}
+
+void detection_server::publisher::bind(void* context, int port) {
+    this->close();
+    this->socket = zmq_socket(context, ZMQ_PUB);
+    if (this->socket == NULL) {
+        throw detection_error("ZMQ socket could not be created");
+    }
+    // Only the last message is kept so a slow client does not accumulate
+    // delay in the stream
+    int hwm = 1;
+    zmq_setsockopt(this->socket, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+    int linger = 0;
+    zmq_setsockopt(this->socket, ZMQ_LINGER, &linger, sizeof(linger));
+    std::string endpoint = "tcp://*:" + std::to_string(port);
+    if (zmq_bind(this->socket, endpoint.c_str()) != 0) {
+        this->close();
+        throw detection_error("ZMQ socket could not be bound to " + endpoint);
+    }
+}
+
+bool detection_server::publisher::send(const void* data, size_t len) {
+    return zmq_send(this->socket, data, len, 0) == (int) len;
+}
+
+void detection_server::publisher::close() {
+    if (this->socket != NULL) {
+        zmq_close(this->socket);
+        this->socket = NULL;
+    }
+}
@@ -0,0 +1,26 @@
+#include <string>
+#include <stdexcept>
+
+#include <zmq.h>
+
+namespace detection_server {
+    class detection_error : public std::runtime_error {
+    public:
+        detection_error(const std::string what) : std::runtime_error(what) {}
+    };
+
+    // ZMQ PUB socket keeping only the last message for slow subscribers
+    // (as the sockets of triangle-detector-server.py)
+    class publisher {
+    public:
+        publisher();
+        ~publisher();
+        // Bind to tcp://*:port. Throws detection_error.
+        void bind(void* context, int port);
+        // Send a message. Returns false if it could not be queued.
+        bool send(const void* data, size_t len);
+        void close();
+    private:
+        void* socket;
+    };
+}
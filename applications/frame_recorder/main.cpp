@@ -0,0 +1,95 @@
+#include "main.hpp"
+
+void print_usage(void) {
+    printf("Usage:\n");
+    printf("frame_recorder --binary|--greyscale|--rgbg <file> [frames] [slots]\n");
+    printf("Records 'frames' frames in a ring file of 'slots' frames (default %d and %d)\n",
+           FRAMES_DEFAULT, SLOTS_DEFAULT);
+}
+
+int main(int argc, char **argv) {
+    uint32_t format;
+    const char *device;
+    int frames = FRAMES_DEFAULT;
+    int slots = SLOTS_DEFAULT;
+
+    // Process command line arguments
+    if ((argc < 3) || (argc > 5)) {
+        print_usage();
+        return(1);
+    }
+    if (strcmp(argv[1], "--rgbg") == 0) {
+        format = FRAME_FORMAT_RGBG;
+        device = DEV_PATH_RGBG;
+    } else if (strcmp(argv[1], "--greyscale") == 0) {
+        format = FRAME_FORMAT_GRAY;
+        device = DEV_PATH_GRAY;
+    } else if (strcmp(argv[1], "--binary") == 0) {
+        format = FRAME_FORMAT_BIN;
+        device = DEV_PATH_BIN;
+    } else {
+        print_usage();
+        return(1);
+    }
+    if (argc >= 4) {
+        frames = atoi(argv[3]);
+    }
+    if (argc == 5) {
+        slots = atoi(argv[4]);
+    }
+
+    // Frames come from the camera driver if it is loaded. Otherwise the
+    // image writer is driven from userspace (simulated without hardware).
+    FrameSource *source;
+    RegisterBackend *backend = NULL;
+    if (access(device, F_OK) == 0) {
+        DeviceFrameSource *device_source = new DeviceFrameSource(format, IMAGE_WIDTH, IMAGE_HEIGHT);
+        source = device_source;
+        if (device_source->open(device) != 0) {
+            printf("ERROR: could not open \"%s\"...\n", device);
+            delete source;
+            return(1);
+        }
+    } else {
+        backend = open_register_backend("auto");
+        if (backend == NULL) {
+            return(1);
+        }
+        ImageWriterFrameSource *writer_source = new ImageWriterFrameSource(format, IMAGE_WIDTH, IMAGE_HEIGHT);
+        source = writer_source;
+        if (writer_source->open(backend) != 0) {
+            printf("ERROR: could not start the image writer...\n");
+            delete source;
+            close_register_backend(backend);
+            return(1);
+        }
+    }
+
+    FrameRecorder recorder;
+    if (recorder.open(argv[2], source->get_frame_size(), slots) != 0) {
+        delete source;
+        if (backend != NULL) close_register_backend(backend);
+        return(1);
+    }
+
+    // Record
+    std::vector<uint8_t> frame(source->get_frame_size());
+    FrameMetadata meta;
+    int error = 0;
+    for (int i = 0; i < frames; i++) {
+        if (source->read_frame(&frame[0], frame.size(), &meta) < 0) {
+            printf("ERROR: could not read frame %d...\n", i);
+            error = 1;
+            break;
+        }
+        recorder.append(&frame[0], &meta);
+    }
+    printf("frames recorded: %u\n", (unsigned int) recorder.get_frames_written());
+
+    recorder.close();
+    delete source;
+    if (backend != NULL) {
+        close_register_backend(backend);
+    }
+    return(error);
+}
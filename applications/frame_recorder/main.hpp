@@ -0,0 +1,19 @@
+// Standard libraries
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h> // atoi()
+#include <string.h> // strcmp()
+#include <unistd.h> // access()
+
+#include <vector>
+
+#include "hw_backend.hpp"
+#include "frame_source.hpp"
+#include "frame_recorder.hpp"
+
+// Default number of frames recorded and slots in the ring file
+#define FRAMES_DEFAULT 300
+#define SLOTS_DEFAULT 300
+// Image dimensions
+#define IMAGE_WIDTH 640
+#define IMAGE_HEIGHT 480
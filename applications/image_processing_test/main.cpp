@@ -10,38 +10,34 @@ void print_img_proc_config(ImageProcessing* img_proc) {
 }
 
 int main(int argc, char **argv) {
-    void *virtual_base;
-    int fd;
+    RegisterBackend *backend;
     void *img_proc_virtual_address;
 
-    // Open the device file for accessing the physical memory
-    if ((fd = open("/dev/mem", (O_RDWR | O_SYNC))) == -1) {
-        printf("ERROR: could not open \"/dev/mem\"...\n");
+    // Open the FPGA address map (real hardware unless UVISPACE_BACKEND
+    // selects a simulated one)
+    backend = open_register_backend();
+    if (backend == NULL) {
         return(1);
     }
-    // Map the physical memory to the virtual address space. The base address
-    // for the FPGA address map is stored in 'virtual_base'.
-    virtual_base = mmap(NULL, HW_REGS_SPAN, (PROT_READ | PROT_WRITE),
-                        MAP_SHARED, fd, HW_REGS_BASE);
-    if( virtual_base == MAP_FAILED ) {
-        printf( "ERROR: mmap() failed...\n" );
-        close( fd );
-        return( 1 );
-    }
-    // Virtual address of the camera registers.
-    img_proc_virtual_address = (void*) ((uint8_t*)virtual_base + ((unsigned long) (AVALON_IMAGE_PROCESSING_0_BASE) & (unsigned long) (HW_REGS_MASK)));
+    // Virtual address of the image processing registers.
+    img_proc_virtual_address = backend->component_address(AVALON_IMAGE_PROCESSING_0_BASE);
 
     //Initialize camera
     ImageProcessing img_proc(img_proc_virtual_address);
 
     //Write the col_size value written by the user in the avalon_camera registers
     if ( argc == 7) {
-        img_proc.set_hue_th_L(atoi(argv[1]));
-        img_proc.set_hue_th_H(atoi(argv[2]));
-        img_proc.set_brightness_th_L(atoi(argv[3]));
-        img_proc.set_brightness_th_H(atoi(argv[4]));
-        img_proc.set_saturation_th_L(atoi(argv[5]));
-        img_proc.set_saturation_th_H(atoi(argv[6]));
+        // Values out of the range of a register are not written
+        int error = 0;
+        error |= img_proc.set_hue_th_L(atoi(argv[1]));
+        error |= img_proc.set_hue_th_H(atoi(argv[2]));
+        error |= img_proc.set_brightness_th_L(atoi(argv[3]));
+        error |= img_proc.set_brightness_th_H(atoi(argv[4]));
+        error |= img_proc.set_saturation_th_L(atoi(argv[5]));
+        error |= img_proc.set_saturation_th_H(atoi(argv[6]));
+        if (error != 0) {
+            printf("ERROR: some values are out of range, they were not written\n");
+        }
         print_img_proc_config(&img_proc);
     }
     else if (argc == 2) {
@@ -61,11 +57,8 @@ int main(int argc, char **argv) {
     }
 
     // clean up the memory mapping and exit
-    if (munmap( virtual_base, HW_REGS_SPAN ) != 0) {
-        printf("ERROR: munmap() failed...\n");
-        close(fd);
+    if (close_register_backend(backend) != 0) {
         return(1);
     }
-    close(fd);
     return(0);
 }
@@ -0,0 +1,91 @@
+#include "main.hpp"
+
+void print_usage(void) {
+    printf("Usage:\n");
+    printf("image_writer_test --binary [frames]\n");
+    printf("image_writer_test --greyscale [frames]\n");
+    printf("image_writer_test --rgbg [frames]\n");
+}
+
+int main(int argc, char **argv) {
+    RegisterBackend *backend;
+    unsigned long image_writer_base;
+    unsigned int pixel_size;
+    int frames = FRAMES_DEFAULT;
+
+    // Process command line arguments
+    if ((argc != 2) && (argc != 3)) {
+        print_usage();
+        return(1);
+    }
+    if (strcmp(argv[1], "--rgbg") == 0) {
+        image_writer_base = AVALON_IMG_WRITER_RGBGRAY_BASE;
+        pixel_size = 4;
+    } else if (strcmp(argv[1], "--greyscale") == 0) {
+        image_writer_base = AVALON_IMG_WRITER_GRAY_BASE;
+        pixel_size = 1;
+    } else if (strcmp(argv[1], "--binary") == 0) {
+        image_writer_base = AVALON_IMG_WRITER_BINARY_BASE;
+        pixel_size = 1;
+    } else {
+        print_usage();
+        return(1);
+    }
+    if (argc == 3) {
+        frames = atoi(argv[2]);
+    }
+
+    // Open the FPGA address map. Without hardware use the simulation.
+    backend = open_register_backend("auto");
+    if (backend == NULL) {
+        return(1);
+    }
+
+    // Initialize image writer and its buffers
+    ImageWriter *writer = new ImageWriter(backend->component_address(image_writer_base));
+    if (writer->alloc_buffers(backend, IMAGE_WIDTH * IMAGE_HEIGHT * pixel_size) != 0) {
+        printf("ERROR: could not allocate the capture buffers...\n");
+        delete writer;
+        close_register_backend(backend);
+        return(1);
+    }
+    if (writer->start_capture() != 0) {
+        printf("ERROR: image writer does not reply...\n");
+        delete writer;
+        close_register_backend(backend);
+        return(1);
+    }
+
+    // Acquire frames polling the image counter
+    uint32_t image_number, first_image_number = 0, last_image_number = 0;
+    unsigned int lost = 0;
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+        const uint8_t *frame = writer->get_frame(&image_number);
+        if (frame == NULL) {
+            printf("ERROR: timeout waiting for frame %d...\n", i);
+            break;
+        }
+        if (i == 0) {
+            first_image_number = image_number;
+            t1 = std::chrono::steady_clock::now();
+        } else {
+            lost += image_number - last_image_number - 1;
+        }
+        last_image_number = image_number;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t1;
+
+    unsigned int acquired = last_image_number - first_image_number + 1 - lost;
+    printf("frames acquired: %u\n", acquired);
+    printf("frames lost: %u\n", lost);
+    if (elapsed.count() > 0) {
+        printf("frame rate: %.2f fps\n", (acquired - 1) / elapsed.count());
+    }
+
+    delete writer;
+    if (close_register_backend(backend) != 0) {
+        return(1);
+    }
+    return(0);
+}
@@ -0,0 +1,17 @@
+// Standard libraries
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h> // atoi()
+#include <string.h> // strcmp()
+
+#include <chrono>
+
+#include "hps_0.h"
+#include "hw_backend.hpp"
+#include "avalon_image_writer.hpp"
+
+// Default number of frames acquired
+#define FRAMES_DEFAULT 300
+// Image dimensions
+#define IMAGE_WIDTH 640
+#define IMAGE_HEIGHT 480
@@ -0,0 +1,48 @@
+#cython: boundscheck=False
+#cython: nonecheck=False
+#cython: wraparound=False
+import numpy as np
+
+from libc.stdint cimport uint8_t, uint32_t
+from libcpp.vector cimport vector
+
+
+cdef extern from "contour_finder.hpp":
+    cdef cppclass ContourSet:
+        vector[double] rows, cols
+        vector[uint32_t] starts
+        size_t size()
+
+    cdef cppclass ContourFinder:
+        int find(const uint8_t* image, int width, int height, int stride,
+                 double level, ContourSet* contours)
+
+
+# Working memory reused between calls
+cdef ContourFinder _finder
+cdef ContourSet _contours
+
+
+def find_contours(image, double level):
+    """Contours of 'level' in an 8-bit image found by the native marching
+    squares and grid-indexed assembly (inc/contour_finder.hpp). Same result
+    as _find_contours.find_contours with the default parameters.
+
+    """
+    image = np.ascontiguousarray(image, dtype=np.uint8)
+    if image.ndim != 2 or image.shape[0] < 2 or image.shape[1] < 2:
+        raise ValueError("Input array must be at least 2x2.")
+    # Address of the data: frames replayed from recordings are read-only
+    # and can not be taken as a memoryview
+    cdef size_t address = image.ctypes.data
+    _finder.find(<const uint8_t*> address, image.shape[1], image.shape[0],
+                 image.shape[1], level, &_contours)
+    cdef size_t n = _contours.rows.size()
+    cdef size_t i
+    points = np.empty((n, 2), dtype=np.double)
+    cdef double[:, ::1] view = points
+    for i in range(n):
+        view[i, 0] = _contours.rows[i]
+        view[i, 1] = _contours.cols[i]
+    starts = _contours.starts
+    return [points[starts[i]:starts[i + 1]] for i in range(_contours.size())]
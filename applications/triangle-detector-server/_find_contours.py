@@ -2,6 +2,7 @@ from collections import deque
 
 import numpy
 
+import _contours_cy
 import _find_contours_cy
 
 
@@ -10,7 +11,7 @@ _param_options = ('high', 'low')
 
 def find_contours(array, level,
                   fully_connected='low', positive_orientation='low'):
-    array = numpy.asarray(array, dtype=numpy.double)
+    array = numpy.asarray(array)
     if array.ndim != 2:
         raise ValueError('Only 2D arrays are supported.')
     level = float(level)
@@ -19,9 +20,14 @@ def find_contours(array, level,
         raise ValueError('Parameters "fully_connected" and '
                          '"positive_orientation" must be either '
                          '"high" or "low".')
-    point_list = _find_contours_cy.iterate_and_store(
-            array, level, fully_connected == 'high')
-    contours = _assemble_contours(_take_2(point_list))
+    if array.dtype == numpy.uint8 and fully_connected == 'low':
+        # 8-bit images (the binary frames) are processed natively
+        contours = _contours_cy.find_contours(array, level)
+    else:
+        array = numpy.asarray(array, dtype=numpy.double)
+        point_list = _find_contours_cy.iterate_and_store(
+                array, level, fully_connected == 'high')
+        contours = _assemble_contours(_take_2(point_list))
     if positive_orientation == 'high':
         contours = [c[::-1] for c in contours]
     return contours
@@ -0,0 +1,68 @@
+import mmap
+import struct
+import time
+
+import numpy
+
+# Reader of the ring files written by the frame_recorder application
+# (see inc/frame_recorder.hpp for the format).
+
+_MAGIC = b'UVIREC01'
+_HEADER = struct.Struct('<8sIIQQQQ')
+_METADATA = struct.Struct('<QQIIIII')
+_METADATA_SIZE = 64
+
+FORMAT_RGBG = 0
+FORMAT_GRAY = 1
+FORMAT_BIN = 2
+
+
+class FrameReplay(object):
+    """Replay the frames of a recording from the oldest to the newest.
+
+    Frames are returned as numpy arrays of shape (height, width): uint32
+    for RGBG recordings and uint8 for gray and binary ones. The replay
+    starts again after the newest frame. With max_speed=False frames are
+    returned with the same timing as when they were recorded.
+    """
+
+    def __init__(self, path, max_speed=False):
+        self._file = open(path, 'rb')
+        self._map = mmap.mmap(self._file.fileno(), 0, access=mmap.ACCESS_READ)
+        (magic, version, self.slot_count, self.slot_size, self._metadata_offset,
+         self._data_offset, frames_written) = _HEADER.unpack_from(self._map, 0)
+        if magic != _MAGIC or version != 1 or frames_written == 0:
+            raise ValueError('%s is not a frame recording' % path)
+        self._last = frames_written
+        self._first = max(1, frames_written - self.slot_count + 1)
+        self._next = self._first
+        self._max_speed = max_speed
+        self._start = None
+
+    def read_frame(self):
+        """Return (frame, frame_counter, timestamp_ns) of the next frame."""
+        if self._next > self._last:
+            self._next = self._first
+            self._start = None
+        slot = (self._next - 1) % self.slot_count
+        self._next += 1
+        (_, timestamp, counter, fmt, width, height, size) = _METADATA.unpack_from(
+            self._map, self._metadata_offset + slot * _METADATA_SIZE)
+
+        if not self._max_speed:
+            now = time.time()
+            if self._start is None:
+                self._start = (now, timestamp)
+            else:
+                due = self._start[0] + (timestamp - self._start[1]) / 1e9
+                if due > now:
+                    time.sleep(due - now)
+
+        dtype = numpy.uint32 if fmt == FORMAT_RGBG else numpy.uint8
+        frame = numpy.frombuffer(self._map, dtype, width * height,
+                                 self._data_offset + slot * self.slot_size)
+        return frame.reshape((height, width)), counter, timestamp
+
+    def close(self):
+        self._map.close()
+        self._file.close()
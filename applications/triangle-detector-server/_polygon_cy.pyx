@@ -0,0 +1,34 @@
+#cython: boundscheck=False
+#cython: nonecheck=False
+#cython: wraparound=False
+import numpy as np
+
+from libc.stdint cimport uint32_t
+from libcpp.vector cimport vector
+
+
+cdef extern from "polygon_approx.hpp":
+    cdef cppclass PolygonApprox:
+        int approximate(const double* rows, const double* cols, size_t n,
+                        double tolerance, size_t max_vertices,
+                        vector[uint32_t]* vertices)
+
+
+# Working memory reused between calls
+cdef PolygonApprox _approx
+cdef vector[uint32_t] _vertices
+
+
+def approximate_polygon(coords, double tolerance, size_t max_vertices):
+    """Indexes of the vertices kept by the native Douglas-Peucker
+    approximation (inc/polygon_approx.hpp) of the (N, 2) coords array.
+
+    """
+    cdef double[::1] rows = np.ascontiguousarray(coords[:, 0], dtype=np.double)
+    cdef double[::1] cols = np.ascontiguousarray(coords[:, 1], dtype=np.double)
+    cdef size_t n = rows.shape[0]
+    if n == 0:
+        return np.zeros(0, dtype=np.intp)
+    _approx.approximate(&rows[0], &cols[0], n, tolerance, max_vertices,
+                        &_vertices)
+    return np.asarray(_vertices, dtype=np.intp)
@@ -1,7 +1,17 @@
 from distutils.core import setup
+from distutils.extension import Extension
 
 from Cython.Build import cythonize
 
+extensions = [
+    Extension("_find_contours_cy", ["_find_contours_cy.pyx"]),
+    # Native algorithms shared with the C++ applications
+    Extension("_contours_cy", ["_contours_cy.pyx"],
+              include_dirs=["../../inc"], language="c++"),
+    Extension("_polygon_cy", ["_polygon_cy.pyx"],
+              include_dirs=["../../inc"], language="c++"),
+]
+
 setup(
-    ext_modules=cythonize("_find_contours_cy.pyx")
+    ext_modules=cythonize(extensions)
 )
@@ -1,10 +1,12 @@
 import datetime
+import os
 
 import numpy
 import zmq
 import sys
 
 import _find_contours
+import _frame_replay
 import _polygon
 # This server posts in 3 different zmq sockets:
 # the gray or rgb image is posted in port 34000
@@ -13,6 +15,9 @@ import _polygon
 # When calling with no arguments gray image is sent by default.
 # Use the custom resolution call adding RGB at the end to send the
 # RGB image instead of the GRAY
+# To process recordings made with frame_recorder instead of the camera set
+# UVISPACE_REPLAY_BIN (and optionally UVISPACE_REPLAY_GRAY) to the recording
+# files. Set UVISPACE_REPLAY_MAX_SPEED=1 to replay as fast as possible.
 
 IMG_WIDTH_DEFAULT = 640;
 IMG_HEIGHT_DEFAULT = 480;
@@ -46,13 +51,18 @@ def main():
         print 'Call without arguments for default Uvispace: 640x480 skip last 12 lines sending gray image'
         return
 
+    replay_bin = os.environ.get('UVISPACE_REPLAY_BIN')
+    replay_rgbgray = os.environ.get('UVISPACE_REPLAY_GRAY')
+    replay_max_speed = os.environ.get('UVISPACE_REPLAY_MAX_SPEED') == '1'
+
     #set the resolution in the driver
-    f_width  =  open("/sys/uvispace_camera/attributes/image_width", "w");
-    file.write(f_width, str(IMG_WIDTH));
-    file.close(f_width);
-    f_height  =  open("/sys/uvispace_camera/attributes/image_height", "w");
-    file.write(f_height, str(IMG_HEIGHT));
-    file.close(f_height);
+    if replay_bin is None:
+        f_width  =  open("/sys/uvispace_camera/attributes/image_width", "w");
+        file.write(f_width, str(IMG_WIDTH));
+        file.close(f_width);
+        f_height  =  open("/sys/uvispace_camera/attributes/image_height", "w");
+        file.write(f_height, str(IMG_HEIGHT));
+        file.close(f_height);
 
     # Bind publisher socket
     bin_frame_publisher = zmq.Context.instance().socket(zmq.PUB)
@@ -67,11 +77,18 @@ def main():
     bin_frame_publisher.bind("tcp://*:33000")
     rgbgray_frame_publisher.bind("tcp://*:34000")
     triangle_publisher.bind("tcp://*:32000")
-    f_bin  =  open("/dev/uvispace_camera_bin",  "rb");
-    if IMAGE_SEND == "GRAY":
-        f_rgbgray =  open("/dev/uvispace_camera_gray", "rb");
+    if replay_bin is None:
+        f_bin  =  open("/dev/uvispace_camera_bin",  "rb");
+        if IMAGE_SEND == "GRAY":
+            f_rgbgray =  open("/dev/uvispace_camera_gray", "rb");
+        else:
+            f_rgbgray =  open("/dev/uvispace_camera_rgbg", "rb");
     else:
-        f_rgbgray =  open("/dev/uvispace_camera_rgbg", "rb");
+        f_bin = _frame_replay.FrameReplay(replay_bin, replay_max_speed)
+        f_rgbgray = None
+        if replay_rgbgray is not None:
+            # Timing is given by the binary recording
+            f_rgbgray = _frame_replay.FrameReplay(replay_rgbgray, True)
 
     # Start loop
     IMG_HEIGHT_SEND = IMG_HEIGHT-LINES_SKIP;
@@ -81,16 +98,24 @@ def main():
     t1 = datetime.datetime.now()
     while True:
         #extract triangles from bin image and publish them
-        bin_frame = numpy.fromfile(f_bin, numpy.uint8, IMG_HEIGHT_SEND * IMG_WIDTH).reshape((IMG_HEIGHT_SEND, IMG_WIDTH))
+        if replay_bin is None:
+            bin_frame = numpy.fromfile(f_bin, numpy.uint8, IMG_HEIGHT_SEND * IMG_WIDTH).reshape((IMG_HEIGHT_SEND, IMG_WIDTH))
+        else:
+            bin_frame = f_bin.read_frame()[0][:IMG_HEIGHT_SEND]
         triangles = process_frame(bin_frame)
         triangle_publisher.send_json(triangles)
         #publish binary image and gray image
         bin_frame_publisher.send(bin_frame)
-        if IMAGE_SEND == "GRAY":
+        if replay_bin is not None:
+            if f_rgbgray is not None:
+                rgbgray_frame = f_rgbgray.read_frame()[0][:IMG_HEIGHT_SEND]
+                rgbgray_frame_publisher.send(numpy.ascontiguousarray(rgbgray_frame))
+        elif IMAGE_SEND == "GRAY":
             rgbgray_frame = numpy.fromfile(f_rgbgray, numpy.uint8, IMG_HEIGHT_SEND * IMG_WIDTH).reshape((IMG_HEIGHT_SEND, IMG_WIDTH))
+            rgbgray_frame_publisher.send(rgbgray_frame)
         else:#RGB
             rgbgray_frame = numpy.fromfile(f_rgbgray, numpy.uint32, IMG_HEIGHT_SEND * IMG_WIDTH).reshape((IMG_HEIGHT_SEND, IMG_WIDTH))
-        rgbgray_frame_publisher.send(rgbgray_frame)
+            rgbgray_frame_publisher.send(rgbgray_frame)
         #update frame rate and print
         t2 = datetime.datetime.now()
         loop_time = (t2 - t1).microseconds
@@ -114,7 +139,7 @@ def get_shapes(image):
     triangles = []
     contours = _find_contours.find_contours(image, 0.9)
     for contour in contours:
-        coords = _polygon.approximate_polygon(contour, 8)
+        coords = _polygon.approximate_polygon(contour, 8, 4)
         vertices = len(coords)
         if vertices == 3 and not numpy.array_equal(coords[0], coords[-1]):
             triangle = coords[:].tolist()
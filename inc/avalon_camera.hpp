@@ -7,10 +7,8 @@
 #include <inttypes.h> // for uint16_t
 #include <string.h> // for memcpy
 
-// Macros for accessing an address map
-#include "hw_io.hpp"
-// Internal address map of avalon camera (32-bit addresses)
-#include "avalon_camera_regs.h"
+// Register descriptors of avalon camera (32-bit addresses)
+#include "avalon_register_map.hpp"
 
 /*
   Default values of some config registers
@@ -45,47 +43,53 @@ class Camera {
     // constructor
     Camera(void* virtual_address);
 
+    // Generic accessors of the registers of camera_regs. set returns
+    // ERROR_REGISTER_RANGE without writing if the value is out of range.
+    template <typename Reg> int set(uint32_t val) { return Reg::write_checked(this->address, val); }
+    template <typename Reg> uint32_t get(void) { return Reg::read(this->address); }
+
     // methods to set the camera configuration
     // the following methods change the values of the avalon_camera
     // registers without resetting the camera. So after using this
     // functions call config_update to reset the camera with the
     // new parameters and actually change the camera behaviour.
-    int config_set_width(uint16_t val);
-    int config_set_height(uint16_t val);
-    int config_set_start_row(uint16_t val);
-    int config_set_start_column(uint16_t val);
-    int config_set_row_size(uint16_t val);
-    int config_set_column_size(uint16_t val);
-    int config_set_row_mode(uint16_t val);
-    int config_set_column_mode(uint16_t val);
-    int config_set_exposure(uint16_t val);
-    int config_set_h_blanking(uint16_t val);
-    int config_set_v_blanking(uint16_t val);
-    int config_set_red_gain(uint16_t val);
-    int config_set_blue_gain(uint16_t val);
-    int config_set_green1_gain(uint16_t val);
-    int config_set_green2_gain(uint16_t val);
+    // They return 0 or ERROR_REGISTER_RANGE.
+    int config_set_width(uint32_t val) { return this->set<camera_regs::width>(val); }
+    int config_set_height(uint32_t val) { return this->set<camera_regs::height>(val); }
+    int config_set_start_row(uint32_t val) { return this->set<camera_regs::start_row>(val); }
+    int config_set_start_column(uint32_t val) { return this->set<camera_regs::start_column>(val); }
+    int config_set_row_size(uint32_t val) { return this->set<camera_regs::row_size>(val); }
+    int config_set_column_size(uint32_t val) { return this->set<camera_regs::column_size>(val); }
+    int config_set_row_mode(uint32_t val) { return this->set<camera_regs::row_mode>(val); }
+    int config_set_column_mode(uint32_t val) { return this->set<camera_regs::column_mode>(val); }
+    int config_set_exposure(uint32_t val) { return this->set<camera_regs::exposure>(val); }
+    int config_set_h_blanking(uint32_t val) { return this->set<camera_regs::h_blanking>(val); }
+    int config_set_v_blanking(uint32_t val) { return this->set<camera_regs::v_blanking>(val); }
+    int config_set_red_gain(uint32_t val) { return this->set<camera_regs::red_gain>(val); }
+    int config_set_blue_gain(uint32_t val) { return this->set<camera_regs::blue_gain>(val); }
+    int config_set_green1_gain(uint32_t val) { return this->set<camera_regs::green1_gain>(val); }
+    int config_set_green2_gain(uint32_t val) { return this->set<camera_regs::green2_gain>(val); }
     int config_set_default(void);
     // config_update loads new configuration into the camera and resets
     // the video stream.
     int config_update(void);
 
     // methods to get the camera configuration
-    uint16_t config_get_width(void);
-    uint16_t config_get_height(void);
-    uint16_t config_get_start_row(void);
-    uint16_t config_get_start_column(void);
-    uint16_t config_get_row_size(void);
-    uint16_t config_get_column_size(void);
-    uint16_t config_get_row_mode(void);
-    uint16_t config_get_column_mode(void);
-    uint16_t config_get_exposure(void);
-    uint16_t config_get_h_blanking(void);
-    uint16_t config_get_v_blanking(void);
-    uint16_t config_get_red_gain(void);
-    uint16_t config_get_blue_gain(void);
-    uint16_t config_get_green1_gain(void);
-    uint16_t config_get_green2_gain(void);
+    uint16_t config_get_width(void) { return this->get<camera_regs::width>(); }
+    uint16_t config_get_height(void) { return this->get<camera_regs::height>(); }
+    uint16_t config_get_start_row(void) { return this->get<camera_regs::start_row>(); }
+    uint16_t config_get_start_column(void) { return this->get<camera_regs::start_column>(); }
+    uint16_t config_get_row_size(void) { return this->get<camera_regs::row_size>(); }
+    uint16_t config_get_column_size(void) { return this->get<camera_regs::column_size>(); }
+    uint16_t config_get_row_mode(void) { return this->get<camera_regs::row_mode>(); }
+    uint16_t config_get_column_mode(void) { return this->get<camera_regs::column_mode>(); }
+    uint16_t config_get_exposure(void) { return this->get<camera_regs::exposure>(); }
+    uint16_t config_get_h_blanking(void) { return this->get<camera_regs::h_blanking>(); }
+    uint16_t config_get_v_blanking(void) { return this->get<camera_regs::v_blanking>(); }
+    uint16_t config_get_red_gain(void) { return this->get<camera_regs::red_gain>(); }
+    uint16_t config_get_blue_gain(void) { return this->get<camera_regs::blue_gain>(); }
+    uint16_t config_get_green1_gain(void) { return this->get<camera_regs::green1_gain>(); }
+    uint16_t config_get_green2_gain(void) { return this->get<camera_regs::green2_gain>(); }
 
   private: // not accesible from ouside the class
     // resets and removes soft reset to reset the video stream
@@ -96,150 +100,45 @@ class Camera {
 // --Class Methods implementation --//
 
 // class constructor (called when object is created)
-Camera::Camera(void* virtual_address) {
+inline Camera::Camera(void* virtual_address) {
   this->address = virtual_address;
   this->config_set_default();
   this->config_update();
 }
 
-// methods to set the camera configuration
-int Camera::config_set_width(uint16_t val) {
-  IOWR32(this->address, ADDR_WIDTH, val);
-  return 0;
-}
-int Camera::config_set_height(uint16_t val) {
-  IOWR32(this->address, ADDR_HEIGHT, val);
-  return 0;
-}
-int Camera::config_set_start_row(uint16_t val) {
-  IOWR32(this->address, ADDR_START_ROW, val);
-  return 0;
-}
-int Camera::config_set_start_column(uint16_t val) {
-  IOWR32(this->address, ADDR_START_COLUMN, val);
-  return 0;
-}
-int Camera::config_set_row_size(uint16_t val) {
-  IOWR32(this->address, ADDR_ROW_SIZE, val);
-  return 0;
-}
-int Camera::config_set_column_size(uint16_t val) {
-  IOWR32(this->address, ADDR_COLUMN_SIZE, val);
-  return 0;
-}
-int Camera::config_set_row_mode(uint16_t val) {
-  IOWR32(this->address, ADDR_ROW_MODE, val);
-  return 0;
-}
-int Camera::config_set_column_mode(uint16_t val) {
-  IOWR32(this->address, ADDR_COLUMN_MODE, val);
-  return 0;
-}
-int Camera::config_set_exposure(uint16_t val) {
-  IOWR32(this->address, ADDR_EXPOSURE, val);
-  return 0;
-}
-int Camera::config_set_h_blanking(uint16_t val) {
-  IOWR32(this->address, ADDR_H_BLANKING, val);
-  return 0;
-}
-int Camera::config_set_v_blanking(uint16_t val) {
-  IOWR32(this->address, ADDR_V_BLANKING, val);
-  return 0;
-}
-int Camera::config_set_red_gain(uint16_t val) {
-  IOWR32(this->address, ADDR_RED_GAIN, val);
-  return 0;
-}
-int Camera::config_set_blue_gain(uint16_t val) {
-  IOWR32(this->address, ADDR_BLUE_GAIN, val);
-  return 0;
-}
-int Camera::config_set_green1_gain(uint16_t val) {
-  IOWR32(this->address, ADDR_GREEN1_GAIN, val);
-  return 0;
-}
-int Camera::config_set_green2_gain(uint16_t val) {
-  IOWR32(this->address, ADDR_GREEN2_GAIN, val);
-  return 0;
-}
-int Camera::config_set_default(void) {
-  this->config_set_width(CONFIG_WIDTH_DEFAULT);
-  this->config_set_height(CONFIG_HEIGHT_DEFAULT);
-  this->config_set_start_row(CONFIG_START_ROW_DEFAULT);
-  this->config_set_start_column(CONFIG_START_COLUMN_DEFAULT);
-  this->config_set_row_size(CONFIG_ROW_SIZE_DEFAULT);
-  this->config_set_column_size(CONFIG_COLUMN_SIZE_DEFAULT);
-  this->config_set_row_mode(CONFIG_ROW_MODE_DEFAULT);
-  this->config_set_column_mode(CONFIG_COLUMN_MODE_DEFAULT);
-  this->config_set_exposure(CONFIG_EXPOSURE_DEFAULT);
-  this->config_set_h_blanking(CONFIG_H_BLANKING_DEFAULT);
-  this->config_set_v_blanking(CONFIG_V_BLANKING_DEFAULT);
-  this->config_set_red_gain(CONFIG_RED_GAIN_DEFAULT);
-  this->config_set_blue_gain(CONFIG_BLUE_GAIN_DEFAULT);
-  this->config_set_green1_gain(CONFIG_GREEN1_GAIN_DEFAULT);
-  this->config_set_green2_gain(CONFIG_GREEN2_GAIN_DEFAULT);
-  return 0;
-}
-int Camera::config_update(void) {
+inline int Camera::config_set_default(void) {
+  // The defaults are range checked at compile time
+  write_registers<
+      RegisterValue<camera_regs::width, CONFIG_WIDTH_DEFAULT>,
+      RegisterValue<camera_regs::height, CONFIG_HEIGHT_DEFAULT>,
+      RegisterValue<camera_regs::start_row, CONFIG_START_ROW_DEFAULT>,
+      RegisterValue<camera_regs::start_column, CONFIG_START_COLUMN_DEFAULT>,
+      RegisterValue<camera_regs::row_size, CONFIG_ROW_SIZE_DEFAULT>,
+      RegisterValue<camera_regs::column_size, CONFIG_COLUMN_SIZE_DEFAULT>,
+      RegisterValue<camera_regs::row_mode, CONFIG_ROW_MODE_DEFAULT>,
+      RegisterValue<camera_regs::column_mode, CONFIG_COLUMN_MODE_DEFAULT>,
+      RegisterValue<camera_regs::exposure, CONFIG_EXPOSURE_DEFAULT>,
+      RegisterValue<camera_regs::h_blanking, CONFIG_H_BLANKING_DEFAULT>,
+      RegisterValue<camera_regs::v_blanking, CONFIG_V_BLANKING_DEFAULT>,
+      RegisterValue<camera_regs::red_gain, CONFIG_RED_GAIN_DEFAULT>,
+      RegisterValue<camera_regs::blue_gain, CONFIG_BLUE_GAIN_DEFAULT>,
+      RegisterValue<camera_regs::green1_gain, CONFIG_GREEN1_GAIN_DEFAULT>,
+      RegisterValue<camera_regs::green2_gain, CONFIG_GREEN2_GAIN_DEFAULT> >(this->address);
+  return 0;
+}
+inline int Camera::config_update(void) {
   // this function is equal to reset now but in the future
   // could not be. So use this to update the camera config.
   this->reset();
   return 0;
 }
 
-// Methods to get the camera configuration
-uint16_t Camera::config_get_width(void) {
-  return IORD32(this->address, ADDR_WIDTH);
-}
-uint16_t Camera::config_get_height(void) {
-  return IORD32(this->address, ADDR_HEIGHT);
-}
-uint16_t Camera::config_get_start_row(void) {
-  return IORD32(this->address, ADDR_START_ROW);
-}
-uint16_t Camera::config_get_start_column(void) {
-  return IORD32(this->address, ADDR_START_COLUMN);
-}
-uint16_t Camera::config_get_row_size(void) {
-  return IORD32(this->address, ADDR_ROW_SIZE);
-}
-uint16_t Camera::config_get_column_size(void) {
-  return IORD32(this->address, ADDR_COLUMN_SIZE);
-}
-uint16_t Camera::config_get_row_mode(void) {
-  return IORD32(this->address, ADDR_ROW_MODE);
-}
-uint16_t Camera::config_get_column_mode(void) {
-  return IORD32(this->address, ADDR_COLUMN_MODE);
-}
-uint16_t Camera::config_get_exposure(void) {
-  return IORD32(this->address, ADDR_EXPOSURE);
-}
-uint16_t Camera::config_get_h_blanking(void) {
-  return IORD32(this->address, ADDR_H_BLANKING);
-}
-uint16_t Camera::config_get_v_blanking(void) {
-  return IORD32(this->address, ADDR_V_BLANKING);
-}
-uint16_t Camera::config_get_red_gain(void) {
-  return IORD32(this->address, ADDR_RED_GAIN);
-}
-uint16_t Camera::config_get_blue_gain(void) {
-  return IORD32(this->address, ADDR_BLUE_GAIN);
-}
-uint16_t Camera::config_get_green1_gain(void) {
-  return IORD32(this->address, ADDR_GREEN1_GAIN);
-}
-uint16_t Camera::config_get_green2_gain(void) {
-  return IORD32(this->address, ADDR_GREEN2_GAIN);
-}
-
 // reset
-int Camera::reset(void) {
+inline int Camera::reset(void) {
   // soft_reset is active low so when 0 the camera is reset
-  IOWR32(this->address, CAMERA_SOFT_RESET, 0); // reset
-  IOWR32(this->address, CAMERA_SOFT_RESET, 1); // remove reset
+  write_registers<RegisterValue<camera_regs::soft_reset, 0>,   // reset
+                  RegisterValue<camera_regs::soft_reset, 1> >( // remove reset
+      this->address);
   return 0; // return 0 on success
 }
 #endif // __AVALON_CAMERA_H
@@ -1,16 +1,14 @@
-// file: avalon_camera.hpp
-// It the avalon_camera component
+// file: avalon_image_processing.hpp
+// It controls the avalon_image_processing component
 
-#ifndef __AVALON_CAMERA_H
-#define __AVALON_CAMERA_H
+#ifndef __AVALON_IMAGE_PROCESSING_H
+#define __AVALON_IMAGE_PROCESSING_H
 
 #include <inttypes.h> // for uint16_t
 #include <string.h> // for memcpy
 
-// Macros for accessing an address map
-#include "hw_io.hpp"
-// Internal address map of avalon camera (32-bit addresses)
-#include "avalon_image_processing_regs.h"
+// Register descriptors of avalon image processing (32-bit addresses)
+#include "avalon_register_map.hpp"
 
 /*
   Default values of some config registers
@@ -36,88 +34,52 @@ class ImageProcessing {
     // constructor
     ImageProcessing(void* virtual_address);
 
-    // Methods to set the thresholds for hsv 2 binary conversion
-    int set_hue_th_L(uint8_t val);
-    int set_hue_th_H(uint8_t val);
-    int set_brightness_th_L(uint8_t val);
-    int set_brightness_th_H(uint8_t val);
-    int set_saturation_th_L(uint8_t val);
-    int set_saturation_th_H(uint8_t val);
+    // Generic accessors of the registers of image_processing_regs. set
+    // returns ERROR_REGISTER_RANGE without writing if the value is out of
+    // range.
+    template <typename Reg> int set(uint32_t val) { return Reg::write_checked(this->address, val); }
+    template <typename Reg> uint32_t get(void) { return Reg::read(this->address); }
+
+    // Methods to set the thresholds for hsv 2 binary conversion. They
+    // return 0 or ERROR_REGISTER_RANGE.
+    int set_hue_th_L(uint32_t val) { return this->set<image_processing_regs::hue_threshold_l>(val); }
+    int set_hue_th_H(uint32_t val) { return this->set<image_processing_regs::hue_threshold_h>(val); }
+    int set_brightness_th_L(uint32_t val) { return this->set<image_processing_regs::bri_threshold_l>(val); }
+    int set_brightness_th_H(uint32_t val) { return this->set<image_processing_regs::bri_threshold_h>(val); }
+    int set_saturation_th_L(uint32_t val) { return this->set<image_processing_regs::sat_threshold_l>(val); }
+    int set_saturation_th_H(uint32_t val) { return this->set<image_processing_regs::sat_threshold_h>(val); }
 
     // Method to set default parameters for image img_processing
     int set_default(void);
 
-    // Methods to set the thresholds for hsv 2 binary conversion
-    uint8_t get_hue_th_L(void);
-    uint8_t get_hue_th_H(void);
-    uint8_t get_brightness_th_L(void);
-    uint8_t get_brightness_th_H(void);
-    uint8_t get_saturation_th_L(void);
-    uint8_t get_saturation_th_H(void);
+    // Methods to get the thresholds for hsv 2 binary conversion
+    uint8_t get_hue_th_L(void) { return this->get<image_processing_regs::hue_threshold_l>(); }
+    uint8_t get_hue_th_H(void) { return this->get<image_processing_regs::hue_threshold_h>(); }
+    uint8_t get_brightness_th_L(void) { return this->get<image_processing_regs::bri_threshold_l>(); }
+    uint8_t get_brightness_th_H(void) { return this->get<image_processing_regs::bri_threshold_h>(); }
+    uint8_t get_saturation_th_L(void) { return this->get<image_processing_regs::sat_threshold_l>(); }
+    uint8_t get_saturation_th_H(void) { return this->get<image_processing_regs::sat_threshold_h>(); }
 };
 
 // --Class Methods implementation --//
 
 // class constructor (called when object is created)
-ImageProcessing::ImageProcessing(void* virtual_address) {
+inline ImageProcessing::ImageProcessing(void* virtual_address) {
   this->address = virtual_address;
   this->set_default();
 }
 
-// Methods to set the thresholds for hsv 2 binary conversion
-int ImageProcessing::set_hue_th_L(uint8_t val){
-  IOWR32(this->address, ADDR_HUE_THRESHOLD_L, val);
-  return 0;
-}
-int ImageProcessing::set_hue_th_H(uint8_t val){
-  IOWR32(this->address, ADDR_HUE_THRESHOLD_H, val);
-  return 0;
-}
-int ImageProcessing::set_brightness_th_L(uint8_t val){
-  IOWR32(this->address, ADDR_BRI_THRESHOLD_L, val);
-  return 0;
-}
-int ImageProcessing::set_brightness_th_H(uint8_t val){
-  IOWR32(this->address, ADDR_BRI_THRESHOLD_H, val);
-  return 0;
-}
-int ImageProcessing::set_saturation_th_L(uint8_t val){
-  IOWR32(this->address, ADDR_SAT_THRESHOLD_L, val);
-  return 0;
-}
-int ImageProcessing::set_saturation_th_H(uint8_t val){
-  IOWR32(this->address, ADDR_SAT_THRESHOLD_H, val);
-  return 0;
-}
-
 // Method to set default parameters for image img_processing
-int ImageProcessing::set_default(void) {
-  this->set_hue_th_L(HUE_THRESHOLD_L_DEFAULT);
-  this->set_hue_th_H(HUE_THRESHOLD_H_DEFAULT);
-  this->set_brightness_th_L(BRI_THRESHOLD_L_DEFAULT);
-  this->set_brightness_th_H(BRI_THRESHOLD_H_DEFAULT);
-  this->set_saturation_th_L(SAT_THRESHOLD_L_DEFAULT);
-  this->set_saturation_th_H(SAT_THRESHOLD_H_DEFAULT);
+inline int ImageProcessing::set_default(void) {
+  // The defaults are range checked at compile time
+  write_registers<
+      RegisterValue<image_processing_regs::hue_threshold_l, HUE_THRESHOLD_L_DEFAULT>,
+      RegisterValue<image_processing_regs::hue_threshold_h, HUE_THRESHOLD_H_DEFAULT>,
+      RegisterValue<image_processing_regs::bri_threshold_l, BRI_THRESHOLD_L_DEFAULT>,
+      RegisterValue<image_processing_regs::bri_threshold_h, BRI_THRESHOLD_H_DEFAULT>,
+      RegisterValue<image_processing_regs::sat_threshold_l, SAT_THRESHOLD_L_DEFAULT>,
+      RegisterValue<image_processing_regs::sat_threshold_h, SAT_THRESHOLD_H_DEFAULT> >(
+      this->address);
   return 0;
 }
-
-// Methods to set the thresholds for hsv 2 binary conversion
-uint8_t ImageProcessing::get_hue_th_L(void){
-  return IORD32(this->address, ADDR_HUE_THRESHOLD_L);
-}
-uint8_t ImageProcessing::get_hue_th_H(void){
-  return IORD32(this->address, ADDR_HUE_THRESHOLD_H);
-}
-uint8_t ImageProcessing::get_brightness_th_L(void){
-  return IORD32(this->address, ADDR_BRI_THRESHOLD_L);
-}
-uint8_t ImageProcessing::get_brightness_th_H(void){
-  return IORD32(this->address, ADDR_BRI_THRESHOLD_H);
-}
-uint8_t ImageProcessing::get_saturation_th_L(void){
-  return IORD32(this->address, ADDR_SAT_THRESHOLD_L);
-}
-uint8_t ImageProcessing::get_saturation_th_H(void){
-  return IORD32(this->address, ADDR_SAT_THRESHOLD_H);
-}
-#endif // __AVALON_CAMERA_H
+#endif // __AVALON_IMAGE_PROCESSING_H
@@ -0,0 +1,373 @@
+// file: avalon_image_writer.hpp
+// It controls the avalon_image_writer component directly from userspace.
+// It is an alternative to the camera driver for low latency applications:
+// frames are written by the FPGA into physically contiguous buffers mapped in
+// the application (udmabuf, or simulated memory when there is no hardware)
+// and new frames are detected polling CAPTURE_IMAGE_COUNTER, so getting a
+// frame needs no system call and no copy.
+// Do not use it on an image writer that is open in the camera driver.
+
+#ifndef __AVALON_IMAGE_WRITER_H
+#define __AVALON_IMAGE_WRITER_H
+
+#include <inttypes.h> // for uint32_t
+#include <string.h> // for memcpy
+
+#include <atomic>
+#include <chrono>
+
+// Register backends (provide the DMA buffers)
+#include "hw_backend.hpp"
+// Register descriptors of avalon image writer (32-bit addresses)
+#include "avalon_register_map.hpp"
+
+// Acquisition modes
+#ifndef SINGLE_SHOT
+#define SINGLE_SHOT 0
+#define CONTINUOUS  1
+#endif
+
+/*
+  Default values of some config registers
+*/
+#define CAPTURE_MODE_DEFAULT CONTINUOUS
+#define CONT_DOUBLE_BUFF_DEFAULT 1
+#define CAPTURE_BUFFER_SELECT_DEFAULT 0
+#define CAPTURE_DOWNSAMPLING_DEFAULT 1
+
+// Time waiting for the hardware before giving up (ms)
+#define IMAGE_WRITER_TIMEOUT_MS 1000
+
+// Image writer errors
+#define ERROR_IMAGE_WRITER_NO_REPLY -1
+#define ERROR_IMAGE_WRITER_NO_BUFFERS -2
+
+/*
+  Class definition for easy control of the image writer
+*/
+class ImageWriter {
+  private: // accesible only inside the class
+    // --Class Variables--//
+    // Virtual base address of the avalon_image_writer.
+    void* address;
+    // Backend that allocated the buffers (NULL if not allocated)
+    RegisterBackend* backend;
+    // Capture buffers (virtual and physical addresses)
+    uint8_t* buffer[2];
+    uint32_t buffer_physical[2];
+    size_t image_size;
+    // Image counter when the capture started and when the last image was
+    // returned
+    uint32_t start_image_number;
+    uint32_t last_image_number;
+    // When get_frame saw last_image_number, and the start and end of the
+    // capture of the last image returned (steady clock, 0 if unknown)
+    uint64_t counter_seen_ns;
+    uint64_t frame_start_ns;
+    uint64_t frame_ready_ns;
+
+  public: // accessible from outside the class
+    // --Class Methods definition--//
+    // constructor
+    ImageWriter(void* virtual_address);
+    ~ImageWriter(void);
+
+    // Generic accessors of the registers of image_writer_regs. set returns
+    // ERROR_REGISTER_RANGE without writing if the value is out of range.
+    template <typename Reg> int set(uint32_t val) { return Reg::write_checked(this->address, val); }
+    template <typename Reg> uint32_t get(void) { return Reg::read(this->address); }
+
+    // Methods to set the image writer configuration. They take effect
+    // in the next call to start_capture. They return 0 or
+    // ERROR_REGISTER_RANGE.
+    int set_mode(uint32_t val);
+    int set_buff0(uint32_t physical_address);
+    int set_buff1(uint32_t physical_address);
+    int set_cont_double_buff(uint32_t val);
+    int set_buffer_select(uint32_t val);
+    int set_downsampling(uint32_t val);
+    int set_default(void);
+
+    // Methods to get the image writer configuration and status
+    uint32_t get_mode(void);
+    uint32_t get_buff0(void);
+    uint32_t get_buff1(void);
+    uint32_t get_cont_double_buff(void);
+    uint32_t get_buffer_select(void);
+    uint32_t get_downsampling(void);
+    uint32_t get_standby(void);
+    uint32_t get_last_buffer_captured(void);
+    uint32_t get_image_counter(void);
+
+    // Allocate the two capture buffers from the backend and write their
+    // physical addresses into CAPTURE_BUFF0/1
+    int alloc_buffers(RegisterBackend* backend, size_t image_size);
+    int free_buffers(void);
+    size_t get_image_size(void) { return this->image_size; }
+
+    // Start and stop the capture. In CONTINUOUS mode the hardware keeps
+    // writing images in the buffers until stop_capture is called.
+    int start_capture(void);
+    int stop_capture(void);
+
+    // Zero-copy frame acquisition. In CONTINUOUS mode it waits (polling)
+    // until a new image is available and returns the buffer where it is.
+    // The image stays valid until the hardware starts the next image
+    // (one frame period), use read_frame for a safe copy.
+    // In SINGLE_SHOT mode it captures a new image in buffer 0.
+    // Returns NULL on timeout. image_number can be NULL.
+    const uint8_t* get_frame(uint32_t* image_number);
+    // Copy a new image into 'destination' (at most len Bytes). If the
+    // hardware started overwriting it during the copy, it is repeated with
+    // the newest image. Returns the Bytes copied or a negative error.
+    int read_frame(uint8_t* destination, size_t len, uint32_t* image_number);
+    // When the capture of the last image returned started and ended, as seen
+    // polling the image counter (steady clock ns, 0 if not seen). The FPGA
+    // starts capturing an image when the counter goes up and it is complete
+    // when the counter goes up again (CONTINUOUS) or at standby (SINGLE_SHOT).
+    uint64_t get_frame_start_ns(void) { return this->frame_start_ns; }
+    uint64_t get_frame_ready_ns(void) { return this->frame_ready_ns; }
+
+  private: // not accesible from ouside the class
+    // Wait until standby is 1 or timeout. Returns 0 on success.
+    int wait_standby(void);
+    static uint64_t now_ns(void) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+// --Class Methods implementation --//
+
+// class constructor (called when object is created)
+inline ImageWriter::ImageWriter(void* virtual_address) {
+  this->address = virtual_address;
+  this->backend = NULL;
+  this->buffer[0] = this->buffer[1] = NULL;
+  this->buffer_physical[0] = this->buffer_physical[1] = 0;
+  this->image_size = 0;
+  this->start_image_number = 0;
+  this->last_image_number = 0;
+  this->counter_seen_ns = 0;
+  this->frame_start_ns = 0;
+  this->frame_ready_ns = 0;
+  this->stop_capture();
+  this->set_default();
+}
+
+inline ImageWriter::~ImageWriter(void) {
+  this->stop_capture();
+  this->free_buffers();
+}
+
+// methods to set the image writer configuration
+inline int ImageWriter::set_mode(uint32_t val) {
+  return this->set<image_writer_regs::mode>(val);
+}
+inline int ImageWriter::set_buff0(uint32_t physical_address) {
+  return this->set<image_writer_regs::buff0>(physical_address);
+}
+inline int ImageWriter::set_buff1(uint32_t physical_address) {
+  return this->set<image_writer_regs::buff1>(physical_address);
+}
+inline int ImageWriter::set_cont_double_buff(uint32_t val) {
+  return this->set<image_writer_regs::cont_double_buff>(val);
+}
+inline int ImageWriter::set_buffer_select(uint32_t val) {
+  return this->set<image_writer_regs::buffer_select>(val);
+}
+inline int ImageWriter::set_downsampling(uint32_t val) {
+  return this->set<image_writer_regs::downsampling>(val);
+}
+inline int ImageWriter::set_default(void) {
+  // The defaults are range checked at compile time
+  write_registers<
+      RegisterValue<image_writer_regs::mode, CAPTURE_MODE_DEFAULT>,
+      RegisterValue<image_writer_regs::cont_double_buff, CONT_DOUBLE_BUFF_DEFAULT>,
+      RegisterValue<image_writer_regs::buffer_select, CAPTURE_BUFFER_SELECT_DEFAULT>,
+      RegisterValue<image_writer_regs::downsampling, CAPTURE_DOWNSAMPLING_DEFAULT> >(
+      this->address);
+  return 0;
+}
+
+// Methods to get the image writer configuration and status
+inline uint32_t ImageWriter::get_mode(void) {
+  return this->get<image_writer_regs::mode>();
+}
+inline uint32_t ImageWriter::get_buff0(void) {
+  return this->get<image_writer_regs::buff0>();
+}
+inline uint32_t ImageWriter::get_buff1(void) {
+  return this->get<image_writer_regs::buff1>();
+}
+inline uint32_t ImageWriter::get_cont_double_buff(void) {
+  return this->get<image_writer_regs::cont_double_buff>();
+}
+inline uint32_t ImageWriter::get_buffer_select(void) {
+  return this->get<image_writer_regs::buffer_select>();
+}
+inline uint32_t ImageWriter::get_downsampling(void) {
+  return this->get<image_writer_regs::downsampling>();
+}
+inline uint32_t ImageWriter::get_standby(void) {
+  return this->get<image_writer_regs::standby>();
+}
+inline uint32_t ImageWriter::get_last_buffer_captured(void) {
+  return this->get<image_writer_regs::last_buffer_captured>();
+}
+inline uint32_t ImageWriter::get_image_counter(void) {
+  return this->get<image_writer_regs::image_counter>();
+}
+
+// Buffers
+inline int ImageWriter::alloc_buffers(RegisterBackend* backend,
+    size_t image_size) {
+  this->free_buffers();
+  this->buffer[0] = (uint8_t*) backend->alloc_dma_buffer(image_size,
+      &this->buffer_physical[0]);
+  this->buffer[1] = (uint8_t*) backend->alloc_dma_buffer(image_size,
+      &this->buffer_physical[1]);
+  if ((this->buffer[0] == NULL) || (this->buffer[1] == NULL)) {
+    if (this->buffer[0] != NULL) backend->free_dma_buffer(this->buffer[0]);
+    if (this->buffer[1] != NULL) backend->free_dma_buffer(this->buffer[1]);
+    this->buffer[0] = this->buffer[1] = NULL;
+    return ERROR_IMAGE_WRITER_NO_BUFFERS;
+  }
+  this->backend = backend;
+  this->image_size = image_size;
+  this->set_buff0(this->buffer_physical[0]);
+  this->set_buff1(this->buffer_physical[1]);
+  return 0;
+}
+
+inline int ImageWriter::free_buffers(void) {
+  if (this->backend == NULL) {
+    return 0;
+  }
+  this->stop_capture();
+  this->backend->free_dma_buffer(this->buffer[0]);
+  this->backend->free_dma_buffer(this->buffer[1]);
+  this->buffer[0] = this->buffer[1] = NULL;
+  this->backend = NULL;
+  this->image_size = 0;
+  return 0;
+}
+
+// Capture control
+inline int ImageWriter::wait_standby(void) {
+  std::chrono::steady_clock::time_point timeout = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(IMAGE_WRITER_TIMEOUT_MS);
+  while (!this->get_standby()) {
+    if (std::chrono::steady_clock::now() > timeout) {
+      return ERROR_IMAGE_WRITER_NO_REPLY;
+    }
+  }
+  return 0;
+}
+
+inline int ImageWriter::start_capture(void) {
+  if (this->backend == NULL) {
+    return ERROR_IMAGE_WRITER_NO_BUFFERS;
+  }
+  //Stop the capture (to ensure a known state)
+  this->stop_capture();
+  // Wait until Standby signal is 1. Its the way to ensure that the component
+  // is not in reset or acquiring a signal.
+  if (this->wait_standby() != 0) {
+    return ERROR_IMAGE_WRITER_NO_REPLY;
+  }
+  this->start_image_number = this->get_image_counter();
+  this->last_image_number = this->start_image_number;
+  this->counter_seen_ns = 0;
+  write_registers<RegisterValue<image_writer_regs::start_capture, 1> >(this->address);
+  return 0;
+}
+
+inline int ImageWriter::stop_capture(void) {
+  write_registers<RegisterValue<image_writer_regs::start_capture, 0> >(this->address);
+  return 0;
+}
+
+// Frame acquisition
+inline const uint8_t* ImageWriter::get_frame(uint32_t* image_number) {
+  uint32_t counter;
+  const uint8_t* frame;
+  uint64_t started_ns = 0;
+  std::chrono::steady_clock::time_point timeout = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(IMAGE_WRITER_TIMEOUT_MS);
+
+  if (this->backend == NULL) {
+    return NULL;
+  }
+
+  if (this->get_mode() == SINGLE_SHOT) {
+    this->set_buffer_select(0);
+    if (this->start_capture() != 0) {
+      return NULL;
+    }
+    // The image is complete when the component is idle again after at
+    // least one new frame started (the counter goes up at frame start)
+    while (((counter = this->get_image_counter()) - this->start_image_number < 2) ||
+           !this->get_standby()) {
+      if ((started_ns == 0) && (counter != this->start_image_number)) {
+        started_ns = now_ns();
+      }
+      if (std::chrono::steady_clock::now() > timeout) {
+        return NULL;
+      }
+    }
+    this->last_image_number = this->get_image_counter();
+    this->frame_ready_ns = now_ns();
+    this->frame_start_ns = started_ns;
+    frame = this->buffer[0];
+  } else { // CONTINUOUS
+    // Block here until a new image is available. The first image is ready
+    // when the second frame after start_capture begins.
+    while (((counter = this->get_image_counter()) == this->last_image_number) ||
+           ((counter - this->start_image_number) < 2)) {
+      if (std::chrono::steady_clock::now() > timeout) {
+        return NULL;
+      }
+    }
+    // The image started when the previous counter value was seen, if it
+    // was the previous image
+    this->frame_ready_ns = now_ns();
+    this->frame_start_ns = (counter == this->last_image_number + 1) ? this->counter_seen_ns : 0;
+    this->counter_seen_ns = this->frame_ready_ns;
+    this->last_image_number = counter;
+    // Capture already started so just check where the last image was saved
+    frame = this->buffer[this->get_last_buffer_captured() & 1];
+  }
+  // Do not read the image before the hardware finished writing it
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (image_number != NULL) {
+    *image_number = this->last_image_number;
+  }
+  return frame;
+}
+
+inline int ImageWriter::read_frame(uint8_t* destination, size_t len,
+    uint32_t* image_number) {
+  if (len > this->image_size) {
+    len = this->image_size;
+  }
+  // Retry once if the buffer was overwritten while copying
+  for (int attempt = 0; attempt < 2; attempt++) {
+    uint32_t number;
+    const uint8_t* frame = this->get_frame(&number);
+    if (frame == NULL) {
+      return ERROR_IMAGE_WRITER_NO_REPLY;
+    }
+    memcpy(destination, frame, len);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if ((this->get_mode() == SINGLE_SHOT) ||
+        (this->get_image_counter() == number)) {
+      if (image_number != NULL) {
+        *image_number = number;
+      }
+      return len;
+    }
+  }
+  return ERROR_IMAGE_WRITER_NO_REPLY;
+}
+#endif // __AVALON_IMAGE_WRITER_H
@@ -0,0 +1,172 @@
+// file: avalon_register_map.hpp
+// Compile-time descriptors of the registers of the Avalon components.
+//
+// Each register is a type with its offset, width, access mode and range of
+// valid values, all known at compile time. Reads and writes through the
+// descriptors inline to the same single volatile load or store as the
+// IORD32/IOWR32 macros, but:
+//  - writing a read-only register or reading a write-only one does not
+//    compile,
+//  - constant values (RegisterValue, write_registers) are range checked at
+//    compile time,
+//  - run-time values can be checked with write_checked before they reach
+//    the bridge.
+//
+// The offsets are the ones of the *_regs.h headers, which stay the
+// reference for C code and the drivers.
+
+#ifndef __AVALON_REGISTER_MAP_H
+#define __AVALON_REGISTER_MAP_H
+
+#include <inttypes.h>
+
+// Macros for accessing an address map
+#include "hw_io.hpp"
+#include "avalon_camera_regs.h"
+#include "avalon_image_processing_regs.h"
+#include "avalon_image_writer_regs.h"
+
+// Value out of the range of the register
+#define ERROR_REGISTER_RANGE -10
+
+// Access modes
+#define REG_RW 0
+#define REG_RO 1 // written only by the hardware
+#define REG_WO 2
+
+/*
+  Descriptor of a 32-bit aligned register. Width is the number of bits
+  implemented and [Min, Max] the values accepted.
+*/
+template <uint32_t Offset, unsigned int Width, int Access, uint32_t Min, uint32_t Max>
+struct Register {
+  static const uint32_t offset = Offset;
+  static const unsigned int width = Width;
+  static const int access = Access;
+  static const uint32_t min = Min;
+  static const uint32_t max = Max;
+
+  static_assert(Offset % 4 == 0, "registers are 32-bit aligned");
+  static_assert((Width >= 1) && (Width <= 32), "invalid register width");
+  static_assert(Min <= Max, "empty register range");
+  static_assert((Width == 32) || (Max < (1ULL << Width)), "range wider than the register");
+
+  static constexpr bool valid(uint32_t value) {
+    return (value >= Min) && (value <= Max);
+  }
+  static inline void write(void* base, uint32_t value) {
+    static_assert(Access != REG_RO, "read-only register");
+    IOWR32(base, Offset, value);
+  }
+  static inline uint32_t read(void* base) {
+    static_assert(Access != REG_WO, "write-only register");
+    return IORD32(base, Offset);
+  }
+  // Write only if the value is in range. Returns 0 or ERROR_REGISTER_RANGE.
+  static inline int write_checked(void* base, uint32_t value) {
+    if (!valid(value)) {
+      return ERROR_REGISTER_RANGE;
+    }
+    write(base, value);
+    return 0;
+  }
+};
+
+/*
+  Constant value of a register, checked at compile time
+*/
+template <typename Reg, uint32_t Value>
+struct RegisterValue {
+  typedef Reg reg;
+  static const uint32_t value = Value;
+  static_assert(Reg::valid(Value), "value out of the register range");
+  static_assert(Reg::access != REG_RO, "read-only register");
+  static inline void write(void* base) {
+    IOWR32(base, Reg::offset, Value);
+  }
+};
+
+// Write several constant values in order, e.g.
+//   write_registers<RegisterValue<camera_regs::width, 640>,
+//                   RegisterValue<camera_regs::height, 480> >(address);
+template <typename... Values>
+inline void write_registers(void* base) {
+  int writes[] = {0, (Values::write(base), 0)...};
+  (void) writes;
+}
+
+/*
+  Run-time batch of register writes, e.g. a configuration prepared in
+  advance and applied at once
+*/
+struct RegisterWrite {
+  uint32_t offset;
+  uint32_t value;
+};
+
+// Make a RegisterWrite checking the range. Returns 0 or ERROR_REGISTER_RANGE.
+template <typename Reg>
+inline int register_write(uint32_t value, RegisterWrite* write) {
+  static_assert(Reg::access != REG_RO, "read-only register");
+  if (!Reg::valid(value)) {
+    return ERROR_REGISTER_RANGE;
+  }
+  write->offset = Reg::offset;
+  write->value = value;
+  return 0;
+}
+
+inline void write_registers(void* base, const RegisterWrite* writes, unsigned int count) {
+  for (unsigned int i = 0; i < count; i++) {
+    IOWR32(base, writes[i].offset, writes[i].value);
+  }
+}
+
+// avalon_camera. Sizes and modes are the ones of the sensor (MT9P031).
+namespace camera_regs {
+  typedef Register<ADDR_WIDTH,        12, REG_RW, 1, 2592>  width;
+  typedef Register<ADDR_HEIGHT,       11, REG_RW, 1, 1944>  height;
+  typedef Register<ADDR_START_ROW,    11, REG_RW, 0, 2004>  start_row;
+  typedef Register<ADDR_START_COLUMN, 12, REG_RW, 0, 2750>  start_column;
+  typedef Register<ADDR_ROW_SIZE,     11, REG_RW, 1, 2005>  row_size;
+  typedef Register<ADDR_COLUMN_SIZE,  12, REG_RW, 1, 2751>  column_size;
+  // Bits 5:4 binning, 2:0 skipping
+  typedef Register<ADDR_ROW_MODE,      6, REG_RW, 0, 0x37>  row_mode;
+  typedef Register<ADDR_COLUMN_MODE,   6, REG_RW, 0, 0x37>  column_mode;
+  typedef Register<ADDR_EXPOSURE,     16, REG_RW, 0, 0xFFFF> exposure;
+  typedef Register<ADDR_H_BLANKING,   12, REG_RW, 0, 4095>  h_blanking;
+  typedef Register<ADDR_V_BLANKING,   11, REG_RW, 8, 2047>  v_blanking;
+  // Bits 14:8 digital gain, 6 analog multiplier, 5:0 analog gain
+  typedef Register<ADDR_RED_GAIN,     15, REG_RW, 0, 0x7FFF> red_gain;
+  typedef Register<ADDR_BLUE_GAIN,    15, REG_RW, 0, 0x7FFF> blue_gain;
+  typedef Register<ADDR_GREEN1_GAIN,  15, REG_RW, 0, 0x7FFF> green1_gain;
+  typedef Register<ADDR_GREEN2_GAIN,  15, REG_RW, 0, 0x7FFF> green2_gain;
+  // Active low
+  typedef Register<CAMERA_SOFT_RESET,  1, REG_RW, 0, 1>     soft_reset;
+}
+
+// avalon_image_processing. HSV binarization thresholds.
+namespace image_processing_regs {
+  typedef Register<ADDR_HUE_THRESHOLD_L, 8, REG_RW, 0, 255> hue_threshold_l;
+  typedef Register<ADDR_HUE_THRESHOLD_H, 8, REG_RW, 0, 255> hue_threshold_h;
+  typedef Register<ADDR_BRI_THRESHOLD_L, 8, REG_RW, 0, 255> bri_threshold_l;
+  typedef Register<ADDR_BRI_THRESHOLD_H, 8, REG_RW, 0, 255> bri_threshold_h;
+  typedef Register<ADDR_SAT_THRESHOLD_L, 8, REG_RW, 0, 255> sat_threshold_l;
+  typedef Register<ADDR_SAT_THRESHOLD_H, 8, REG_RW, 0, 255> sat_threshold_h;
+}
+
+// avalon_image_writer
+namespace image_writer_regs {
+  typedef Register<CAPTURE_MODE,          1,  REG_RW, 0, 1>          mode;
+  typedef Register<CAPTURE_BUFF0,         32, REG_RW, 0, 0xFFFFFFFF> buff0;
+  typedef Register<CAPTURE_BUFF1,         32, REG_RW, 0, 0xFFFFFFFF> buff1;
+  typedef Register<CONT_DOUBLE_BUFF,      1,  REG_RW, 0, 1>          cont_double_buff;
+  typedef Register<CAPTURE_BUFFER_SELECT, 1,  REG_RW, 0, 1>          buffer_select;
+  typedef Register<START_CAPTURE,         1,  REG_RW, 0, 1>          start_capture;
+  typedef Register<CAPTURE_STANDBY,       1,  REG_RO, 0, 1>          standby;
+  typedef Register<LAST_BUFFER_CAPTURED,  1,  REG_RO, 0, 1>          last_buffer_captured;
+  typedef Register<CAPTURE_DOWNSAMPLING,  8,  REG_RW, 1, 255>        downsampling;
+  typedef Register<CAPTURE_IMAGE_COUNTER, 32, REG_RO, 0, 0xFFFFFFFF> image_counter;
+}
+
+#endif // __AVALON_REGISTER_MAP_H
@@ -0,0 +1,397 @@
+// file: camera_client.hpp
+// Client of camera_server (applications/camera_server) that keeps several
+// capture_frame requests in flight, so the frames arrive back to back
+// instead of one per round trip.
+//
+// The requests are queued and sent together before waiting for the
+// responses, which the server answers in order. Each frame is received
+// straight into its buffer: one given by the caller or one of a pool kept
+// by the client, without intermediate copies. The geometry of the frames
+// is asked to the server (frame_info) when connecting and after switching
+// profiles, so the clients do not hard-code it.
+//
+// Frames can be taken one at a time, without blocking (poll) or waiting
+// (wait), with get_fd() in the poll or epoll loop of the application, or
+// handed to a callback by stream().
+
+#ifndef __CAMERA_CLIENT_H
+#define __CAMERA_CLIENT_H
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#define CAMERA_CLIENT_PORT 36000
+// Requests in flight at most
+#define CAMERA_CLIENT_MAX_DEPTH 16
+// Bytes of a text response read at once
+#define CAMERA_CLIENT_LINE_SIZE 256
+
+#define ERROR_CAMERA_CLIENT_CONNECT  -1
+#define ERROR_CAMERA_CLIENT_IO       -2
+#define ERROR_CAMERA_CLIENT_RESPONSE -3
+#define ERROR_CAMERA_CLIENT_BUSY     -4
+
+struct CameraClientFrame {
+  uint8_t* data;
+  size_t size;
+  // Order of the request, from 0
+  uint64_t sequence;
+  // Given with the request
+  void* user;
+  // The buffer belongs to the pool: give it back with release()
+  bool pooled;
+};
+
+// Called by CameraClient::stream() with each frame. Returns false to stop.
+typedef bool (*CameraClientCallback)(const CameraClientFrame& frame, void* user);
+
+/*
+  Class definition of the camera client
+*/
+class CameraClient {
+  public:
+    CameraClient(void) : fd(-1), width(0), height(0), format(0), frame_size(0),
+                         received(0), sequence(0) {}
+    ~CameraClient(void) { this->close(); }
+    // Connect to the server and get the geometry of its frames. Returns 0
+    // or an error.
+    int open(const char* host, int port = CAMERA_CLIENT_PORT);
+    int close(void);
+    // Socket, readable when there is something to receive
+    int get_fd(void) { return this->fd; }
+    // Geometry of the frames (format as the image type of camera_server: 0
+    // RGBG, 1 gray, 2 binary)
+    uint32_t get_width(void) { return this->width; }
+    uint32_t get_height(void) { return this->height; }
+    uint32_t get_format(void) { return this->format; }
+    size_t get_frame_size(void) { return this->frame_size; }
+    // Send a command answered with one line (e.g. "frame_info") and get the
+    // answer without the line break. Returns 0, ERROR_CAMERA_CLIENT_BUSY with
+    // frames in flight or an error.
+    int command(const char* request, std::string* response);
+    // Switch the camera profile and get the geometry of its frames
+    int select_profile(const char* name);
+    // Ask for a frame, received into 'buffer' (get_frame_size() Bytes, not
+    // used by the caller until it is returned) or into a buffer of the pool
+    // if NULL. Returns 0 or ERROR_CAMERA_CLIENT_BUSY with
+    // CAMERA_CLIENT_MAX_DEPTH requests in flight (or no memory for the
+    // buffer).
+    int request_frame(uint8_t* buffer = NULL, void* user = NULL);
+    int get_in_flight(void) { return this->in_flight.size(); }
+    // Receive what arrived without blocking. Returns 1 with the oldest frame
+    // requested if it is complete, 0 if not or an error.
+    int poll(CameraClientFrame* frame);
+    // Wait up to timeout_ms (-1: forever) for the oldest frame requested.
+    // Returns 1 with the frame, 0 on timeout or an error.
+    int wait(CameraClientFrame* frame, int timeout_ms);
+    // Give a buffer back to the pool
+    void release(const CameraClientFrame& frame);
+    // Receive 'frames' frames (0: until the callback returns false) keeping
+    // 'depth' requests in flight, into buffers of the pool given back after
+    // the callback. Returns the frames handed to the callback or an error.
+    // If a frame can not be requested, the stream stops with that error once
+    // the frames in flight are received.
+    int64_t stream(int depth, uint64_t frames, CameraClientCallback callback, void* user);
+
+  private:
+    struct Request {
+      uint8_t* data;
+      bool pooled;
+      void* user;
+      uint64_t sequence;
+    };
+    // Send the requests queued
+    int flush(void);
+    // Receive into the oldest frame requested. Returns 1 if it is complete.
+    int receive(int flags, CameraClientFrame* frame);
+    // Read the geometry of the frames
+    int read_frame_info(void);
+    void free_pool(void);
+    int fd;
+    uint32_t width, height, format;
+    size_t frame_size;
+    // Requests not sent yet
+    std::string outgoing;
+    // Requests sent or queued, in the order of the responses, and Bytes of
+    // the oldest one received
+    std::deque<Request> in_flight;
+    size_t received;
+    uint64_t sequence;
+    // Buffers of frame_size Bytes not in use
+    std::vector<uint8_t*> pool;
+};
+
+// --Class Methods implementation --//
+
+inline int CameraClient::open(const char* host, int port) {
+  this->close();
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addresses;
+  std::string service = std::to_string(port);
+  if (getaddrinfo(host, service.c_str(), &hints, &addresses) != 0) {
+    printf("ERROR: Unknown host %s\n", host);
+    return ERROR_CAMERA_CLIENT_CONNECT;
+  }
+  for (struct addrinfo* a = addresses; (a != NULL) && (this->fd < 0); a = a->ai_next) {
+    this->fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if ((this->fd >= 0) && (connect(this->fd, a->ai_addr, a->ai_addrlen) != 0)) {
+      ::close(this->fd);
+      this->fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (this->fd < 0) {
+    printf("ERROR: Connecting to %s:%d failed\n", host, port);
+    return ERROR_CAMERA_CLIENT_CONNECT;
+  }
+  // The requests are small: sent at once instead of waiting for the
+  // acknowledgement of the previous ones
+  int one = 1;
+  setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  int error = this->read_frame_info();
+  if (error != 0) {
+    this->close();
+  }
+  return error;
+}
+
+inline int CameraClient::close(void) {
+  if (this->fd >= 0) {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+  this->outgoing.clear();
+  for (size_t i = 0; i < this->in_flight.size(); i++) {
+    if (this->in_flight[i].pooled) {
+      free(this->in_flight[i].data);
+    }
+  }
+  this->in_flight.clear();
+  this->received = 0;
+  this->free_pool();
+  return 0;
+}
+
+inline int CameraClient::command(const char* request, std::string* response) {
+  if (!this->in_flight.empty()) {
+    return ERROR_CAMERA_CLIENT_BUSY;
+  }
+  this->outgoing.append(request);
+  this->outgoing.push_back('\n');
+  int error = this->flush();
+  if (error != 0) {
+    return error;
+  }
+  // Nothing else is sent by the server until the line is read
+  response->clear();
+  char line[CAMERA_CLIENT_LINE_SIZE];
+  while ((response->empty()) || ((*response)[response->size() - 1] != '\n')) {
+    ssize_t nread = recv(this->fd, line, sizeof(line), 0);
+    if ((nread < 0) && (errno == EINTR)) {
+      continue;
+    }
+    if (nread <= 0) {
+      return ERROR_CAMERA_CLIENT_IO;
+    }
+    response->append(line, nread);
+  }
+  response->erase(response->size() - 1);
+  return 0;
+}
+
+inline int CameraClient::select_profile(const char* name) {
+  std::string response;
+  int error = this->command((std::string("profile ") + name).c_str(), &response);
+  if (error != 0) {
+    return error;
+  }
+  if (response.compare(0, 3, "ok ") != 0) {
+    printf("ERROR: Profile %s not selected: %s\n", name, response.c_str());
+    return ERROR_CAMERA_CLIENT_RESPONSE;
+  }
+  return this->read_frame_info();
+}
+
+inline int CameraClient::request_frame(uint8_t* buffer, void* user) {
+  if (this->in_flight.size() >= CAMERA_CLIENT_MAX_DEPTH) {
+    return ERROR_CAMERA_CLIENT_BUSY;
+  }
+  Request request = {buffer, buffer == NULL, user, this->sequence++};
+  if (request.pooled) {
+    if (this->pool.empty()) {
+      request.data = (uint8_t*) malloc(this->frame_size);
+      if (request.data == NULL) {
+        return ERROR_CAMERA_CLIENT_BUSY;
+      }
+    } else {
+      request.data = this->pool.back();
+      this->pool.pop_back();
+    }
+  }
+  this->in_flight.push_back(request);
+  this->outgoing.append("capture_frame\n");
+  return 0;
+}
+
+inline int CameraClient::poll(CameraClientFrame* frame) {
+  return this->receive(MSG_DONTWAIT, frame);
+}
+
+inline int CameraClient::wait(CameraClientFrame* frame, int timeout_ms) {
+  while (true) {
+    int result = this->receive(MSG_DONTWAIT, frame);
+    if ((result != 0) || this->in_flight.empty()) {
+      return result;
+    }
+    struct pollfd descriptor = {this->fd, POLLIN, 0};
+    int ready = ::poll(&descriptor, 1, timeout_ms);
+    if ((ready < 0) && (errno != EINTR)) {
+      return ERROR_CAMERA_CLIENT_IO;
+    }
+    if (ready == 0) {
+      return 0;
+    }
+  }
+}
+
+inline void CameraClient::release(const CameraClientFrame& frame) {
+  if (!frame.pooled) {
+    return;
+  }
+  // Buffers of another geometry are not reused
+  if (frame.size == this->frame_size) {
+    this->pool.push_back(frame.data);
+  } else {
+    free(frame.data);
+  }
+}
+
+inline int64_t CameraClient::stream(int depth, uint64_t frames, CameraClientCallback callback,
+    void* user) {
+  depth = (depth < 1) ? 1 : (depth > CAMERA_CLIENT_MAX_DEPTH) ? CAMERA_CLIENT_MAX_DEPTH : depth;
+  uint64_t requested = 0;
+  int64_t handed = 0;
+  bool stopping = false;
+  int error = 0;
+  while (true) {
+    while (!stopping && (error == 0) && ((int) this->in_flight.size() < depth) &&
+           ((frames == 0) || (requested < frames))) {
+      error = this->request_frame();
+      if (error == 0) {
+        requested++;
+      }
+    }
+    if (this->in_flight.empty()) {
+      return (error != 0) ? error : handed;
+    }
+    CameraClientFrame frame;
+    int result = this->wait(&frame, -1);
+    if (result <= 0) {
+      return (result < 0) ? result : handed;
+    }
+    // The frames in flight when stopping are received and dropped
+    if (!stopping) {
+      handed++;
+      stopping = !callback(frame, user);
+    }
+    this->release(frame);
+  }
+}
+
+inline int CameraClient::flush(void) {
+  size_t sent = 0;
+  while (sent < this->outgoing.size()) {
+    ssize_t nwritten = send(this->fd, this->outgoing.data() + sent, this->outgoing.size() - sent,
+                            MSG_NOSIGNAL);
+    if ((nwritten < 0) && (errno == EINTR)) {
+      continue;
+    }
+    if (nwritten < 0) {
+      return ERROR_CAMERA_CLIENT_IO;
+    }
+    sent += nwritten;
+  }
+  this->outgoing.clear();
+  return 0;
+}
+
+inline int CameraClient::receive(int flags, CameraClientFrame* frame) {
+  if (this->in_flight.empty()) {
+    return 0;
+  }
+  if (!this->outgoing.empty() && (this->flush() != 0)) {
+    return ERROR_CAMERA_CLIENT_IO;
+  }
+  Request& request = this->in_flight.front();
+  while (this->received < this->frame_size) {
+    ssize_t nread = recv(this->fd, request.data + this->received,
+                         this->frame_size - this->received, flags);
+    if (nread < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : ERROR_CAMERA_CLIENT_IO;
+    }
+    if (nread == 0) {
+      // The server closes the connection if a frame can not be read
+      printf("ERROR: Connection closed by the server\n");
+      return ERROR_CAMERA_CLIENT_IO;
+    }
+    this->received += nread;
+  }
+  frame->data = request.data;
+  frame->size = this->frame_size;
+  frame->sequence = request.sequence;
+  frame->user = request.user;
+  frame->pooled = request.pooled;
+  this->in_flight.pop_front();
+  this->received = 0;
+  return 1;
+}
+
+inline int CameraClient::read_frame_info(void) {
+  std::string response;
+  int error = this->command("frame_info", &response);
+  if (error != 0) {
+    return error;
+  }
+  unsigned int width, height, format;
+  unsigned long size;
+  if (sscanf(response.c_str(), "%u %u %u %lu", &width, &height, &format, &size) != 4) {
+    printf("ERROR: Unexpected frame_info response: %s\n", response.c_str());
+    return ERROR_CAMERA_CLIENT_RESPONSE;
+  }
+  if (size != this->frame_size) {
+    this->free_pool();
+  }
+  this->width = width;
+  this->height = height;
+  this->format = format;
+  this->frame_size = size;
+  return 0;
+}
+
+inline void CameraClient::free_pool(void) {
+  for (size_t i = 0; i < this->pool.size(); i++) {
+    free(this->pool[i]);
+  }
+  this->pool.clear();
+}
+
+#endif // __CAMERA_CLIENT_H
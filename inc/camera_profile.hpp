@@ -0,0 +1,312 @@
+// file: camera_profile.hpp
+// Named configurations of the camera (geometry, binning/skipping, exposure
+// and gains) that can be switched at run time.
+//
+// The profiles are read from a file and the register image of each one is
+// computed and range checked when it is loaded. Switching to a profile is
+// a single operation that keeps the camera registers, the geometry of the
+// camera driver and the frame buffers consistent:
+//  1. the frame source is closed (the buffers of the old size are freed),
+//  2. the camera is held in reset while its register image is written,
+//  3. the driver geometry is updated (when the frames come from the
+//     driver),
+//  4. the frame source is open again, allocating buffers of the new size.
+// If any step fails the previous profile is applied again.
+
+#ifndef __CAMERA_PROFILE_H
+#define __CAMERA_PROFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "hps_0.h"
+#include "avalon_camera.hpp"
+#include "avalon_register_map.hpp"
+#include "frame_source.hpp"
+
+// Registers written by a profile (all the configuration of avalon_camera)
+#define CAMERA_PROFILE_REGISTERS 15
+
+#define ERROR_CAMERA_PROFILE_UNKNOWN  -1
+#define ERROR_CAMERA_PROFILE_FILE     -2
+#define ERROR_CAMERA_PROFILE_PARSE    -3
+#define ERROR_CAMERA_PROFILE_GEOMETRY -4
+#define ERROR_CAMERA_PROFILE_SOURCE   -5
+
+/*
+  A named configuration and the register writes that apply it
+*/
+struct CameraProfile {
+  std::string name;
+  // Frame geometry (the width and height registers)
+  uint32_t width, height;
+  RegisterWrite writes[CAMERA_PROFILE_REGISTERS];
+};
+
+// Read the profiles of a file of sections with the register values:
+//   [tracking]
+//   width = 640
+//   height = 480
+//   row_mode = 17
+// The keys are the names of camera_regs (without soft_reset) and the ones
+// not given take the CONFIG_*_DEFAULT values. Lines starting with '#' are
+// comments. Returns 0 or an error (the line with errors is printed).
+int load_camera_profiles(const char* path, std::vector<CameraProfile>* profiles);
+
+/*
+  Class definition of the profile switcher. It owns the frame source of
+  one format, which changes with every switch.
+*/
+class CameraProfileSwitcher {
+  public:
+    // backend: registers of the camera and, without the camera driver, of
+    // the image writers. It must stay open while the switcher is used.
+    CameraProfileSwitcher(RegisterBackend* backend, uint32_t format)
+        : backend(backend), format(format), source(NULL), active(-1),
+          switch_latency_ns(0) {}
+    ~CameraProfileSwitcher(void) { this->close(); }
+    // Apply the profile 'initial' of 'profiles'. Returns 0 or an error.
+    int open(const std::vector<CameraProfile>& profiles, const std::string& initial);
+    int close(void);
+    // Switch to another profile. Must not be called while a frame is read.
+    // Returns 0 or an error (the previous profile stays active).
+    int select(const std::string& name);
+
+    // Frame source of the active profile. It changes after each switch.
+    FrameSource* get_source(void) { return this->source; }
+    const std::vector<CameraProfile>& get_profiles(void) { return this->profiles; }
+    const CameraProfile& get_active(void) { return this->profiles[this->active]; }
+    // Duration of the last switch (steps 1 to 4)
+    uint64_t get_switch_latency_ns(void) { return this->switch_latency_ns; }
+
+  private:
+    // Apply a profile (source must be closed). Returns 0 or an error.
+    int apply(int index);
+    int find(const std::string& name);
+
+    RegisterBackend* backend;
+    uint32_t format;
+    std::vector<CameraProfile> profiles;
+    FrameSource* source;
+    int active;
+    uint64_t switch_latency_ns;
+};
+
+// --Class Methods implementation --//
+
+// Keys of the profile files, in the order of CameraProfile::writes
+struct CameraProfileKey {
+  const char* name;
+  uint32_t default_value;
+  int (*make)(uint32_t value, RegisterWrite* write);
+};
+
+inline const CameraProfileKey* camera_profile_keys(void) {
+  static const CameraProfileKey keys[CAMERA_PROFILE_REGISTERS] = {
+    {"width",        CONFIG_WIDTH_DEFAULT,        &register_write<camera_regs::width>},
+    {"height",       CONFIG_HEIGHT_DEFAULT,       &register_write<camera_regs::height>},
+    {"start_row",    CONFIG_START_ROW_DEFAULT,    &register_write<camera_regs::start_row>},
+    {"start_column", CONFIG_START_COLUMN_DEFAULT, &register_write<camera_regs::start_column>},
+    {"row_size",     CONFIG_ROW_SIZE_DEFAULT,     &register_write<camera_regs::row_size>},
+    {"column_size",  CONFIG_COLUMN_SIZE_DEFAULT,  &register_write<camera_regs::column_size>},
+    {"row_mode",     CONFIG_ROW_MODE_DEFAULT,     &register_write<camera_regs::row_mode>},
+    {"column_mode",  CONFIG_COLUMN_MODE_DEFAULT,  &register_write<camera_regs::column_mode>},
+    {"exposure",     CONFIG_EXPOSURE_DEFAULT,     &register_write<camera_regs::exposure>},
+    {"h_blanking",   CONFIG_H_BLANKING_DEFAULT,   &register_write<camera_regs::h_blanking>},
+    {"v_blanking",   CONFIG_V_BLANKING_DEFAULT,   &register_write<camera_regs::v_blanking>},
+    {"red_gain",     CONFIG_RED_GAIN_DEFAULT,     &register_write<camera_regs::red_gain>},
+    {"blue_gain",    CONFIG_BLUE_GAIN_DEFAULT,    &register_write<camera_regs::blue_gain>},
+    {"green1_gain",  CONFIG_GREEN1_GAIN_DEFAULT,  &register_write<camera_regs::green1_gain>},
+    {"green2_gain",  CONFIG_GREEN2_GAIN_DEFAULT,  &register_write<camera_regs::green2_gain>},
+  };
+  return keys;
+}
+
+// Compute the register image of a profile from its values
+inline int camera_profile_make(const std::string& name,
+    const uint32_t values[CAMERA_PROFILE_REGISTERS], CameraProfile* profile) {
+  const CameraProfileKey* keys = camera_profile_keys();
+  profile->name = name;
+  profile->width = values[0];
+  profile->height = values[1];
+  for (int i = 0; i < CAMERA_PROFILE_REGISTERS; i++) {
+    if (keys[i].make(values[i], &profile->writes[i]) != 0) {
+      return ERROR_REGISTER_RANGE;
+    }
+  }
+  return 0;
+}
+
+inline int load_camera_profiles(const char* path, std::vector<CameraProfile>* profiles) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    printf("ERROR: could not open \"%s\"...\n", path);
+    return ERROR_CAMERA_PROFILE_FILE;
+  }
+  const CameraProfileKey* keys = camera_profile_keys();
+  profiles->clear();
+  std::string name;
+  uint32_t values[CAMERA_PROFILE_REGISTERS];
+  char line[256];
+  int line_number = 0;
+  int error = 0;
+  // The profile of a section is made when the next one begins
+  bool end_of_file = false;
+  while (!end_of_file && (error == 0)) {
+    char key[64];
+    char number[32];
+    char extra[2];
+    char* end;
+    unsigned long value = 0;
+    end_of_file = (fgets(line, sizeof(line), file) == NULL);
+    line_number++;
+    bool section = !end_of_file && (sscanf(line, " [%63[^]]] %1s", key, extra) == 1);
+    if ((section || end_of_file) && !name.empty()) {
+      CameraProfile profile;
+      if (camera_profile_make(name, values, &profile) != 0) {
+        printf("ERROR: %s: values of profile \"%s\" out of range...\n", path, name.c_str());
+        error = ERROR_CAMERA_PROFILE_PARSE;
+        break;
+      }
+      profiles->push_back(profile);
+    }
+    if (end_of_file || (sscanf(line, " %1s", extra) != 1) || (extra[0] == '#')) {
+      continue;
+    }
+    if (section) {
+      name = key;
+      for (int i = 0; i < CAMERA_PROFILE_REGISTERS; i++) {
+        values[i] = keys[i].default_value;
+      }
+      continue;
+    }
+    int index = -1;
+    // Decimal or hexadecimal (0x) values
+    if (!name.empty() && (sscanf(line, " %63[a-z0-9_] = %31s %1s", key, number, extra) == 2) &&
+        ((value = strtoul(number, &end, 0)), *end == '\0') && (value <= 0xFFFFFFFF)) {
+      for (int i = 0; i < CAMERA_PROFILE_REGISTERS; i++) {
+        if (strcmp(key, keys[i].name) == 0) {
+          index = i;
+        }
+      }
+    }
+    if (index < 0) {
+      printf("ERROR: %s:%d: invalid line \"%s\"...\n", path, line_number,
+             strtok(line, "\r\n"));
+      error = ERROR_CAMERA_PROFILE_PARSE;
+      break;
+    }
+    values[index] = value;
+  }
+  fclose(file);
+  return error;
+}
+
+// Geometry attributes of the camera driver
+#define SYSFS_IMAGE_WIDTH  "/sys/uvispace_camera/attributes/image_width"
+#define SYSFS_IMAGE_HEIGHT "/sys/uvispace_camera/attributes/image_height"
+
+inline int camera_driver_set_attribute(const char* path, uint32_t value) {
+  FILE* attribute = fopen(path, "w");
+  if (attribute == NULL) {
+    return ERROR_CAMERA_PROFILE_GEOMETRY;
+  }
+  int written = fprintf(attribute, "%u", value);
+  if ((fclose(attribute) != 0) || (written <= 0)) {
+    return ERROR_CAMERA_PROFILE_GEOMETRY;
+  }
+  return 0;
+}
+
+// CameraProfileSwitcher
+inline int CameraProfileSwitcher::open(const std::vector<CameraProfile>& profiles,
+    const std::string& initial) {
+  this->close();
+  this->profiles = profiles;
+  int index = this->find(initial);
+  if (index < 0) {
+    return ERROR_CAMERA_PROFILE_UNKNOWN;
+  }
+  return this->apply(index);
+}
+
+inline int CameraProfileSwitcher::close(void) {
+  delete this->source;
+  this->source = NULL;
+  this->active = -1;
+  return 0;
+}
+
+inline int CameraProfileSwitcher::select(const std::string& name) {
+  int index = this->find(name);
+  if (index < 0) {
+    return ERROR_CAMERA_PROFILE_UNKNOWN;
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  int previous = this->active;
+  delete this->source;
+  this->source = NULL;
+  int error = this->apply(index);
+  if ((error != 0) && (previous >= 0)) {
+    this->apply(previous);
+  }
+  this->switch_latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  return error;
+}
+
+inline int CameraProfileSwitcher::apply(int index) {
+  const CameraProfile& profile = this->profiles[index];
+  this->active = -1;
+  // Hold the camera in reset while its configuration changes
+  void* camera = this->backend->component_address(AVALON_CAMERA_0_BASE);
+  if (camera == NULL) {
+    return ERROR_CAMERA_PROFILE_SOURCE;
+  }
+  write_registers<RegisterValue<camera_regs::soft_reset, 0> >(camera);
+  write_registers(camera, profile.writes, CAMERA_PROFILE_REGISTERS);
+  write_registers<RegisterValue<camera_regs::soft_reset, 1> >(camera);
+
+  // The driver allocates the buffers with its geometry when it is open
+  if (access(DEV_PATH_BIN, F_OK) == 0) {
+    if ((camera_driver_set_attribute(SYSFS_IMAGE_WIDTH, profile.width) != 0) ||
+        (camera_driver_set_attribute(SYSFS_IMAGE_HEIGHT, profile.height) != 0)) {
+      return ERROR_CAMERA_PROFILE_GEOMETRY;
+    }
+    DeviceFrameSource* device = new DeviceFrameSource(this->format, profile.width,
+                                                      profile.height);
+    if (device->open() != 0) {
+      delete device;
+      return ERROR_CAMERA_PROFILE_SOURCE;
+    }
+    this->source = device;
+  } else {
+    ImageWriterFrameSource* writer = new ImageWriterFrameSource(this->format, profile.width,
+                                                                profile.height);
+    if (writer->open(this->backend) != 0) {
+      delete writer;
+      return ERROR_CAMERA_PROFILE_SOURCE;
+    }
+    this->source = writer;
+  }
+  this->active = index;
+  return 0;
+}
+
+inline int CameraProfileSwitcher::find(const std::string& name) {
+  for (size_t i = 0; i < this->profiles.size(); i++) {
+    if (this->profiles[i].name == name) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+#endif // __CAMERA_PROFILE_H
@@ -0,0 +1,301 @@
+// file: contour_finder.hpp
+// Native version of _find_contours.find_contours (marching squares) used by
+// the triangle detector. It returns the same contours, in the same order,
+// as the Python version with the default parameters
+// (fully_connected='low', positive_orientation='low').
+//
+// Instead of joining the segments through dictionaries keyed by their
+// coordinates, every segment end is identified by the grid element it lies
+// on, computed from the cell coordinates:
+//   3 * (r * width + c) + 0  horizontal edge from pixel (r, c) to (r, c + 1)
+//   3 * (r * width + c) + 1  vertical edge from pixel (r, c) to (r + 1, c)
+//   3 * (r * width + c) + 2  pixel (r, c) itself (its value equals the level)
+// The chains of segments are joined as in the Python version, but looking
+// up the chain that starts or ends on an element in integer tables indexed
+// by those ids and linking the segments by index. The assembly is linear
+// in the number of segments, without hashing nor copying points, and the
+// contours are written as contiguous spans of one coordinate array.
+
+#ifndef __CONTOUR_FINDER_H
+#define __CONTOUR_FINDER_H
+
+#include <inttypes.h>
+#include <math.h>
+
+#include <vector>
+
+#define CONTOUR_EDGE_HORIZONTAL 0
+#define CONTOUR_EDGE_VERTICAL   1
+#define CONTOUR_EDGE_PIXEL      2
+#define CONTOUR_NONE            -1
+
+// A point of a contour in (row, column) image coordinates
+struct ContourPoint {
+  double r, c;
+  bool operator==(const ContourPoint& other) const {
+    return (this->r == other.r) && (this->c == other.c);
+  }
+};
+
+/*
+  Contours stored one after the other. Contour i has the points
+  starts[i] to starts[i + 1] - 1 of rows and cols.
+*/
+struct ContourSet {
+  std::vector<double> rows, cols;
+  std::vector<uint32_t> starts;
+
+  size_t size(void) const { return this->starts.empty() ? 0 : this->starts.size() - 1; }
+  uint32_t length(size_t i) const { return this->starts[i + 1] - this->starts[i]; }
+  const double* contour_rows(size_t i) const { return &this->rows[this->starts[i]]; }
+  const double* contour_cols(size_t i) const { return &this->cols[this->starts[i]]; }
+  ContourPoint point(size_t i, uint32_t index) const {
+    ContourPoint p = {this->rows[this->starts[i] + index], this->cols[this->starts[i] + index]};
+    return p;
+  }
+  void clear(void) {
+    this->rows.clear();
+    this->cols.clear();
+    this->starts.assign(1, 0);
+  }
+};
+
+/*
+  Class definition of the contour finder. The tables grow to the largest
+  image seen and are kept between calls.
+*/
+class ContourFinder {
+  public:
+    // Find the contours of 'level' in an 8-bit image of width x height
+    // pixels (row-major, 'stride' Bytes per row). Returns 0 on success.
+    int find(const uint8_t* image, int width, int height, int stride,
+             double level, ContourSet* contours);
+
+  private:
+    // Marching squares: store the segments crossing 'level'
+    void iterate_and_store(const uint8_t* image, int width, int height,
+                           int stride, double level);
+    // Join the segments into contours
+    void assemble_contours(ContourSet* contours);
+    void add_point(int kind, int r, int c, double point_r, double point_c,
+                   double fraction, int id_width);
+
+    // Segments as consecutive (from, to) points
+    std::vector<double> point_r, point_c;
+    std::vector<int32_t> point_id;
+    // Chain starting and ending on each grid element id
+    std::vector<int32_t> start_chain, end_chain;
+    // First and last segment of each chain (first CONTOUR_NONE once joined
+    // to another chain) and segment after each one in its chain
+    std::vector<int32_t> chain_first, chain_last;
+    std::vector<int32_t> segment_next;
+};
+
+// --Class Methods implementation --//
+
+inline int ContourFinder::find(const uint8_t* image, int width, int height,
+    int stride, double level, ContourSet* contours) {
+  contours->clear();
+  if ((width < 2) || (height < 2)) {
+    return -1;
+  }
+  size_t ids = 3 * (size_t) width * height;
+  if (this->start_chain.size() < ids) {
+    this->start_chain.assign(ids, CONTOUR_NONE);
+    this->end_chain.assign(ids, CONTOUR_NONE);
+  }
+  this->point_r.clear();
+  this->point_c.clear();
+  this->point_id.clear();
+  this->iterate_and_store(image, width, height, stride, level);
+  this->assemble_contours(contours);
+  return 0;
+}
+
+static inline double contour_fraction(double from_value, double to_value,
+    double level) {
+  if (to_value == from_value) {
+    return 0;
+  }
+  return (level - from_value) / (to_value - from_value);
+}
+
+// Store a segment end on the edge 'kind' of pixel (r, c). If it falls on one
+// of the ends of the edge it is identified as that pixel.
+inline void ContourFinder::add_point(int kind, int r, int c, double point_r,
+    double point_c, double fraction, int id_width) {
+  if (fraction == 1) {
+    if (kind == CONTOUR_EDGE_HORIZONTAL) {
+      c++;
+    } else {
+      r++;
+    }
+  }
+  if ((fraction == 0) || (fraction == 1)) {
+    kind = CONTOUR_EDGE_PIXEL;
+  }
+  this->point_r.push_back(point_r);
+  this->point_c.push_back(point_c);
+  this->point_id.push_back(3 * (r * id_width + c) + kind);
+}
+
+inline void ContourFinder::iterate_and_store(const uint8_t* image, int width,
+    int height, int stride, double level) {
+  // Integer pixels are above the level when they are above its floor
+  int threshold = (int) floor(level);
+  // Iterate a 2x2 square across the image. The vertices of each square are
+  //   ul ur
+  //   ll lr
+  // and each one adds a bit to square_case if it is above the level. The
+  // segments are drawn so that the lower-valued pixels are on their left.
+  for (int r0 = 0; r0 < height - 1; r0++) {
+    const uint8_t* row0 = image + (size_t) r0 * stride;
+    const uint8_t* row1 = row0 + stride;
+    int r1 = r0 + 1;
+    // Bits of the left column of the square
+    int left_bits = (row0[0] > threshold) | ((row1[0] > threshold) << 2);
+    for (int c0 = 0; c0 < width - 1; c0++) {
+      int c1 = c0 + 1;
+      int right_bits = ((row0[c1] > threshold) << 1) | ((row1[c1] > threshold) << 3);
+      int square_case = left_bits | right_bits;
+      left_bits = right_bits >> 1;
+      if ((square_case == 0) || (square_case == 15)) {
+        continue;
+      }
+
+      double ul = row0[c0], ur = row0[c1], ll = row1[c0], lr = row1[c1];
+      double top = contour_fraction(ul, ur, level);
+      double bottom = contour_fraction(ll, lr, level);
+      double left = contour_fraction(ul, ll, level);
+      double right = contour_fraction(ur, lr, level);
+#define TOP    this->add_point(CONTOUR_EDGE_HORIZONTAL, r0, c0, r0, c0 + top, top, width)
+#define BOTTOM this->add_point(CONTOUR_EDGE_HORIZONTAL, r1, c0, r1, c0 + bottom, bottom, width)
+#define LEFT   this->add_point(CONTOUR_EDGE_VERTICAL, r0, c0, r0 + left, c0, left, width)
+#define RIGHT  this->add_point(CONTOUR_EDGE_VERTICAL, r0, c1, r0 + right, c1, right, width)
+      switch (square_case) {
+        case 1: TOP; LEFT; break;
+        case 2: RIGHT; TOP; break;
+        case 3: RIGHT; LEFT; break;
+        case 4: LEFT; BOTTOM; break;
+        case 5: TOP; BOTTOM; break;
+        case 6: RIGHT; TOP; LEFT; BOTTOM; break;
+        case 7: RIGHT; BOTTOM; break;
+        case 8: BOTTOM; RIGHT; break;
+        case 9: TOP; LEFT; BOTTOM; RIGHT; break;
+        case 10: BOTTOM; TOP; break;
+        case 11: BOTTOM; LEFT; break;
+        case 12: LEFT; RIGHT; break;
+        case 13: TOP; RIGHT; break;
+        case 14: LEFT; TOP; break;
+      }
+#undef TOP
+#undef BOTTOM
+#undef LEFT
+#undef RIGHT
+    }
+  }
+}
+
+inline void ContourFinder::assemble_contours(ContourSet* contours) {
+  int32_t segments = this->point_id.size() / 2;
+  const int32_t* id = this->point_id.data();
+  int32_t* start_chain = this->start_chain.data();
+  int32_t* end_chain = this->end_chain.data();
+  this->segment_next.assign(segments, CONTOUR_NONE);
+  this->chain_first.clear();
+  this->chain_last.clear();
+  int32_t* next = this->segment_next.data();
+
+  // Same joins as the Python version, with chains of segments linked by
+  // index instead of deques of points. Chain n starts on the element
+  // id[2 * chain_first[n]] and ends on id[2 * chain_last[n] + 1].
+  for (int32_t s = 0; s < segments; s++) {
+    int32_t from_id = id[2 * s];
+    int32_t to_id = id[2 * s + 1];
+    // Ignore degenerate segments (one pixel exactly at the level). The
+    // pixel is picked up by the neighbouring squares.
+    if (from_id == to_id) {
+      continue;
+    }
+    int32_t tail = start_chain[to_id];
+    int32_t head = end_chain[from_id];
+
+    if ((tail != CONTOUR_NONE) && (head != CONTOUR_NONE)) {
+      if (tail == head) {
+        // Close the contour
+        next[this->chain_last[head]] = s;
+        this->chain_last[head] = s;
+        start_chain[to_id] = CONTOUR_NONE;
+        end_chain[from_id] = CONTOUR_NONE;
+        continue;
+      }
+      // Join head + segment + tail, keeping the chain created first so
+      // that the contours are ordered left->right, top->bottom
+      int32_t head_first_id = id[2 * this->chain_first[head]];
+      int32_t tail_last_id = id[2 * this->chain_last[tail] + 1];
+      next[this->chain_last[head]] = s;
+      next[s] = this->chain_first[tail];
+      if (tail > head) {
+        this->chain_last[head] = this->chain_last[tail];
+        this->chain_first[tail] = CONTOUR_NONE;
+        start_chain[to_id] = CONTOUR_NONE;
+        end_chain[tail_last_id] = CONTOUR_NONE;
+        end_chain[from_id] = CONTOUR_NONE;
+        end_chain[tail_last_id] = head;
+      } else {
+        this->chain_first[tail] = this->chain_first[head];
+        this->chain_first[head] = CONTOUR_NONE;
+        start_chain[head_first_id] = CONTOUR_NONE;
+        end_chain[from_id] = CONTOUR_NONE;
+        start_chain[to_id] = CONTOUR_NONE;
+        start_chain[head_first_id] = tail;
+      }
+    } else if ((tail == CONTOUR_NONE) && (head == CONTOUR_NONE)) {
+      // New contour
+      int32_t chain = this->chain_first.size();
+      this->chain_first.push_back(s);
+      this->chain_last.push_back(s);
+      start_chain[from_id] = chain;
+      end_chain[to_id] = chain;
+    } else if (tail != CONTOUR_NONE) {
+      // Prepend the segment to a contour
+      next[s] = this->chain_first[tail];
+      this->chain_first[tail] = s;
+      start_chain[to_id] = CONTOUR_NONE;
+      start_chain[from_id] = tail;
+    } else {
+      // Append the segment to a contour
+      next[this->chain_last[head]] = s;
+      this->chain_last[head] = s;
+      end_chain[from_id] = CONTOUR_NONE;
+      end_chain[to_id] = head;
+    }
+  }
+
+  // Write the contours in order of creation as contiguous spans
+  size_t chains = this->chain_first.size();
+  for (size_t n = 0; n < chains; n++) {
+    int32_t s = this->chain_first[n];
+    if (s == CONTOUR_NONE) {
+      continue;
+    }
+    contours->rows.push_back(this->point_r[2 * s]);
+    contours->cols.push_back(this->point_c[2 * s]);
+    for (; ; s = next[s]) {
+      contours->rows.push_back(this->point_r[2 * s + 1]);
+      contours->cols.push_back(this->point_c[2 * s + 1]);
+      if (s == this->chain_last[n]) {
+        break;
+      }
+    }
+    contours->starts.push_back(contours->rows.size());
+  }
+
+  // Clear the tables for the next image
+  for (int32_t p = 0; p < 2 * segments; p++) {
+    start_chain[id[p]] = CONTOUR_NONE;
+    end_chain[id[p]] = CONTOUR_NONE;
+  }
+}
+
+#endif // __CONTOUR_FINDER_H
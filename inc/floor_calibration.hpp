@@ -0,0 +1,332 @@
+// file: floor_calibration.hpp
+// Position on the floor of the points of the image: the lens distortion is
+// removed and the undistorted pixel is projected on the floor plane.
+//
+// The calibration file has the intrinsics and distortion of the camera
+// (the model of OpenCV: radial k1, k2, k3 and tangential p1, p2) and the
+// homography from undistorted pixels (column, row, 1) to floor coordinates
+// (x, y, 1), in the units of the floor (e.g. mm), one key per line:
+//
+//   # Geometry of the image calibrated (full resolution)
+//   width = 640
+//   height = 480
+//   fx = 520.3
+//   fy = 519.9
+//   cx = 321.2
+//   cy = 238.7
+//   k1 = -0.281
+//   k2 = 0.091
+//   p1 = 0.0004
+//   p2 = -0.0002
+//   k3 = 0
+//   homography = 5.91 0.02 -1893.1 0.01 -5.93 1421.6 0.00001 0.00002 1
+//   # Pixels between the points of the lookup grid (optional, 16 by default)
+//   grid_step = 16
+//
+// The whole mapping is computed once, when the file is read, on a grid of
+// points every grid_step pixels (about 10 kB for VGA: it stays in the
+// cache). A point is mapped by bilinear interpolation between the four grid
+// points around it, so only the points detected are mapped, at the cost of
+// a few multiplications each.
+//
+// The poses on the floor are sent as a header, as the one of the binary
+// triangle messages (triangle_message.hpp) with the magic "UVFP", followed
+// by the FloorPose records.
+
+#ifndef __FLOOR_CALIBRATION_H
+#define __FLOOR_CALIBRATION_H
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "triangle_detector.hpp"
+#include "triangle_message.hpp"
+#include "triangle_pose.hpp"
+
+#define ERROR_FLOOR_CALIBRATION_FILE  -1
+#define ERROR_FLOOR_CALIBRATION_PARSE -2
+#define ERROR_FLOOR_CALIBRATION_MODEL -3
+
+#define FLOOR_MESSAGE_MAGIC       "UVFP"
+#define FLOOR_MESSAGE_POSE_SIZE   40
+
+#define FLOOR_GRID_STEP_DEFAULT 16
+// Iterations of the inverse of the distortion model
+#define FLOOR_UNDISTORT_ITERATIONS 20
+
+// Flags of a floor pose, added to those of the image pose
+#define POSE_OUTSIDE_CALIBRATION 0x8 // a point outside the calibrated image
+
+/*
+  Pose of a UGV on the floor. Fixed size (40 Bytes) and layout, in the
+  byte order of the machine (little-endian on the HPS), like TrianglePose:
+  struct.unpack("<9fHh", record) in Python.
+*/
+struct FloorPose {
+  // Centroid on the floor
+  float x, y;
+  // Direction of the apex on the floor, atan2(y, x)
+  float heading;
+  // Vertices on the floor, in the order of the triangle
+  float vertex_x[3], vertex_y[3];
+  // Flags of the pose in the image and POSE_OUTSIDE_CALIBRATION
+  uint16_t flags;
+  int16_t label;
+};
+
+static_assert(sizeof(FloorPose) == FLOOR_MESSAGE_POSE_SIZE, "FloorPose must be 40 Bytes");
+
+// Write the message of the poses of a frame in 'message' (resized to fit)
+void floor_message_encode(const TriangleMessageHeader& header,
+                          const std::vector<FloorPose>& poses, std::string* message);
+// Read a message. Returns the number of poses or a negative error
+// (ERROR_TRIANGLE_MESSAGE_*).
+int floor_message_decode(const void* message, size_t len, TriangleMessageHeader* header,
+                         std::vector<FloorPose>* poses);
+
+/*
+  Class definition of the floor calibration
+*/
+class FloorCalibration {
+  public:
+    FloorCalibration(void) : width(0), height(0), step(FLOOR_GRID_STEP_DEFAULT),
+                             grid_cols(0), grid_rows(0) {}
+    // Read a calibration file and build the lookup grid. Returns 0 or an
+    // error.
+    int load(const char* path);
+    bool is_loaded(void) const { return !this->grid.empty(); }
+    // Geometry of the image calibrated
+    int get_width(void) const { return this->width; }
+    int get_height(void) const { return this->height; }
+    // Point of the floor of a pixel (row, column) of the distorted image.
+    // Returns false if it is outside the image calibrated (the nearest
+    // point of the border is mapped).
+    bool map(double row, double col, float* x, float* y) const;
+    // Poses on the floor of the triangles and their poses in the image
+    void map_poses(const std::vector<Triangle>& triangles,
+                   const std::vector<TrianglePose>& poses,
+                   std::vector<FloorPose>* floor_poses) const;
+
+  private:
+    // Undistorted pixel of a distorted one
+    void undistort(double col, double row, double* u, double* v) const;
+    // Point of the floor of an undistorted pixel. False if behind the camera
+    bool project(double u, double v, double* x, double* y) const;
+
+    int width, height;
+    double fx, fy, cx, cy;
+    double k1, k2, k3, p1, p2;
+    double homography[9];
+    int step;
+    int grid_cols, grid_rows;
+    // x, y of each grid point, row after row
+    std::vector<float> grid;
+};
+
+// --Class Methods implementation --//
+
+inline int FloorCalibration::load(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    printf("ERROR: could not open \"%s\"...\n", path);
+    return ERROR_FLOOR_CALIBRATION_FILE;
+  }
+  // Keys and the values they need
+  const char* names[13] = {"width", "height", "fx", "fy", "cx", "cy", "k1", "k2", "p1", "p2",
+                           "k3", "homography", "grid_step"};
+  double* values[13] = {NULL, NULL, &this->fx, &this->fy, &this->cx, &this->cy, &this->k1,
+                        &this->k2, &this->p1, &this->p2, &this->k3, this->homography, NULL};
+  bool found[13] = {false};
+  double width = 0, height = 0, step = FLOOR_GRID_STEP_DEFAULT;
+  values[0] = &width;
+  values[1] = &height;
+  values[12] = &step;
+  found[12] = true;
+  char line[512];
+  int line_number = 0;
+  int error = 0;
+  while ((error == 0) && (fgets(line, sizeof(line), file) != NULL)) {
+    line_number++;
+    char key[32];
+    char extra[2];
+    int offset = 0;
+    if ((sscanf(line, " %1s", extra) != 1) || (extra[0] == '#')) {
+      continue;
+    }
+    int k = 0;
+    if (sscanf(line, " %31[a-z_0-9] = %n", key, &offset) == 1) {
+      for (k = 0; (k < 13) && (strcmp(key, names[k]) != 0); k++) {
+      }
+    } else {
+      k = 13;
+    }
+    // 9 numbers for the homography, 1 for the others
+    int count = (k == 11) ? 9 : 1;
+    int parsed = 0;
+    const char* p = line + offset;
+    for (; (k < 13) && (parsed < count); parsed++) {
+      int used;
+      if (sscanf(p, "%lf%n", &values[k][parsed], &used) != 1) {
+        break;
+      }
+      p += used;
+    }
+    if ((k == 13) || (parsed < count) || (sscanf(p, " %1s", extra) == 1)) {
+      printf("ERROR: %s:%d: expected <key> = <value>...\n", path, line_number);
+      error = ERROR_FLOOR_CALIBRATION_PARSE;
+      break;
+    }
+    found[k] = true;
+  }
+  fclose(file);
+  for (int k = 0; (error == 0) && (k < 13); k++) {
+    if (!found[k]) {
+      printf("ERROR: %s: %s missing...\n", path, names[k]);
+      error = ERROR_FLOOR_CALIBRATION_PARSE;
+    }
+  }
+  if (error != 0) {
+    return error;
+  }
+  if ((width < 2) || (height < 2) || (step < 1) || (this->fx <= 0) || (this->fy <= 0)) {
+    printf("ERROR: %s: geometry or focal length out of range...\n", path);
+    return ERROR_FLOOR_CALIBRATION_MODEL;
+  }
+  this->width = width;
+  this->height = height;
+  this->step = step;
+
+  // Grid points every 'step' pixels, up to the last row and column
+  this->grid_cols = (this->width - 1 + this->step - 1) / this->step + 1;
+  this->grid_rows = (this->height - 1 + this->step - 1) / this->step + 1;
+  this->grid.resize(2 * this->grid_cols * this->grid_rows);
+  for (int gr = 0; gr < this->grid_rows; gr++) {
+    for (int gc = 0; gc < this->grid_cols; gc++) {
+      double u, v, x, y;
+      this->undistort(gc * this->step, gr * this->step, &u, &v);
+      if (!this->project(u, v, &x, &y)) {
+        printf("ERROR: %s: the homography maps pixel (%d, %d) to infinity...\n", path,
+               gr * this->step, gc * this->step);
+        this->grid.clear();
+        return ERROR_FLOOR_CALIBRATION_MODEL;
+      }
+      this->grid[2 * (gr * this->grid_cols + gc)] = x;
+      this->grid[2 * (gr * this->grid_cols + gc) + 1] = y;
+    }
+  }
+  return 0;
+}
+
+inline void FloorCalibration::undistort(double col, double row, double* u, double* v) const {
+  // Normalized distorted point, and the undistorted one found by fixed
+  // point iteration as cv::undistortPoints does
+  double xd = (col - this->cx) / this->fx;
+  double yd = (row - this->cy) / this->fy;
+  double x = xd, y = yd;
+  for (int i = 0; i < FLOOR_UNDISTORT_ITERATIONS; i++) {
+    double r2 = x * x + y * y;
+    double radial = 1 + r2 * (this->k1 + r2 * (this->k2 + r2 * this->k3));
+    double dx = 2 * this->p1 * x * y + this->p2 * (r2 + 2 * x * x);
+    double dy = this->p1 * (r2 + 2 * y * y) + 2 * this->p2 * x * y;
+    x = (xd - dx) / radial;
+    y = (yd - dy) / radial;
+  }
+  *u = x * this->fx + this->cx;
+  *v = y * this->fy + this->cy;
+}
+
+inline bool FloorCalibration::project(double u, double v, double* x, double* y) const {
+  const double* h = this->homography;
+  double w = h[6] * u + h[7] * v + h[8];
+  if (fabs(w) < 1e-12) {
+    return false;
+  }
+  *x = (h[0] * u + h[1] * v + h[2]) / w;
+  *y = (h[3] * u + h[4] * v + h[5]) / w;
+  return true;
+}
+
+inline bool FloorCalibration::map(double row, double col, float* x, float* y) const {
+  bool inside = (row >= 0) && (row <= this->height - 1) && (col >= 0) &&
+                (col <= this->width - 1);
+  row = (row < 0) ? 0 : (row > this->height - 1) ? this->height - 1 : row;
+  col = (col < 0) ? 0 : (col > this->width - 1) ? this->width - 1 : col;
+  // Cell of the grid and position in it
+  double gr = row / this->step, gc = col / this->step;
+  int r0 = (int) gr, c0 = (int) gc;
+  r0 = (r0 < this->grid_rows - 1) ? r0 : this->grid_rows - 2;
+  c0 = (c0 < this->grid_cols - 1) ? c0 : this->grid_cols - 2;
+  float fr = gr - r0, fc = gc - c0;
+  const float* p00 = &this->grid[2 * (r0 * this->grid_cols + c0)];
+  const float* p10 = p00 + 2 * this->grid_cols;
+  float w00 = (1 - fr) * (1 - fc), w01 = (1 - fr) * fc, w10 = fr * (1 - fc), w11 = fr * fc;
+  *x = w00 * p00[0] + w01 * p00[2] + w10 * p10[0] + w11 * p10[2];
+  *y = w00 * p00[1] + w01 * p00[3] + w10 * p10[1] + w11 * p10[3];
+  return inside;
+}
+
+inline void FloorCalibration::map_poses(const std::vector<Triangle>& triangles,
+    const std::vector<TrianglePose>& poses, std::vector<FloorPose>* floor_poses) const {
+  floor_poses->resize(poses.size());
+  for (size_t i = 0; i < poses.size(); i++) {
+    const TrianglePose& pose = poses[i];
+    FloorPose& floor = (*floor_poses)[i];
+    bool inside = this->map(pose.row, pose.col, &floor.x, &floor.y);
+    for (int v = 0; v < 3; v++) {
+      inside = this->map(triangles[i].vertices[v].r, triangles[i].vertices[v].c,
+                         &floor.vertex_x[v], &floor.vertex_y[v]) && inside;
+    }
+    // Heading of a point one pixel ahead of the centroid
+    float ahead_x, ahead_y;
+    this->map(pose.row + sin(pose.heading), pose.col + cos(pose.heading), &ahead_x, &ahead_y);
+    floor.heading = atan2(ahead_y - floor.y, ahead_x - floor.x);
+    floor.flags = pose.flags | (inside ? 0 : POSE_OUTSIDE_CALIBRATION);
+    floor.label = pose.label;
+  }
+}
+
+inline void floor_message_encode(const TriangleMessageHeader& header,
+    const std::vector<FloorPose>& poses, std::string* message) {
+  // The header of a message without triangles, and then the records
+  std::vector<Triangle> none;
+  triangle_message_encode(header, none, message);
+  uint8_t* p = (uint8_t*) &(*message)[0];
+  memcpy(p, FLOOR_MESSAGE_MAGIC, 4);
+  triangle_message_put32(p + 12, poses.size());
+  message->append((const char*) poses.data(), poses.size() * sizeof(FloorPose));
+}
+
+inline int floor_message_decode(const void* message, size_t len,
+    TriangleMessageHeader* header, std::vector<FloorPose>* poses) {
+  const uint8_t* p = (const uint8_t*) message;
+  if (len < TRIANGLE_MESSAGE_HEADER_SIZE) {
+    return ERROR_TRIANGLE_MESSAGE_SIZE;
+  }
+  if (memcmp(p, FLOOR_MESSAGE_MAGIC, 4) != 0) {
+    return ERROR_TRIANGLE_MESSAGE_MAGIC;
+  }
+  header->version = triangle_message_get16(p + 4);
+  if (header->version != TRIANGLE_MESSAGE_VERSION) {
+    return ERROR_TRIANGLE_MESSAGE_VERSION;
+  }
+  header->label = (int16_t) triangle_message_get16(p + 6);
+  header->frame_counter = triangle_message_get32(p + 8);
+  header->timestamp_ns = triangle_message_get32(p + 16) |
+                         ((uint64_t) triangle_message_get32(p + 20) << 32);
+  header->count = triangle_message_get32(p + 12);
+  if ((len - TRIANGLE_MESSAGE_HEADER_SIZE) / FLOOR_MESSAGE_POSE_SIZE < header->count) {
+    return ERROR_TRIANGLE_MESSAGE_SIZE;
+  }
+  poses->resize(header->count);
+  if (header->count > 0) {
+    memcpy(poses->data(), p + TRIANGLE_MESSAGE_HEADER_SIZE, header->count * sizeof(FloorPose));
+  }
+  return header->count;
+}
+
+#endif // __FLOOR_CALIBRATION_H
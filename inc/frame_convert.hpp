@@ -0,0 +1,32 @@
+// file: frame_convert.hpp
+// Conversions of the frames of the image writers for the clients that
+// need other layouts (e.g. RGB for display or OpenCV, gray from an RGBG
+// frame so the camera is read only once).
+//
+// RGBG frames have 4 Bytes per pixel in the order R, G, B and Gray.
+
+#ifndef __FRAME_CONVERT_H
+#define __FRAME_CONVERT_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// RGBG to packed RGB (3 Bytes per pixel)
+inline void frame_rgbg_to_rgb(const uint8_t* rgbg, size_t pixels, uint8_t* rgb) {
+  for (size_t i = 0; i < pixels; i++) {
+    rgb[0] = rgbg[0];
+    rgb[1] = rgbg[1];
+    rgb[2] = rgbg[2];
+    rgbg += 4;
+    rgb += 3;
+  }
+}
+
+// Gray component of an RGBG frame (1 Byte per pixel)
+inline void frame_rgbg_to_gray(const uint8_t* rgbg, size_t pixels, uint8_t* gray) {
+  for (size_t i = 0; i < pixels; i++) {
+    gray[i] = rgbg[4 * i + 3];
+  }
+}
+
+#endif // __FRAME_CONVERT_H
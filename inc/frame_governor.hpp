@@ -0,0 +1,245 @@
+// file: frame_governor.hpp
+// Keeps the latency of a frame pipeline within a budget by changing the
+// work done per frame instead of letting the frames queue up.
+//
+// The work is set by a level. Each level is cheaper than the one before
+// it, using in this order:
+//  - side streams (e.g. gray images) processed only every few frames,
+//  - a band of rows (ROI) processed instead of the whole frame,
+//  - hardware downsampling (CAPTURE_DOWNSAMPLING of the image writers).
+//
+// The latency of every frame is fed to update(). The frames are judged in
+// windows of GOVERNOR_WINDOW frames: if more than GOVERNOR_LATE_FRAMES of a
+// window are over the budget the level goes one step up. It goes one step
+// down when all the frames of GOVERNOR_RELAX_WINDOWS windows in a row took
+// less than GOVERNOR_RELAX of the budget. Levels the pipeline can not apply
+// (downsampling above the maximum, or ROIs) are skipped. Frames still in flight with the
+// previous level when it changes are ignored.
+//
+// update() is called from one thread (the last stage of the pipeline);
+// get_level() and get_settings() from any of them.
+
+#ifndef __FRAME_GOVERNOR_H
+#define __FRAME_GOVERNOR_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+// Frames per decision and frames over the budget tolerated in each
+#define GOVERNOR_WINDOW        16
+#define GOVERNOR_LATE_FRAMES   1
+// Fraction of the budget and windows in a row to go one level down
+#define GOVERNOR_RELAX         0.6
+#define GOVERNOR_RELAX_WINDOWS 4
+// Frames ignored after a change (at least the ones in the pipeline)
+#define GOVERNOR_SETTLE_FRAMES 8
+// The ROI is given in eighths of the frame height
+#define GOVERNOR_ROI_FULL      8
+#define GOVERNOR_LEVELS        7
+
+/*
+  Work done per frame at a level
+*/
+struct GovernorLevel {
+  // CAPTURE_DOWNSAMPLING of the image writers
+  uint32_t downsampling;
+  // Rows processed, in eighths of the frame (GOVERNOR_ROI_FULL: all)
+  uint32_t roi_eighths;
+  // Side streams processed one frame out of side_period
+  uint32_t side_period;
+};
+
+// From full quality to the cheapest: relative cost about
+// 1, <1, <1, 3/4, 1/2, 1/4, 1/8 of the pixels processed
+static const GovernorLevel governor_levels[GOVERNOR_LEVELS] = {
+  {1, 8, 1},
+  {1, 8, 2},
+  {1, 8, 4},
+  {1, 6, 4},
+  {1, 4, 8},
+  {2, 8, 8},
+  {2, 4, 8},
+};
+
+/*
+  Decisions of the governor and the frames seen
+*/
+struct GovernorMetrics {
+  uint64_t frames;
+  // Frames over the budget
+  uint64_t late_frames;
+  // Level changes
+  uint64_t degrades, restores;
+  // Largest latency of the last complete window
+  uint64_t window_max_ns;
+  // Frames at each level
+  uint64_t level_frames[GOVERNOR_LEVELS];
+};
+
+/*
+  Class definition of the governor
+*/
+class FrameGovernor {
+  public:
+    // Disabled (always level 0) until started
+    FrameGovernor(void);
+    // Start with a latency budget (0 disables it), the largest downsampling
+    // that can be used (1 for sources without it) and whether the pipeline
+    // can process a band of rows (otherwise the levels with ROI are skipped)
+    void start(uint64_t budget_ns, uint32_t max_downsampling, bool roi = true);
+    bool is_enabled(void) const { return this->budget_ns > 0; }
+    // Latency of a frame, from reading it to the end of the pipeline.
+    // Returns true if the level changed.
+    bool update(uint64_t latency_ns);
+    int get_level(void) const { return this->level.load(std::memory_order_acquire); }
+    const GovernorLevel& get_settings(void) const { return governor_levels[this->get_level()]; }
+    uint64_t get_budget_ns(void) const { return this->budget_ns; }
+    // Only consistent from the thread of update() or once it stopped
+    const GovernorMetrics& get_metrics(void) const { return this->metrics; }
+    // One line describing a level
+    static std::string describe(int level);
+    // Table with the frames at each level and the changes
+    std::string summary(void) const;
+
+  private:
+    void set_level(int new_level);
+    // Whether a level can be used, and the next one up (direction 1) or
+    // down (-1) that can, or 'level' if there is none
+    bool is_usable(int level) const;
+    int next_level(int level, int direction) const;
+    uint64_t budget_ns;
+    uint32_t max_downsampling;
+    bool roi;
+    int max_level;
+    std::atomic<int> level;
+    // Current window
+    uint32_t window_frames, window_late, relax_windows, settle;
+    uint64_t window_max_ns;
+    GovernorMetrics metrics;
+};
+
+// --Class Methods implementation --//
+
+inline FrameGovernor::FrameGovernor(void)
+    : budget_ns(0), max_downsampling(1), roi(true), max_level(0), level(0), window_frames(0), window_late(0),
+      relax_windows(0), settle(0), window_max_ns(0) {
+  this->metrics = GovernorMetrics();
+}
+
+inline void FrameGovernor::start(uint64_t budget_ns, uint32_t max_downsampling, bool roi) {
+  this->budget_ns = budget_ns;
+  this->max_downsampling = max_downsampling;
+  this->roi = roi;
+  this->max_level = 0;
+  for (int i = 0; i < GOVERNOR_LEVELS; i++) {
+    if (this->is_usable(i)) {
+      this->max_level = i;
+    }
+  }
+  this->level = 0;
+  this->window_frames = this->window_late = this->relax_windows = 0;
+  this->settle = 0;
+  this->window_max_ns = 0;
+  this->metrics = GovernorMetrics();
+}
+
+inline bool FrameGovernor::update(uint64_t latency_ns) {
+  this->metrics.frames++;
+  this->metrics.level_frames[this->get_level()]++;
+  if (latency_ns > this->budget_ns) {
+    this->metrics.late_frames++;
+  }
+  if (!this->is_enabled()) {
+    return false;
+  }
+  if (this->settle > 0) {
+    this->settle--;
+    return false;
+  }
+  this->window_frames++;
+  this->window_late += (latency_ns > this->budget_ns);
+  this->window_max_ns = std::max(this->window_max_ns, latency_ns);
+  if (this->window_frames < GOVERNOR_WINDOW) {
+    return false;
+  }
+  this->metrics.window_max_ns = this->window_max_ns;
+  int new_level = this->get_level();
+  if (this->window_late > GOVERNOR_LATE_FRAMES) {
+    this->relax_windows = 0;
+    if (new_level < this->max_level) {
+      new_level = this->next_level(new_level, 1);
+      this->metrics.degrades++;
+    }
+  } else if (this->window_max_ns < GOVERNOR_RELAX * this->budget_ns) {
+    if (++this->relax_windows >= GOVERNOR_RELAX_WINDOWS) {
+      this->relax_windows = 0;
+      if (new_level > 0) {
+        new_level = this->next_level(new_level, -1);
+        this->metrics.restores++;
+      }
+    }
+  } else {
+    this->relax_windows = 0;
+  }
+  this->window_frames = this->window_late = 0;
+  this->window_max_ns = 0;
+  if (new_level == this->get_level()) {
+    return false;
+  }
+  this->set_level(new_level);
+  return true;
+}
+
+inline bool FrameGovernor::is_usable(int level) const {
+  return (governor_levels[level].downsampling <= this->max_downsampling) &&
+         (this->roi || (governor_levels[level].roi_eighths >= GOVERNOR_ROI_FULL));
+}
+
+inline int FrameGovernor::next_level(int level, int direction) const {
+  for (int i = level + direction; (i >= 0) && (i <= this->max_level); i += direction) {
+    if (this->is_usable(i)) {
+      return i;
+    }
+  }
+  return level;
+}
+
+inline void FrameGovernor::set_level(int new_level) {
+  this->level.store(new_level, std::memory_order_release);
+  this->settle = GOVERNOR_SETTLE_FRAMES;
+}
+
+inline std::string FrameGovernor::describe(int level) {
+  const GovernorLevel& settings = governor_levels[level];
+  char line[96];
+  snprintf(line, sizeof(line), "level %d: downsampling %u, rows %u/8, side streams 1/%u",
+           level, settings.downsampling, settings.roi_eighths, settings.side_period);
+  return line;
+}
+
+inline std::string FrameGovernor::summary(void) const {
+  std::string result;
+  char line[128];
+  snprintf(line, sizeof(line), "governor: budget %.1f ms, %llu of %llu frames late, "
+           "%llu degrades, %llu restores\n", this->budget_ns / 1e6,
+           (unsigned long long) this->metrics.late_frames,
+           (unsigned long long) this->metrics.frames,
+           (unsigned long long) this->metrics.degrades,
+           (unsigned long long) this->metrics.restores);
+  result += line;
+  for (int i = 0; i <= this->max_level; i++) {
+    if (!this->is_usable(i)) {
+      continue;
+    }
+    snprintf(line, sizeof(line), "  %-56s %8llu frames\n", describe(i).c_str(),
+             (unsigned long long) this->metrics.level_frames[i]);
+    result += line;
+  }
+  return result;
+}
+
+#endif // __FRAME_GOVERNOR_H
@@ -0,0 +1,412 @@
+// file: frame_recorder.hpp
+// Frame recorder and replay using a preallocated memory-mapped ring file.
+//
+// File layout (all sections 4096-Byte aligned so the frames can also be
+// read with O_DIRECT):
+//   - Header (one page): magic, geometry of the ring and frames written.
+//   - Metadata table: one FrameMetadata (64 Bytes) per slot.
+//   - Data slots: slot_count slots of slot_size Bytes (frame size rounded
+//     up to 4096).
+// The recorder overwrites the oldest slot when the ring is full. Appending
+// a frame is a memcpy into the mapping: no allocation and no system call.
+// A file can be replayed while it is recorded: the sequence of each slot is
+// 0 while it is written, and the replay skips the frames overwritten before
+// or while they are read.
+
+#ifndef __FRAME_RECORDER_H
+#define __FRAME_RECORDER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#define FRAME_RECORDER_MAGIC "UVIREC01"
+#define FRAME_RECORDER_VERSION 1
+#define FRAME_RECORDER_ALIGNMENT 4096
+
+// Pixel formats of the recorded frames (bytes per pixel in brackets)
+#define FRAME_FORMAT_RGBG 0 // (4) R, G, B and Gray
+#define FRAME_FORMAT_GRAY 1 // (1)
+#define FRAME_FORMAT_BIN  2 // (1)
+
+// Replay speeds
+#define REPLAY_RECORDED_SPEED 0 // same frame rate as when recorded
+#define REPLAY_MAX_SPEED      1 // as fast as possible
+
+// Errors
+#define ERROR_RECORDER_OPEN   -1
+#define ERROR_RECORDER_FORMAT -2
+#define ERROR_RECORDER_SIZE   -3
+#define ERROR_RECORDER_EMPTY  -4
+
+// Metadata of one recorded frame (64 Bytes)
+struct FrameMetadata {
+  uint64_t sequence;      // append number starting at 1 (0 = empty slot)
+  uint64_t timestamp_ns;  // capture time (steady clock)
+  uint32_t frame_counter; // CAPTURE_IMAGE_COUNTER or application counter
+  uint32_t format;        // FRAME_FORMAT_*
+  uint32_t width;
+  uint32_t height;
+  uint32_t size;          // Bytes of frame data
+  uint32_t reserved0;
+  // When the capture of the image started in the FPGA and when it was
+  // complete in the buffer (steady clock, 0 if unknown)
+  uint64_t fpga_start_ns;
+  uint64_t fpga_ready_ns;
+  uint32_t reserved[2];
+};
+static_assert(sizeof(FrameMetadata) == 64, "the metadata table has 64 Bytes per slot");
+
+struct FrameRecorderHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t slot_count;
+  uint64_t slot_size;
+  uint64_t metadata_offset;
+  uint64_t data_offset;
+  uint64_t frames_written;
+};
+
+inline size_t frame_recorder_align(size_t size) {
+  return (size + FRAME_RECORDER_ALIGNMENT - 1) & ~((size_t) FRAME_RECORDER_ALIGNMENT - 1);
+}
+
+// Sequence of a slot, read from the mapping (it changes while recording)
+inline uint64_t frame_recorder_sequence(const FrameMetadata* meta) {
+  return *((const volatile uint64_t*) &meta->sequence);
+}
+
+inline uint64_t frame_recorder_now_ns(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+  Records frames in a ring file
+*/
+class FrameRecorder {
+  private:
+    int fd;
+    uint8_t* base;
+    size_t file_size;
+    FrameRecorderHeader* header;
+    FrameMetadata* metadata;
+
+  public:
+    FrameRecorder(void) : fd(-1), base(NULL), file_size(0), header(NULL), metadata(NULL) {}
+    ~FrameRecorder(void) { this->close(); }
+
+    // Create (or overwrite) the ring file with room for slot_count frames
+    // of at most max_frame_size Bytes. The whole file is allocated now.
+    int open(const char* path, size_t max_frame_size, uint32_t slot_count);
+    int close(void);
+
+    // Append a frame. meta->sequence is filled by the recorder and the
+    // timestamp is set to now if it is 0. Returns 0 on success.
+    int append(const void* frame, const FrameMetadata* meta);
+    uint64_t get_frames_written(void) {
+      return (this->header != NULL) ? this->header->frames_written : 0;
+    }
+};
+
+/*
+  Reads the frames of a ring file from the oldest to the newest
+*/
+class FrameReplay {
+  private:
+    int fd;
+    const uint8_t* base;
+    size_t file_size;
+    const FrameRecorderHeader* header;
+    const FrameMetadata* metadata;
+    // Next frame to return and range of valid sequences
+    uint64_t next_sequence, first_sequence, last_sequence;
+    int speed;
+    int loop;
+    // Wall clock and recorded time of the first frame replayed
+    uint64_t replay_start_ns, record_start_ns;
+
+  public:
+    FrameReplay(void) : fd(-1), base(NULL), file_size(0), header(NULL), metadata(NULL),
+        next_sequence(0), first_sequence(0), last_sequence(0),
+        speed(REPLAY_MAX_SPEED), loop(1), replay_start_ns(0), record_start_ns(0) {}
+    ~FrameReplay(void) { this->close(); }
+
+    int open(const char* path);
+    int close(void);
+    // REPLAY_RECORDED_SPEED or REPLAY_MAX_SPEED. With loop the replay starts
+    // again after the newest frame, otherwise ERROR_RECORDER_EMPTY is
+    // returned at the end.
+    void set_speed(int speed) { this->speed = speed; }
+    void set_loop(int loop) { this->loop = loop; }
+    uint64_t get_frame_count(void) { return this->last_sequence - this->first_sequence + 1; }
+    // Go back to the oldest frame. The frames appended since open (or the
+    // previous rewind) by a recorder writing the file are added.
+    void rewind(void);
+
+    // Zero-copy access to the next frame (valid until close). It waits if
+    // replaying at recorded speed. Returns NULL at the end (without loop).
+    // If the file is being recorded the frame may be overwritten while it
+    // is used: read_frame checks it after copying.
+    const uint8_t* get_frame(FrameMetadata* meta);
+    // Copy the next frame into 'destination' (at most len Bytes). Frames
+    // overwritten during the copy are skipped. Returns the Bytes copied or
+    // a negative error.
+    int read_frame(uint8_t* destination, size_t len, FrameMetadata* meta);
+};
+
+// --Class Methods implementation --//
+
+// FrameRecorder
+inline int FrameRecorder::open(const char* path, size_t max_frame_size,
+    uint32_t slot_count) {
+  this->close();
+  if ((max_frame_size == 0) || (slot_count == 0)) {
+    return ERROR_RECORDER_SIZE;
+  }
+  size_t slot_size = frame_recorder_align(max_frame_size);
+  size_t metadata_offset = FRAME_RECORDER_ALIGNMENT;
+  size_t data_offset = metadata_offset +
+      frame_recorder_align(slot_count * sizeof(FrameMetadata));
+  this->file_size = data_offset + slot_size * slot_count;
+
+  this->fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (this->fd == -1) {
+    printf("ERROR: could not open \"%s\"...\n", path);
+    return ERROR_RECORDER_OPEN;
+  }
+  // Reserve all the blocks now so recording never waits for the filesystem
+  if (posix_fallocate(this->fd, 0, this->file_size) != 0) {
+    printf("ERROR: could not allocate %u Bytes for \"%s\"...\n",
+           (unsigned int) this->file_size, path);
+    this->close();
+    return ERROR_RECORDER_SIZE;
+  }
+  this->base = (uint8_t*) mmap(NULL, this->file_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, this->fd, 0);
+  if (this->base == MAP_FAILED) {
+    printf("ERROR: mmap() of \"%s\" failed...\n", path);
+    this->base = NULL;
+    this->close();
+    return ERROR_RECORDER_OPEN;
+  }
+
+  this->header = (FrameRecorderHeader*) this->base;
+  this->metadata = (FrameMetadata*) (this->base + metadata_offset);
+  memset(this->base, 0, data_offset);
+  memcpy(this->header->magic, FRAME_RECORDER_MAGIC, sizeof(this->header->magic));
+  this->header->version = FRAME_RECORDER_VERSION;
+  this->header->slot_count = slot_count;
+  this->header->slot_size = slot_size;
+  this->header->metadata_offset = metadata_offset;
+  this->header->data_offset = data_offset;
+  this->header->frames_written = 0;
+  return 0;
+}
+
+inline int FrameRecorder::close(void) {
+  if (this->base != NULL) {
+    msync(this->base, this->file_size, MS_ASYNC);
+    munmap(this->base, this->file_size);
+    this->base = NULL;
+  }
+  this->header = NULL;
+  this->metadata = NULL;
+  if (this->fd != -1) {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+  return 0;
+}
+
+inline int FrameRecorder::append(const void* frame, const FrameMetadata* meta) {
+  if (this->header == NULL) {
+    return ERROR_RECORDER_OPEN;
+  }
+  if (meta->size > this->header->slot_size) {
+    return ERROR_RECORDER_SIZE;
+  }
+  uint64_t sequence = this->header->frames_written + 1;
+  uint32_t slot = (sequence - 1) % this->header->slot_count;
+  FrameMetadata* slot_metadata = &this->metadata[slot];
+
+  // Invalidate the slot while it is being overwritten so a concurrent
+  // replay skips it instead of getting a torn frame
+  slot_metadata->sequence = 0;
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(this->base + this->header->data_offset + (size_t) slot * this->header->slot_size,
+         frame, meta->size);
+  FrameMetadata copy = *meta;
+  copy.sequence = 0;
+  if (copy.timestamp_ns == 0) {
+    copy.timestamp_ns = frame_recorder_now_ns();
+  }
+  *slot_metadata = copy;
+  std::atomic_thread_fence(std::memory_order_release);
+  slot_metadata->sequence = sequence;
+  this->header->frames_written = sequence;
+  return 0;
+}
+
+// FrameReplay
+inline int FrameReplay::open(const char* path) {
+  struct stat st;
+  this->close();
+  this->fd = ::open(path, O_RDONLY);
+  if ((this->fd == -1) || (fstat(this->fd, &st) != 0)) {
+    printf("ERROR: could not open \"%s\"...\n", path);
+    this->close();
+    return ERROR_RECORDER_OPEN;
+  }
+  this->file_size = st.st_size;
+  if (this->file_size < FRAME_RECORDER_ALIGNMENT) {
+    this->close();
+    return ERROR_RECORDER_FORMAT;
+  }
+  this->base = (const uint8_t*) mmap(NULL, this->file_size, PROT_READ, MAP_SHARED,
+                                     this->fd, 0);
+  if (this->base == MAP_FAILED) {
+    printf("ERROR: mmap() of \"%s\" failed...\n", path);
+    this->base = NULL;
+    this->close();
+    return ERROR_RECORDER_OPEN;
+  }
+  this->header = (const FrameRecorderHeader*) this->base;
+  // The metadata table must be between the header and the data slots, and
+  // the slots inside the file (compared without overflowing)
+  uint64_t file_size = this->file_size;
+  const FrameRecorderHeader* h = this->header;
+  if ((memcmp(h->magic, FRAME_RECORDER_MAGIC, sizeof(h->magic)) != 0) ||
+      (h->version != FRAME_RECORDER_VERSION) ||
+      (h->slot_count == 0) || (h->slot_size == 0) ||
+      (h->metadata_offset < sizeof(FrameRecorderHeader)) ||
+      (h->metadata_offset % sizeof(uint64_t) != 0) ||
+      (h->data_offset > file_size) || (h->metadata_offset > h->data_offset) ||
+      ((uint64_t) h->slot_count * sizeof(FrameMetadata) > h->data_offset - h->metadata_offset) ||
+      (h->slot_size > (file_size - h->data_offset) / h->slot_count)) {
+    printf("ERROR: \"%s\" is not a frame recording...\n", path);
+    this->close();
+    return ERROR_RECORDER_FORMAT;
+  }
+  this->metadata = (const FrameMetadata*) (this->base + this->header->metadata_offset);
+  if (this->header->frames_written == 0) {
+    this->close();
+    return ERROR_RECORDER_EMPTY;
+  }
+  this->rewind();
+  return 0;
+}
+
+inline int FrameReplay::close(void) {
+  if (this->base != NULL) {
+    munmap((void*) this->base, this->file_size);
+    this->base = NULL;
+  }
+  this->header = NULL;
+  this->metadata = NULL;
+  if (this->fd != -1) {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+  return 0;
+}
+
+inline void FrameReplay::rewind(void) {
+  if (this->header == NULL) {
+    return;
+  }
+  this->last_sequence = *((const volatile uint64_t*) &this->header->frames_written);
+  this->first_sequence = (this->last_sequence > this->header->slot_count) ?
+      this->last_sequence - this->header->slot_count + 1 : 1;
+  this->next_sequence = this->first_sequence;
+  this->replay_start_ns = 0;
+}
+
+inline const uint8_t* FrameReplay::get_frame(FrameMetadata* meta) {
+  FrameMetadata frame_meta;
+  uint32_t slot;
+  uint32_t skipped = 0;
+  if (this->header == NULL) {
+    return NULL;
+  }
+  // Skip the slots overwritten since the range was read (a whole ring of
+  // them means the recorder is faster than the replay)
+  while (true) {
+    if (this->next_sequence > this->last_sequence) {
+      if (!this->loop) {
+        return NULL;
+      }
+      this->rewind();
+    }
+    uint64_t sequence = this->next_sequence++;
+    slot = (sequence - 1) % this->header->slot_count;
+    const FrameMetadata* slot_metadata = &this->metadata[slot];
+    if (frame_recorder_sequence(slot_metadata) == sequence) {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      frame_meta = *slot_metadata;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (frame_recorder_sequence(slot_metadata) == sequence) {
+        if (frame_meta.size > this->header->slot_size) {
+          frame_meta.size = this->header->slot_size;
+        }
+        break;
+      }
+    }
+    if (++skipped > this->header->slot_count) {
+      return NULL;
+    }
+  }
+
+  if (this->speed == REPLAY_RECORDED_SPEED) {
+    // Keep the same time between frames as in the recording
+    if (this->replay_start_ns == 0) {
+      this->replay_start_ns = frame_recorder_now_ns();
+      this->record_start_ns = frame_meta.timestamp_ns;
+    } else {
+      uint64_t due = this->replay_start_ns +
+          (frame_meta.timestamp_ns - this->record_start_ns);
+      uint64_t now = frame_recorder_now_ns();
+      if (due > now) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+      }
+    }
+  }
+  if (meta != NULL) {
+    *meta = frame_meta;
+  }
+  return this->base + this->header->data_offset + (size_t) slot * this->header->slot_size;
+}
+
+inline int FrameReplay::read_frame(uint8_t* destination, size_t len,
+    FrameMetadata* meta) {
+  FrameMetadata frame_meta;
+  while (true) {
+    const uint8_t* frame = this->get_frame(&frame_meta);
+    if (frame == NULL) {
+      return ERROR_RECORDER_EMPTY;
+    }
+    size_t size = std::min<uint64_t>(std::min<uint64_t>(len, frame_meta.size),
+                                     this->header->slot_size);
+    memcpy(destination, frame, size);
+    // Skip the frame if the recorder started overwriting it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t slot = (frame_meta.sequence - 1) % this->header->slot_count;
+    if (frame_recorder_sequence(&this->metadata[slot]) == frame_meta.sequence) {
+      if (meta != NULL) {
+        *meta = frame_meta;
+      }
+      return size;
+    }
+  }
+}
+
+#endif // __FRAME_RECORDER_H
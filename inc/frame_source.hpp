@@ -0,0 +1,252 @@
+// file: frame_source.hpp
+// Sources of frames for the applications. All of them return the frame
+// together with its metadata (frame counter, timestamp, format, geometry):
+//  - DeviceFrameSource: a uvispace_camera device of the camera driver.
+//  - ImageWriterFrameSource: an image writer driven from userspace
+//    (real hardware or simulated, see hw_backend.hpp).
+//  - ReplayFrameSource: a recording made with FrameRecorder.
+
+#ifndef __FRAME_SOURCE_H
+#define __FRAME_SOURCE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include "hps_0.h"
+#include "hw_backend.hpp"
+#include "avalon_image_writer.hpp"
+#include "frame_recorder.hpp"
+
+// Devices created by the camera driver for each format
+#define DEV_PATH_RGBG "/dev/uvispace_camera_rgbg"
+#define DEV_PATH_GRAY "/dev/uvispace_camera_gray"
+#define DEV_PATH_BIN  "/dev/uvispace_camera_bin"
+
+#define ERROR_FRAME_SOURCE_OPEN -1
+#define ERROR_FRAME_SOURCE_READ -2
+
+// Bytes per pixel of each FRAME_FORMAT_*
+inline unsigned int frame_format_pixel_size(uint32_t format) {
+  return (format == FRAME_FORMAT_RGBG) ? 4 : 1;
+}
+
+/*
+  Base class of all frame sources
+*/
+class FrameSource {
+  public:
+    virtual ~FrameSource(void) {}
+    // Copy the next frame into 'destination' (at most len Bytes) and fill
+    // its metadata (meta can be NULL). Returns the Bytes copied or a
+    // negative error.
+    virtual int read_frame(uint8_t* destination, size_t len, FrameMetadata* meta) = 0;
+    // Geometry of the frames
+    uint32_t get_format(void) { return this->format; }
+    uint32_t get_width(void) { return this->width; }
+    uint32_t get_height(void) { return this->height; }
+    size_t get_frame_size(void) {
+      return (size_t) this->width * this->height * frame_format_pixel_size(this->format);
+    }
+
+  protected:
+    FrameSource(uint32_t format, uint32_t width, uint32_t height)
+        : format(format), width(width), height(height) {}
+    uint32_t format, width, height;
+};
+
+/*
+  Frames read from the camera driver
+*/
+class DeviceFrameSource : public FrameSource {
+  public:
+    DeviceFrameSource(uint32_t format, uint32_t width, uint32_t height)
+        : FrameSource(format, width, height), fd(-1), frame_counter(0) {}
+    ~DeviceFrameSource(void) { this->close(); }
+    // Open the device of the format (path NULL) or the given one
+    int open(const char* path = NULL);
+    int close(void);
+    int read_frame(uint8_t* destination, size_t len, FrameMetadata* meta);
+    // Descriptor of the device, for reading it asynchronously (-1 if closed)
+    int get_fd(void) { return this->fd; }
+
+  private:
+    int fd;
+    // The driver does not return the image counter: frames are numbered
+    // in the order they are read
+    uint32_t frame_counter;
+};
+
+/*
+  Frames acquired driving the image writer from userspace
+*/
+class ImageWriterFrameSource : public FrameSource {
+  public:
+    ImageWriterFrameSource(uint32_t format, uint32_t width, uint32_t height)
+        : FrameSource(format, width, height), backend(NULL), writer(NULL) {}
+    ~ImageWriterFrameSource(void) { this->close(); }
+    // Open the image writer of the format in the backend and start a
+    // continuous capture. The backend must stay open until close.
+    int open(RegisterBackend* backend);
+    int close(void);
+    int read_frame(uint8_t* destination, size_t len, FrameMetadata* meta);
+    ImageWriter* get_image_writer(void) { return this->writer; }
+
+  private:
+    RegisterBackend* backend;
+    ImageWriter* writer;
+};
+
+/*
+  Frames replayed from a recording
+*/
+class ReplayFrameSource : public FrameSource {
+  public:
+    ReplayFrameSource(void) : FrameSource(FRAME_FORMAT_GRAY, 0, 0) {}
+    // The geometry is taken from the first frame of the recording
+    int open(const char* path, int speed = REPLAY_RECORDED_SPEED);
+    int close(void) { return this->replay.close(); }
+    int read_frame(uint8_t* destination, size_t len, FrameMetadata* meta);
+
+  private:
+    FrameReplay replay;
+};
+
+// --Class Methods implementation --//
+
+// DeviceFrameSource
+inline int DeviceFrameSource::open(const char* path) {
+  if (path == NULL) {
+    if (this->format == FRAME_FORMAT_RGBG) {
+      path = DEV_PATH_RGBG;
+    } else if (this->format == FRAME_FORMAT_GRAY) {
+      path = DEV_PATH_GRAY;
+    } else {
+      path = DEV_PATH_BIN;
+    }
+  }
+  this->fd = ::open(path, O_RDONLY);
+  if (this->fd == -1) {
+    return ERROR_FRAME_SOURCE_OPEN;
+  }
+  return 0;
+}
+
+inline int DeviceFrameSource::close(void) {
+  if (this->fd != -1) {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+  return 0;
+}
+
+inline int DeviceFrameSource::read_frame(uint8_t* destination, size_t len,
+    FrameMetadata* meta) {
+  if (len > this->get_frame_size()) {
+    len = this->get_frame_size();
+  }
+  // The driver returns a whole image per read
+  ssize_t nread = ::read(this->fd, destination, len);
+  if (nread < 0) {
+    return ERROR_FRAME_SOURCE_READ;
+  }
+  this->frame_counter++;
+  if (meta != NULL) {
+    memset(meta, 0, sizeof(*meta));
+    meta->timestamp_ns = frame_recorder_now_ns();
+    meta->frame_counter = this->frame_counter;
+    meta->format = this->format;
+    meta->width = this->width;
+    meta->height = this->height;
+    meta->size = len;
+  }
+  return len;
+}
+
+// ImageWriterFrameSource
+inline int ImageWriterFrameSource::open(RegisterBackend* backend) {
+  unsigned long base;
+  if (this->format == FRAME_FORMAT_RGBG) {
+    base = AVALON_IMG_WRITER_RGBGRAY_BASE;
+  } else if (this->format == FRAME_FORMAT_GRAY) {
+    base = AVALON_IMG_WRITER_GRAY_BASE;
+  } else {
+    base = AVALON_IMG_WRITER_BINARY_BASE;
+  }
+  this->close();
+  this->backend = backend;
+  this->writer = new ImageWriter(backend->component_address(base));
+  if ((this->writer->alloc_buffers(backend, this->get_frame_size()) != 0) ||
+      (this->writer->start_capture() != 0)) {
+    this->close();
+    return ERROR_FRAME_SOURCE_OPEN;
+  }
+  return 0;
+}
+
+inline int ImageWriterFrameSource::close(void) {
+  delete this->writer;
+  this->writer = NULL;
+  this->backend = NULL;
+  return 0;
+}
+
+inline int ImageWriterFrameSource::read_frame(uint8_t* destination, size_t len,
+    FrameMetadata* meta) {
+  uint32_t image_number;
+  // Downsampled frames only fill the beginning of the buffer
+  uint32_t downsampling = std::max<uint32_t>(this->writer->get_downsampling(), 1);
+  size_t size = (size_t) (this->width / downsampling) * (this->height / downsampling) *
+                frame_format_pixel_size(this->format);
+  int nread = this->writer->read_frame(destination, std::min(len, size), &image_number);
+  if (nread < 0) {
+    return ERROR_FRAME_SOURCE_READ;
+  }
+  if (meta != NULL) {
+    memset(meta, 0, sizeof(*meta));
+    meta->timestamp_ns = frame_recorder_now_ns();
+    meta->frame_counter = image_number;
+    meta->fpga_start_ns = this->writer->get_frame_start_ns();
+    meta->fpga_ready_ns = this->writer->get_frame_ready_ns();
+    meta->format = this->format;
+    meta->width = this->width / downsampling;
+    meta->height = this->height / downsampling;
+    meta->size = nread;
+  }
+  return nread;
+}
+
+// ReplayFrameSource
+inline int ReplayFrameSource::open(const char* path, int speed) {
+  FrameMetadata meta;
+  int error = this->replay.open(path);
+  if (error != 0) {
+    return error;
+  }
+  this->replay.set_speed(speed);
+  if (this->replay.get_frame(&meta) == NULL) {
+    return ERROR_RECORDER_EMPTY;
+  }
+  this->format = meta.format;
+  this->width = meta.width;
+  this->height = meta.height;
+  this->replay.rewind();
+  return 0;
+}
+
+inline int ReplayFrameSource::read_frame(uint8_t* destination, size_t len,
+    FrameMetadata* meta) {
+  int nread = this->replay.read_frame(destination, len, meta);
+  if ((nread >= 0) && (meta != NULL)) {
+    // Those of the recording, not of this run
+    meta->fpga_start_ns = 0;
+    meta->fpga_ready_ns = 0;
+  }
+  return nread;
+}
+
+#endif // __FRAME_SOURCE_H
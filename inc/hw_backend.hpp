@@ -0,0 +1,804 @@
+// file: hw_backend.hpp
+// Register backends that provide the FPGA address map used by the HAL
+// classes (Camera, ImageProcessing...).
+//
+// The HAL classes only need the virtual address of their component and
+// access it with the macros in hw_io.hpp. A backend provides that address:
+//  - MmioBackend: the real FPGA registers, mapped through /dev/mem. DMA
+//    buffers for userspace capture come from a udmabuf device.
+//  - SimRegisterBackend: an in-memory register file. Writes are stored and
+//    read back but have no other effect. Enough to exercise Camera and
+//    ImageProcessing on a PC.
+//  - SimImageWriterBackend: register file plus a simulated FPGA that follows
+//    the avalon_image_writer semantics (CAPTURE_STANDBY,
+//    LAST_BUFFER_CAPTURED, CAPTURE_IMAGE_COUNTER...) and writes synthetic
+//    frames into simulated DMA memory at a configurable frame rate.
+// open_register_backend() chooses one of them using the UVISPACE_BACKEND
+// environment variable, so the same binary runs on the board or on a PC.
+
+#ifndef __HW_BACKEND_H
+#define __HW_BACKEND_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Macros for accessing an address map
+#include "hw_io.hpp"
+// Base addresses of the components in the FPGA
+#include "hps_0.h"
+// Internal address maps of the components
+#include "avalon_camera_regs.h"
+#include "avalon_image_processing_regs.h"
+#include "avalon_image_writer_regs.h"
+
+//Constants to do mmap and get access to FPGA peripherals
+#define HPS_FPGA_BRIDGE_BASE 0xC0000000
+#define HW_REGS_BASE ( HPS_FPGA_BRIDGE_BASE )
+#define HW_REGS_SPAN ( 0x04000000 )
+#define HW_REGS_MASK ( HW_REGS_SPAN - 1 )
+
+// udmabuf device that exports physically contiguous memory to userspace.
+// It can be changed with the UVISPACE_UDMABUF environment variable.
+#define UDMABUF_NAME_DEFAULT "udmabuf0"
+
+// Span of the simulated register file. It covers all components in hps_0.h
+#define SIM_REGS_SPAN 0x1000
+// Fake physical address of the first simulated DMA buffer
+#define SIM_DMA_PHYSICAL_BASE 0x20000000
+#define SIM_DMA_ALIGNMENT 4096
+
+// Image writer modes (same values as in the camera driver)
+#ifndef SINGLE_SHOT
+#define SINGLE_SHOT 0
+#define CONTINUOUS  1
+#endif
+
+// Default frame rate of the simulated image writers
+#define SIM_FPS_DEFAULT 30.0
+// Default image size used by the simulation if the camera registers are 0
+#define SIM_WIDTH_DEFAULT 640
+#define SIM_HEIGHT_DEFAULT 480
+// Value written in the binary image for pixels inside the thresholds
+#define SIM_BINARY_WHITE 255
+
+/*
+  Base class of all register backends
+*/
+class RegisterBackend {
+  public:
+    RegisterBackend(void) : virtual_base(NULL), span(0) {}
+    virtual ~RegisterBackend(void) {}
+
+    // Map the address space. Return 0 on success.
+    virtual int open(void) = 0;
+    // Unmap the address space. Return 0 on success.
+    virtual int close(void) = 0;
+
+    // Allocate physically contiguous memory that the FPGA can write into.
+    // Returns the virtual address (NULL on failure) and fills the physical
+    // address that must be written in the image writer registers.
+    virtual void* alloc_dma_buffer(size_t size, uint32_t* physical_address) = 0;
+    virtual int free_dma_buffer(void* buffer) = 0;
+
+    // Virtual address of the component with the given base address
+    // (the *_BASE constants in hps_0.h). NULL if it is out of the span.
+    void* component_address(unsigned long base) {
+      unsigned long offset = base & (unsigned long) HW_REGS_MASK;
+      if ((this->virtual_base == NULL) || (offset >= this->span)) {
+        return NULL;
+      }
+      return (void*) ((uint8_t*) this->virtual_base + offset);
+    }
+
+  protected:
+    void* virtual_base;
+    size_t span;
+};
+
+/*
+  Real hardware: FPGA registers mapped from /dev/mem
+*/
+class MmioBackend : public RegisterBackend {
+  public:
+    MmioBackend(void) : fd(-1), udmabuf_fd(-1), udmabuf_base(NULL),
+        udmabuf_physical_address(0), udmabuf_size(0), udmabuf_used(0),
+        udmabuf_buffers(0) {}
+    ~MmioBackend(void) { this->close(); }
+    int open(void);
+    int close(void);
+    // DMA buffers are carved from the udmabuf device. Only needed when the
+    // image writers are driven from userspace instead of the camera driver.
+    void* alloc_dma_buffer(size_t size, uint32_t* physical_address);
+    int free_dma_buffer(void* buffer);
+
+  private:
+    int open_udmabuf(void);
+    void close_udmabuf(void);
+    int fd;
+    // udmabuf memory is mapped once and handed out sequentially
+    int udmabuf_fd;
+    void* udmabuf_base;
+    uint32_t udmabuf_physical_address;
+    size_t udmabuf_size;
+    size_t udmabuf_used;
+    int udmabuf_buffers;
+};
+
+/*
+  In-memory register file. Registers keep the last value written.
+*/
+class SimRegisterBackend : public RegisterBackend {
+  public:
+    SimRegisterBackend(void) : next_physical_address(SIM_DMA_PHYSICAL_BASE) {}
+    ~SimRegisterBackend(void) { this->close(); }
+    int open(void);
+    int close(void);
+    // DMA buffers are regular memory with a fake physical address
+    void* alloc_dma_buffer(size_t size, uint32_t* physical_address);
+    int free_dma_buffer(void* buffer);
+
+  protected:
+    // Simulated physical memory: translates an address written in a
+    // register into the memory it points to. NULL if it is not allocated.
+    // len is filled with the bytes available from that address.
+    void* physical_to_virtual(uint32_t physical_address, size_t* len);
+
+  private:
+    struct DmaRegion {
+      uint32_t physical_address;
+      size_t size;
+      void* virtual_address;
+    };
+    std::vector<DmaRegion> dma_regions;
+    std::mutex dma_mutex;
+    uint32_t next_physical_address;
+};
+
+/*
+  Register file plus simulated image writers producing synthetic frames
+*/
+// Type of image written by a simulated image writer
+#define SIM_FRAME_RGBG 0
+#define SIM_FRAME_GRAY 1
+#define SIM_FRAME_BIN  2
+
+class SimImageWriterBackend : public SimRegisterBackend {
+  public:
+    SimImageWriterBackend(double fps = SIM_FPS_DEFAULT);
+    ~SimImageWriterBackend(void) { this->close(); }
+    // Opens the register file and starts the simulated FPGA
+    int open(void);
+    // Stops the simulated FPGA and releases the register file
+    int close(void);
+
+    // Add a simulated image writer at the given base address. The three
+    // image writers in hps_0.h are added by the constructor.
+    int add_image_writer(unsigned long base, int frame_type);
+    // Change the frame rate. Can be called while running. A frame rate that
+    // is not positive is rejected and SIM_FPS_DEFAULT used instead.
+    void set_fps(double fps);
+    double get_fps(void) { return this->fps; }
+
+  private:
+    struct SimImageWriter {
+      unsigned long base;
+      int frame_type;
+      int state;          // SIM_WRITER_IDLE, SIM_WRITER_SINGLE_SHOT or
+                          // SIM_WRITER_CONTINUOUS
+      int buffer;         // buffer written by the frame being captured
+      uint32_t captured;  // frames captured since START_CAPTURE
+    };
+    // A synthetic UGV: a coloured isosceles triangle pointing to its heading
+    struct SimUgv {
+      double x, y, heading;
+      uint8_t r, g, b;
+    };
+
+    void run(void);
+    void tick(SimImageWriter* writer, uint32_t frame_number);
+    void update_scene(uint32_t frame_number);
+    void render(SimImageWriter* writer, uint8_t* buffer, size_t len);
+    int is_binary_white(uint8_t r, uint8_t g, uint8_t b);
+
+    std::vector<SimImageWriter> writers;
+    std::vector<SimUgv> ugvs;
+    std::thread fpga_thread;
+    std::atomic<bool> running;
+    std::atomic<double> fps;
+    uint32_t frame_number;
+    // Geometry and thresholds latched at the beginning of each frame
+    unsigned int width, height;
+    uint8_t thresholds[6];
+};
+
+// Create and open the backend chosen with the UVISPACE_BACKEND environment
+// variable: "mmio" (real hardware), "sim" (register file only),
+// "sim_writer" (register file + simulated image writers, the frame rate is
+// taken from UVISPACE_SIM_FPS) or "auto" (mmio when running on the HPS,
+// sim_writer on any other machine). default_name is used when the variable is
+// not set. Returns NULL on failure.
+RegisterBackend* open_register_backend(const char* default_name = "mmio");
+// Close and delete a backend returned by open_register_backend
+int close_register_backend(RegisterBackend* backend);
+
+// --Class Methods implementation --//
+
+// MmioBackend
+inline int MmioBackend::open(void) {
+  // Open the device file for accessing the physical memory
+  if ((this->fd = ::open("/dev/mem", (O_RDWR | O_SYNC))) == -1) {
+    printf("ERROR: could not open \"/dev/mem\"...\n");
+    return -1;
+  }
+  // Map the physical memory to the virtual address space. The base address
+  // for the FPGA address map is stored in 'virtual_base'.
+  this->virtual_base = mmap(NULL, HW_REGS_SPAN, (PROT_READ | PROT_WRITE),
+                            MAP_SHARED, this->fd, HW_REGS_BASE);
+  if (this->virtual_base == MAP_FAILED) {
+    printf("ERROR: mmap() failed...\n");
+    this->virtual_base = NULL;
+    ::close(this->fd);
+    this->fd = -1;
+    return -1;
+  }
+  this->span = HW_REGS_SPAN;
+  return 0;
+}
+
+inline int MmioBackend::close(void) {
+  int error = 0;
+  this->close_udmabuf();
+  if (this->virtual_base != NULL) {
+    if (munmap(this->virtual_base, HW_REGS_SPAN) != 0) {
+      printf("ERROR: munmap() failed...\n");
+      error = -1;
+    }
+    this->virtual_base = NULL;
+    this->span = 0;
+  }
+  if (this->fd != -1) {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+  return error;
+}
+
+inline int MmioBackend::open_udmabuf(void) {
+  char path[128];
+  char value[64];
+  const char* name = getenv("UVISPACE_UDMABUF");
+  if (name == NULL) {
+    name = UDMABUF_NAME_DEFAULT;
+  }
+
+  // Physical address and size are exported in sysfs. The class name
+  // changed from udmabuf to u-dma-buf in newer versions of the driver.
+  const char* classes[] = {"u-dma-buf", "udmabuf"};
+  FILE* f = NULL;
+  int i;
+  for (i = 0; (i < 2) && (f == NULL); i++) {
+    snprintf(path, sizeof(path), "/sys/class/%s/%s/phys_addr", classes[i], name);
+    f = fopen(path, "r");
+  }
+  if ((f == NULL) || (fgets(value, sizeof(value), f) == NULL)) {
+    printf("ERROR: could not read the physical address of %s...\n", name);
+    if (f != NULL) fclose(f);
+    return -1;
+  }
+  fclose(f);
+  this->udmabuf_physical_address = strtoul(value, NULL, 0);
+  snprintf(path, sizeof(path), "/sys/class/%s/%s/size", classes[i - 1], name);
+  f = fopen(path, "r");
+  if ((f == NULL) || (fgets(value, sizeof(value), f) == NULL)) {
+    printf("ERROR: could not read the size of %s...\n", name);
+    if (f != NULL) fclose(f);
+    return -1;
+  }
+  fclose(f);
+  this->udmabuf_size = strtoul(value, NULL, 0);
+
+  // O_SYNC maps the buffer uncached, the same as dma_alloc_coherent in the
+  // driver, so the CPU always sees what the FPGA wrote.
+  snprintf(path, sizeof(path), "/dev/%s", name);
+  if ((this->udmabuf_fd = ::open(path, (O_RDWR | O_SYNC))) == -1) {
+    printf("ERROR: could not open \"%s\"...\n", path);
+    return -1;
+  }
+  this->udmabuf_base = mmap(NULL, this->udmabuf_size, (PROT_READ | PROT_WRITE),
+                            MAP_SHARED, this->udmabuf_fd, 0);
+  if (this->udmabuf_base == MAP_FAILED) {
+    printf("ERROR: mmap() of \"%s\" failed...\n", path);
+    this->close_udmabuf();
+    return -1;
+  }
+  this->udmabuf_used = 0;
+  return 0;
+}
+
+inline void MmioBackend::close_udmabuf(void) {
+  if ((this->udmabuf_base != NULL) && (this->udmabuf_base != MAP_FAILED)) {
+    munmap(this->udmabuf_base, this->udmabuf_size);
+  }
+  this->udmabuf_base = NULL;
+  if (this->udmabuf_fd != -1) {
+    ::close(this->udmabuf_fd);
+    this->udmabuf_fd = -1;
+  }
+  this->udmabuf_used = 0;
+  this->udmabuf_buffers = 0;
+}
+
+inline void* MmioBackend::alloc_dma_buffer(size_t size,
+    uint32_t* physical_address) {
+  if ((this->udmabuf_base == NULL) && (this->open_udmabuf() != 0)) {
+    return NULL;
+  }
+  // Keep every buffer page aligned
+  size_t aligned_size = (size + SIM_DMA_ALIGNMENT - 1) & ~((size_t) SIM_DMA_ALIGNMENT - 1);
+  if (this->udmabuf_used + aligned_size > this->udmabuf_size) {
+    printf("ERROR: udmabuf too small (%u bytes needed, %u free)...\n",
+           (unsigned int) size, (unsigned int) (this->udmabuf_size - this->udmabuf_used));
+    return NULL;
+  }
+  void* buffer = (uint8_t*) this->udmabuf_base + this->udmabuf_used;
+  *physical_address = this->udmabuf_physical_address + this->udmabuf_used;
+  this->udmabuf_used += aligned_size;
+  this->udmabuf_buffers++;
+  return buffer;
+}
+
+// The udmabuf memory is given back when all its buffers are freed
+inline int MmioBackend::free_dma_buffer(void* buffer) {
+  if ((this->udmabuf_buffers == 0) || (buffer < this->udmabuf_base) ||
+      (buffer >= (void*) ((uint8_t*) this->udmabuf_base + this->udmabuf_used))) {
+    return -1;
+  }
+  this->udmabuf_buffers--;
+  if (this->udmabuf_buffers == 0) {
+    this->close_udmabuf();
+  }
+  return 0;
+}
+
+// SimRegisterBackend
+inline int SimRegisterBackend::open(void) {
+  if (this->virtual_base != NULL) {
+    return 0;
+  }
+  // All registers are 0 after reset
+  this->virtual_base = calloc(1, SIM_REGS_SPAN);
+  if (this->virtual_base == NULL) {
+    printf("ERROR: could not allocate the simulated register file...\n");
+    return -1;
+  }
+  this->span = SIM_REGS_SPAN;
+  return 0;
+}
+
+inline int SimRegisterBackend::close(void) {
+  free(this->virtual_base);
+  this->virtual_base = NULL;
+  this->span = 0;
+  std::lock_guard<std::mutex> lock(this->dma_mutex);
+  for (size_t i = 0; i < this->dma_regions.size(); i++) {
+    free(this->dma_regions[i].virtual_address);
+  }
+  this->dma_regions.clear();
+  return 0;
+}
+
+inline void* SimRegisterBackend::alloc_dma_buffer(size_t size,
+    uint32_t* physical_address) {
+  void* buffer;
+  if (posix_memalign(&buffer, SIM_DMA_ALIGNMENT, size) != 0) {
+    return NULL;
+  }
+  memset(buffer, 0, size);
+  std::lock_guard<std::mutex> lock(this->dma_mutex);
+  DmaRegion region;
+  region.physical_address = this->next_physical_address;
+  region.size = size;
+  region.virtual_address = buffer;
+  this->dma_regions.push_back(region);
+  // Next region starts at the next aligned fake physical address
+  this->next_physical_address +=
+      (size + SIM_DMA_ALIGNMENT - 1) & ~((size_t) SIM_DMA_ALIGNMENT - 1);
+  *physical_address = region.physical_address;
+  return buffer;
+}
+
+inline int SimRegisterBackend::free_dma_buffer(void* buffer) {
+  std::lock_guard<std::mutex> lock(this->dma_mutex);
+  for (size_t i = 0; i < this->dma_regions.size(); i++) {
+    if (this->dma_regions[i].virtual_address == buffer) {
+      free(buffer);
+      this->dma_regions.erase(this->dma_regions.begin() + i);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+inline void* SimRegisterBackend::physical_to_virtual(uint32_t physical_address,
+    size_t* len) {
+  std::lock_guard<std::mutex> lock(this->dma_mutex);
+  for (size_t i = 0; i < this->dma_regions.size(); i++) {
+    DmaRegion* region = &this->dma_regions[i];
+    if ((physical_address >= region->physical_address) &&
+        (physical_address < region->physical_address + region->size)) {
+      size_t offset = physical_address - region->physical_address;
+      *len = region->size - offset;
+      return (uint8_t*) region->virtual_address + offset;
+    }
+  }
+  *len = 0;
+  return NULL;
+}
+
+// SimImageWriterBackend
+#define SIM_WRITER_IDLE        0
+#define SIM_WRITER_SINGLE_SHOT 1
+#define SIM_WRITER_CONTINUOUS  2
+
+inline SimImageWriterBackend::SimImageWriterBackend(double fps)
+    : running(false), fps(SIM_FPS_DEFAULT), frame_number(0),
+      width(SIM_WIDTH_DEFAULT), height(SIM_HEIGHT_DEFAULT) {
+  this->set_fps(fps);
+  memset(this->thresholds, 0, sizeof(this->thresholds));
+  this->add_image_writer(AVALON_IMG_WRITER_RGBGRAY_BASE, SIM_FRAME_RGBG);
+  this->add_image_writer(AVALON_IMG_WRITER_GRAY_BASE, SIM_FRAME_GRAY);
+  this->add_image_writer(AVALON_IMG_WRITER_BINARY_BASE, SIM_FRAME_BIN);
+  // Three UGVs with the colours used to tell the teams apart
+  SimUgv ugv;
+  memset(&ugv, 0, sizeof(ugv));
+  ugv.r = 220; ugv.g = 30;  ugv.b = 30;  this->ugvs.push_back(ugv);
+  ugv.r = 30;  ugv.g = 200; ugv.b = 40;  this->ugvs.push_back(ugv);
+  ugv.r = 40;  ugv.g = 50;  ugv.b = 210; this->ugvs.push_back(ugv);
+}
+
+inline void SimImageWriterBackend::set_fps(double fps) {
+  // Also false for NaN
+  if (!(fps > 0)) {
+    printf("ERROR: simulated frame rate %g is not positive, using %g\n", fps,
+           SIM_FPS_DEFAULT);
+    fps = SIM_FPS_DEFAULT;
+  }
+  this->fps = fps;
+}
+
+inline int SimImageWriterBackend::add_image_writer(unsigned long base,
+    int frame_type) {
+  if (this->running) {
+    return -1;
+  }
+  SimImageWriter writer;
+  writer.base = base;
+  writer.frame_type = frame_type;
+  writer.state = SIM_WRITER_IDLE;
+  writer.buffer = 0;
+  writer.captured = 0;
+  this->writers.push_back(writer);
+  return 0;
+}
+
+inline int SimImageWriterBackend::open(void) {
+  if (this->running) {
+    return 0;
+  }
+  if (SimRegisterBackend::open() != 0) {
+    return -1;
+  }
+  // Binarization thresholds after reset detect red UGVs (the defaults of
+  // avalon_image_processing.hpp)
+  void* img_proc = this->component_address(AVALON_IMAGE_PROCESSING_0_BASE);
+  IOWR32(img_proc, ADDR_HUE_THRESHOLD_L, 230);
+  IOWR32(img_proc, ADDR_HUE_THRESHOLD_H, 20);
+  IOWR32(img_proc, ADDR_BRI_THRESHOLD_L, 45);
+  IOWR32(img_proc, ADDR_BRI_THRESHOLD_H, 255);
+  IOWR32(img_proc, ADDR_SAT_THRESHOLD_L, 20);
+  IOWR32(img_proc, ADDR_SAT_THRESHOLD_H, 255);
+  // Image writers come out of reset idle and ready to capture
+  for (size_t i = 0; i < this->writers.size(); i++) {
+    void* address = this->component_address(this->writers[i].base);
+    if (address == NULL) {
+      printf("ERROR: simulated image writer out of the register file...\n");
+      SimRegisterBackend::close();
+      return -1;
+    }
+    IOWR32(address, CAPTURE_DOWNSAMPLING, 1);
+    IOWR32(address, CAPTURE_STANDBY, 1);
+  }
+  this->running = true;
+  this->fpga_thread = std::thread(&SimImageWriterBackend::run, this);
+  return 0;
+}
+
+inline int SimImageWriterBackend::close(void) {
+  if (this->running) {
+    this->running = false;
+    this->fpga_thread.join();
+  }
+  return SimRegisterBackend::close();
+}
+
+// Simulated FPGA. Every frame period each image writer finishes the frame
+// being captured and starts a new one.
+inline void SimImageWriterBackend::run(void) {
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+  while (this->running) {
+    // Latch camera geometry and binarization thresholds for this frame
+    void* camera = this->component_address(AVALON_CAMERA_0_BASE);
+    void* img_proc = this->component_address(AVALON_IMAGE_PROCESSING_0_BASE);
+    this->width = IORD32(camera, ADDR_WIDTH);
+    this->height = IORD32(camera, ADDR_HEIGHT);
+    if ((this->width == 0) || (this->height == 0)) {
+      this->width = SIM_WIDTH_DEFAULT;
+      this->height = SIM_HEIGHT_DEFAULT;
+    }
+    this->thresholds[0] = IORD32(img_proc, ADDR_HUE_THRESHOLD_L);
+    this->thresholds[1] = IORD32(img_proc, ADDR_HUE_THRESHOLD_H);
+    this->thresholds[2] = IORD32(img_proc, ADDR_BRI_THRESHOLD_L);
+    this->thresholds[3] = IORD32(img_proc, ADDR_BRI_THRESHOLD_H);
+    this->thresholds[4] = IORD32(img_proc, ADDR_SAT_THRESHOLD_L);
+    this->thresholds[5] = IORD32(img_proc, ADDR_SAT_THRESHOLD_H);
+    this->update_scene(this->frame_number);
+
+    for (size_t i = 0; i < this->writers.size(); i++) {
+      this->tick(&this->writers[i], this->frame_number);
+    }
+    this->frame_number++;
+
+    // Wait for the next frame. If we are late do not try to catch up.
+    std::chrono::steady_clock::duration period =
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / this->fps));
+    next += period;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (next < now) {
+      next = now;
+    }
+    std::this_thread::sleep_until(next);
+  }
+}
+
+inline void SimImageWriterBackend::tick(SimImageWriter* writer,
+    uint32_t frame_number) {
+  void* address = this->component_address(writer->base);
+
+  // End of the frame being captured: write it into its buffer
+  if (writer->state != SIM_WRITER_IDLE) {
+    uint32_t physical_address = IORD32(address,
+        writer->buffer == 0 ? CAPTURE_BUFF0 : CAPTURE_BUFF1);
+    size_t len;
+    uint8_t* buffer = (uint8_t*) this->physical_to_virtual(physical_address, &len);
+    if (buffer != NULL) {
+      this->render(writer, buffer, len);
+    }
+    // The image must be in memory before software can see it
+    std::atomic_thread_fence(std::memory_order_release);
+    IOWR32(address, LAST_BUFFER_CAPTURED, writer->buffer);
+    writer->captured++;
+    if (writer->state == SIM_WRITER_SINGLE_SHOT) {
+      IOWR32(address, START_CAPTURE, 0);
+      writer->state = SIM_WRITER_IDLE;
+    }
+  }
+
+  // Beginning of a new frame
+  uint32_t mode = IORD32(address, CAPTURE_MODE);
+  uint32_t start = IORD32(address, START_CAPTURE);
+  if (start && (mode == CONTINUOUS)) {
+    if (writer->state != SIM_WRITER_CONTINUOUS) {
+      writer->captured = 0;
+    }
+    writer->state = SIM_WRITER_CONTINUOUS;
+    if (IORD32(address, CONT_DOUBLE_BUFF)) {
+      // First image to buff0, second to buff1, then buff0...
+      writer->buffer = writer->captured & 1;
+    } else {
+      writer->buffer = IORD32(address, CAPTURE_BUFFER_SELECT) & 1;
+    }
+  } else if (start && (mode == SINGLE_SHOT)) {
+    writer->state = SIM_WRITER_SINGLE_SHOT;
+    writer->buffer = IORD32(address, CAPTURE_BUFFER_SELECT) & 1;
+  } else {
+    writer->state = SIM_WRITER_IDLE;
+  }
+  // Software sees the new counter only after the state of the new frame
+  IOWR32(address, CAPTURE_STANDBY, writer->state == SIM_WRITER_IDLE);
+  std::atomic_thread_fence(std::memory_order_release);
+  IOWR32(address, CAPTURE_IMAGE_COUNTER, frame_number);
+}
+
+// UGVs drive around circles of different radius and speed. The scene only
+// depends on the frame number so the same frames are produced at any fps.
+inline void SimImageWriterBackend::update_scene(uint32_t frame_number) {
+  double t = frame_number / SIM_FPS_DEFAULT;
+  for (size_t i = 0; i < this->ugvs.size(); i++) {
+    double speed = 0.3 + 0.15 * i;
+    double radius = 0.15 + 0.1 * i;
+    double angle = speed * t + 2.0 * M_PI * i / this->ugvs.size();
+    this->ugvs[i].x = this->width * (0.5 + radius * cos(angle));
+    this->ugvs[i].y = this->height * (0.5 + radius * sin(angle));
+    this->ugvs[i].heading = angle + M_PI / 2;
+  }
+}
+
+// Return 1 if the colour is inside the latched HSV thresholds
+inline int SimImageWriterBackend::is_binary_white(uint8_t r, uint8_t g,
+    uint8_t b) {
+  int max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+  int min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+  int delta = max - min;
+  int hue = 0;
+  int sat = (max == 0) ? 0 : (delta * 255) / max;
+  int bri = max;
+  // Hue in 0-255 (0-360 degrees)
+  if (delta != 0) {
+    if (max == r) {
+      hue = (43 * (g - b)) / delta;
+    } else if (max == g) {
+      hue = 85 + (43 * (b - r)) / delta;
+    } else {
+      hue = 171 + (43 * (r - g)) / delta;
+    }
+    hue &= 0xFF;
+  }
+  int hue_in;
+  if (this->thresholds[0] <= this->thresholds[1]) {
+    hue_in = (hue >= this->thresholds[0]) && (hue <= this->thresholds[1]);
+  } else {
+    // The range wraps around 0 (red)
+    hue_in = (hue >= this->thresholds[0]) || (hue <= this->thresholds[1]);
+  }
+  return hue_in &&
+         (bri >= this->thresholds[2]) && (bri <= this->thresholds[3]) &&
+         (sat >= this->thresholds[4]) && (sat <= this->thresholds[5]);
+}
+
+inline void SimImageWriterBackend::render(SimImageWriter* writer,
+    uint8_t* buffer, size_t len) {
+  void* address = this->component_address(writer->base);
+  unsigned int downsampling = IORD32(address, CAPTURE_DOWNSAMPLING);
+  if (downsampling == 0) {
+    downsampling = 1;
+  }
+  unsigned int pixel_size = (writer->frame_type == SIM_FRAME_RGBG) ? 4 : 1;
+  unsigned int out_width = this->width / downsampling;
+  unsigned int out_height = this->height / downsampling;
+  // Never write out of the buffer
+  if ((size_t) out_width * pixel_size > len) {
+    return;
+  }
+  if ((size_t) out_width * out_height * pixel_size > len) {
+    out_height = len / (out_width * pixel_size);
+  }
+
+  // Background: gray checkerboard floor (no saturation)
+  uint8_t bg_white = this->is_binary_white(60, 60, 60) ? SIM_BINARY_WHITE : 0;
+  for (unsigned int y = 0; y < out_height; y++) {
+    uint8_t* row = buffer + (size_t) y * out_width * pixel_size;
+    for (unsigned int x = 0; x < out_width; x++) {
+      uint8_t level = ((((x * downsampling) >> 5) + ((y * downsampling) >> 5)) & 1) ? 80 : 60;
+      if (writer->frame_type == SIM_FRAME_RGBG) {
+        row[4 * x + 0] = level;
+        row[4 * x + 1] = level;
+        row[4 * x + 2] = level;
+        row[4 * x + 3] = level;
+      } else if (writer->frame_type == SIM_FRAME_GRAY) {
+        row[x] = level;
+      } else {
+        row[x] = bg_white;
+      }
+    }
+  }
+
+  // UGVs: rasterize each triangle inside its bounding box
+  double size = 24.0 * this->width / SIM_WIDTH_DEFAULT;
+  for (size_t i = 0; i < this->ugvs.size(); i++) {
+    const SimUgv* ugv = &this->ugvs[i];
+    double c = cos(ugv->heading), s = sin(ugv->heading);
+    // Apex forward, base corners behind (in downsampled pixels)
+    double vx[3], vy[3];
+    const double local_x[3] = {1.0, -0.6, -0.6};
+    const double local_y[3] = {0.0, 0.5, -0.5};
+    double min_x = 1e9, max_x = -1e9, min_y = 1e9, max_y = -1e9;
+    for (int k = 0; k < 3; k++) {
+      vx[k] = (ugv->x + size * (local_x[k] * c - local_y[k] * s)) / downsampling;
+      vy[k] = (ugv->y + size * (local_x[k] * s + local_y[k] * c)) / downsampling;
+      min_x = fmin(min_x, vx[k]); max_x = fmax(max_x, vx[k]);
+      min_y = fmin(min_y, vy[k]); max_y = fmax(max_y, vy[k]);
+    }
+    int x0 = (int) fmax(0, floor(min_x)), x1 = (int) fmin(out_width - 1, ceil(max_x));
+    int y0 = (int) fmax(0, floor(min_y)), y1 = (int) fmin(out_height - 1, ceil(max_y));
+    uint8_t gray = (77 * ugv->r + 150 * ugv->g + 29 * ugv->b) >> 8;
+    uint8_t white = this->is_binary_white(ugv->r, ugv->g, ugv->b) ? SIM_BINARY_WHITE : 0;
+    for (int y = y0; y <= y1; y++) {
+      uint8_t* row = buffer + (size_t) y * out_width * pixel_size;
+      for (int x = x0; x <= x1; x++) {
+        // Inside if the point is on the same side of the 3 edges
+        double px = x + 0.5, py = y + 0.5;
+        double e0 = (vx[1] - vx[0]) * (py - vy[0]) - (vy[1] - vy[0]) * (px - vx[0]);
+        double e1 = (vx[2] - vx[1]) * (py - vy[1]) - (vy[2] - vy[1]) * (px - vx[1]);
+        double e2 = (vx[0] - vx[2]) * (py - vy[2]) - (vy[0] - vy[2]) * (px - vx[2]);
+        if (!(((e0 >= 0) && (e1 >= 0) && (e2 >= 0)) ||
+              ((e0 <= 0) && (e1 <= 0) && (e2 <= 0)))) {
+          continue;
+        }
+        if (writer->frame_type == SIM_FRAME_RGBG) {
+          row[4 * x + 0] = ugv->r;
+          row[4 * x + 1] = ugv->g;
+          row[4 * x + 2] = ugv->b;
+          row[4 * x + 3] = gray;
+        } else if (writer->frame_type == SIM_FRAME_GRAY) {
+          row[x] = gray;
+        } else {
+          row[x] = white;
+        }
+      }
+    }
+  }
+}
+
+// Backend selection
+inline RegisterBackend* open_register_backend(const char* default_name) {
+  RegisterBackend* backend;
+  const char* name = getenv("UVISPACE_BACKEND");
+  if (name == NULL) {
+    name = default_name;
+  }
+  if (strcmp(name, "auto") == 0) {
+    // The FPGA is only reachable when running on the HPS (ARM)
+#if defined(__arm__)
+    name = "mmio";
+#else
+    printf("No FPGA in this machine, using the simulated image writers\n");
+    name = "sim_writer";
+#endif
+  }
+  if (strcmp(name, "mmio") == 0) {
+    backend = new MmioBackend();
+  } else if (strcmp(name, "sim") == 0) {
+    backend = new SimRegisterBackend();
+  } else if (strcmp(name, "sim_writer") == 0) {
+    const char* fps = getenv("UVISPACE_SIM_FPS");
+    double sim_fps = SIM_FPS_DEFAULT;
+    if (fps != NULL) {
+      char* end;
+      sim_fps = strtod(fps, &end);
+      if ((end == fps) || (*end != '\0') || !(sim_fps > 0)) {
+        printf("ERROR: wrong UVISPACE_SIM_FPS \"%s\", using %g\n", fps, SIM_FPS_DEFAULT);
+        sim_fps = SIM_FPS_DEFAULT;
+      }
+    }
+    backend = new SimImageWriterBackend(sim_fps);
+  } else {
+    printf("ERROR: unknown UVISPACE_BACKEND \"%s\" (mmio, sim, sim_writer or auto)\n", name);
+    return NULL;
+  }
+  if (backend->open() != 0) {
+    delete backend;
+    return NULL;
+  }
+  return backend;
+}
+
+inline int close_register_backend(RegisterBackend* backend) {
+  int error = backend->close();
+  delete backend;
+  return error;
+}
+
+#endif // __HW_BACKEND_H
@@ -2,16 +2,19 @@
 
 /*
 Macros for accessing an address map with a data bus size of 8, 16 or 32 bits.
+Accesses are volatile so the compiler never caches, merges or reorders them:
+the address map may be FPGA registers (MMIO) or a simulated register file
+updated by another thread (see hw_backend.hpp).
 */
 #ifndef __LOW_LEVEL_RW_MACROS
 #define __LOW_LEVEL_RW_MACROS
 // Macro for R/W operations on 8-bit addresses.
-#define IOWR8(base, offset, dat)        (*((uint8_t*)(base) + (offset)) = (uint8_t)(dat))
-#define IORD8(base, offset)             (*((uint8_t*)(base) + (offset)))
+#define IOWR8(base, offset, dat)        (*((volatile uint8_t*)(base) + (offset)) = (uint8_t)(dat))
+#define IORD8(base, offset)             (*((volatile uint8_t*)(base) + (offset)))
 // Macro for R/W operations on 16-bit addresses.
-#define IOWR16(base, offset, dat)       ((*((uint16_t*)((uint8_t*)(base) + (offset)))) = (uint16_t)(dat))
-#define IORD16(base, offset)            (*((uint16_t*)((uint8_t)(base) + (offset))))
+#define IOWR16(base, offset, dat)       ((*((volatile uint16_t*)((uint8_t*)(base) + (offset)))) = (uint16_t)(dat))
+#define IORD16(base, offset)            (*((volatile uint16_t*)((uint8_t*)(base) + (offset))))
 // Macro for R/W operations on 32-bit addresses.
-#define IOWR32(base, offset, dat)       ((*((uint32_t*) ((uint8_t*)(base) + (offset)))) = (uint32_t)(dat))
-#define IORD32(base, offset)            (*((uint32_t*) ((uint8_t*)(base) + (offset))))
+#define IOWR32(base, offset, dat)       ((*((volatile uint32_t*) ((uint8_t*)(base) + (offset)))) = (uint32_t)(dat))
+#define IORD32(base, offset)            (*((volatile uint32_t*) ((uint8_t*)(base) + (offset))))
 #endif
@@ -0,0 +1,301 @@
+// file: io_ring.hpp
+// Minimal io_uring ring (without liburing) for the servers: reads of
+// files into registered buffers and socket sends and receives, queued and
+// then submitted together with a single io_uring_enter that can also wait
+// for their completions.
+//
+// Files are given as indexes of the registered (fixed) files and reads use
+// the registered buffers, so the kernel does not look them up nor map them
+// per operation. Registering files or buffers must be done with no
+// operations in flight (older kernels wait for them to complete).
+//
+// Needs Linux 5.7 (IORING_FEAT_FAST_POLL, send and receive operations);
+// open() fails with older kernels so the caller can fall back to blocking
+// system calls. A ring is used by one thread.
+
+#ifndef __IO_RING_H
+#define __IO_RING_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include <algorithm>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup    425
+#define __NR_io_uring_enter    426
+#define __NR_io_uring_register 427
+#endif
+
+#define ERROR_IO_RING_SETUP    -1
+#define ERROR_IO_RING_REGISTER -2
+#define ERROR_IO_RING_FULL     -3
+#define ERROR_IO_RING_ENTER    -4
+
+/*
+  Completion of an operation
+*/
+struct IoRingCompletion {
+  uint64_t user_data;
+  // Bytes transferred or a negative errno
+  int result;
+};
+
+/*
+  Class definition of the ring
+*/
+class IoRing {
+  public:
+    IoRing(void);
+    ~IoRing(void) { this->close(); }
+    // Create a ring of 'entries' submissions (power of 2)
+    int open(unsigned int entries);
+    int close(void);
+    bool is_open(void) const { return this->fd >= 0; }
+    // Fixed files, used with their index in 'fds'
+    int register_files(const int* fds, unsigned int count);
+    int unregister_files(void);
+    // Registered buffers, used with their index in 'buffers'
+    int register_buffers(const struct iovec* buffers, unsigned int count);
+    int unregister_buffers(void);
+    // Queue an operation. Returns 0 or ERROR_IO_RING_FULL. With 'link' the
+    // next operation queued starts when this one completes in full, and is
+    // cancelled if it fails or is short.
+    int read_fixed(int file, void* buffer, unsigned int len, uint64_t offset, int buffer_index,
+                   uint64_t user_data, bool link = false);
+    // Read into a buffer not registered
+    int read(int file, void* buffer, unsigned int len, uint64_t offset, uint64_t user_data,
+             bool link = false);
+    int send(int file, const void* buffer, unsigned int len, uint64_t user_data,
+             bool link = false);
+    int recv(int file, void* buffer, unsigned int len, uint64_t user_data, bool link = false);
+    // Submit the operations queued and wait until 'wait' completions are
+    // available. Returns the operations submitted or ERROR_IO_RING_ENTER
+    // (0 if interrupted by a signal).
+    int submit(unsigned int wait = 0);
+    // Take the next completion. Returns false if there is none.
+    bool pop(IoRingCompletion* completion);
+    // System calls made by the ring (enter and register)
+    uint64_t get_syscalls(void) const { return this->syscalls; }
+
+  private:
+    struct io_uring_sqe* get_sqe(void);
+    int do_register(unsigned int opcode, const void* arg, unsigned int count);
+    int fd;
+    struct io_uring_params params;
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe* sqes;
+    // Submission ring
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    // Completion ring
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe* cqes;
+    // Submissions queued and not submitted yet
+    unsigned int sqe_tail, sqe_submitted;
+    uint64_t syscalls;
+};
+
+// --Class Methods implementation --//
+
+inline IoRing::IoRing(void)
+    : fd(-1), sq_ring(MAP_FAILED), cq_ring(MAP_FAILED), sq_ring_size(0), cq_ring_size(0),
+      sqes((struct io_uring_sqe*) MAP_FAILED), sqe_tail(0), sqe_submitted(0), syscalls(0) {
+  memset(&this->params, 0, sizeof(this->params));
+}
+
+inline int IoRing::open(unsigned int entries) {
+  this->close();
+  memset(&this->params, 0, sizeof(this->params));
+  this->fd = syscall(__NR_io_uring_setup, entries, &this->params);
+  this->syscalls++;
+  if (this->fd < 0) {
+    this->fd = -1;
+    return ERROR_IO_RING_SETUP;
+  }
+  if (!(this->params.features & IORING_FEAT_FAST_POLL)) {
+    this->close();
+    return ERROR_IO_RING_SETUP;
+  }
+  struct io_uring_params& p = this->params;
+  this->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  this->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  // Both rings are in the same mapping (IORING_FEAT_SINGLE_MMAP, implied
+  // by IORING_FEAT_FAST_POLL)
+  this->sq_ring_size = this->cq_ring_size = std::max(this->sq_ring_size, this->cq_ring_size);
+  this->sq_ring = mmap(NULL, this->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING);
+  this->cq_ring = this->sq_ring;
+  this->sqes = (struct io_uring_sqe*) mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES);
+  if ((this->sq_ring == MAP_FAILED) || (this->sqes == MAP_FAILED)) {
+    this->close();
+    return ERROR_IO_RING_SETUP;
+  }
+  uint8_t* sq = (uint8_t*) this->sq_ring;
+  this->sq_head = (unsigned int*) (sq + p.sq_off.head);
+  this->sq_tail = (unsigned int*) (sq + p.sq_off.tail);
+  this->sq_mask = (unsigned int*) (sq + p.sq_off.ring_mask);
+  this->sq_array = (unsigned int*) (sq + p.sq_off.array);
+  uint8_t* cq = (uint8_t*) this->cq_ring;
+  this->cq_head = (unsigned int*) (cq + p.cq_off.head);
+  this->cq_tail = (unsigned int*) (cq + p.cq_off.tail);
+  this->cq_mask = (unsigned int*) (cq + p.cq_off.ring_mask);
+  this->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+  this->sqe_tail = this->sqe_submitted = *this->sq_tail;
+  return 0;
+}
+
+inline int IoRing::close(void) {
+  if (this->sqes != MAP_FAILED) {
+    munmap(this->sqes, this->params.sq_entries * sizeof(struct io_uring_sqe));
+    this->sqes = (struct io_uring_sqe*) MAP_FAILED;
+  }
+  if (this->sq_ring != MAP_FAILED) {
+    munmap(this->sq_ring, this->sq_ring_size);
+    this->sq_ring = this->cq_ring = MAP_FAILED;
+  }
+  if (this->fd >= 0) {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+  return 0;
+}
+
+inline int IoRing::do_register(unsigned int opcode, const void* arg, unsigned int count) {
+  this->syscalls++;
+  if (syscall(__NR_io_uring_register, this->fd, opcode, arg, count) < 0) {
+    return ERROR_IO_RING_REGISTER;
+  }
+  return 0;
+}
+
+inline int IoRing::register_files(const int* fds, unsigned int count) {
+  return this->do_register(IORING_REGISTER_FILES, fds, count);
+}
+
+inline int IoRing::unregister_files(void) {
+  return this->do_register(IORING_UNREGISTER_FILES, NULL, 0);
+}
+
+inline int IoRing::register_buffers(const struct iovec* buffers, unsigned int count) {
+  return this->do_register(IORING_REGISTER_BUFFERS, buffers, count);
+}
+
+inline int IoRing::unregister_buffers(void) {
+  return this->do_register(IORING_UNREGISTER_BUFFERS, NULL, 0);
+}
+
+inline struct io_uring_sqe* IoRing::get_sqe(void) {
+  unsigned int head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+  if (this->sqe_tail - head >= this->params.sq_entries) {
+    return NULL;
+  }
+  unsigned int index = this->sqe_tail & *this->sq_mask;
+  struct io_uring_sqe* sqe = &this->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  this->sq_array[index] = index;
+  this->sqe_tail++;
+  return sqe;
+}
+
+inline int IoRing::read_fixed(int file, void* buffer, unsigned int len, uint64_t offset,
+                              int buffer_index, uint64_t user_data, bool link) {
+  struct io_uring_sqe* sqe = this->get_sqe();
+  if (sqe == NULL) {
+    return ERROR_IO_RING_FULL;
+  }
+  sqe->opcode = IORING_OP_READ_FIXED;
+  sqe->flags = IOSQE_FIXED_FILE | (link ? IOSQE_IO_LINK : 0);
+  sqe->fd = file;
+  sqe->addr = (uint64_t) (uintptr_t) buffer;
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->buf_index = buffer_index;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+inline int IoRing::read(int file, void* buffer, unsigned int len, uint64_t offset,
+                        uint64_t user_data, bool link) {
+  struct io_uring_sqe* sqe = this->get_sqe();
+  if (sqe == NULL) {
+    return ERROR_IO_RING_FULL;
+  }
+  sqe->opcode = IORING_OP_READ;
+  sqe->flags = IOSQE_FIXED_FILE | (link ? IOSQE_IO_LINK : 0);
+  sqe->fd = file;
+  sqe->addr = (uint64_t) (uintptr_t) buffer;
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+inline int IoRing::send(int file, const void* buffer, unsigned int len, uint64_t user_data,
+                        bool link) {
+  struct io_uring_sqe* sqe = this->get_sqe();
+  if (sqe == NULL) {
+    return ERROR_IO_RING_FULL;
+  }
+  sqe->opcode = IORING_OP_SEND;
+  sqe->flags = IOSQE_FIXED_FILE | (link ? IOSQE_IO_LINK : 0);
+  sqe->fd = file;
+  sqe->addr = (uint64_t) (uintptr_t) buffer;
+  sqe->len = len;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+inline int IoRing::recv(int file, void* buffer, unsigned int len, uint64_t user_data,
+                        bool link) {
+  struct io_uring_sqe* sqe = this->get_sqe();
+  if (sqe == NULL) {
+    return ERROR_IO_RING_FULL;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->flags = IOSQE_FIXED_FILE | (link ? IOSQE_IO_LINK : 0);
+  sqe->fd = file;
+  sqe->addr = (uint64_t) (uintptr_t) buffer;
+  sqe->len = len;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+inline int IoRing::submit(unsigned int wait) {
+  unsigned int count = this->sqe_tail - this->sqe_submitted;
+  __atomic_store_n(this->sq_tail, this->sqe_tail, __ATOMIC_RELEASE);
+  this->syscalls++;
+  int submitted = syscall(__NR_io_uring_enter, this->fd, count, wait,
+                          (wait > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (submitted < 0) {
+    // Interrupted while waiting: the caller waits again
+    return (errno == EINTR) ? 0 : ERROR_IO_RING_ENTER;
+  }
+  this->sqe_submitted += submitted;
+  return submitted;
+}
+
+inline bool IoRing::pop(IoRingCompletion* completion) {
+  unsigned int head = *this->cq_head;
+  if (head == __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  struct io_uring_cqe* cqe = &this->cqes[head & *this->cq_mask];
+  completion->user_data = cqe->user_data;
+  completion->result = cqe->res;
+  __atomic_store_n(this->cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+#endif // __IO_RING_H
@@ -0,0 +1,262 @@
+// file: latency_trace.hpp
+// Lightweight timestamp tracing of the frame pipeline stages, from the FPGA
+// frame counter to the moment the results are sent to a client.
+//
+// Each thread records events in its own ring buffer (single producer, no
+// locks, no allocation after the first event of the thread). The rings
+// keep the last TRACE_RING_SIZE events of each thread and can be dumped at
+// any time as Chrome trace JSON (chrome://tracing, Perfetto) or summarized
+// as p50/p99/p999 latency per stage.
+//
+// Usage: latency_trace::record(TRACE_READ_COMPLETE, frame_number) after each
+// stage, using the same frame number in all stages of a frame. The FPGA
+// stages are timestamped by the frame source (FrameMetadata::fpga_start_ns
+// and fpga_ready_ns) and recorded with record_fpga when the frame is read.
+
+#ifndef __LATENCY_TRACE_H
+#define __LATENCY_TRACE_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Pipeline stages
+#define TRACE_FPGA_FRAME      0 // new CAPTURE_IMAGE_COUNTER value seen
+#define TRACE_FRAME_READY     1 // frame complete in the driver/DMA buffer
+#define TRACE_READ_COMPLETE   2 // frame available in the application
+#define TRACE_DETECT_COMPLETE 3 // detection results ready
+#define TRACE_SEND            4 // results or frame sent to the socket
+#define TRACE_STAGES          5
+
+// Events kept per thread (power of 2)
+#define TRACE_RING_SIZE 4096
+
+namespace latency_trace {
+
+    struct event {
+        uint64_t timestamp_ns;
+        uint32_t frame;
+        uint32_t stage;
+    };
+
+    // Ring buffer of one thread. Only the owner thread writes.
+    struct ring {
+        event events[TRACE_RING_SIZE];
+        // Number of events ever written
+        std::atomic<uint64_t> head;
+        int thread_index;
+    };
+
+    inline const char* stage_name(int stage) {
+        static const char* names[TRACE_STAGES] = {
+            "fpga_frame", "frame_ready", "read_complete", "detect_complete", "send"};
+        return ((stage >= 0) && (stage < TRACE_STAGES)) ? names[stage] : "unknown";
+    }
+
+    inline uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Registry of the rings of all threads. Locked only when a thread
+    // records its first event and when dumping.
+    inline std::mutex& registry_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    inline std::vector<ring*>& registry() {
+        static std::vector<ring*> rings;
+        return rings;
+    }
+    inline std::atomic<bool>& enabled() {
+        static std::atomic<bool> flag(true);
+        return flag;
+    }
+
+    inline ring* thread_ring() {
+        // Rings are never freed so they can be dumped after the thread ends
+        static thread_local ring* local = NULL;
+        if (local == NULL) {
+            local = new ring();
+            local->head.store(0);
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            local->thread_index = registry().size();
+            registry().push_back(local);
+        }
+        return local;
+    }
+
+    // Record that 'frame' reached 'stage' now
+    inline void record(int stage, uint32_t frame, uint64_t timestamp_ns = 0) {
+        if (!enabled().load(std::memory_order_relaxed)) {
+            return;
+        }
+        ring* r = thread_ring();
+        uint64_t head = r->head.load(std::memory_order_relaxed);
+        event* e = &r->events[head & (TRACE_RING_SIZE - 1)];
+        e->timestamp_ns = (timestamp_ns != 0) ? timestamp_ns : now_ns();
+        e->frame = frame;
+        e->stage = stage;
+        r->head.store(head + 1, std::memory_order_release);
+    }
+
+    // Record the FPGA stages of 'frame' at the times given, if known (not 0)
+    inline void record_fpga(uint32_t frame, uint64_t start_ns, uint64_t ready_ns) {
+        if (start_ns != 0) {
+            record(TRACE_FPGA_FRAME, frame, start_ns);
+        }
+        if (ready_ns != 0) {
+            record(TRACE_FRAME_READY, frame, ready_ns);
+        }
+    }
+
+    // Copy the events currently in all rings. Events overwritten while
+    // copying are discarded.
+    inline std::vector<std::pair<int, event> > snapshot() {
+        std::vector<std::pair<int, event> > result;
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for (size_t i = 0; i < registry().size(); i++) {
+            ring* r = registry()[i];
+            uint64_t head = r->head.load(std::memory_order_acquire);
+            uint64_t first = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+            std::vector<event> copy;
+            for (uint64_t n = first; n < head; n++) {
+                copy.push_back(r->events[n & (TRACE_RING_SIZE - 1)]);
+            }
+            // The writer may have wrapped around during the copy. The slot of
+            // new_head may be being written, so it is not valid either. The
+            // fence keeps the copies above before reading head again.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t new_head = r->head.load(std::memory_order_relaxed);
+            uint64_t valid = (new_head + 1 > TRACE_RING_SIZE) ? new_head + 1 - TRACE_RING_SIZE : 0;
+            for (uint64_t n = std::max(first, valid); n < head; n++) {
+                result.push_back(std::make_pair(r->thread_index, copy[n - first]));
+            }
+        }
+        return result;
+    }
+
+    // Latency of every stage for each frame, relative to the first stage
+    // recorded for that frame
+    struct frame_trace {
+        uint64_t timestamp_ns[TRACE_STAGES];
+        int thread[TRACE_STAGES];
+    };
+    inline std::map<uint32_t, frame_trace> frames() {
+        std::map<uint32_t, frame_trace> result;
+        std::vector<std::pair<int, event> > events = snapshot();
+        for (size_t i = 0; i < events.size(); i++) {
+            const event& e = events[i].second;
+            if (e.stage >= TRACE_STAGES) {
+                continue;
+            }
+            std::map<uint32_t, frame_trace>::iterator it = result.find(e.frame);
+            if (it == result.end()) {
+                frame_trace empty;
+                for (int s = 0; s < TRACE_STAGES; s++) {
+                    empty.timestamp_ns[s] = 0;
+                    empty.thread[s] = 0;
+                }
+                it = result.insert(std::make_pair(e.frame, empty)).first;
+            }
+            it->second.timestamp_ns[e.stage] = e.timestamp_ns;
+            it->second.thread[e.stage] = events[i].first;
+        }
+        return result;
+    }
+
+    inline uint64_t percentile(std::vector<uint64_t>& values, double q) {
+        if (values.empty()) {
+            return 0;
+        }
+        size_t index = (size_t) (q * values.size());
+        if (index >= values.size()) {
+            index = values.size() - 1;
+        }
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+
+    // Text table with the latency percentiles (in microseconds) of each
+    // stage since the first stage of the frame ("total") and since the
+    // previous recorded stage ("step")
+    inline std::string summary() {
+        std::map<uint32_t, frame_trace> traces = frames();
+        std::vector<uint64_t> total[TRACE_STAGES];
+        std::vector<uint64_t> step[TRACE_STAGES];
+        for (std::map<uint32_t, frame_trace>::iterator it = traces.begin();
+             it != traces.end(); ++it) {
+            uint64_t first = 0, previous = 0;
+            for (int s = 0; s < TRACE_STAGES; s++) {
+                uint64_t t = it->second.timestamp_ns[s];
+                if (t == 0) {
+                    continue;
+                }
+                if (first == 0) {
+                    first = previous = t;
+                    continue;
+                }
+                total[s].push_back(t - first);
+                step[s].push_back(t - previous);
+                previous = t;
+            }
+        }
+        std::string result;
+        char line[160];
+        snprintf(line, sizeof(line), "%-16s %8s %10s %10s %10s %10s %10s %10s\n",
+                 "stage(us)", "frames", "total_p50", "total_p99", "total_p999",
+                 "step_p50", "step_p99", "step_p999");
+        result += line;
+        for (int s = 0; s < TRACE_STAGES; s++) {
+            if (total[s].empty()) {
+                continue;
+            }
+            snprintf(line, sizeof(line), "%-16s %8u %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                     stage_name(s), (unsigned int) total[s].size(),
+                     percentile(total[s], 0.5) / 1e3, percentile(total[s], 0.99) / 1e3,
+                     percentile(total[s], 0.999) / 1e3, percentile(step[s], 0.5) / 1e3,
+                     percentile(step[s], 0.99) / 1e3, percentile(step[s], 0.999) / 1e3);
+            result += line;
+        }
+        return result;
+    }
+
+    // Chrome trace JSON. Each stage of a frame is a complete event ("X")
+    // that lasts from the previous recorded stage of the same frame.
+    inline std::string chrome_json() {
+        std::map<uint32_t, frame_trace> traces = frames();
+        std::string result = "{\"traceEvents\":[";
+        char buffer[256];
+        bool first_event = true;
+        for (std::map<uint32_t, frame_trace>::iterator it = traces.begin();
+             it != traces.end(); ++it) {
+            uint64_t previous = 0;
+            for (int s = 0; s < TRACE_STAGES; s++) {
+                uint64_t t = it->second.timestamp_ns[s];
+                if (t == 0) {
+                    continue;
+                }
+                uint64_t start = (previous != 0) ? previous : t;
+                snprintf(buffer, sizeof(buffer),
+                         "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                         "\"pid\":1,\"tid\":%d,\"args\":{\"frame\":%u}}",
+                         first_event ? "" : ",", stage_name(s), start / 1e3,
+                         (t - start) / 1e3, it->second.thread[s], it->first);
+                result += buffer;
+                first_event = false;
+                previous = t;
+            }
+        }
+        result += "]}\n";
+        return result;
+    }
+}
+
+#endif // __LATENCY_TRACE_H
@@ -0,0 +1,180 @@
+// file: motion_mask.hpp
+// Tiles of a binary or gray frame that changed since the previous frames,
+// so the detection can be run only where something moved.
+//
+// The frame is compared with a reference image in tiles of
+// MOTION_TILE_SIZE x MOTION_TILE_SIZE pixels. A tile changed when more than
+// 'min_pixels' of its pixels differ from the reference by more than
+// 'pixel_threshold'. Only the changed tiles are copied into the reference,
+// so slow changes add up until they mark their tile. The differences are
+// counted 16 pixels at a time with NEON on the HPS and SSE2 on a PC.
+
+#ifndef __MOTION_MASK_H
+#define __MOTION_MASK_H
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Pixels of a tile side
+#define MOTION_TILE_SIZE       32
+// Defaults: any change of a binary pixel, and more than 4 of them, so a
+// few pixels flickering on a border do not mark the tile
+#define MOTION_PIXEL_THRESHOLD 0
+#define MOTION_MIN_PIXELS      4
+
+// Pixels of a tile (rows of 'width' pixels, 'stride_a' and 'stride_b' Bytes
+// apart) that differ by more than 'threshold'
+static inline uint32_t motion_tile_changes(const uint8_t* a, int stride_a, const uint8_t* b,
+    int stride_b, int width, int rows, uint8_t threshold) {
+  uint32_t changes = 0;
+  int simd_width = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  simd_width = width & ~15;
+  uint8x16_t limit = vdupq_n_u8(threshold);
+  uint16x8_t count = vdupq_n_u16(0);
+  for (int r = 0; r < rows; r++) {
+    const uint8_t* pa = a + (size_t) r * stride_a;
+    const uint8_t* pb = b + (size_t) r * stride_b;
+    for (int c = 0; c < simd_width; c += 16) {
+      uint8x16_t changed = vcgtq_u8(vabdq_u8(vld1q_u8(pa + c), vld1q_u8(pb + c)), limit);
+      count = vpadalq_u8(count, vshrq_n_u8(changed, 7));
+    }
+  }
+  uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(count));
+  changes = vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+#elif defined(__SSE2__)
+  simd_width = width & ~15;
+  __m128i limit = _mm_set1_epi8((char) threshold);
+  __m128i zero = _mm_setzero_si128();
+  __m128i ones = _mm_cmpeq_epi8(zero, zero);
+  // Sums of the 0xff of the changed pixels
+  __m128i count = zero;
+  for (int r = 0; r < rows; r++) {
+    const uint8_t* pa = a + (size_t) r * stride_a;
+    const uint8_t* pb = b + (size_t) r * stride_b;
+    for (int c = 0; c < simd_width; c += 16) {
+      __m128i va = _mm_loadu_si128((const __m128i*) (pa + c));
+      __m128i vb = _mm_loadu_si128((const __m128i*) (pb + c));
+      __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+      __m128i same = _mm_cmpeq_epi8(_mm_subs_epu8(diff, limit), zero);
+      count = _mm_add_epi64(count, _mm_sad_epu8(_mm_xor_si128(same, ones), zero));
+    }
+  }
+  changes = (uint32_t) ((_mm_cvtsi128_si32(count) +
+                         _mm_cvtsi128_si32(_mm_unpackhi_epi64(count, count))) / 255);
+#endif
+  for (int r = 0; (simd_width < width) && (r < rows); r++) {
+    const uint8_t* pa = a + (size_t) r * stride_a;
+    const uint8_t* pb = b + (size_t) r * stride_b;
+    for (int c = simd_width; c < width; c++) {
+      int diff = (int) pa[c] - (int) pb[c];
+      changes += ((diff > threshold) || (-diff > threshold));
+    }
+  }
+  return changes;
+}
+
+/*
+  Class definition of the motion mask. The reference and the mask are
+  allocated for the largest frame seen and kept between frames.
+*/
+class MotionMask {
+  public:
+    MotionMask(void) : pixel_threshold(MOTION_PIXEL_THRESHOLD), min_pixels(MOTION_MIN_PIXELS),
+                       width(0), height(0), cols(0), rows(0) {}
+    void set_pixel_threshold(int threshold) { this->pixel_threshold = threshold; }
+    void set_min_pixels(int pixels) { this->min_pixels = pixels; }
+    // Compare an 8-bit image of width x height pixels (row-major, 'stride'
+    // Bytes per row) with the reference and mark its tiles changed. All of
+    // them change with the first image, one of another size or after
+    // reset(). Returns the tiles changed.
+    int update(const uint8_t* image, int width, int height, int stride);
+    // Compare the next image with nothing
+    void reset(void) { this->width = 0; }
+    // Tiles per row and rows of tiles (the last ones may be smaller)
+    int get_cols(void) const { return this->cols; }
+    int get_rows(void) const { return this->rows; }
+    bool changed(int row, int col) const { return this->mask[row * this->cols + col] != 0; }
+    // Pixels [first_row, end_row) x [first_col, end_col) covering the tiles
+    // changed. Returns false if none changed.
+    bool changed_bounds(int* first_row, int* end_row, int* first_col, int* end_col) const;
+
+  private:
+    int pixel_threshold, min_pixels;
+    int width, height;
+    int cols, rows;
+    std::vector<uint8_t> reference;
+    std::vector<uint8_t> mask;
+};
+
+// --Class Methods implementation --//
+
+inline int MotionMask::update(const uint8_t* image, int width, int height, int stride) {
+  bool all = (width != this->width) || (height != this->height);
+  if (all) {
+    this->width = width;
+    this->height = height;
+    this->cols = (width + MOTION_TILE_SIZE - 1) / MOTION_TILE_SIZE;
+    this->rows = (height + MOTION_TILE_SIZE - 1) / MOTION_TILE_SIZE;
+    this->reference.resize((size_t) width * height);
+    this->mask.resize((size_t) this->cols * this->rows);
+  }
+  int changed = 0;
+  for (int tr = 0; tr < this->rows; tr++) {
+    int r0 = tr * MOTION_TILE_SIZE;
+    int tile_rows = (r0 + MOTION_TILE_SIZE <= height) ? MOTION_TILE_SIZE : height - r0;
+    for (int tc = 0; tc < this->cols; tc++) {
+      int c0 = tc * MOTION_TILE_SIZE;
+      int tile_cols = (c0 + MOTION_TILE_SIZE <= width) ? MOTION_TILE_SIZE : width - c0;
+      const uint8_t* tile = image + (size_t) r0 * stride + c0;
+      uint8_t* reference = &this->reference[(size_t) r0 * width + c0];
+      bool tile_changed = all ||
+          (motion_tile_changes(tile, stride, reference, width, tile_cols, tile_rows,
+                               this->pixel_threshold) > (uint32_t) this->min_pixels);
+      this->mask[tr * this->cols + tc] = tile_changed;
+      if (!tile_changed) {
+        continue;
+      }
+      for (int r = 0; r < tile_rows; r++) {
+        memcpy(reference + (size_t) r * width, tile + (size_t) r * stride, tile_cols);
+      }
+      changed++;
+    }
+  }
+  return changed;
+}
+
+inline bool MotionMask::changed_bounds(int* first_row, int* end_row, int* first_col,
+    int* end_col) const {
+  int min_tr = this->rows, max_tr = -1, min_tc = this->cols, max_tc = -1;
+  for (int tr = 0; tr < this->rows; tr++) {
+    for (int tc = 0; tc < this->cols; tc++) {
+      if (this->mask[tr * this->cols + tc]) {
+        min_tr = (tr < min_tr) ? tr : min_tr;
+        max_tr = (tr > max_tr) ? tr : max_tr;
+        min_tc = (tc < min_tc) ? tc : min_tc;
+        max_tc = (tc > max_tc) ? tc : max_tc;
+      }
+    }
+  }
+  if (max_tr < 0) {
+    return false;
+  }
+  *first_row = min_tr * MOTION_TILE_SIZE;
+  *end_row = ((max_tr + 1) * MOTION_TILE_SIZE < this->height) ?
+             (max_tr + 1) * MOTION_TILE_SIZE : this->height;
+  *first_col = min_tc * MOTION_TILE_SIZE;
+  *end_col = ((max_tc + 1) * MOTION_TILE_SIZE < this->width) ?
+             (max_tc + 1) * MOTION_TILE_SIZE : this->width;
+  return true;
+}
+
+#endif // __MOTION_MASK_H
@@ -0,0 +1,139 @@
+// file: polygon_approx.hpp
+// Native version of _polygon.approximate_polygon: approximation of a
+// polygonal chain with the Ramer-Douglas-Peucker algorithm. It keeps the
+// same vertices as the Python version, but compares squared distances
+// obtained with cross products instead of computing the angle of every
+// segment with atan2/sin/cos.
+//
+// The coordinates are given as separate row and column arrays, so the
+// inner loop only reads two contiguous streams. The chain can be abandoned
+// once it has more than 'max_vertices' vertices: the algorithm only adds
+// vertices, so that chain can never become a triangle.
+
+#ifndef __POLYGON_APPROX_H
+#define __POLYGON_APPROX_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <vector>
+
+// No limit of vertices
+#define POLYGON_APPROX_UNLIMITED 0
+
+/*
+  Class definition of the polygon approximation. The working arrays grow
+  to the longest chain seen and are kept between calls.
+*/
+class PolygonApprox {
+  public:
+    // Approximate the chain of n points so that no point is farther than
+    // 'tolerance' from the result, and store the indexes of the vertices
+    // kept, in ascending order. With tolerance <= 0 all are kept. If more
+    // than max_vertices are found the approximation stops and returns
+    // max_vertices + 1 (the indexes are the vertices found until then).
+    // Returns the number of vertices.
+    int approximate(const double* rows, const double* cols, size_t n,
+                    double tolerance, size_t max_vertices,
+                    std::vector<uint32_t>* vertices);
+
+  private:
+    // Vertex flag of each point
+    std::vector<uint8_t> chain;
+    // Pending (start, end) pairs
+    std::vector<uint32_t> stack;
+};
+
+// --Class Methods implementation --//
+
+inline int PolygonApprox::approximate(const double* rows, const double* cols,
+    size_t n, double tolerance, size_t max_vertices,
+    std::vector<uint32_t>* vertices) {
+  vertices->clear();
+  if ((tolerance <= 0) || (n < 3)) {
+    for (size_t i = 0; i < n; i++) {
+      vertices->push_back(i);
+    }
+    return n;
+  }
+  if (this->chain.size() < n) {
+    this->chain.resize(n);
+    // Each pop pushes at most two pairs and splits the chain
+    this->stack.reserve(2 * n + 2);
+  }
+  uint8_t* chain = &this->chain[0];
+  for (size_t i = 0; i < n; i++) {
+    chain[i] = 0;
+  }
+  chain[0] = 1;
+  chain[n - 1] = 1;
+  size_t count = 2;
+  double tolerance2 = tolerance * tolerance;
+  this->stack.clear();
+  this->stack.push_back(0);
+  this->stack.push_back(n - 1);
+
+  while (!this->stack.empty()) {
+    uint32_t end = this->stack.back();
+    this->stack.pop_back();
+    uint32_t start = this->stack.back();
+    this->stack.pop_back();
+    if (end - start < 2) {
+      continue;
+    }
+    // Properties of the current line segment
+    double r0 = rows[start], c0 = cols[start];
+    double r1 = rows[end], c1 = cols[end];
+    double dr = r1 - r0;
+    double dc = c1 - c0;
+    double len2 = dr * dr + dc * dc;
+    double inv_len2 = (len2 > 0) ? 1 / len2 : 0;
+
+    // Squared distance of the points in-between to the segment:
+    // perpendicular if their projection falls inside it, to the closest end
+    // otherwise. A zero-length segment (closed chain) has no inside.
+    double max_dist2 = 0;
+    uint32_t max_index = 0;
+    for (uint32_t i = start + 1; i < end; i++) {
+      double dr0 = rows[i] - r0, dc0 = cols[i] - c0;
+      double dr1 = rows[i] - r1, dc1 = cols[i] - c1;
+      double projected_length0 = dr0 * dr + dc0 * dc;
+      double projected_length1 = -dr1 * dr - dc1 * dc;
+      double dist2;
+      if ((projected_length0 > 0) && (projected_length1 > 0)) {
+        double cross = dr0 * dc - dc0 * dr;
+        dist2 = cross * cross * inv_len2;
+      } else {
+        double dist2_start = dr0 * dr0 + dc0 * dc0;
+        double dist2_end = dr1 * dr1 + dc1 * dc1;
+        dist2 = (dist2_start < dist2_end) ? dist2_start : dist2_end;
+      }
+      if (dist2 > max_dist2) {
+        max_dist2 = dist2;
+        max_index = i;
+      }
+    }
+
+    if (max_dist2 > tolerance2) {
+      // Split at the point with the maximum distance to the line
+      chain[max_index] = 1;
+      count++;
+      if ((max_vertices != POLYGON_APPROX_UNLIMITED) && (count > max_vertices)) {
+        break;
+      }
+      this->stack.push_back(max_index);
+      this->stack.push_back(end);
+      this->stack.push_back(start);
+      this->stack.push_back(max_index);
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (chain[i]) {
+      vertices->push_back(i);
+    }
+  }
+  return vertices->size();
+}
+
+#endif // __POLYGON_APPROX_H
@@ -0,0 +1,276 @@
+// file: server_metrics.hpp
+// Runtime metrics of the frame servers: frames and bytes served to each
+// client, latency histograms of reading the frames and sending them, and the
+// frames lost, in Prometheus text exposition format.
+//
+// Like latency_trace.hpp, each thread updates its own block of counters.
+// Only the owner thread writes them, so an update is a relaxed load and
+// store (no locked instruction, no lock, no allocation). The blocks are
+// added up only when they are scraped, from any thread.
+//
+// Usage: int client = server_metrics::client_slot("10.0.0.2") when a client
+// connects, then server_metrics::add_frame(client),
+// server_metrics::observe(METRICS_READ_LATENCY, ns), ... and
+// server_metrics::prometheus("camera_server", gauges) to scrape.
+
+#ifndef __SERVER_METRICS_H
+#define __SERVER_METRICS_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Counters not related to a client
+#define METRICS_READ_ERRORS    0 // frames that could not be read
+#define METRICS_SEND_ERRORS    1 // frames read but not sent
+#define METRICS_FRAMES_SKIPPED 2 // frames captured and never served
+#define METRICS_COUNTERS       3
+
+// Latency histograms
+#define METRICS_READ_LATENCY   0 // reading a frame from the source
+#define METRICS_SEND_LATENCY   1 // sending a response to the client
+#define METRICS_HISTOGRAMS     2
+
+// Bucket i counts latencies up to 2^i us (1 us to 0.5 s), the last one the
+// rest (+Inf)
+#define METRICS_BUCKETS        21
+// Clients with their own counters per thread. The last slot is shared by
+// the clients beyond them.
+#define METRICS_MAX_CLIENTS    16
+#define METRICS_CLIENT_NAME    48
+
+namespace server_metrics {
+
+    struct histogram {
+        std::atomic<uint64_t> buckets[METRICS_BUCKETS];
+        std::atomic<uint64_t> sum_ns;
+    };
+
+    struct client {
+        // Written once, with the registry mutex held
+        char name[METRICS_CLIENT_NAME];
+        std::atomic<uint64_t> frames, bytes, requests;
+    };
+
+    // Counters of one thread. Only the owner thread writes.
+    struct block {
+        std::atomic<uint64_t> counters[METRICS_COUNTERS];
+        histogram histograms[METRICS_HISTOGRAMS];
+        client clients[METRICS_MAX_CLIENTS];
+        // Slots in use, with the registry mutex held
+        int nclients;
+    };
+
+    // Value of a gauge computed by the server when it is scraped
+    struct gauge {
+        std::string name;
+        std::string help;
+        double value;
+    };
+
+    inline std::mutex& registry_mutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    inline std::vector<block*>& registry() {
+        static std::vector<block*> blocks;
+        return blocks;
+    }
+
+    inline block* thread_block() {
+        // Blocks are never freed so the counters of ended threads still add up
+        static thread_local block* local = NULL;
+        if (local == NULL) {
+            local = new block();
+            for (int i = 0; i < METRICS_COUNTERS; i++) {
+                local->counters[i].store(0);
+            }
+            for (int h = 0; h < METRICS_HISTOGRAMS; h++) {
+                for (int i = 0; i < METRICS_BUCKETS; i++) {
+                    local->histograms[h].buckets[i].store(0);
+                }
+                local->histograms[h].sum_ns.store(0);
+            }
+            for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+                local->clients[i].name[0] = '\0';
+                local->clients[i].frames.store(0);
+                local->clients[i].bytes.store(0);
+                local->clients[i].requests.store(0);
+            }
+            local->nclients = 0;
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            registry().push_back(local);
+        }
+        return local;
+    }
+
+    // Increment of a counter by its only writer
+    inline void add(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value,
+                      std::memory_order_relaxed);
+    }
+
+    // Slot of the counters of a client (e.g. its address) in this thread.
+    // Called when the client connects, not per frame.
+    inline int client_slot(const char* name) {
+        block* b = thread_block();
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for (int i = 0; i < b->nclients; i++) {
+            if (strcmp(b->clients[i].name, name) == 0) {
+                return i;
+            }
+        }
+        if (b->nclients < METRICS_MAX_CLIENTS - 1) {
+            snprintf(b->clients[b->nclients].name, METRICS_CLIENT_NAME, "%s", name);
+            return b->nclients++;
+        }
+        if (b->nclients == METRICS_MAX_CLIENTS - 1) {
+            snprintf(b->clients[b->nclients].name, METRICS_CLIENT_NAME, "other");
+            b->nclients++;
+        }
+        return METRICS_MAX_CLIENTS - 1;
+    }
+
+    inline void add_request(int client) {
+        add(thread_block()->clients[client].requests, 1);
+    }
+
+    inline void add_frame(int client) {
+        add(thread_block()->clients[client].frames, 1);
+    }
+
+    inline void add_bytes(int client, uint64_t bytes) {
+        add(thread_block()->clients[client].bytes, bytes);
+    }
+
+    inline void count(int counter, uint64_t value = 1) {
+        add(thread_block()->counters[counter], value);
+    }
+
+    inline int bucket(uint64_t latency_ns) {
+        // Smallest i with latency <= 2^i us
+        uint64_t us = (latency_ns + 999) / 1000;
+        int i = (us <= 1) ? 0 : 64 - __builtin_clzll(us - 1);
+        return (i < METRICS_BUCKETS - 1) ? i : METRICS_BUCKETS - 1;
+    }
+
+    inline void observe(int hist, uint64_t latency_ns) {
+        histogram& h = thread_block()->histograms[hist];
+        add(h.buckets[bucket(latency_ns)], 1);
+        add(h.sum_ns, latency_ns);
+    }
+
+    // Totals of all the threads
+    struct totals {
+        uint64_t counters[METRICS_COUNTERS];
+        uint64_t buckets[METRICS_HISTOGRAMS][METRICS_BUCKETS];
+        uint64_t sum_ns[METRICS_HISTOGRAMS];
+        // frames, bytes and requests by client name
+        std::map<std::string, std::vector<uint64_t> > clients;
+    };
+
+    inline totals aggregate() {
+        totals t;
+        memset(t.counters, 0, sizeof(t.counters));
+        memset(t.buckets, 0, sizeof(t.buckets));
+        memset(t.sum_ns, 0, sizeof(t.sum_ns));
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for (size_t b = 0; b < registry().size(); b++) {
+            block* blk = registry()[b];
+            for (int i = 0; i < METRICS_COUNTERS; i++) {
+                t.counters[i] += blk->counters[i].load(std::memory_order_relaxed);
+            }
+            for (int h = 0; h < METRICS_HISTOGRAMS; h++) {
+                for (int i = 0; i < METRICS_BUCKETS; i++) {
+                    t.buckets[h][i] += blk->histograms[h].buckets[i].load(std::memory_order_relaxed);
+                }
+                t.sum_ns[h] += blk->histograms[h].sum_ns.load(std::memory_order_relaxed);
+            }
+            for (int i = 0; i < blk->nclients; i++) {
+                std::vector<uint64_t>& c = t.clients[blk->clients[i].name];
+                c.resize(3, 0);
+                c[0] += blk->clients[i].frames.load(std::memory_order_relaxed);
+                c[1] += blk->clients[i].bytes.load(std::memory_order_relaxed);
+                c[2] += blk->clients[i].requests.load(std::memory_order_relaxed);
+            }
+        }
+        return t;
+    }
+
+    inline void append_header(std::string* text, const std::string& name, const char* type,
+                              const char* help) {
+        *text += "# HELP " + name + " " + help + "\n";
+        *text += "# TYPE " + name + " " + type + "\n";
+    }
+
+    inline void append_sample(std::string* text, const std::string& name, const char* labels,
+                              double value) {
+        char line[256];
+        snprintf(line, sizeof(line), "%s%s %.17g\n", name.c_str(), labels, value);
+        *text += line;
+    }
+
+    // All the metrics in Prometheus text format, named <prefix>_<metric>,
+    // followed by the gauges of the server
+    inline std::string prometheus(const std::string& prefix,
+                                  const std::vector<gauge>& gauges = std::vector<gauge>()) {
+        static const char* client_metrics[3][2] = {
+            {"frames_served_total", "Frames sent to each client."},
+            {"bytes_sent_total", "Bytes of the responses sent to each client."},
+            {"requests_total", "Requests received from each client."}};
+        static const char* histogram_metrics[METRICS_HISTOGRAMS][2] = {
+            {"read_latency_seconds", "Time to read a frame from the source."},
+            {"send_latency_seconds", "Time to send a response to the client."}};
+        totals t = aggregate();
+        std::string text;
+        char labels[128];
+        for (int m = 0; m < 3; m++) {
+            std::string name = prefix + "_" + client_metrics[m][0];
+            append_header(&text, name, "counter", client_metrics[m][1]);
+            std::map<std::string, std::vector<uint64_t> >::const_iterator it;
+            for (it = t.clients.begin(); it != t.clients.end(); ++it) {
+                snprintf(labels, sizeof(labels), "{client=\"%s\"}", it->first.c_str());
+                append_sample(&text, name, labels, it->second[m]);
+            }
+        }
+        std::string name = prefix + "_frames_dropped_total";
+        append_header(&text, name, "counter", "Frames lost by the server.");
+        append_sample(&text, name, "{reason=\"read_error\"}", t.counters[METRICS_READ_ERRORS]);
+        append_sample(&text, name, "{reason=\"send_error\"}", t.counters[METRICS_SEND_ERRORS]);
+        name = prefix + "_frames_skipped_total";
+        append_header(&text, name, "counter",
+                      "Frames captured by the source between two frames served.");
+        append_sample(&text, name, "", t.counters[METRICS_FRAMES_SKIPPED]);
+        for (int h = 0; h < METRICS_HISTOGRAMS; h++) {
+            name = prefix + "_" + histogram_metrics[h][0];
+            append_header(&text, name, "histogram", histogram_metrics[h][1]);
+            uint64_t cumulative = 0;
+            for (int i = 0; i < METRICS_BUCKETS; i++) {
+                cumulative += t.buckets[h][i];
+                if (i < METRICS_BUCKETS - 1) {
+                    snprintf(labels, sizeof(labels), "{le=\"%g\"}", (1 << i) * 1e-6);
+                } else {
+                    snprintf(labels, sizeof(labels), "{le=\"+Inf\"}");
+                }
+                append_sample(&text, name + "_bucket", labels, cumulative);
+            }
+            append_sample(&text, name + "_sum", "", t.sum_ns[h] / 1e9);
+            append_sample(&text, name + "_count", "", cumulative);
+        }
+        for (size_t i = 0; i < gauges.size(); i++) {
+            name = prefix + "_" + gauges[i].name;
+            append_header(&text, name, "gauge", gauges[i].help.c_str());
+            append_sample(&text, name, "", gauges[i].value);
+        }
+        return text;
+    }
+}
+
+#endif // __SERVER_METRICS_H
@@ -0,0 +1,249 @@
+// file: shm_channel.hpp
+// Latest-value channel in POSIX shared memory for local processes (e.g. a
+// control loop or a logger running on the HPS).
+//
+// One writer publishes messages of up to 'capacity' Bytes and any number
+// of readers get the last one. Writing and reading are a copy to or from
+// the mapped memory, without system calls or locks. The value is protected
+// by a sequence lock: the sequence is odd while the writer is copying, and
+// a reader repeats the copy if the sequence was odd or changed meanwhile.
+// The writer never waits for the readers.
+//
+// The channel is a file of /dev/shm created by the writer and removed when
+// it is closed. Readers can be started before or after the writer.
+
+#ifndef __SHM_CHANNEL_H
+#define __SHM_CHANNEL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#define SHM_CHANNEL_MAGIC   "UVSHMCH"
+#define SHM_CHANNEL_VERSION 1
+// Reads repeated while the writer is copying before giving up
+#define SHM_CHANNEL_READ_RETRIES 1000
+
+#define ERROR_SHM_CHANNEL_OPEN     -1
+#define ERROR_SHM_CHANNEL_FORMAT   -2
+#define ERROR_SHM_CHANNEL_SIZE     -3
+#define ERROR_SHM_CHANNEL_BUSY     -4
+#define ERROR_SHM_CHANNEL_EMPTY    -5
+
+/*
+  Header at the beginning of the shared memory, followed by the value
+*/
+struct ShmChannelHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t capacity;
+  // Odd while the value is being written. Incremented by 2 per message.
+  std::atomic<uint32_t> sequence;
+  uint32_t size;
+  uint64_t timestamp_ns;
+};
+
+// Time of the steady clock, as the one of the frames
+inline uint64_t shm_channel_now_ns(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+  Writer of a channel. Only one per channel.
+*/
+class ShmChannelWriter {
+  public:
+    ShmChannelWriter(void) : header(NULL), map_size(0) {}
+    ~ShmChannelWriter(void) { this->close(); }
+    // Create the channel 'name' (e.g. "/uvispace_triangles") for values of
+    // up to capacity Bytes. Returns 0 or an error.
+    int open(const char* name, uint32_t capacity);
+    // Remove the channel. The readers keep the last value mapped.
+    int close(void);
+    // Publish a value. Returns 0 or ERROR_SHM_CHANNEL_SIZE if it does not fit.
+    int write(const void* value, uint32_t size);
+
+  private:
+    std::string name;
+    ShmChannelHeader* header;
+    size_t map_size;
+};
+
+/*
+  Reader of a channel
+*/
+class ShmChannelReader {
+  public:
+    ShmChannelReader(void) : header(NULL), map_size(0) {}
+    ~ShmChannelReader(void) { this->close(); }
+    // Map the channel 'name'. Returns 0 or an error.
+    int open(const char* name);
+    int close(void);
+    // Copy the last value into 'destination' (at most len Bytes) with its
+    // sequence (can be NULL) and the time it was written (can be NULL).
+    // Returns the size of the value or a negative error.
+    int read(void* destination, size_t len, uint32_t* sequence, uint64_t* timestamp_ns);
+    // Copy the value if its sequence is not 'last_sequence'. Returns 0 if
+    // there is no new value.
+    int read_new(void* destination, size_t len, uint32_t last_sequence,
+                 uint32_t* sequence, uint64_t* timestamp_ns);
+    // Sequence of the last value (0: none yet)
+    uint32_t get_sequence(void) {
+      return this->header->sequence.load(std::memory_order_acquire) & ~1U;
+    }
+    uint32_t get_capacity(void) { return this->header->capacity; }
+
+  private:
+    ShmChannelHeader* header;
+    size_t map_size;
+};
+
+// --Class Methods implementation --//
+
+// ShmChannelWriter
+inline int ShmChannelWriter::open(const char* name, uint32_t capacity) {
+  this->close();
+  int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+  if (fd == -1) {
+    return ERROR_SHM_CHANNEL_OPEN;
+  }
+  size_t size = sizeof(ShmChannelHeader) + capacity;
+  if (ftruncate(fd, size) != 0) {
+    ::close(fd);
+    return ERROR_SHM_CHANNEL_OPEN;
+  }
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return ERROR_SHM_CHANNEL_OPEN;
+  }
+  this->name = name;
+  this->header = (ShmChannelHeader*) map;
+  this->map_size = size;
+  // Readers mapping it meanwhile see an empty channel until the magic
+  memset(this->header->magic, 0, sizeof(this->header->magic));
+  this->header->version = SHM_CHANNEL_VERSION;
+  this->header->capacity = capacity;
+  this->header->sequence.store(0, std::memory_order_relaxed);
+  this->header->size = 0;
+  this->header->timestamp_ns = 0;
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(this->header->magic, SHM_CHANNEL_MAGIC, sizeof(SHM_CHANNEL_MAGIC));
+  return 0;
+}
+
+inline int ShmChannelWriter::close(void) {
+  if (this->header != NULL) {
+    munmap(this->header, this->map_size);
+    shm_unlink(this->name.c_str());
+    this->header = NULL;
+  }
+  return 0;
+}
+
+inline int ShmChannelWriter::write(const void* value, uint32_t size) {
+  if (size > this->header->capacity) {
+    return ERROR_SHM_CHANNEL_SIZE;
+  }
+  uint32_t sequence = this->header->sequence.load(std::memory_order_relaxed);
+  this->header->sequence.store(sequence + 1, std::memory_order_relaxed);
+  // The odd sequence is visible before any Byte of the value changes
+  std::atomic_thread_fence(std::memory_order_release);
+  this->header->size = size;
+  this->header->timestamp_ns = shm_channel_now_ns();
+  memcpy((uint8_t*) (this->header + 1), value, size);
+  this->header->sequence.store(sequence + 2, std::memory_order_release);
+  return 0;
+}
+
+// ShmChannelReader
+inline int ShmChannelReader::open(const char* name) {
+  this->close();
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd == -1) {
+    return ERROR_SHM_CHANNEL_OPEN;
+  }
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || ((size_t) st.st_size < sizeof(ShmChannelHeader))) {
+    ::close(fd);
+    return ERROR_SHM_CHANNEL_FORMAT;
+  }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return ERROR_SHM_CHANNEL_OPEN;
+  }
+  this->header = (ShmChannelHeader*) map;
+  this->map_size = st.st_size;
+  if ((memcmp(this->header->magic, SHM_CHANNEL_MAGIC, sizeof(SHM_CHANNEL_MAGIC)) != 0) ||
+      (this->header->version != SHM_CHANNEL_VERSION) ||
+      (sizeof(ShmChannelHeader) + this->header->capacity > this->map_size)) {
+    this->close();
+    return ERROR_SHM_CHANNEL_FORMAT;
+  }
+  return 0;
+}
+
+inline int ShmChannelReader::close(void) {
+  if (this->header != NULL) {
+    munmap(this->header, this->map_size);
+    this->header = NULL;
+  }
+  return 0;
+}
+
+inline int ShmChannelReader::read(void* destination, size_t len, uint32_t* sequence,
+    uint64_t* timestamp_ns) {
+  for (int retry = 0; retry < SHM_CHANNEL_READ_RETRIES; retry++) {
+    uint32_t before = this->header->sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+      // Being written: the copy takes less than a microsecond
+      std::this_thread::yield();
+      continue;
+    }
+    if (before == 0) {
+      return ERROR_SHM_CHANNEL_EMPTY;
+    }
+    uint32_t size = this->header->size;
+    uint64_t timestamp = this->header->timestamp_ns;
+    if (size > this->header->capacity) {
+      continue;
+    }
+    if (size > len) {
+      size = len;
+    }
+    memcpy(destination, this->header + 1, size);
+    // The copy is complete before the sequence is checked again
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (this->header->sequence.load(std::memory_order_relaxed) == before) {
+      if (sequence != NULL) {
+        *sequence = before;
+      }
+      if (timestamp_ns != NULL) {
+        *timestamp_ns = timestamp;
+      }
+      return size;
+    }
+  }
+  return ERROR_SHM_CHANNEL_BUSY;
+}
+
+inline int ShmChannelReader::read_new(void* destination, size_t len, uint32_t last_sequence,
+    uint32_t* sequence, uint64_t* timestamp_ns) {
+  if (this->get_sequence() == last_sequence) {
+    return 0;
+  }
+  return this->read(destination, len, sequence, timestamp_ns);
+}
+
+#endif // __SHM_CHANNEL_H
@@ -0,0 +1,126 @@
+// file: spsc_queue.hpp
+// Bounded lock-free queue for one producer thread and one consumer thread.
+// Used to pass frames between the stages of a pipeline without locks or
+// allocations: the items are usually pointers to preallocated buffers.
+
+#ifndef __SPSC_QUEUE_H
+#define __SPSC_QUEUE_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Size of a cache line, to keep the indexes of each side apart
+#define SPSC_CACHE_LINE 64
+// Busy polls before a waiting side starts sleeping
+#define SPSC_SPIN_POLLS 200
+#define SPSC_SLEEP_US   50
+
+template <typename T>
+class SpscQueue {
+  public:
+    // The capacity is rounded up to a power of 2
+    explicit SpscQueue(size_t capacity);
+    // Producer side. Returns false if the queue is full.
+    bool push(const T& item);
+    // Consumer side. Returns false if the queue is empty.
+    bool pop(T* item);
+    // Wait until an item is available or 'running' becomes false. Returns
+    // false in the latter case.
+    bool wait_pop(T* item, const std::atomic<bool>& running);
+    bool wait_push(const T& item, const std::atomic<bool>& running);
+    size_t size(void) const;
+    size_t capacity(void) const { return this->mask + 1; }
+
+  private:
+    std::vector<T> items;
+    size_t mask;
+    // Next position to read, written only by the consumer
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> head;
+    // Copy of tail last seen by the consumer
+    size_t cached_tail;
+    // Next position to write, written only by the producer
+    alignas(SPSC_CACHE_LINE) std::atomic<size_t> tail;
+    // Copy of head last seen by the producer
+    size_t cached_head;
+};
+
+// Poll 'ready' spinning first and then sleeping, until it returns true or
+// 'running' becomes false
+template <typename F>
+inline bool spsc_wait(F ready, const std::atomic<bool>& running) {
+  unsigned int polls = 0;
+  while (!ready()) {
+    if (!running.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    if (++polls < SPSC_SPIN_POLLS) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(SPSC_SLEEP_US));
+    }
+  }
+  return true;
+}
+
+// --Class Methods implementation --//
+
+template <typename T>
+inline SpscQueue<T>::SpscQueue(size_t capacity)
+    : head(0), cached_tail(0), tail(0), cached_head(0) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  this->items.resize(size);
+  this->mask = size - 1;
+}
+
+template <typename T>
+inline bool SpscQueue<T>::push(const T& item) {
+  size_t tail = this->tail.load(std::memory_order_relaxed);
+  if (tail - this->cached_head > this->mask) {
+    this->cached_head = this->head.load(std::memory_order_acquire);
+    if (tail - this->cached_head > this->mask) {
+      return false;
+    }
+  }
+  this->items[tail & this->mask] = item;
+  this->tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+inline bool SpscQueue<T>::pop(T* item) {
+  size_t head = this->head.load(std::memory_order_relaxed);
+  if (head == this->cached_tail) {
+    this->cached_tail = this->tail.load(std::memory_order_acquire);
+    if (head == this->cached_tail) {
+      return false;
+    }
+  }
+  *item = this->items[head & this->mask];
+  this->head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+inline bool SpscQueue<T>::wait_pop(T* item, const std::atomic<bool>& running) {
+  return spsc_wait([&]() { return this->pop(item); }, running);
+}
+
+template <typename T>
+inline bool SpscQueue<T>::wait_push(const T& item, const std::atomic<bool>& running) {
+  return spsc_wait([&]() { return this->push(item); }, running);
+}
+
+template <typename T>
+inline size_t SpscQueue<T>::size(void) const {
+  return this->tail.load(std::memory_order_acquire) -
+         this->head.load(std::memory_order_acquire);
+}
+
+#endif // __SPSC_QUEUE_H
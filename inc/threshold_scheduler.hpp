@@ -0,0 +1,210 @@
+// file: threshold_scheduler.hpp
+// Time-multiplexing of the avalon_image_processing block between several
+// sets of HSV thresholds (profiles), e.g. one per UGV colour.
+//
+// The profiles are rotated in step with CAPTURE_IMAGE_COUNTER of the image
+// writer: each one is kept for a number of frames and the binary frames
+// read are tagged with the profile that produced them. The thresholds
+// are applied by the block as soon as they are written, so the frame being
+// captured during a change mixes two profiles. It is tagged as a guard
+// frame and must be discarded. If the counter changes while the thresholds
+// are written, all the frames it went through are guard frames.
+//
+// Frame numbers are the ones returned by ImageWriter::read_frame: the
+// counter when the frame was read, one more than the counter while it was
+// captured.
+//
+// update() and tag() are meant to be called from the thread that reads the
+// binary frames, after each frame.
+
+#ifndef __THRESHOLD_SCHEDULER_H
+#define __THRESHOLD_SCHEDULER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <string>
+#include <vector>
+
+#include "avalon_register_map.hpp"
+#include "avalon_image_writer.hpp"
+
+// Tags of the frames without a profile
+#define THRESHOLD_PROFILE_NONE  -1 // captured before the first profile
+#define THRESHOLD_PROFILE_GUARD -2 // captured while the thresholds changed
+
+// Registers of a profile (hue, brightness and saturation, low and high)
+#define THRESHOLD_PROFILE_REGISTERS 6
+// Profile changes remembered to tag the frames (power of 2)
+#define THRESHOLD_SWITCHES 16
+
+#define ERROR_THRESHOLD_PROFILES_FILE  -1
+#define ERROR_THRESHOLD_PROFILES_PARSE -2
+
+/*
+  A named set of thresholds, as the register writes that apply it
+*/
+struct ThresholdProfile {
+  std::string name;
+  RegisterWrite writes[THRESHOLD_PROFILE_REGISTERS];
+};
+
+// Make a profile from its thresholds in the order hue L/H, brightness L/H,
+// saturation L/H. Returns 0 or ERROR_REGISTER_RANGE.
+int threshold_profile_make(const std::string& name,
+                           const uint32_t thresholds[THRESHOLD_PROFILE_REGISTERS],
+                           ThresholdProfile* profile);
+
+// Read the profiles of a text file with one profile per line:
+//   name hue_L hue_H brightness_L brightness_H saturation_L saturation_H
+// Empty lines and lines starting with '#' are ignored. Returns 0 or an
+// error (the line with errors is printed).
+int load_threshold_profiles(const char* path, std::vector<ThresholdProfile>* profiles);
+
+/*
+  Class definition of the scheduler
+*/
+class ThresholdScheduler {
+  public:
+    // image_processing: virtual address of avalon_image_processing.
+    // writer: image writer of the binary frames, giving the counter.
+    ThresholdScheduler(void* image_processing, ImageWriter* writer)
+        : image_processing(image_processing), writer(writer), frames(1),
+          active(0), switches(0) {}
+    // Apply the first profile. Each profile is kept for 'frames' frames
+    // (plus the guard frame after each change).
+    void start(const std::vector<ThresholdProfile>& profiles, uint32_t frames);
+    // Change to the next profile if the current one was kept long enough
+    void update(void);
+    // Profile index of the frame 'image_number', THRESHOLD_PROFILE_GUARD
+    // or THRESHOLD_PROFILE_NONE (also for frames older than the changes
+    // remembered)
+    int tag(uint32_t image_number) const;
+    size_t get_profiles(void) const { return this->profiles.size(); }
+    const ThresholdProfile& get_profile(int index) const { return this->profiles[index]; }
+
+  private:
+    // Write a profile and remember the frames it applies to
+    void apply(size_t index);
+
+    // A profile change. Frames captured with the counter in
+    // [first_guard, first_frame) may mix profiles.
+    struct Switch {
+      uint32_t first_guard;
+      uint32_t first_frame;
+      int profile;
+    };
+
+    void* image_processing;
+    ImageWriter* writer;
+    std::vector<ThresholdProfile> profiles;
+    uint32_t frames;
+    size_t active;
+    Switch history[THRESHOLD_SWITCHES];
+    // Changes ever made
+    uint32_t switches;
+};
+
+// --Class Methods implementation --//
+
+inline int threshold_profile_make(const std::string& name,
+    const uint32_t thresholds[THRESHOLD_PROFILE_REGISTERS],
+    ThresholdProfile* profile) {
+  int error = 0;
+  profile->name = name;
+  error |= register_write<image_processing_regs::hue_threshold_l>(thresholds[0], &profile->writes[0]);
+  error |= register_write<image_processing_regs::hue_threshold_h>(thresholds[1], &profile->writes[1]);
+  error |= register_write<image_processing_regs::bri_threshold_l>(thresholds[2], &profile->writes[2]);
+  error |= register_write<image_processing_regs::bri_threshold_h>(thresholds[3], &profile->writes[3]);
+  error |= register_write<image_processing_regs::sat_threshold_l>(thresholds[4], &profile->writes[4]);
+  error |= register_write<image_processing_regs::sat_threshold_h>(thresholds[5], &profile->writes[5]);
+  return (error != 0) ? ERROR_REGISTER_RANGE : 0;
+}
+
+inline int load_threshold_profiles(const char* path, std::vector<ThresholdProfile>* profiles) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    printf("ERROR: could not open \"%s\"...\n", path);
+    return ERROR_THRESHOLD_PROFILES_FILE;
+  }
+  profiles->clear();
+  char line[256];
+  int line_number = 0;
+  int error = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line_number++;
+    char name[64];
+    char extra[2];
+    uint32_t t[THRESHOLD_PROFILE_REGISTERS];
+    if (sscanf(line, " %1s", extra) != 1 || extra[0] == '#') {
+      continue;
+    }
+    ThresholdProfile profile;
+    if ((sscanf(line, "%63s %u %u %u %u %u %u %1s", name, &t[0], &t[1], &t[2],
+                &t[3], &t[4], &t[5], extra) != THRESHOLD_PROFILE_REGISTERS + 1) ||
+        (threshold_profile_make(name, t, &profile) != 0)) {
+      printf("ERROR: %s:%d: invalid profile \"%s\"...\n", path, line_number,
+             strtok(line, "\r\n"));
+      error = ERROR_THRESHOLD_PROFILES_PARSE;
+      break;
+    }
+    profiles->push_back(profile);
+  }
+  fclose(file);
+  return error;
+}
+
+// ThresholdScheduler
+inline void ThresholdScheduler::start(const std::vector<ThresholdProfile>& profiles,
+    uint32_t frames) {
+  this->profiles = profiles;
+  this->frames = (frames > 0) ? frames : 1;
+  this->switches = 0;
+  if (!this->profiles.empty()) {
+    this->apply(0);
+  }
+}
+
+inline void ThresholdScheduler::update(void) {
+  // A single profile is never changed
+  if ((this->profiles.size() < 2) || (this->switches == 0)) {
+    return;
+  }
+  const Switch& last = this->history[(this->switches - 1) % THRESHOLD_SWITCHES];
+  uint32_t counter = this->writer->get_image_counter();
+  if ((int32_t) (counter - last.first_frame) >= (int32_t) this->frames) {
+    this->apply((this->active + 1) % this->profiles.size());
+  }
+}
+
+inline int ThresholdScheduler::tag(uint32_t image_number) const {
+  // Counter while the frame was captured
+  uint32_t captured = image_number - 1;
+  uint32_t remembered = (this->switches < THRESHOLD_SWITCHES) ? this->switches
+                                                               : THRESHOLD_SWITCHES;
+  for (uint32_t i = 1; i <= remembered; i++) {
+    const Switch& s = this->history[(this->switches - i) % THRESHOLD_SWITCHES];
+    if ((int32_t) (captured - s.first_frame) >= 0) {
+      return s.profile;
+    }
+    if ((int32_t) (captured - s.first_guard) >= 0) {
+      return THRESHOLD_PROFILE_GUARD;
+    }
+  }
+  return THRESHOLD_PROFILE_NONE;
+}
+
+inline void ThresholdScheduler::apply(size_t index) {
+  Switch& s = this->history[this->switches % THRESHOLD_SWITCHES];
+  s.first_guard = this->writer->get_image_counter();
+  write_registers(this->image_processing, this->profiles[index].writes,
+                  THRESHOLD_PROFILE_REGISTERS);
+  // If a new frame started meanwhile it can also have both profiles
+  s.first_frame = this->writer->get_image_counter() + 1;
+  s.profile = index;
+  this->active = index;
+  this->switches++;
+}
+
+#endif // __THRESHOLD_SCHEDULER_H
@@ -0,0 +1,79 @@
+// file: triangle_detector.hpp
+// Native version of get_shapes() of triangle-detector-server.py: finds the
+// triangles (UGVs) in a binary image. The vertices are in (row, column)
+// image coordinates, in the same order as the Python version.
+
+#ifndef __TRIANGLE_DETECTOR_H
+#define __TRIANGLE_DETECTOR_H
+
+#include <inttypes.h>
+
+#include <vector>
+
+#include "contour_finder.hpp"
+#include "polygon_approx.hpp"
+
+// Parameters of triangle-detector-server.py
+#define TRIANGLE_CONTOUR_LEVEL 0.9
+#define TRIANGLE_TOLERANCE     8
+// Vertices of a closed triangle (the first one is repeated at the end)
+#define TRIANGLE_MAX_VERTICES  4
+
+struct Triangle {
+  ContourPoint vertices[3];
+};
+
+/*
+  Class definition of the triangle detector. Reuses its working memory
+  between frames.
+*/
+class TriangleDetector {
+  public:
+    TriangleDetector(void) : level(TRIANGLE_CONTOUR_LEVEL), tolerance(TRIANGLE_TOLERANCE) {}
+    // Detect the triangles of a binary image of width x height pixels
+    // (row-major, 'stride' Bytes per row). Returns the number found.
+    int detect(const uint8_t* image, int width, int height, int stride,
+               std::vector<Triangle>* triangles);
+    void set_level(double level) { this->level = level; }
+    void set_tolerance(double tolerance) { this->tolerance = tolerance; }
+
+  private:
+    double level, tolerance;
+    ContourFinder finder;
+    PolygonApprox approx;
+    ContourSet contours;
+    std::vector<uint32_t> vertices;
+};
+
+// --Class Methods implementation --//
+
+inline int TriangleDetector::detect(const uint8_t* image, int width, int height,
+    int stride, std::vector<Triangle>* triangles) {
+  triangles->clear();
+  if (this->finder.find(image, width, height, stride, this->level, &this->contours) != 0) {
+    return 0;
+  }
+  for (size_t i = 0; i < this->contours.size(); i++) {
+    size_t vertices = this->approx.approximate(this->contours.contour_rows(i),
+        this->contours.contour_cols(i), this->contours.length(i), this->tolerance,
+        TRIANGLE_MAX_VERTICES, &this->vertices);
+    // Open chains of 3 vertices and closed chains of 4 (first == last)
+    const uint32_t* v = &this->vertices[0];
+    size_t first;
+    if ((vertices == 3) && !(this->contours.point(i, v[0]) == this->contours.point(i, v[2]))) {
+      first = 0;
+    } else if ((vertices == 4) && (this->contours.point(i, v[0]) == this->contours.point(i, v[3]))) {
+      first = 1;
+    } else {
+      continue;
+    }
+    Triangle triangle;
+    for (int k = 0; k < 3; k++) {
+      triangle.vertices[k] = this->contours.point(i, v[first + k]);
+    }
+    triangles->push_back(triangle);
+  }
+  return triangles->size();
+}
+
+#endif // __TRIANGLE_DETECTOR_H
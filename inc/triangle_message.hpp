@@ -0,0 +1,199 @@
+// file: triangle_message.hpp
+// Messages with the triangles of a frame sent to the clients:
+//  - JSON, as send_json of triangle-detector-server.py: a list of triangles,
+//    each one a list of 3 [row, column] vertices.
+//  - Binary: a fixed-layout little-endian header followed by the packed
+//    vertices, decoded without parsing text.
+//
+// Binary layout (all little-endian):
+//   offset  size  field
+//        0     4  magic "UVTM"
+//        4     2  version (TRIANGLE_MESSAGE_VERSION)
+//        6     2  label: int16 threshold profile of the frame or -1
+//        8     4  frame counter (CAPTURE_IMAGE_COUNTER)
+//       12     4  count: number of triangles
+//       16     8  capture timestamp (ns, steady clock of the server)
+//       24  24*n  triangles: 3 vertices of float32 row, column each
+// In Python: struct.unpack_from("<4sHhIIQ", message) and then
+// struct.unpack_from("<6f", message, 24 + 24 * i).
+
+#ifndef __TRIANGLE_MESSAGE_H
+#define __TRIANGLE_MESSAGE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <string>
+#include <vector>
+
+#include "triangle_detector.hpp"
+
+#define TRIANGLE_MESSAGE_MAGIC   "UVTM"
+#define TRIANGLE_MESSAGE_VERSION 1
+#define TRIANGLE_MESSAGE_HEADER_SIZE   24
+#define TRIANGLE_MESSAGE_TRIANGLE_SIZE 24
+
+#define ERROR_TRIANGLE_MESSAGE_SIZE    -1
+#define ERROR_TRIANGLE_MESSAGE_MAGIC   -2
+#define ERROR_TRIANGLE_MESSAGE_VERSION -3
+
+// Header of a binary message
+struct TriangleMessageHeader {
+  uint16_t version;
+  int16_t label;
+  uint32_t frame_counter;
+  uint32_t count;
+  uint64_t timestamp_ns;
+};
+
+// Write the binary message of a frame in 'message' (resized to fit)
+void triangle_message_encode(const TriangleMessageHeader& header,
+                             const std::vector<Triangle>& triangles,
+                             std::string* message);
+// Read a binary message. triangles can be NULL to read only the header.
+// Returns the number of triangles or a negative error.
+int triangle_message_decode(const void* message, size_t len,
+                            TriangleMessageHeader* header,
+                            std::vector<Triangle>* triangles);
+
+// Append the JSON list of the triangles, with the numbers formatted as
+// Python does
+void triangles_json_append(const std::vector<Triangle>& triangles, std::string* json);
+// JSON message of the triangles (as send_json)
+inline void triangles_json(const std::vector<Triangle>& triangles, std::string* json) {
+  json->clear();
+  triangles_json_append(triangles, json);
+}
+
+// --Functions implementation --//
+
+// Little-endian fields, independent of the byte order of the machine
+inline void triangle_message_put16(uint8_t* p, uint16_t value) {
+  p[0] = value;
+  p[1] = value >> 8;
+}
+inline void triangle_message_put32(uint8_t* p, uint32_t value) {
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+inline void triangle_message_put_float(uint8_t* p, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  triangle_message_put32(p, bits);
+}
+inline uint16_t triangle_message_get16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+inline uint32_t triangle_message_get32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+inline float triangle_message_get_float(const uint8_t* p) {
+  uint32_t bits = triangle_message_get32(p);
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+inline void triangle_message_encode(const TriangleMessageHeader& header,
+    const std::vector<Triangle>& triangles, std::string* message) {
+  message->resize(TRIANGLE_MESSAGE_HEADER_SIZE +
+                  triangles.size() * TRIANGLE_MESSAGE_TRIANGLE_SIZE);
+  uint8_t* p = (uint8_t*) &(*message)[0];
+  memcpy(p, TRIANGLE_MESSAGE_MAGIC, 4);
+  triangle_message_put16(p + 4, TRIANGLE_MESSAGE_VERSION);
+  triangle_message_put16(p + 6, header.label);
+  triangle_message_put32(p + 8, header.frame_counter);
+  triangle_message_put32(p + 12, triangles.size());
+  triangle_message_put32(p + 16, header.timestamp_ns);
+  triangle_message_put32(p + 20, header.timestamp_ns >> 32);
+  p += TRIANGLE_MESSAGE_HEADER_SIZE;
+  for (size_t i = 0; i < triangles.size(); i++) {
+    for (int v = 0; v < 3; v++) {
+      triangle_message_put_float(p, triangles[i].vertices[v].r);
+      triangle_message_put_float(p + 4, triangles[i].vertices[v].c);
+      p += 8;
+    }
+  }
+}
+
+inline int triangle_message_decode(const void* message, size_t len,
+    TriangleMessageHeader* header, std::vector<Triangle>* triangles) {
+  const uint8_t* p = (const uint8_t*) message;
+  if (len < TRIANGLE_MESSAGE_HEADER_SIZE) {
+    return ERROR_TRIANGLE_MESSAGE_SIZE;
+  }
+  if (memcmp(p, TRIANGLE_MESSAGE_MAGIC, 4) != 0) {
+    return ERROR_TRIANGLE_MESSAGE_MAGIC;
+  }
+  header->version = triangle_message_get16(p + 4);
+  if (header->version != TRIANGLE_MESSAGE_VERSION) {
+    return ERROR_TRIANGLE_MESSAGE_VERSION;
+  }
+  header->label = (int16_t) triangle_message_get16(p + 6);
+  header->frame_counter = triangle_message_get32(p + 8);
+  header->count = triangle_message_get32(p + 12);
+  header->timestamp_ns = triangle_message_get32(p + 16) |
+                         ((uint64_t) triangle_message_get32(p + 20) << 32);
+  if ((len - TRIANGLE_MESSAGE_HEADER_SIZE) / TRIANGLE_MESSAGE_TRIANGLE_SIZE < header->count) {
+    return ERROR_TRIANGLE_MESSAGE_SIZE;
+  }
+  if (triangles != NULL) {
+    triangles->resize(header->count);
+    p += TRIANGLE_MESSAGE_HEADER_SIZE;
+    for (uint32_t i = 0; i < header->count; i++) {
+      for (int v = 0; v < 3; v++) {
+        (*triangles)[i].vertices[v].r = triangle_message_get_float(p);
+        (*triangles)[i].vertices[v].c = triangle_message_get_float(p + 4);
+        p += 8;
+      }
+    }
+  }
+  return header->count;
+}
+
+// Shortest decimal representation that reads back as the same value, as
+// Python prints floats (always with a decimal point). If a number of
+// decimals reads back, any larger one does too, so it is binary searched
+// after trying 1 (half of the coordinates of the vertices are whole pixels).
+inline void triangles_json_append_float(double value, std::string* out) {
+  char buffer[48];
+  snprintf(buffer, sizeof(buffer), "%.1f", value);
+  if (strtod(buffer, NULL) == value) {
+    out->append(buffer);
+    return;
+  }
+  int low = 2, high = 17;
+  while (low < high) {
+    int decimals = (low + high) / 2;
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    if (strtod(buffer, NULL) == value) {
+      high = decimals;
+    } else {
+      low = decimals + 1;
+    }
+  }
+  snprintf(buffer, sizeof(buffer), "%.*f", low, value);
+  out->append(buffer);
+}
+
+inline void triangles_json_append(const std::vector<Triangle>& triangles, std::string* json) {
+  json->append("[");
+  for (size_t i = 0; i < triangles.size(); i++) {
+    json->append((i == 0) ? "[" : ", [");
+    for (int v = 0; v < 3; v++) {
+      json->append((v == 0) ? "[" : ", [");
+      triangles_json_append_float(triangles[i].vertices[v].r, json);
+      json->append(", ");
+      triangles_json_append_float(triangles[i].vertices[v].c, json);
+      json->append("]");
+    }
+    json->append("]");
+  }
+  json->append("]");
+}
+
+#endif // __TRIANGLE_MESSAGE_H
@@ -0,0 +1,300 @@
+// file: triangle_pose.hpp
+// Pose of the UGVs (position, heading, area) from the triangles found by
+// TriangleDetector, as fixed-size records that clients can use without
+// repeating the geometry.
+//
+// The vertices of the binary contours are whole-pixel accurate and lie
+// about half a pixel outside the UGV. When the gray image of the same frame
+// is available each side is refined: the gray level is sampled across the
+// side at several points, the position of the strongest gradient is
+// interpolated to a fraction of a pixel, and a line is fitted to those
+// positions. The vertices are the intersections of the three lines.
+//
+// The UGV triangles are isosceles: the apex is the vertex opposite the
+// shortest side and the heading points from the middle of that side to
+// the apex.
+
+#ifndef __TRIANGLE_POSE_H
+#define __TRIANGLE_POSE_H
+
+#include <inttypes.h>
+#include <math.h>
+
+#include <vector>
+
+#include "triangle_detector.hpp"
+
+// Flags of a pose
+#define POSE_REFINED        0x1 // sides refined with the gray image
+#define POSE_APEX_AMBIGUOUS 0x2 // two shortest sides of similar length
+#define POSE_BORDER         0x4 // a vertex on the border of the image
+
+// Label of the poses not classified (e.g. by colour)
+#define POSE_LABEL_NONE -1
+
+// Points sampled along each side and distance searched across it (pixels)
+#define POSE_SIDE_SAMPLES     12
+#define POSE_SEARCH_RADIUS    3.0
+// Gray levels per pixel of the weakest edge accepted
+#define POSE_MIN_GRADIENT     4.0
+// The apex is clear when the shortest side is at most this fraction of
+// the next one (0.6 for the UGV markers)
+#define POSE_APEX_RATIO       0.8
+
+/*
+  Pose of a UGV. Fixed size (24 Bytes) and layout, in the byte order of
+  the machine (little-endian on the HPS), for clients reading it directly:
+  struct.unpack("<5fHh", record) in Python.
+*/
+struct TrianglePose {
+  // Centroid in (row, column) image coordinates
+  float row, col;
+  // Direction of the apex in radians, atan2(row, column) (clockwise from
+  // the column axis on the screen)
+  float heading;
+  // Area in pixels^2
+  float area;
+  // 0 to 1: how clearly the apex stands out times the fraction of the side
+  // samples with a clear gray edge (0.5 if not refined)
+  float confidence;
+  uint16_t flags;
+  // Class of the UGV (e.g. colour profile) or POSE_LABEL_NONE
+  int16_t label;
+};
+
+static_assert(sizeof(TrianglePose) == 24, "TrianglePose must be 24 Bytes");
+
+/*
+  Class definition of the pose estimator
+*/
+class TrianglePoseEstimator {
+  public:
+    // Estimate the poses of the triangles of a frame. gray is the gray
+    // image of the same frame (NULL if not available) with 'stride' Bytes
+    // per row and the gray level in the last Byte of each pixel of
+    // 'pixel_size' Bytes (1 for gray images, 4 for RGBG).
+    void estimate(const std::vector<Triangle>& triangles, const uint8_t* gray,
+                  int width, int height, int stride, int pixel_size, int16_t label,
+                  std::vector<TrianglePose>* poses);
+    TrianglePose estimate(const Triangle& triangle, const uint8_t* gray, int width,
+                          int height, int stride, int pixel_size, int16_t label);
+
+  private:
+    // Line n.p = d of a side, refined with the gray image. Returns the
+    // fraction of samples with a clear edge (the line is not changed if
+    // there are not enough).
+    double refine_side(const ContourPoint& p0, const ContourPoint& p1, double line[3]);
+    // Gray level at a fractional position (bilinear). False outside.
+    bool sample(double r, double c, double* value);
+
+    const uint8_t* gray;
+    int width, height, stride, pixel_size;
+};
+
+// --Class Methods implementation --//
+
+inline void TrianglePoseEstimator::estimate(const std::vector<Triangle>& triangles,
+    const uint8_t* gray, int width, int height, int stride, int pixel_size,
+    int16_t label, std::vector<TrianglePose>* poses) {
+  poses->resize(triangles.size());
+  for (size_t i = 0; i < triangles.size(); i++) {
+    (*poses)[i] = this->estimate(triangles[i], gray, width, height, stride, pixel_size, label);
+  }
+}
+
+inline TrianglePose TrianglePoseEstimator::estimate(const Triangle& triangle,
+    const uint8_t* gray, int width, int height, int stride, int pixel_size,
+    int16_t label) {
+  TrianglePose pose;
+  pose.flags = 0;
+  pose.label = label;
+  this->gray = gray;
+  this->width = width;
+  this->height = height;
+  this->stride = stride;
+  this->pixel_size = pixel_size;
+
+  const ContourPoint* v = triangle.vertices;
+  ContourPoint refined[3] = {v[0], v[1], v[2]};
+  double support = 0.5;
+  for (int k = 0; k < 3; k++) {
+    if ((v[k].r <= 0) || (v[k].c <= 0) || (v[k].r >= height - 1) || (v[k].c >= width - 1)) {
+      pose.flags |= POSE_BORDER;
+    }
+  }
+  if (gray != NULL) {
+    // Side k goes from vertex k to vertex k + 1
+    double lines[3][3];
+    double fit = 0;
+    for (int k = 0; k < 3; k++) {
+      fit += this->refine_side(v[k], v[(k + 1) % 3], lines[k]) / 3;
+    }
+    // Vertex k is where sides k - 1 and k meet. The refinement is only
+    // kept if every vertex stays close to the one of the contour.
+    bool valid = true;
+    for (int k = 0; k < 3; k++) {
+      const double* a = lines[(k + 2) % 3];
+      const double* b = lines[k];
+      double det = a[0] * b[1] - a[1] * b[0];
+      if (fabs(det) < 1e-6) {
+        valid = false;
+        break;
+      }
+      refined[k].r = (a[2] * b[1] - a[1] * b[2]) / det;
+      refined[k].c = (a[0] * b[2] - a[2] * b[0]) / det;
+      double dr = refined[k].r - v[k].r, dc = refined[k].c - v[k].c;
+      if (dr * dr + dc * dc > 4 * POSE_SEARCH_RADIUS * POSE_SEARCH_RADIUS) {
+        valid = false;
+        break;
+      }
+    }
+    if (valid) {
+      pose.flags |= POSE_REFINED;
+      support = fit;
+    } else {
+      refined[0] = v[0];
+      refined[1] = v[1];
+      refined[2] = v[2];
+    }
+  }
+
+  // Centroid and area
+  pose.row = (refined[0].r + refined[1].r + refined[2].r) / 3;
+  pose.col = (refined[0].c + refined[1].c + refined[2].c) / 3;
+  double cross = (refined[1].r - refined[0].r) * (refined[2].c - refined[0].c) -
+                 (refined[1].c - refined[0].c) * (refined[2].r - refined[0].r);
+  pose.area = fabs(cross) / 2;
+
+  // Apex opposite the shortest side. side[k] is the side opposite vertex k.
+  double side[3];
+  for (int k = 0; k < 3; k++) {
+    const ContourPoint& a = refined[(k + 1) % 3];
+    const ContourPoint& b = refined[(k + 2) % 3];
+    side[k] = hypot(a.r - b.r, a.c - b.c);
+  }
+  int apex = 0;
+  for (int k = 1; k < 3; k++) {
+    if (side[k] < side[apex]) {
+      apex = k;
+    }
+  }
+  double next = fmin(side[(apex + 1) % 3], side[(apex + 2) % 3]);
+  double ratio = (next > 0) ? side[apex] / next : 1;
+  if (ratio > POSE_APEX_RATIO) {
+    pose.flags |= POSE_APEX_AMBIGUOUS;
+  }
+  const ContourPoint& a = refined[(apex + 1) % 3];
+  const ContourPoint& b = refined[(apex + 2) % 3];
+  pose.heading = atan2(refined[apex].r - (a.r + b.r) / 2, refined[apex].c - (a.c + b.c) / 2);
+  // 1 when the base is at most half as long as the other sides, 0 for
+  // an equilateral triangle
+  double distinct = fmin(1, fmax(0, (1 - ratio) / 0.5));
+  pose.confidence = distinct * support;
+  return pose;
+}
+
+inline double TrianglePoseEstimator::refine_side(const ContourPoint& p0,
+    const ContourPoint& p1, double line[3]) {
+  double dr = p1.r - p0.r, dc = p1.c - p0.c;
+  double length = hypot(dr, dc);
+  // Normal of the side
+  double nr = (length > 0) ? -dc / length : 0;
+  double nc = (length > 0) ? dr / length : 0;
+  line[0] = nr;
+  line[1] = nc;
+  line[2] = nr * p0.r + nc * p0.c;
+  if (length < 4) {
+    return 0;
+  }
+
+  // Strongest gradient across the side at points spread along it, away
+  // from the vertices
+  double points_r[POSE_SIDE_SAMPLES], points_c[POSE_SIDE_SAMPLES];
+  int found = 0;
+  const int steps = (int) (2 * POSE_SEARCH_RADIUS);
+  for (int i = 0; i < POSE_SIDE_SAMPLES; i++) {
+    double t = 0.2 + 0.6 * i / (POSE_SIDE_SAMPLES - 1);
+    double r = p0.r + t * dr, c = p0.c + t * dc;
+    // Gray levels every half pixel across the side
+    double profile[4 * (int) POSE_SEARCH_RADIUS + 1];
+    bool inside = true;
+    for (int s = -steps; s <= steps; s++) {
+      inside = inside && this->sample(r + 0.5 * s * nr, c + 0.5 * s * nc, &profile[s + steps]);
+    }
+    if (!inside) {
+      continue;
+    }
+    // Derivative (per pixel) between consecutive samples
+    double best = 0;
+    int best_index = -1;
+    double derivative[4 * (int) POSE_SEARCH_RADIUS];
+    for (int s = 0; s < 2 * steps; s++) {
+      derivative[s] = 2 * (profile[s + 1] - profile[s]);
+      if (fabs(derivative[s]) > best) {
+        best = fabs(derivative[s]);
+        best_index = s;
+      }
+    }
+    if (best < POSE_MIN_GRADIENT) {
+      continue;
+    }
+    // Parabola through the peak and its neighbours
+    double offset = 0;
+    if ((best_index > 0) && (best_index < 2 * steps - 1)) {
+      double y0 = fabs(derivative[best_index - 1]);
+      double y1 = best;
+      double y2 = fabs(derivative[best_index + 1]);
+      double denominator = y0 - 2 * y1 + y2;
+      if (denominator < 0) {
+        offset = 0.5 * (y0 - y2) / denominator;
+      }
+    }
+    // Derivative s is centred between samples s and s + 1
+    double distance = 0.5 * (best_index + 0.5 + offset - steps);
+    points_r[found] = r + distance * nr;
+    points_c[found] = c + distance * nc;
+    found++;
+  }
+  if (found < 3) {
+    return 0;
+  }
+
+  // Total least squares line through the points
+  double mean_r = 0, mean_c = 0;
+  for (int i = 0; i < found; i++) {
+    mean_r += points_r[i];
+    mean_c += points_c[i];
+  }
+  mean_r /= found;
+  mean_c /= found;
+  double srr = 0, scc = 0, src = 0;
+  for (int i = 0; i < found; i++) {
+    double er = points_r[i] - mean_r, ec = points_c[i] - mean_c;
+    srr += er * er;
+    scc += ec * ec;
+    src += er * ec;
+  }
+  // Direction of largest spread and its normal
+  double angle = 0.5 * atan2(2 * src, srr - scc);
+  line[0] = -sin(angle);
+  line[1] = cos(angle);
+  line[2] = line[0] * mean_r + line[1] * mean_c;
+  return (double) found / POSE_SIDE_SAMPLES;
+}
+
+inline bool TrianglePoseEstimator::sample(double r, double c, double* value) {
+  if ((r < 0) || (c < 0) || (r >= this->height - 1) || (c >= this->width - 1)) {
+    return false;
+  }
+  int r0 = (int) r, c0 = (int) c;
+  double fr = r - r0, fc = c - c0;
+  const uint8_t* p = this->gray + (size_t) r0 * this->stride +
+                     (size_t) c0 * this->pixel_size + this->pixel_size - 1;
+  double top = p[0] + fc * (p[this->pixel_size] - p[0]);
+  p += this->stride;
+  double bottom = p[0] + fc * (p[this->pixel_size] - p[0]);
+  *value = top + fr * (bottom - top);
+  return true;
+}
+
+#endif // __TRIANGLE_POSE_H
@@ -4,7 +4,10 @@
 #include <linux/fs.h>
 #include <linux/kobject.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/stringify.h>
 #include <asm/io.h>
 #include <asm/types.h>
 #include <asm/uaccess.h>
@@ -18,14 +21,24 @@
 
 #define CLASS_NAME "uvispace_camera"
 
-#define DEV_NAME_RGBG "uvispace_camera_rgbg"
-#define DEV_NAME_GRAY "uvispace_camera_gray"
-#define DEV_NAME_BIN "uvispace_camera_bin"
+// Each image writer has a device uvispace_camera_<name>. Its minor number
+// (used to identify each device because they share file operations) is its
+// position in the image_writers parameter.
+#define DEV_NAME_PREFIX "uvispace_camera_"
+#define IMAGE_WRITER_NAME_SIZE 32
 
-//Minor numbers (used to identify each device because they share file operations)
-#define MINOR_RGBG 0
-#define MINOR_GRAY 1
-#define MINOR_BIN  2
+// Minor numbers reserved by register_chrdev
+#define IMAGE_WRITERS_MAX 256
+
+// All the image writers have the same registers
+#define IMAGE_WRITER_SPAN AVALON_IMG_WRITER_BINARY_SPAN
+
+// Image writers of the FPGA design in hps_0.h: name, base address in the
+// lightweight bridge and Bytes per pixel
+#define DEFAULT_IMAGE_WRITERS \
+    "rgbg:" __stringify(AVALON_IMG_WRITER_RGBGRAY_BASE) ":4," \
+    "gray:" __stringify(AVALON_IMG_WRITER_GRAY_BASE) ":1," \
+    "bin:" __stringify(AVALON_IMG_WRITER_BINARY_BASE) ":1"
 
 // Img writer mode.
 // SINGLE_SHOT when reading it waits until a frame starts, captures it and comes back to iddle.
@@ -33,13 +46,22 @@
 // Use SINGLE_SHOT for getting a picture and CONTINUOUS for getting a video. If CONTINUOUS is
 // used to get a picture, if open and read are executed too fast the first image may not be
 // acquired yet. If SINGLE_SHOT is used for video it will just go slower.
+// SINGLE_SHOT_PREFETCH captures single shots too, but as soon as an image is complete the
+// capture of the next one starts into the other buffer, overlapping the copy to userspace and
+// the time until the next read. Every image read started after the previous read began, at
+// close to the CONTINUOUS frame rate.
 #define SINGLE_SHOT 0
 #define CONTINUOUS  1
+#define SINGLE_SHOT_PREFETCH 2
 
 // Default image dimensions
 #define DEFAULT_IMAGE_HEIGHT 480
 #define DEFAULT_IMAGE_WIDTH  640
 
+// Default largest image the buffers reserved at init can hold
+#define DEFAULT_MAX_IMAGE_HEIGHT DEFAULT_IMAGE_HEIGHT
+#define DEFAULT_MAX_IMAGE_WIDTH  DEFAULT_IMAGE_WIDTH
+
 // Camera errors
 #define ERROR_CAMERA_NO_REPLY 1
 
@@ -56,23 +78,55 @@ MODULE_DESCRIPTION("uvispace_camera: character device driver for uvispace camera
 MODULE_LICENSE("GPL");
 MODULE_VERSION("0.1");
 
+// Image writers of the FPGA design, e.g. for one more binary image:
+// insmod uvispace_camera_driver.ko image_writers="rgbg:0x100:4,gray:0x200:1,bin:0x300:1,bin_red:0x500:1"
+static char* image_writers = DEFAULT_IMAGE_WRITERS;
+module_param(image_writers, charp, 0444);
+MODULE_PARM_DESC(image_writers, "Image writers as name:base:bytes_per_pixel separated by commas "
+                 "(default "DEFAULT_IMAGE_WRITERS")");
+
+// The two buffers of each image writer are allocated at init, with room for
+// max_image_width * max_image_height pixels, so opening a device does not
+// allocate and does not fail when the memory gets fragmented. Any image_width
+// and image_height with as many pixels at most can be used, e.g. for 1280x960:
+// insmod uvispace_camera_driver.ko max_image_width=1280 max_image_height=960
+static int max_image_width = DEFAULT_MAX_IMAGE_WIDTH;
+module_param(max_image_width, int, 0444);
+MODULE_PARM_DESC(max_image_width, "Width of the largest image (default "
+                 __stringify(DEFAULT_MAX_IMAGE_WIDTH)")");
+static int max_image_height = DEFAULT_MAX_IMAGE_HEIGHT;
+module_param(max_image_height, int, 0444);
+MODULE_PARM_DESC(max_image_height, "Height of the largest image (default "
+                 __stringify(DEFAULT_MAX_IMAGE_HEIGHT)")");
+
 // Device driver variables
 static int majorNumber;
 static struct class* class = NULL;
-static struct device* device_rgbg = NULL;
-static struct device* device_gray = NULL;
-static struct device* device_bin = NULL;
-
-// Image writer variables (one for each image_writer)
-// 0 is RGBGray, 1 is Gray and 2 is Bin (same as minor numbers)
-static void* address_virtual_image_writer[3];
-static int is_open[3];
-static void* address_virtual_buffer0[3];
-static dma_addr_t address_physical_buffer0[3];
-static void* address_virtual_buffer1[3];
-static dma_addr_t address_physical_buffer1[3];
-static size_t image_memory_size[3];
-static int32_t last_image_number[3];
+
+// Image writer variables (one for each image_writer, indexed by minor number)
+struct image_writer {
+    char name[IMAGE_WRITER_NAME_SIZE];
+    unsigned long base;
+    int pixel_size;
+    struct device* device;
+    void* address_virtual_image_writer;
+    int is_open;
+    void* address_virtual_buffer0;
+    dma_addr_t address_physical_buffer0;
+    void* address_virtual_buffer1;
+    dma_addr_t address_physical_buffer1;
+    // Size of each buffer, allocated at init
+    size_t buffer_size;
+    size_t image_memory_size;
+    int32_t last_image_number;
+    // Mode when the device was opened
+    int mode;
+    // SINGLE_SHOT_PREFETCH: a capture into prefetch_buffer was started
+    int prefetch_armed;
+    int prefetch_buffer;
+};
+static struct image_writer* writers = NULL;
+static int writer_count = 0;
 
 // Function prototypes
 static int camera_open(struct inode *, struct file *);
@@ -143,16 +197,133 @@ static struct kobject *uvispace_camera_kobj;
 
 
 //------INIT AND EXIT FUNCTIONS-----//
+// Fill writers from the image_writers parameter. Returns the number of image
+// writers or a negative error.
+static int parse_image_writers(void) {
+    char* list;
+    char* cursor;
+    char* entry;
+    char* name;
+    char* base;
+    char* pixel_size;
+    int count = 1;
+    int n = 0;
+
+    for (cursor = image_writers; *cursor != '\0'; cursor++) {
+        if (*cursor == ',') {
+            count++;
+        }
+    }
+    if (count > IMAGE_WRITERS_MAX) {
+        printk(KERN_ALERT DRIVER_NAME": More than %d image writers\n", IMAGE_WRITERS_MAX);
+        return -EINVAL;
+    }
+    writers = kcalloc(count, sizeof(struct image_writer), GFP_KERNEL);
+    list = kstrdup(image_writers, GFP_KERNEL);
+    if ((writers == NULL) || (list == NULL)) {
+        kfree(writers);
+        kfree(list);
+        writers = NULL;
+        return -ENOMEM;
+    }
+    cursor = list;
+    while ((entry = strsep(&cursor, ",")) != NULL) {
+        name = strsep(&entry, ":");
+        base = strsep(&entry, ":");
+        pixel_size = entry;
+        if ((name == NULL) || (name[0] == '\0') || (strlen(name) >= IMAGE_WRITER_NAME_SIZE) ||
+                (base == NULL) || (pixel_size == NULL) ||
+                (kstrtoul(base, 0, &writers[n].base) != 0) ||
+                (kstrtoint(pixel_size, 0, &writers[n].pixel_size) != 0) ||
+                (writers[n].pixel_size < 1) || (writers[n].pixel_size > 4)) {
+            printk(KERN_ALERT DRIVER_NAME": Wrong image writer %d in \"%s\"\n", n, image_writers);
+            kfree(list);
+            kfree(writers);
+            writers = NULL;
+            return -EINVAL;
+        }
+        strcpy(writers[n].name, name);
+        n++;
+    }
+    kfree(list);
+    return n;
+}
+
+// Free the buffers of the first count image writers
+static void free_buffers(int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (writers[i].address_virtual_buffer0 != NULL) {
+            dma_free_coherent(NULL, writers[i].buffer_size, writers[i].address_virtual_buffer0,
+                              writers[i].address_physical_buffer0);
+            writers[i].address_virtual_buffer0 = NULL;
+        }
+        if (writers[i].address_virtual_buffer1 != NULL) {
+            dma_free_coherent(NULL, writers[i].buffer_size, writers[i].address_virtual_buffer1,
+                              writers[i].address_physical_buffer1);
+            writers[i].address_virtual_buffer1 = NULL;
+        }
+    }
+}
+
+// Allocate the two buffers of every image writer for the largest image.
+// The dma_alloc_coherent() function allocates non-cached physically
+// contiguous memory (from CMA when it is enabled). Accesses to the memory by
+// the CPU are the same as a cache miss when the cache is used. The CPU does
+// not have to invalidate or flush the cache which can be time consuming.
+static int allocate_buffers(void) {
+    int i;
+
+    if ((max_image_width < 1) || (max_image_height < 1)) {
+        printk(KERN_ALERT DRIVER_NAME": Wrong maximum image size %dx%d\n",
+               max_image_width, max_image_height);
+        return -EINVAL;
+    }
+    for (i = 0; i < writer_count; i++) {
+        writers[i].buffer_size = (size_t)max_image_width * max_image_height * writers[i].pixel_size;
+        writers[i].address_virtual_buffer0 = dma_alloc_coherent(
+            NULL,
+            writers[i].buffer_size,
+            &(writers[i].address_physical_buffer0), //address to use from image writer in fpga
+            GFP_KERNEL);
+        writers[i].address_virtual_buffer1 = dma_alloc_coherent(
+            NULL,
+            writers[i].buffer_size,
+            &(writers[i].address_physical_buffer1), //address to use from image writer in fpga
+            GFP_KERNEL);
+        if ((writers[i].address_virtual_buffer0 == NULL) ||
+                (writers[i].address_virtual_buffer1 == NULL)) {
+            printk(KERN_ALERT DRIVER_NAME": Allocation of 2 buffers of %zu Bytes for %s failed\n",
+                   writers[i].buffer_size, writers[i].name);
+            free_buffers(i + 1);
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
 static int __init camera_driver_init(void) {
     int result;
     int i;
     void* SDRAMC_virtual_address;
 
     printk(KERN_INFO DRIVER_NAME": Init\n");
+    writer_count = parse_image_writers();
+    if (writer_count < 0) {
+        return writer_count;
+    }
+    result = allocate_buffers();
+    if (result != 0) {
+        kfree(writers);
+        return result;
+    }
     // Dynamically allocate a major number for the device
     majorNumber = register_chrdev(0, DRIVER_NAME, &fops);
     if (majorNumber < 0) {
         printk(KERN_ALERT DRIVER_NAME": Failed to register a major number\n");
+        free_buffers(writer_count);
+        kfree(writers);
         return 1;
     }
     // Register the device class
@@ -161,23 +332,16 @@ static int __init camera_driver_init(void) {
         printk(KERN_ALERT DRIVER_NAME": Failed to register device class\n");
         goto error_class_create;
     }
-    // Register the RGBG device
-    device_rgbg = device_create(class, NULL, MKDEV(majorNumber, MINOR_RGBG), NULL, DEV_NAME_RGBG);
-    if (IS_ERR(device_rgbg)) {
-        printk(KERN_ALERT DRIVER_NAME": Failed to create the device RGBG\n");
-        goto error_create_rgbg;
-    }
-    // Register the GRAY device
-    device_gray = device_create(class, NULL, MKDEV(majorNumber, MINOR_GRAY), NULL, DEV_NAME_GRAY);
-    if (IS_ERR(device_gray)) {
-        printk(KERN_ALERT DRIVER_NAME": Failed to create the device GRAY\n");
-        goto error_create_gray;
-    }
-    // Register the BIN device
-    device_bin = device_create(class, NULL, MKDEV(majorNumber, MINOR_BIN), NULL, DEV_NAME_BIN);
-    if (IS_ERR(device_bin)) {
-        printk(KERN_ALERT DRIVER_NAME": Failed to create the device BIN\n");
-        goto error_create_bin;
+    // Register a device for each image writer
+    for (i = 0; i < writer_count; i++) {
+        writers[i].device = device_create(class, NULL, MKDEV(majorNumber, i), NULL,
+                                          DEV_NAME_PREFIX"%s", writers[i].name);
+        if (IS_ERR(writers[i].device)) {
+            printk(KERN_ALERT DRIVER_NAME": Failed to create the device %s\n", writers[i].name);
+            goto error_create_device;
+        }
+        printk(KERN_INFO DRIVER_NAME": %s at 0x%lx, %d Bytes per pixel\n", writers[i].name,
+               writers[i].base, writers[i].pixel_size);
     }
 
     // Export sysfs variables
@@ -194,9 +358,6 @@ static int __init camera_driver_init(void) {
         goto error_create_kobj;
     }
 
-    // Reset the variables that flag if a device is already Open
-    for (i=0; i<3; i++) is_open[i] = 0;
-
     //Remove FPGA-to-SDRAMC ports from reset so FPGA can access SDRAM from them
     SDRAMC_virtual_address = ioremap(SDRAMC_REGS, SDRAMC_REGS_SPAN);
     if (SDRAMC_virtual_address == NULL)
@@ -210,23 +371,28 @@ static int __init camera_driver_init(void) {
 
     //Undo what it was done in case of error
 error_create_kobj:
-    device_destroy(class, MKDEV(majorNumber, MINOR_BIN));
-error_create_bin:
-    device_destroy(class, MKDEV(majorNumber, MINOR_GRAY));
-error_create_gray:
-    device_destroy(class, MKDEV(majorNumber, MINOR_RGBG));
-error_create_rgbg:
+    i = writer_count;
+error_create_device:
+    while (i-- > 0) {
+        device_destroy(class, MKDEV(majorNumber, i));
+    }
     class_unregister(class);
     class_destroy(class);
 error_class_create:
     unregister_chrdev(majorNumber, DRIVER_NAME);
+    free_buffers(writer_count);
+    kfree(writers);
     return -1;
 }
 
 static void __exit camera_driver_exit(void) {
-    device_destroy(class, MKDEV(majorNumber, MINOR_BIN));
-    device_destroy(class, MKDEV(majorNumber, MINOR_GRAY));
-    device_destroy(class, MKDEV(majorNumber, MINOR_RGBG));
+    int i;
+
+    for (i = 0; i < writer_count; i++) {
+        device_destroy(class, MKDEV(majorNumber, i));
+    }
+    free_buffers(writer_count);
+    kfree(writers);
     class_unregister(class);
     class_destroy(class);
     unregister_chrdev(majorNumber, DRIVER_NAME);
@@ -236,21 +402,23 @@ static void __exit camera_driver_exit(void) {
 
 //-----SMALL API TO CONTROL THE CAMERA-----//
 int camera_setup(int n){
-    // Save the mode (SINGLE_SHOT or CONTINUOUS)
-    iowrite32(image_writer_mode, address_virtual_image_writer[n] + CAPTURE_MODE);
+    // Save the mode (SINGLE_SHOT or CONTINUOUS). The hardware captures SINGLE_SHOT_PREFETCH
+    // images as single shots.
+    iowrite32((writers[n].mode == CONTINUOUS) ? CONTINUOUS : SINGLE_SHOT,
+              writers[n].address_virtual_image_writer + CAPTURE_MODE);
 
     // Save physical addresses into the avalon_camera
-    iowrite32(address_physical_buffer0[n], address_virtual_image_writer[n] + CAPTURE_BUFF0);
-    iowrite32(address_physical_buffer1[n], address_virtual_image_writer[n] + CAPTURE_BUFF1);
+    iowrite32(writers[n].address_physical_buffer0, writers[n].address_virtual_image_writer + CAPTURE_BUFF0);
+    iowrite32(writers[n].address_physical_buffer1, writers[n].address_virtual_image_writer + CAPTURE_BUFF1);
 
     // Choose buffer 0 to be used in SINGLE_SHOT
-    iowrite32(0, address_virtual_image_writer[n] + CAPTURE_BUFFER_SELECT);
+    iowrite32(0, writers[n].address_virtual_image_writer + CAPTURE_BUFFER_SELECT);
 
     // Choose to use 2 alternating buffers in CONTINUOUS mode
-    iowrite32(1, address_virtual_image_writer[n] + CONT_DOUBLE_BUFF);
+    iowrite32(1, writers[n].address_virtual_image_writer + CONT_DOUBLE_BUFF);
 
     // Set up downsampling as 1 to get the whole image
-    iowrite32(1, address_virtual_image_writer[n] + CAPTURE_DOWNSAMPLING);
+    iowrite32(1, writers[n].address_virtual_image_writer + CAPTURE_DOWNSAMPLING);
 
     return 0;
 }
@@ -259,12 +427,12 @@ int camera_start_capture(int n) {
     int counter;
 
     //Stop the capture (to ensure a known state)
-    iowrite32(0, address_virtual_image_writer[n] + START_CAPTURE);
+    iowrite32(0, writers[n].address_virtual_image_writer + START_CAPTURE);
 
     // Wait until Standby signal is 1. Its the way to ensure that the component
     // is not in reset or acquiring a signal.
     counter = 10000000;
-    while((!(ioread32(address_virtual_image_writer[n] + CAPTURE_STANDBY))) && (counter>0)) {
+    while((!(ioread32(writers[n].address_virtual_image_writer + CAPTURE_STANDBY))) && (counter>0)) {
         // Ugly way avoid software to get stuck
         counter--;
     }
@@ -274,7 +442,7 @@ int camera_start_capture(int n) {
     }
 
     // Start the capture
-    iowrite32(1, address_virtual_image_writer[n] + START_CAPTURE);
+    iowrite32(1, writers[n].address_virtual_image_writer + START_CAPTURE);
 
     return 0;
 }
@@ -282,7 +450,7 @@ int camera_start_capture(int n) {
 // Stop the capture
 int camera_stop_capture(int n) {
     // Stop the capture
-    iowrite32(0, address_virtual_image_writer[n] + START_CAPTURE);
+    iowrite32(0, writers[n].address_virtual_image_writer + START_CAPTURE);
     return 0;
 }
 
@@ -292,7 +460,7 @@ int camera_get_image(int n, char* user_read_buffer,  size_t len) {
     int last_buffer;
     void* address_virtual_buffer;
 
-    if (image_writer_mode == SINGLE_SHOT)
+    if (writers[n].mode == SINGLE_SHOT)
     {
         //Start capture
         error = camera_start_capture(n);
@@ -302,28 +470,57 @@ int camera_get_image(int n, char* user_read_buffer,  size_t len) {
         }
 
         // Wait for the image to be acquired
-        while (!ioread32(address_virtual_image_writer[n] + CAPTURE_STANDBY)) {}
+        while (!ioread32(writers[n].address_virtual_image_writer + CAPTURE_STANDBY)) {}
 
         //In SINGLE_SHOT image is always saved in buffer 0
-        address_virtual_buffer = address_virtual_buffer0[n];
+        address_virtual_buffer = writers[n].address_virtual_buffer0;
     }
-    else // (image_writer_mode == CONTINUOUS)
+    else if (writers[n].mode == SINGLE_SHOT_PREFETCH)
+    {
+        // Start a capture if the previous read did not (first read or failed start)
+        if (!writers[n].prefetch_armed) {
+            iowrite32(writers[n].prefetch_buffer,
+                      writers[n].address_virtual_image_writer + CAPTURE_BUFFER_SELECT);
+            error = camera_start_capture(n);
+            if (error != 0) {
+                printk(KERN_INFO DRIVER_NAME": Start capture failure\n");
+                return error;
+            }
+            writers[n].prefetch_armed = 1;
+        }
+
+        // Wait for the image started by this read or the previous one
+        while (!ioread32(writers[n].address_virtual_image_writer + CAPTURE_STANDBY)) {}
+
+        if (writers[n].prefetch_buffer == 0)
+            address_virtual_buffer = writers[n].address_virtual_buffer0;
+        else
+            address_virtual_buffer = writers[n].address_virtual_buffer1;
+
+        // Start the next image into the other buffer while this one is copied. If it fails the
+        // next read starts it again.
+        writers[n].prefetch_buffer ^= 1;
+        iowrite32(writers[n].prefetch_buffer,
+                  writers[n].address_virtual_image_writer + CAPTURE_BUFFER_SELECT);
+        writers[n].prefetch_armed = (camera_start_capture(n) == 0);
+    }
+    else // (writers[n].mode == CONTINUOUS)
     {
         //In case the software applicattions ask for images faster than the hardware can provide
         //block the execution here until a new image is available
-        while (ioread32(address_virtual_image_writer[n] + CAPTURE_IMAGE_COUNTER)
-        == last_image_number[n]){};
+        while (ioread32(writers[n].address_virtual_image_writer + CAPTURE_IMAGE_COUNTER)
+        == writers[n].last_image_number){};
 
-        last_image_number[n] = ioread32(address_virtual_image_writer[n] + CAPTURE_IMAGE_COUNTER);
+        writers[n].last_image_number = ioread32(writers[n].address_virtual_image_writer + CAPTURE_IMAGE_COUNTER);
 
-        //printk(KERN_INFO DRIVER_NAME": Image number %d\n", (int) last_image_number[n]);
+        //printk(KERN_INFO DRIVER_NAME": Image number %d\n", (int) writers[n].last_image_number);
 
         //Capture already started so just check where the last image was saved
-        last_buffer = ioread32(address_virtual_image_writer[n] + LAST_BUFFER_CAPTURED);
+        last_buffer = ioread32(writers[n].address_virtual_image_writer + LAST_BUFFER_CAPTURED);
         if (last_buffer == 0)
-            address_virtual_buffer = address_virtual_buffer0[n];
+            address_virtual_buffer = writers[n].address_virtual_buffer0;
         else
-            address_virtual_buffer = address_virtual_buffer1[n];
+            address_virtual_buffer = writers[n].address_virtual_buffer1;
     }
 
     // Copy the image from buffer camera buffer to user buffer
@@ -340,96 +537,64 @@ int camera_get_image(int n, char* user_read_buffer,  size_t len) {
 //-----CHAR DEVICE DRIVER SPECIFIC FUNCTIONS-----//
 static int camera_open(struct inode *inodep, struct file *filep) {
     int error;
-    int image_writer_base;
-    int image_writer_span;
-    int pixel_size;
 
     //Findout which device is being open using the minor numbers
     int dev_number = iminor(filep->f_path.dentry->d_inode);
 
-    // Establish image_writer and pixel_size based on image_type
-    if (dev_number == MINOR_RGBG) {
-        printk(KERN_INFO DRIVER_NAME": Open RGBG\n");
-        image_writer_base = AVALON_IMG_WRITER_RGBGRAY_BASE;
-        image_writer_span = AVALON_IMG_WRITER_RGBGRAY_SPAN;
-        pixel_size = sizeof(u8) * 4;
-    } else if (dev_number == MINOR_GRAY) {
-        printk(KERN_INFO DRIVER_NAME": Open GRAY\n");
-        image_writer_base = AVALON_IMG_WRITER_GRAY_BASE;
-        image_writer_span = AVALON_IMG_WRITER_GRAY_SPAN;
-        pixel_size = sizeof(u8) * 1;
-    } else if (dev_number == MINOR_BIN) {
-        printk(KERN_INFO DRIVER_NAME": Open BIN\n");
-        image_writer_base = AVALON_IMG_WRITER_BINARY_BASE;
-        image_writer_span = AVALON_IMG_WRITER_BINARY_SPAN;
-        pixel_size = sizeof(u8) * 1;
-    } else {
+    if (dev_number >= writer_count) {
         printk(KERN_INFO DRIVER_NAME": Some error with the minor numbers!!\n");
         return -1;
     }
+    printk(KERN_INFO DRIVER_NAME": Open %s\n", writers[dev_number].name);
 
-    if (is_open[dev_number] == 1) {
+    if (writers[dev_number].is_open == 1) {
       printk(KERN_INFO DRIVER_NAME": This device is already open!!\n");
       return -1;
     }
 
+    // Calculate required memory to store an Image
+    writers[dev_number].image_memory_size =
+        (size_t)image_width * image_height * writers[dev_number].pixel_size;
+    if ((image_width < 1) || (image_height < 1) ||
+            (writers[dev_number].image_memory_size > writers[dev_number].buffer_size)) {
+        printk(KERN_INFO DRIVER_NAME": Image size %dx%d larger than the buffers (max_image_width "
+               "and max_image_height)\n", image_width, image_height);
+        return -EINVAL;
+    }
+
     // Ioremap FPGA memory //
     // To ioremap the slave port of the image writer in the FPGA so we can access from kernel space
-    address_virtual_image_writer[dev_number] =
-        ioremap(HPS_FPGA_BRIDGE_BASE + image_writer_base, image_writer_span);
-    if (address_virtual_image_writer[dev_number] == NULL) {
+    writers[dev_number].address_virtual_image_writer =
+        ioremap(HPS_FPGA_BRIDGE_BASE + writers[dev_number].base, IMAGE_WRITER_SPAN);
+    if (writers[dev_number].address_virtual_image_writer == NULL) {
         printk(KERN_INFO DRIVER_NAME": Error doing FPGA camera ioremap\n");
         return -1;
     }
 
-    // Calculate required memory to store an Image
-    image_memory_size[dev_number] = image_width * image_height * pixel_size;
-
-    // Allocate uncached buffers
-    // The dma_alloc_coherent() function allocates non-cached physically
-    // contiguous memory. Accesses to the memory by the CPU are the same
-    // as a cache miss when the cache is used. The CPU does not have to
-    // invalidate or flush the cache which can be time consuming.
-    address_virtual_buffer0[dev_number] = dma_alloc_coherent(
-        NULL,
-        image_memory_size[dev_number],
-        &(address_physical_buffer0[dev_number]), //address to use from image writer in fpga
-        GFP_KERNEL);
-
-    if (address_virtual_buffer0[dev_number] == NULL) {
-        printk(KERN_INFO DRIVER_NAME": Allocation of non-cached buffer 0 failed\n");
-        return -1;
-    }
-
-    address_virtual_buffer1[dev_number] = dma_alloc_coherent(
-        NULL,
-        image_memory_size[dev_number],
-        &(address_physical_buffer1[dev_number]), //address to use from image writer in fpga
-        GFP_KERNEL);
-
-    if (address_virtual_buffer1[dev_number] == NULL) {
-        printk(KERN_INFO DRIVER_NAME": Allocation of non-cached buffer 1 failed\n");
-        return -1;
-    }
+    writers[dev_number].mode = image_writer_mode;
+    writers[dev_number].prefetch_armed = 0;
+    writers[dev_number].prefetch_buffer = 0;
 
     //Write the setup to the camera
     error = camera_setup(dev_number);
     if (error != 0) {
         printk(KERN_INFO DRIVER_NAME": Setup failure\n");
+        iounmap(writers[dev_number].address_virtual_image_writer);
         return -1;
     }
 
     //In continuous mode start the capture of images into buff0 and buff1
-    if(image_writer_mode == CONTINUOUS){
+    if(writers[dev_number].mode == CONTINUOUS){
       error = camera_start_capture(dev_number);
       if (error != 0) {
           printk(KERN_INFO DRIVER_NAME": Start capture failure\n");
+          iounmap(writers[dev_number].address_virtual_image_writer);
           return -1;
       }
     }
 
-    is_open[dev_number] = 1;
-    last_image_number[dev_number] = 0;
+    writers[dev_number].is_open = 1;
+    writers[dev_number].last_image_number = 0;
 
     return 0;
 }
@@ -440,7 +605,7 @@ static ssize_t camera_read(struct file *filep, char *buffer, size_t len, loff_t
     //Findout which device is being open using the minor numbers
     int dev_number = iminor(filep->f_path.dentry->d_inode);
 
-    if (is_open[dev_number] == 0) {
+    if ((dev_number >= writer_count) || (writers[dev_number].is_open == 0)) {
       printk(KERN_INFO DRIVER_NAME": This device is not open!!\n");
       return -1;
     }
@@ -450,7 +615,7 @@ static ssize_t camera_read(struct file *filep, char *buffer, size_t len, loff_t
         printk(KERN_INFO DRIVER_NAME": Read failure\n");
         return -1;
     }
-    return image_memory_size[dev_number];
+    return writers[dev_number].image_memory_size;
 }
 
 static int camera_release(struct inode *inodep, struct file *filep) {
@@ -458,27 +623,21 @@ static int camera_release(struct inode *inodep, struct file *filep) {
     //Findout which device is being open using the minor numbers
     int dev_number = iminor(filep->f_path.dentry->d_inode);
 
-    if (dev_number == MINOR_RGBG) {
-        printk(KERN_INFO DRIVER_NAME": Release RGBG\n");
-    } else if (dev_number == MINOR_GRAY) {
-        printk(KERN_INFO DRIVER_NAME": Release GRAY\n");
-    } else if (dev_number == MINOR_BIN) {
-        printk(KERN_INFO DRIVER_NAME": Release BIN\n");
+    if (dev_number >= writer_count) {
+        return -1;
     }
+    printk(KERN_INFO DRIVER_NAME": Release %s\n", writers[dev_number].name);
 
-    if (is_open[dev_number] == 0) {
+    if (writers[dev_number].is_open == 0) {
       printk(KERN_INFO DRIVER_NAME": Error releasing: this device is not open!!\n");
       return -1;
     }
 
+    // The buffers are kept until the module is removed
     camera_stop_capture(dev_number);
-    dma_free_coherent(NULL, image_memory_size[dev_number], address_virtual_buffer0[dev_number],
-      address_physical_buffer0[dev_number]);
-    dma_free_coherent(NULL, image_memory_size[dev_number], address_virtual_buffer1[dev_number],
-      address_physical_buffer1[dev_number]);
-    iounmap(address_virtual_image_writer[dev_number]);
+    iounmap(writers[dev_number].address_virtual_image_writer);
 
-    is_open[dev_number] = 0;
+    writers[dev_number].is_open = 0;
 
     return 0;
 }